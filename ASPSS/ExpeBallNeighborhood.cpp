@@ -61,6 +61,9 @@ BallNeighborhood::BallNeighborhood(ConstPointSetPtr pPoints)
     
     mCachedFilterScale = 0.;
     mRootNode = 0;
+    mNofLeaves = 0;
+    mBatchMode = false;
+    mCandidates.pNode = 0;
 }
 
 BallNeighborhood::~BallNeighborhood()
@@ -71,18 +74,22 @@ BallNeighborhood::~BallNeighborhood()
 void BallNeighborhood::rebuild(void)
 {
     delete mRootNode;
+    mCandidates.pNode = 0;
+    mNofLeaves = 0;
     
     mRootNode = new Node();
     IndexArray indices(mpPoints->size());
     mScales.resize(mpPoints->size());
 	//mScalarScales.resize(mpPoints->size());
     AxisAlignedBox aabb;
+    PointSet::ConstVector3Span positions = mpPoints->span(PointSet::Attribute_position);
+    PointSet::ConstFloatSpan radii = mpPoints->span(PointSet::Attribute_radius);
     for (uint i=0 ; i<mpPoints->size() ; ++i)
     {
         indices[i] = i;
-        aabb.min().makeFloor(mpPoints->at(i).position() - mpPoints->at(i).radius()*mFilterScale);
-        aabb.max().makeCeil(mpPoints->at(i).position() + mpPoints->at(i).radius()*mFilterScale);
-        mScales[i] = 1./(mpPoints->at(i).radius()*mFilterScale);
+        aabb.min().makeFloor(positions[i] - radii[i]*mFilterScale);
+        aabb.max().makeCeil(positions[i] + radii[i]*mFilterScale);
+        mScales[i] = 1./(radii[i]*mFilterScale);
         mScales[i] = mScales[i] * mScales[i];
 
 		//mScalarScales[i] = 1./(mpPoints->at(i).scalarradius()*mFilterScale);
@@ -100,11 +107,72 @@ void BallNeighborhood::computeNeighborhood(const Vector3& p, const WeightingFunc
         rebuild();
     }
     
-    mNeighborQueue.init();
     mQueryPosition = p;
-    queryNode(*mRootNode);
+    if (!mBatchMode)
+    {
+        mNeighborQueue.init();
+        queryNode(*mRootNode);
+        mNofFoundNeighbors = mNeighborQueue.getNofElements();
+        mPackedValid = false;
+        computeWeights(pWeightingFunc);
+        return;
+    }
+    
+    const Node* pLeaf = findLeaf(p);
+    if (pLeaf!=mCandidates.pNode)
+        packLeaf(pLeaf);
+    
+    // same test as queryNode() on the packed samples,
+    // the queue holds positions in the leaf until the neighbors are gathered
+    uint nb = pLeaf->size;
+    mPackedValid = false;
+    if (nb==0)
+    {
+        mNofFoundNeighbors = 0;
+        return;
+    }
+    Real* d2 = &mCandidates.d2[0];
+    const Real* px = &mCandidates.px[0];
+    const Real* py = &mCandidates.py[0];
+    const Real* pz = &mCandidates.pz[0];
+    for (uint k=0 ; k<nb ; ++k)
+    {
+        Real dx = p.x - px[k];
+        Real dy = p.y - py[k];
+        Real dz = p.z - pz[k];
+        d2[k] = dx*dx + dy*dy + dz*dz;
+    }
+    mNeighborQueue.init();
+    for (uint k=0 ; k<nb ; ++k)
+    {
+        if (d2[k]*mCandidates.scales[k]<1.)
+            mNeighborQueue.insert(k, d2[k]);
+    }
     mNofFoundNeighbors = mNeighborQueue.getNofElements();
     
+    mPacked.px.resize(mNofFoundNeighbors);
+    mPacked.py.resize(mNofFoundNeighbors);
+    mPacked.pz.resize(mNofFoundNeighbors);
+    mPacked.nx.resize(mNofFoundNeighbors);
+    mPacked.ny.resize(mNofFoundNeighbors);
+    mPacked.nz.resize(mNofFoundNeighbors);
+    for (uint i=0 ; i<mNofFoundNeighbors ; ++i)
+    {
+        uint k = mNeighborList[i].index;
+        mPacked.px[i] = px[k];
+        mPacked.py[i] = py[k];
+        mPacked.pz[i] = pz[k];
+        mPacked.nx[i] = mCandidates.nx[k];
+        mPacked.ny[i] = mCandidates.ny[k];
+        mPacked.nz[i] = mCandidates.nz[k];
+        mNeighborList[i].index = pLeaf->indices[k];
+    }
+    mPackedValid = true;
+    computeWeights(pWeightingFunc);
+}
+
+void BallNeighborhood::computeWeights(const WeightingFunction* pWeightingFunc)
+{
     if (mNofFoundNeighbors>0)
     {
         mCurrentFilterRadius = Math::Sqrt(getNeighborSquaredDistance(0));
@@ -126,13 +194,79 @@ void BallNeighborhood::computeNeighborhood(const Vector3& p, const WeightingFunc
     }
 }
 
+void BallNeighborhood::beginBatch(void)
+{
+    mBatchMode = true;
+    mCandidates.pNode = 0;
+}
+
+void BallNeighborhood::endBatch(void)
+{
+    mBatchMode = false;
+    mCandidates.pNode = 0;
+}
+
+uint BallNeighborhood::getBatchKey(const Vector3& p)
+{
+    if (mCachedFilterScale != mFilterScale)
+    {
+        rebuild();
+    }
+    return findLeaf(p)->leafId;
+}
+
+const BallNeighborhood::Node* BallNeighborhood::findLeaf(const Vector3& p) const
+{
+    const Node* pNode = mRootNode;
+    while (!pNode->leaf)
+    {
+        if (p[pNode->dim] - pNode->splitValue < 0)
+            pNode = pNode->children[0];
+        else
+            pNode = pNode->children[1];
+    }
+    return pNode;
+}
+
+void BallNeighborhood::packLeaf(const Node* pLeaf)
+{
+    uint nb = pLeaf->size;
+    mCandidates.pNode = pLeaf;
+    mCandidates.px.resize(nb);
+    mCandidates.py.resize(nb);
+    mCandidates.pz.resize(nb);
+    mCandidates.nx.resize(nb);
+    mCandidates.ny.resize(nb);
+    mCandidates.nz.resize(nb);
+    mCandidates.scales.resize(nb);
+    mCandidates.d2.resize(nb);
+    bool hasNormal = mpPoints->hasAttribute((UberVectorBaseT<_PointSetBuiltinData>::Attribute)(PointSet::Attribute_normal));
+    PointSet::ConstVector3Span positions = mpPoints->span(PointSet::Attribute_position);
+    PointSet::ConstVector3Span normals;
+    if (hasNormal)
+        normals = mpPoints->span(PointSet::Attribute_normal);
+    for (uint k=0 ; k<nb ; ++k)
+    {
+        uint id = pLeaf->indices[k];
+        mCandidates.px[k] = positions[id].x;
+        mCandidates.py[k] = positions[id].y;
+        mCandidates.pz[k] = positions[id].z;
+        Vector3 n = hasNormal ? normals[id] : Vector3(0.,0.,0.);
+        mCandidates.nx[k] = n.x;
+        mCandidates.ny[k] = n.y;
+        mCandidates.nz[k] = n.z;
+        mCandidates.scales[k] = mScales[id];
+    }
+}
+
 void BallNeighborhood::queryNode(Node& node)
 {
     if (node.leaf)
     {
+        PointSet::ConstVector3Span positions = mpPoints->span(PointSet::Attribute_position);
         for (uint i=0 ; i<node.size ; ++i)
         {
-            Real d2 = mQueryPosition.squaredDistanceTo(mpPoints->at(node.indices[i]).position());
+            Real d2 = mQueryPosition.squaredDistanceTo(positions[node.indices[i]]);
             if (d2*mScales[node.indices[i]]<1.)
             {
                 mNeighborQueue.insert(node.indices[i], d2);
@@ -150,13 +284,14 @@ void BallNeighborhood::queryNode(Node& node)
 
 void BallNeighborhood::split(const IndexArray& indices, const AxisAlignedBox& aabbLeft, const AxisAlignedBox& aabbRight, IndexArray& iLeft, IndexArray& iRight)
 {
+    PointSet::ConstVector3Span positions = mpPoints->span(PointSet::Attribute_position);
+    PointSet::ConstFloatSpan radii = mpPoints->span(PointSet::Attribute_radius);
     for (IndexArray::const_iterator it=indices.begin(), end=indices.end() ; it!=end ; ++it)
     {
-        PointSet::ConstPointHandle pt = mpPoints->at(*it);
-        if (aabbLeft.distanceTo(pt.position()) < pt.radius()*mFilterScale)
+        if (aabbLeft.distanceTo(positions[*it]) < radii[*it]*mFilterScale)
             iLeft.push_back(*it);
         
-        if (aabbRight.distanceTo(pt.position()) < pt.radius()*mFilterScale)
+        if (aabbRight.distanceTo(positions[*it]) < radii[*it]*mFilterScale)
             iRight.push_back(*it);
     }
 }
@@ -165,8 +300,9 @@ void BallNeighborhood::createTree(Node& node, IndexArray& indices, AxisAlignedBo
 {
     //
     Real avgradius = 0.;
+    PointSet::ConstFloatSpan radii = mpPoints->span(PointSet::Attribute_radius);
     for (IndexArray::const_iterator it=indices.begin(), end=indices.end() ; it!=end ; ++it)
-        avgradius += mpPoints->at(*it).radius();
+        avgradius += radii[*it];
     avgradius /= Real(indices.size());
     Vector3 diag = aabb.max() - aabb.min();
     if (indices.size()<mTargetCellSize || avgradius*0.9 > diag.maxComponent())
@@ -177,6 +313,7 @@ void BallNeighborhood::createTree(Node& node, IndexArray& indices, AxisAlignedBo
            // getchar();
 		}
         node.leaf = 1;
+        node.leafId = mNofLeaves++;
         node.size = indices.size();
         node.indices = new uint[node.size];
         for (uint i=0 ; i<node.size ; ++i)
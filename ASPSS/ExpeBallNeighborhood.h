@@ -59,6 +59,16 @@ public:
     
     virtual void computeNeighborhood(const Vector3& p, const WeightingFunction* pWeightingFunc = 0);
     
+    /** In batch mode the samples of the last visited leaf are kept packed in arrays,
+        so that the following queries in the same leaf do not go through the PointSet.
+    */
+    virtual void beginBatch(void);
+    virtual void endBatch(void);
+    
+    /** Returns the id of the leaf containing p.
+    */
+    virtual uint getBatchKey(const Vector3& p);
+    
     QUICK_MEMBER(Real,FilterScale);
     
 protected:
@@ -80,6 +90,7 @@ protected:
         Real splitValue;
         ubyte dim;
         ubyte leaf;
+        uint leafId;
         union {
             Node* children[2];
             struct {
@@ -93,6 +104,9 @@ protected:
     void createTree(Node& node, IndexArray& indices, AxisAlignedBox aabb);
     void split(const IndexArray& indices, const AxisAlignedBox& aabbLeft, const AxisAlignedBox& aabbRight, IndexArray& iLeft, IndexArray& iRight);
     void queryNode(Node& node);
+    const Node* findLeaf(const Vector3& p) const;
+    void packLeaf(const Node* pLeaf);
+    void computeWeights(const WeightingFunction* pWeightingFunc);
     Vector3 mQueryPosition;
     
 protected:
@@ -107,6 +121,20 @@ protected:
     Node* mRootNode;
     Real mCachedFilterScale;
     std::vector<Real> mScales;
+    uint mNofLeaves;
+    
+    /** Samples of a leaf packed in arrays (batch mode).
+    */
+    struct LeafCandidates
+    {
+        const Node* pNode;
+        RealArray px, py, pz;
+        RealArray nx, ny, nz;
+        RealArray scales;
+        RealArray d2;
+    };
+    bool mBatchMode;
+    LeafCandidates mCandidates;
 
 	std::vector<Real> mScalarScales;
 };
@@ -0,0 +1,131 @@
+/*
+----------------------------------------------------------------------
+
+This source file is part of Expé
+(EXperimental Point Engine)
+
+Copyright (c) 2004-2007 by
+ - Computer Graphics Laboratory, ETH Zurich
+ - IRIT, University of Toulouse
+ - Gael Guennebaud.
+
+----------------------------------------------------------------------
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330,
+Boston, MA  02111-1307, USA.
+
+http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+----------------------------------------------------------------------
+*/
+
+
+
+#include "ExpeBallQuery.h"
+
+namespace Expe
+{
+
+BallQuery::BallQuery(ConstPointSetPtr pPoints, Real filterScale)
+    : mpPoints(pPoints), mFilterScale(filterScale), mTargetCellSize(24), mNofLeaves(0)
+{
+    // same bounding box as BallNeighborhood::rebuild()
+    IndexArray indices(mpPoints->size());
+    AxisAlignedBox aabb;
+    PointSet::ConstVector3Span positions = mpPoints->span(PointSet::Attribute_position);
+    PointSet::ConstFloatSpan radii = mpPoints->span(PointSet::Attribute_radius);
+    for (uint i=0 ; i<mpPoints->size() ; ++i)
+    {
+        indices[i] = i;
+        aabb.min().makeFloor(positions[i] - radii[i]*mFilterScale);
+        aabb.max().makeCeil(positions[i] + radii[i]*mFilterScale);
+    }
+    mNodes.resize(1);
+    createTree(0, indices, aabb);
+}
+
+BallQuery::~BallQuery()
+{
+}
+
+void BallQuery::createTree(uint nodeId, IndexArray& indices, AxisAlignedBox aabb)
+{
+    PointSet::ConstVector3Span positions = mpPoints->span(PointSet::Attribute_position);
+    PointSet::ConstFloatSpan radii = mpPoints->span(PointSet::Attribute_radius);
+    
+    // the leaf criterion of BallNeighborhood::createTree()
+    Real avgradius = 0.;
+    for (IndexArray::const_iterator it=indices.begin(), end=indices.end() ; it!=end ; ++it)
+        avgradius += radii[*it];
+    avgradius /= Real(indices.size());
+    Vector3 diag = aabb.max() - aabb.min();
+    if (indices.size()<mTargetCellSize || avgradius*0.9 > diag.maxComponent())
+    {
+        bool hasNormal = mpPoints->hasAttribute((UberVectorBaseT<_PointSetBuiltinData>::Attribute)(PointSet::Attribute_normal));
+        PointSet::ConstVector3Span normals;
+        if (hasNormal)
+            normals = mpPoints->span(PointSet::Attribute_normal);
+        Node& node = mNodes[nodeId];
+        node.leaf = 1;
+        node.leafId = mNofLeaves++;
+        node.first = mIds.size();
+        node.size = indices.size();
+        for (uint k=0 ; k<indices.size() ; ++k)
+        {
+            uint id = indices[k];
+            Vector3 n = hasNormal ? normals[id] : Vector3(0.,0.,0.);
+            Real scale = 1./(radii[id]*mFilterScale);
+            mPx.push_back(positions[id].x);
+            mPy.push_back(positions[id].y);
+            mPz.push_back(positions[id].z);
+            mNx.push_back(n.x);
+            mNy.push_back(n.y);
+            mNz.push_back(n.z);
+            mScales.push_back(scale * scale);
+            mRadii.push_back(radii[id]);
+            mIds.push_back(id);
+        }
+        return;
+    }
+    
+    uint dim = diag.maxComponentId();
+    Real splitValue = 0.5*(aabb.max()[dim] + aabb.min()[dim]);
+    uint first = mNodes.size();
+    mNodes.resize(first + 2);
+    Node& node = mNodes[nodeId];
+    node.leaf = 0;
+    node.dim = dim;
+    node.splitValue = splitValue;
+    node.first = first;
+    
+    AxisAlignedBox aabbLeft=aabb, aabbRight=aabb;
+    aabbLeft.max()[dim] = splitValue;
+    aabbRight.min()[dim] = splitValue;
+    
+    // samples whose ball overlaps each side
+    IndexArray iLeft, iRight;
+    for (IndexArray::const_iterator it=indices.begin(), end=indices.end() ; it!=end ; ++it)
+    {
+        if (aabbLeft.distanceTo(positions[*it]) < radii[*it]*mFilterScale)
+            iLeft.push_back(*it);
+        if (aabbRight.distanceTo(positions[*it]) < radii[*it]*mFilterScale)
+            iRight.push_back(*it);
+    }
+    indices.clear();
+    
+    createTree(first, iLeft, aabbLeft);
+    createTree(first + 1, iRight, aabbRight);
+}
+
+}
@@ -0,0 +1,207 @@
+/*
+----------------------------------------------------------------------
+
+This source file is part of Expé
+(EXperimental Point Engine)
+
+Copyright (c) 2004-2007 by
+ - Computer Graphics Laboratory, ETH Zurich
+ - IRIT, University of Toulouse
+ - Gael Guennebaud.
+
+----------------------------------------------------------------------
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330,
+Boston, MA  02111-1307, USA.
+
+http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+----------------------------------------------------------------------
+*/
+
+
+
+#ifndef _ExpeBallQuery_h_
+#define _ExpeBallQuery_h_
+
+#include "ExpePointSet.h"
+
+namespace Expe
+{
+
+/** Fixed capacity neighbor buffer of StaticMlsSurface, meant to live on the stack.
+    The neighbors are stored as separate arrays so that the fit reads them in a vectorizable loop.
+    When more than Capacity samples are found the farthest ones are dropped, like the
+    neighbor queue of BallNeighborhood.
+*/
+template <uint CapacityT> struct StaticNeighbors
+{
+    static const uint Capacity = CapacityT;
+    
+    uint size;
+    Real px[CapacityT], py[CapacityT], pz[CapacityT];
+    Real nx[CapacityT], ny[CapacityT], nz[CapacityT];
+    Real d2[CapacityT];        ///< squared distance to the query
+    Real x2[CapacityT];        ///< squared distance scaled by the filter radius of the sample, in [0,1[
+    Real radius[CapacityT];
+    uint id[CapacityT];        ///< index in the point set
+    
+    inline void clear(void) { size = 0; }
+    
+    /** Returns the slot of a new neighbor at squared distance dist2, or Capacity if it is dropped.
+    */
+    inline uint insert(Real dist2)
+    {
+        if (size<CapacityT)
+            return size++;
+        uint far = 0;
+        for (uint i=1 ; i<CapacityT ; ++i)
+        {
+            if (d2[i]>d2[far])
+                far = i;
+        }
+        return dist2<d2[far] ? far : CapacityT;
+    }
+};
+
+/** Ball neighborhood queries without virtual calls nor PointSet accesses.
+    The tree is the one of BallNeighborhood (same splits, same leaves, so the same neighbors),
+    stored in a flat node array, and the samples of every leaf are copied in packed arrays
+    (positions, normals, squared inverse filter radii) when it is built.
+    A BallQuery is not modified by queries, several threads can share it.
+*/
+class BallQuery
+{
+public:
+
+    BallQuery(ConstPointSetPtr pPoints, Real filterScale = 2.);
+    
+    ~BallQuery();
+    
+    /** Finds the samples whose ball (radius times filter scale) contains p.
+    */
+    template <class NeighborsT> inline void query(const Vector3& p, NeighborsT& neighbors) const;
+    
+    /** Returns the id of the leaf containing p.
+    */
+    inline uint getLeafId(const Vector3& p) const { return findLeaf(p).leafId; }
+    
+    inline Real getFilterScale(void) const { return mFilterScale; }
+
+protected:
+
+    struct Node
+    {
+        Real splitValue;
+        ubyte dim;
+        ubyte leaf;
+        uint leafId;
+        uint first;         ///< left child (the right one follows), or first sample of the leaf
+        uint size;          ///< number of samples of the leaf
+    };
+    
+    void createTree(uint nodeId, IndexArray& indices, AxisAlignedBox aabb);
+    
+    inline const Node& findLeaf(const Vector3& p) const
+    {
+        const Node* pNode = &mNodes[0];
+        while (!pNode->leaf)
+            pNode = &mNodes[pNode->first + ((p[pNode->dim] - pNode->splitValue < 0) ? 0 : 1)];
+        return *pNode;
+    }
+    
+protected:
+
+    ConstPointSetPtr mpPoints;
+    Real mFilterScale;
+    uint mTargetCellSize;
+    uint mNofLeaves;
+    std::vector<Node> mNodes;
+    
+    // samples of the leaves, leaf by leaf
+    RealArray mPx, mPy, mPz;
+    RealArray mNx, mNy, mNz;
+    RealArray mScales;
+    RealArray mRadii;
+    std::vector<uint> mIds;
+};
+
+template <class NeighborsT> inline void BallQuery::query(const Vector3& p, NeighborsT& neighbors) const
+{
+    const Node& leaf = findLeaf(p);
+    neighbors.clear();
+    const uint first = leaf.first;
+    const uint nb = leaf.size;
+    if (nb<=NeighborsT::Capacity)
+    {
+        // all the samples of the leaf fit: the distances are computed for every sample and
+        // the samples out of their ball are overwritten by the next ones (no branch)
+        uint n = 0;
+        for (uint k=first, end=first+nb ; k<end ; ++k)
+        {
+            Real dx = p.x - mPx[k];
+            Real dy = p.y - mPy[k];
+            Real dz = p.z - mPz[k];
+            Real d2 = dx*dx + dy*dy + dz*dz;
+            neighbors.d2[n] = d2;
+            neighbors.x2[n] = mScales[k] * d2;
+            neighbors.id[n] = k;
+            n += (d2*mScales[k]<1.) ? 1 : 0;
+        }
+        neighbors.size = n;
+        for (uint i=0 ; i<n ; ++i)
+        {
+            uint k = neighbors.id[i];
+            neighbors.px[i] = mPx[k];
+            neighbors.py[i] = mPy[k];
+            neighbors.pz[i] = mPz[k];
+            neighbors.nx[i] = mNx[k];
+            neighbors.ny[i] = mNy[k];
+            neighbors.nz[i] = mNz[k];
+            neighbors.radius[i] = mRadii[k];
+            neighbors.id[i] = mIds[k];
+        }
+        return;
+    }
+    
+    // keep the Capacity closest ones
+    for (uint k=first, end=first+nb ; k<end ; ++k)
+    {
+        Real dx = p.x - mPx[k];
+        Real dy = p.y - mPy[k];
+        Real dz = p.z - mPz[k];
+        Real d2 = dx*dx + dy*dy + dz*dz;
+        if (d2*mScales[k]<1.)
+        {
+            uint i = neighbors.insert(d2);
+            if (i==NeighborsT::Capacity)
+                continue;
+            neighbors.px[i] = mPx[k];
+            neighbors.py[i] = mPy[k];
+            neighbors.pz[i] = mPz[k];
+            neighbors.nx[i] = mNx[k];
+            neighbors.ny[i] = mNy[k];
+            neighbors.nz[i] = mNz[k];
+            neighbors.d2[i] = d2;
+            neighbors.x2[i] = mScales[k] * d2;
+            neighbors.radius[i] = mRadii[k];
+            neighbors.id[i] = mIds[k];
+        }
+    }
+}
+
+}
+
+#endif
+
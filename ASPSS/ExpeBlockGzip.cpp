@@ -0,0 +1,428 @@
+/*
+----------------------------------------------------------------------
+
+This source file is part of Expé
+(EXperimental Point Engine)
+
+Copyright (c) 2004-2007 by
+ - Computer Graphics Laboratory, ETH Zurich
+ - IRIT, University of Toulouse
+ - Gael Guennebaud.
+
+----------------------------------------------------------------------
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330,
+Boston, MA  02111-1307, USA.
+
+http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+----------------------------------------------------------------------
+*/
+
+
+
+#include "ExpeBlockGzip.h"
+#include <algorithm>
+#include <cstring>
+#include <zlib.h>
+
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Expe
+{
+
+namespace
+{
+    // size of the gzip header of a block (with the BC extra field) and of its footer
+    const uint HeaderSize = 18;
+    const uint FooterSize = 8;
+    
+    // number of blocks compressed together by the writer
+    const uint BatchBlocks = 256;
+    
+    // empty block marking the end of the file
+    const unsigned char EofMarker[28] = {
+        0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43,
+        0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    
+    inline void putLE16(unsigned char* p, uint v)
+    {
+        p[0] = v & 0xff;
+        p[1] = (v>>8) & 0xff;
+    }
+    
+    inline void putLE32(unsigned char* p, uint v)
+    {
+        putLE16(p, v & 0xffff);
+        putLE16(p+2, v>>16);
+    }
+    
+    inline uint getLE16(const unsigned char* p)
+    {
+        return uint(p[0]) | (uint(p[1])<<8);
+    }
+    
+    inline uint getLE32(const unsigned char* p)
+    {
+        return getLE16(p) | (getLE16(p+2)<<16);
+    }
+    
+    // compresses n bytes into a complete block
+    bool compressBlock(const char* src, uint n, int level, std::vector<char>& out)
+    {
+        out.resize(BlockGzip::MaxBlockSize);
+        unsigned char* block = reinterpret_cast<unsigned char*>(&out[0]);
+        
+        uLong compressedSize = 0;
+        bool ok = false;
+        // incompressible data is stored
+        for (int attempt=0 ; attempt<2 && !ok ; ++attempt)
+        {
+            z_stream zs;
+            memset(&zs, 0, sizeof(zs));
+            if (deflateInit2(&zs, attempt==0 ? level : Z_NO_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY)!=Z_OK)
+                return false;
+            zs.next_in = (Bytef*)src;
+            zs.avail_in = n;
+            zs.next_out = block + HeaderSize;
+            zs.avail_out = BlockGzip::MaxBlockSize - HeaderSize - FooterSize;
+            ok = deflate(&zs, Z_FINISH)==Z_STREAM_END;
+            compressedSize = zs.total_out;
+            deflateEnd(&zs);
+        }
+        if (!ok)
+            return false;
+        
+        uint blockSize = HeaderSize + compressedSize + FooterSize;
+        memcpy(block, EofMarker, HeaderSize);
+        putLE16(block+16, blockSize-1);
+        putLE32(block+HeaderSize+compressedSize, crc32(0, (const Bytef*)src, n));
+        putLE32(block+HeaderSize+compressedSize+4, n);
+        out.resize(blockSize);
+        return true;
+    }
+}
+
+bool BlockGzip::IsCompressed(const std::string& filename)
+{
+    return filename.size()>=3 && filename.compare(filename.size()-3, 3, ".gz")==0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// BlockGzipWriter
+////////////////////////////////////////////////////////////////////////////////
+
+BlockGzipWriter::BlockGzipWriter()
+    : mpFile(0), mLevel(6), mOk(false)
+{
+}
+
+BlockGzipWriter::~BlockGzipWriter()
+{
+    close();
+}
+
+bool BlockGzipWriter::open(const std::string& filename, int level)
+{
+    close();
+    mpFile = fopen(filename.c_str(), "wb");
+    mLevel = level;
+    mOk = mpFile!=0;
+    mPending.clear();
+    return mOk;
+}
+
+bool BlockGzipWriter::write(const void* data, size_t size)
+{
+    if (!mpFile)
+        return false;
+    // large writes are cut into batches
+    const size_t batchSize = size_t(BatchBlocks)*BlockGzip::BlockDataSize;
+    const char* bytes = static_cast<const char*>(data);
+    while (size>0 && mOk)
+    {
+        size_t n = std::min(size, batchSize-mPending.size());
+        mPending.insert(mPending.end(), bytes, bytes+n);
+        bytes += n;
+        size -= n;
+        if (mPending.size()==batchSize)
+            flush(false);
+    }
+    return mOk;
+}
+
+bool BlockGzipWriter::flush(bool all)
+{
+    size_t nofBlocks = mPending.size()/BlockGzip::BlockDataSize;
+    if (all && (mPending.size()%BlockGzip::BlockDataSize)!=0)
+        nofBlocks++;
+    if (nofBlocks==0)
+        return mOk;
+    
+    std::vector< std::vector<char> > blocks(nofBlocks);
+    int nofFailed = 0;
+    #pragma omp parallel for schedule(dynamic,1) reduction(+:nofFailed)
+    for (int b=0 ; b<int(nofBlocks) ; ++b)
+    {
+        size_t begin = size_t(b)*BlockGzip::BlockDataSize;
+        uint n = uint(std::min(size_t(BlockGzip::BlockDataSize), mPending.size()-begin));
+        if (!compressBlock(&mPending[begin], n, mLevel, blocks[b]))
+            nofFailed++;
+    }
+    mOk = mOk && nofFailed==0;
+    
+    for (size_t b=0 ; b<nofBlocks && mOk ; ++b)
+    {
+        mOk = fwrite(&blocks[b][0], 1, blocks[b].size(), mpFile)==blocks[b].size();
+    }
+    
+    mPending.erase(mPending.begin(), mPending.begin() + std::min(mPending.size(), nofBlocks*BlockGzip::BlockDataSize));
+    return mOk;
+}
+
+bool BlockGzipWriter::close(void)
+{
+    if (!mpFile)
+        return mOk;
+    
+    flush(true);
+    mOk = mOk && fwrite(EofMarker, 1, sizeof(EofMarker), mpFile)==sizeof(EofMarker);
+    mOk = (fclose(mpFile)==0) && mOk;
+    mpFile = 0;
+    mPending.clear();
+    return mOk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// BlockGzipReader
+////////////////////////////////////////////////////////////////////////////////
+
+BlockGzipReader::BlockGzipReader()
+    : mpData(0), mSize(0), mMapped(false)
+{
+}
+
+BlockGzipReader::~BlockGzipReader()
+{
+    close();
+}
+
+bool BlockGzipReader::open(const std::string& filename)
+{
+    close();
+    if (!mapFile(filename))
+        return false;
+    
+    if (buildIndex())
+        return true;
+    
+    // plain gzip file, possibly made of several members
+    mBlockStart.clear();
+    mDataStart.clear();
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 15+32)!=Z_OK)
+        return false;
+    zs.next_in = (Bytef*)mpData;
+    zs.avail_in = mSize;
+    std::vector<char> chunk(1<<20);
+    int ret = Z_OK;
+    while (ret==Z_OK || (ret==Z_STREAM_END && zs.avail_in>0))
+    {
+        if (ret==Z_STREAM_END)
+            inflateReset(&zs);
+        zs.next_out = (Bytef*)&chunk[0];
+        zs.avail_out = chunk.size();
+        ret = inflate(&zs, Z_NO_FLUSH);
+        mPlainData.insert(mPlainData.end(), chunk.begin(), chunk.begin() + (chunk.size()-zs.avail_out));
+    }
+    inflateEnd(&zs);
+    return ret==Z_STREAM_END;
+}
+
+void BlockGzipReader::close(void)
+{
+    if (mpData)
+    {
+        #ifndef WIN32
+        if (mMapped)
+            munmap(mpData, mSize);
+        else
+        #endif
+            free(mpData);
+    }
+    mpData = 0;
+    mSize = 0;
+    mMapped = false;
+    mBlockStart.clear();
+    mDataStart.clear();
+    std::vector<char>().swap(mPlainData);
+}
+
+bool BlockGzipReader::mapFile(const std::string& filename)
+{
+    #ifndef WIN32
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd<0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st)!=0)
+    {
+        ::close(fd);
+        return false;
+    }
+    mSize = st.st_size;
+    void* p = mSize>0 ? mmap(0, mSize, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (p==MAP_FAILED)
+        return false;
+    mpData = static_cast<char*>(p);
+    mMapped = true;
+    return true;
+    #else
+    FILE* fp = fopen(filename.c_str(), "rb");
+    if (!fp)
+        return false;
+    fseek(fp, 0, SEEK_END);
+    mSize = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    mpData = static_cast<char*>(malloc(mSize));
+    bool ok = fread(mpData, 1, mSize, fp)==mSize;
+    fclose(fp);
+    return ok;
+    #endif
+}
+
+bool BlockGzipReader::buildIndex(void)
+{
+    // only the block headers are read
+    size_t offset = 0;
+    size_t dataOffset = 0;
+    while (offset+HeaderSize <= mSize)
+    {
+        const unsigned char* h = reinterpret_cast<const unsigned char*>(mpData+offset);
+        if (h[0]!=0x1f || h[1]!=0x8b || h[2]!=8 || (h[3]&4)==0)
+            return false;
+        
+        // look for the BC extra subfield
+        uint xlen = getLE16(h+10);
+        uint blockSize = 0;
+        for (uint x=12 ; x+4<=12+xlen && offset+x+4<=mSize ; x+=4+getLE16(h+x+2))
+        {
+            if (h[x]=='B' && h[x+1]=='C' && getLE16(h+x+2)==2)
+            {
+                blockSize = getLE16(h+x+4)+1;
+                break;
+            }
+        }
+        if (blockSize<12+xlen+FooterSize || offset+blockSize>mSize)
+            return false;
+        
+        mBlockStart.push_back(offset);
+        mDataStart.push_back(dataOffset);
+        dataOffset += getLE32(h+blockSize-4);
+        offset += blockSize;
+    }
+    if (offset!=mSize || mBlockStart.empty())
+        return false;
+    
+    mBlockStart.push_back(offset);
+    mDataStart.push_back(dataOffset);
+    return true;
+}
+
+bool BlockGzipReader::inflateBlock(uint blockId, char* dst) const
+{
+    const unsigned char* h = reinterpret_cast<const unsigned char*>(mpData+mBlockStart[blockId]);
+    uint blockSize = mBlockStart[blockId+1] - mBlockStart[blockId];
+    uint headerSize = 12 + getLE16(h+10);
+    uint dataSize = mDataStart[blockId+1] - mDataStart[blockId];
+    
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, -15)!=Z_OK)
+        return false;
+    zs.next_in = (Bytef*)(h + headerSize);
+    zs.avail_in = blockSize - headerSize - FooterSize;
+    zs.next_out = (Bytef*)dst;
+    zs.avail_out = dataSize;
+    bool ok = inflate(&zs, Z_FINISH)==Z_STREAM_END && zs.total_out==dataSize;
+    inflateEnd(&zs);
+    
+    return ok && crc32(0, (const Bytef*)dst, dataSize)==getLE32(h+blockSize-FooterSize);
+}
+
+size_t BlockGzipReader::size(void) const
+{
+    return isBlocked() ? mDataStart.back() : mPlainData.size();
+}
+
+size_t BlockGzipReader::read(size_t pos, char* dst, size_t n) const
+{
+    if (pos>=size())
+        return 0;
+    n = std::min(n, size()-pos);
+    
+    if (!isBlocked())
+    {
+        memcpy(dst, &mPlainData[pos], n);
+        return n;
+    }
+    
+    // blocks overlapping [pos, pos+n)
+    int first = int(std::upper_bound(mDataStart.begin(), mDataStart.end(), pos) - mDataStart.begin()) - 1;
+    int last = int(std::lower_bound(mDataStart.begin(), mDataStart.end(), pos+n) - mDataStart.begin());
+    
+    int nofFailed = 0;
+    #pragma omp parallel for schedule(dynamic,1) reduction(+:nofFailed)
+    for (int b=first ; b<last ; ++b)
+    {
+        size_t begin = mDataStart[b];
+        size_t end = mDataStart[b+1];
+        if (begin==end)
+            continue;
+        if (begin>=pos && end<=pos+n)
+        {
+            // whole block
+            if (!inflateBlock(b, dst+(begin-pos)))
+                nofFailed++;
+        }
+        else
+        {
+            std::vector<char> tmp(end-begin);
+            if (!inflateBlock(b, &tmp[0]))
+            {
+                nofFailed++;
+                continue;
+            }
+            size_t from = std::max(begin, pos);
+            size_t to = std::min(end, pos+n);
+            memcpy(dst+(from-pos), &tmp[from-begin], to-from);
+        }
+    }
+    return nofFailed==0 ? n : 0;
+}
+
+bool BlockGzipReader::readAll(std::vector<char>& data) const
+{
+    data.resize(size());
+    return data.empty() || read(0, &data[0], data.size())==data.size();
+}
+
+}
@@ -0,0 +1,173 @@
+/*
+----------------------------------------------------------------------
+
+This source file is part of Expé
+(EXperimental Point Engine)
+
+Copyright (c) 2004-2007 by
+ - Computer Graphics Laboratory, ETH Zurich
+ - IRIT, University of Toulouse
+ - Gael Guennebaud.
+
+----------------------------------------------------------------------
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330,
+Boston, MA  02111-1307, USA.
+
+http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+----------------------------------------------------------------------
+*/
+
+
+
+#ifndef _ExpeBlockGzip_h_ 
+#define _ExpeBlockGzip_h_
+
+#include "ExpePrerequisites.h"
+#include <string>
+#include <vector>
+#include <cstdio>
+
+namespace Expe
+{
+
+/** Block compressed files (BGZF layout).
+    
+    The data is cut into blocks of at most BlockDataSize bytes which are compressed independently.
+    Each block is a complete gzip member whose header stores the compressed size of the block,
+    so the files can still be read by gzip/zcat. Blocks are compressed and decompressed in parallel
+    with OpenMP and, since the reader indexes the blocks when opening a file, any range of the
+    uncompressed data can be read without decoding the blocks before it.
+*/
+namespace BlockGzip
+{
+    /// maximal number of uncompressed bytes in a block
+    const uint BlockDataSize = 0xff00;
+    
+    /// maximal size of a compressed block, header included
+    const uint MaxBlockSize = 0x10000;
+    
+    /** Returns true when the filename has a .gz extension.
+    */
+    bool IsCompressed(const std::string& filename);
+}
+
+/** Writes a block compressed file.
+    
+    Data is accumulated until a batch of blocks is full, the batch is then compressed in parallel
+    and written in order.
+*/
+class BlockGzipWriter
+{
+public:
+
+    BlockGzipWriter();
+    
+    ~BlockGzipWriter();
+    
+    /** \param level zlib compression level (0-9)
+    */
+    bool open(const std::string& filename, int level = 6);
+    
+    bool write(const void* data, size_t size);
+    
+    /** Compresses the remaining data and writes the end of file marker.
+        Returns false if any write failed.
+    */
+    bool close(void);
+    
+    bool isOpen(void) const
+    {
+        return mpFile!=0;
+    }
+
+protected:
+
+    /** Compresses and writes the full blocks of the pending data, and the last partial one if all is true.
+    */
+    bool flush(bool all);
+
+protected:
+
+    FILE* mpFile;
+    int mLevel;
+    bool mOk;
+    std::vector<char> mPending;
+};
+
+/** Reads a block compressed file.
+    
+    A plain gzip file (not written by BlockGzipWriter) is decompressed serially at opening.
+*/
+class BlockGzipReader
+{
+public:
+
+    BlockGzipReader();
+    
+    ~BlockGzipReader();
+    
+    bool open(const std::string& filename);
+    
+    void close(void);
+    
+    /** Returns false for a plain gzip file.
+    */
+    bool isBlocked(void) const
+    {
+        return !mBlockStart.empty();
+    }
+    
+    /** Uncompressed size of the data.
+    */
+    size_t size(void) const;
+    
+    /** Copies n bytes starting at the uncompressed offset pos to dst.
+        The blocks covering the range are decompressed in parallel.
+        Returns the number of bytes read.
+    */
+    size_t read(size_t pos, char* dst, size_t n) const;
+    
+    /** Decompresses the whole file.
+    */
+    bool readAll(std::vector<char>& data) const;
+
+protected:
+
+    bool mapFile(const std::string& filename);
+    
+    bool buildIndex(void);
+    
+    bool inflateBlock(uint blockId, char* dst) const;
+
+protected:
+
+    // the compressed file in memory, mapped when possible
+    char* mpData;
+    size_t mSize;
+    bool mMapped;
+    
+    // per block: offset in the file, offset of its first byte in the uncompressed data (one more entry for the end)
+    std::vector<size_t> mBlockStart;
+    std::vector<size_t> mDataStart;
+    
+    // content of a plain gzip file
+    std::vector<char> mPlainData;
+};
+
+}
+
+#endif
+
@@ -0,0 +1,262 @@
+/*
+----------------------------------------------------------------------
+
+This source file is part of Expé
+(EXperimental Point Engine)
+
+Copyright (c) 2004-2007 by
+ - Computer Graphics Laboratory, ETH Zurich
+ - IRIT, University of Toulouse
+ - Gael Guennebaud.
+
+----------------------------------------------------------------------
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330,
+Boston, MA  02111-1307, USA.
+
+http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+----------------------------------------------------------------------
+*/
+
+
+
+#include "ExpeFlatKdTree.h"
+#include <algorithm>
+#include <limits>
+
+namespace Expe
+{
+
+namespace
+{
+    // orders sample ids along one axis
+    struct AxisLess
+    {
+        AxisLess(const std::vector<Vector3>& positions, uint dim) : mPositions(positions), mDim(dim) {}
+        bool operator() (uint a, uint b) const { return mPositions[a][mDim] < mPositions[b][mDim]; }
+        const std::vector<Vector3>& mPositions;
+        uint mDim;
+    };
+    
+    // the distances of a leaf are computed by blocks of this size
+    const uint LEAF_BLOCK = 16;
+    
+    // subtrees with more samples are built in separate tasks
+    const uint TASK_GRAIN = 4096;
+}
+
+FlatKdTree::FlatKdTree(const PointSet* pPoints, uint nofElementsPerCell)
+ : QueryDataStructure(pPoints), mNeighborQueue(mNeighborList)
+{
+    uint nb = mpPoints->size();
+    std::vector<Vector3> positions(nb);
+    std::vector<uint> ids(nb);
+    for (uint i=0 ; i<nb ; ++i)
+    {
+        positions[i] = mpPoints->at(i).position();
+        ids[i] = i;
+    }
+    mAABB = pPoints->computeAABB();
+    
+    // all the leaves are at the same depth
+    mDepth = 0;
+    while ((nb >> mDepth) > std::max(nofElementsPerCell,1u))
+        mDepth++;
+    mFirstLeaf = (1<<mDepth) - 1;
+    mNodes.resize(mFirstLeaf);
+    mLeafStart.resize((1<<mDepth) + 1);
+    mLeafStart[(1<<mDepth)] = nb;
+    
+    #pragma omp parallel
+    {
+        #pragma omp single
+        createTree(0, 0, nb, 0, positions, ids);
+    }
+    mX.resize(nb);
+    mY.resize(nb);
+    mZ.resize(nb);
+    mIds.swap(ids);
+    #pragma omp parallel for
+    for (int i=0 ; i<int(nb) ; ++i)
+    {
+        const Vector3& p = positions[mIds[i]];
+        mX[i] = p.x;
+        mY[i] = p.y;
+        mZ[i] = p.z;
+    }
+    
+    mNeighborQueue.init();
+}
+
+FlatKdTree::~FlatKdTree()
+{
+}
+
+void FlatKdTree::createTree(uint nodeId, uint start, uint end, uint depth, const std::vector<Vector3>& positions, std::vector<uint>& ids)
+{
+    if (depth==mDepth)
+    {
+        mLeafStart[nodeId - mFirstLeaf] = start;
+        return;
+    }
+    
+    // split the widest dimension at the median
+    Node& node = mNodes[nodeId];
+    uint mid = start + (end-start)/2;
+    node.dim = 0;
+    node.splitValue = 0.;
+    if (end>start)
+    {
+        AxisAlignedBox aabb;
+        for (uint i=start ; i<end ; ++i)
+            aabb.extend(positions[ids[i]]);
+        node.dim = (aabb.max() - aabb.min()).maxComponentId();
+        std::nth_element(ids.begin()+start, ids.begin()+mid, ids.begin()+end, AxisLess(positions,node.dim));
+        node.splitValue = positions[ids[mid]][node.dim];
+    }
+    
+    if (end-start > TASK_GRAIN)
+    {
+        #pragma omp task shared(positions, ids)
+        createTree(2*nodeId+1, start, mid, depth+1, positions, ids);
+        createTree(2*nodeId+2, mid, end, depth+1, positions, ids);
+        #pragma omp taskwait
+    }
+    else
+    {
+        createTree(2*nodeId+1, start, mid, depth+1, positions, ids);
+        createTree(2*nodeId+2, mid, end, depth+1, positions, ids);
+    }
+}
+
+void FlatKdTree::doQueryBall(const Vector3& p, Real dMax)
+{
+    mNofFoundNeighbors = search(p, dMax*dMax, mNeighborQueue);
+}
+
+void FlatKdTree::doQueryK(const Vector3& p)
+{
+    mNofFoundNeighbors = search(p, std::numeric_limits<float>::max(), mNeighborQueue);
+}
+
+void FlatKdTree::queryBall(const Vector3& p, Real dMax, QueryResult& result) const
+{
+    NeighborPriorityQueue queue(result.neighbors);
+    result.nofFoundNeighbors = search(p, dMax*dMax, queue);
+}
+
+void FlatKdTree::queryK(const Vector3& p, QueryResult& result) const
+{
+    NeighborPriorityQueue queue(result.neighbors);
+    result.nofFoundNeighbors = search(p, std::numeric_limits<float>::max(), queue);
+}
+
+uint FlatKdTree::search(const Vector3& p, Real maxSqDist, NeighborPriorityQueue& queue) const
+{
+    queue.init();
+    queue.insert(0xffffffff,maxSqDist);
+    
+    query(p, maxSqDist, queue);
+    
+    if (queue.getTopIndex() == 0xffffffff)
+        queue.removeTop();
+    
+    return queue.getNofElements();
+}
+
+void FlatKdTree::query(const Vector3& p, Real maxSqDist, NeighborPriorityQueue& queue) const
+{
+    if (mIds.empty())
+        return;
+    
+    struct StackEntry
+    {
+        uint node;
+        Real sqDist;
+        Real offset[3];
+    };
+    StackEntry stack[64];
+    uint top = 0;
+    
+    // incremental distance to the cells, starting from the distance to the bounding box
+    StackEntry& root = stack[top++];
+    root.node = 0;
+    root.sqDist = 0.;
+    for (uint k=0 ; k<3 ; ++k)
+    {
+        Real d = 0.;
+        if (p[k] < mAABB.min()[k])
+            d = mAABB.min()[k] - p[k];
+        else if (p[k] > mAABB.max()[k])
+            d = p[k] - mAABB.max()[k];
+        root.offset[k] = d;
+        root.sqDist += d*d;
+    }
+    
+    const Real* x = &mX[0];
+    const Real* y = &mY[0];
+    const Real* z = &mZ[0];
+    Real d2[LEAF_BLOCK];
+    while (top>0)
+    {
+        StackEntry entry = stack[--top];
+        if (entry.sqDist >= queue.getTopWeight())
+            continue;
+        
+        // go down to the closest leaf, the far children are visited later
+        uint nodeId = entry.node;
+        while (nodeId < mFirstLeaf)
+        {
+            const Node& node = mNodes[nodeId];
+            Real newOffset = p[node.dim] - node.splitValue;
+            uint nearId = newOffset < 0 ? 2*nodeId+1 : 2*nodeId+2;
+            uint farId = newOffset < 0 ? 2*nodeId+2 : 2*nodeId+1;
+            Real oldOffset = entry.offset[node.dim];
+            Real farDist = entry.sqDist - oldOffset*oldOffset + newOffset*newOffset;
+            if (farDist < queue.getTopWeight())
+            {
+                StackEntry& far = stack[top++];
+                far = entry;
+                far.node = farId;
+                far.sqDist = farDist;
+                far.offset[node.dim] = newOffset;
+            }
+            nodeId = nearId;
+        }
+        
+        // scan the leaf
+        uint leaf = nodeId - mFirstLeaf;
+        uint end = mLeafStart[leaf+1];
+        for (uint i=mLeafStart[leaf] ; i<end ; i+=LEAF_BLOCK)
+        {
+            uint nb = std::min(LEAF_BLOCK, end-i);
+            #pragma omp simd
+            for (uint j=0 ; j<nb ; ++j)
+            {
+                Real dx = p.x - x[i+j];
+                Real dy = p.y - y[i+j];
+                Real dz = p.z - z[i+j];
+                d2[j] = dx*dx + dy*dy + dz*dz;
+            }
+            for (uint j=0 ; j<nb ; ++j)
+            {
+                if (d2[j] < maxSqDist)
+                    queue.insert(mIds[i+j], d2[j]);
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,102 @@
+/*
+----------------------------------------------------------------------
+
+This source file is part of Expé
+(EXperimental Point Engine)
+
+Copyright (c) 2004-2007 by
+ - Computer Graphics Laboratory, ETH Zurich
+ - IRIT, University of Toulouse
+ - Gael Guennebaud.
+
+----------------------------------------------------------------------
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330,
+Boston, MA  02111-1307, USA.
+
+http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+----------------------------------------------------------------------
+*/
+
+
+
+#ifndef _ExpeFlatKdTree_h_ 
+#define _ExpeFlatKdTree_h_
+
+#include "ExpePrerequisites.h"
+#include "ExpeQueryDataStructure.h"
+
+namespace Expe
+{
+
+/** A balanced kd-tree stored in flat arrays.
+    
+    The tree is complete: the inner nodes are stored in breadth-first order in a single array
+    (the children of node i are 2i+1 and 2i+2) and all the leaves are at the same depth.
+    The samples are reordered leaf by leaf and their positions are stored as separate x/y/z arrays
+    so that the distances to the samples of a leaf are computed in a vectorizable loop.
+    Queries are iterative. The k-nearest neighbors are the same as with KdTree,
+    ball queries only return samples inside the ball.
+*/
+class FlatKdTree : public QueryDataStructure
+{
+public:
+
+    FlatKdTree(const PointSet* pPoints, uint nofElementsPerCell = 8);
+    
+    virtual ~FlatKdTree();
+
+    virtual void doQueryBall(const Vector3& p, Real dMax);
+
+    virtual void doQueryK(const Vector3& p);
+
+    virtual void queryBall(const Vector3& p, Real dMax, QueryResult& result) const;
+
+    virtual void queryK(const Vector3& p, QueryResult& result) const;
+
+protected:
+
+    struct Node
+    {
+        Real splitValue;
+        uint dim;
+    };
+
+    void createTree(uint nodeId, uint start, uint end, uint depth, const std::vector<Vector3>& positions, std::vector<uint>& ids);
+    uint search(const Vector3& p, Real maxSqDist, NeighborPriorityQueue& queue) const;
+    
+    /** Inserts in the queue the samples closer than sqrt(maxSqDist) that may be among the k nearest.
+    */
+    void query(const Vector3& p, Real maxSqDist, NeighborPriorityQueue& queue) const;
+
+protected:
+
+    NeighborPriorityQueue mNeighborQueue;
+
+    uint mDepth;
+    uint mFirstLeaf;
+    std::vector<Node> mNodes;
+    std::vector<uint> mLeafStart;
+    AxisAlignedBox mAABB;
+    
+    // samples sorted by leaf
+    RealArray mX, mY, mZ;
+    std::vector<uint> mIds;
+};
+
+}
+
+#endif
+
@@ -51,6 +51,8 @@ http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
 #include <QFile>
 #include <QTextStream>
 
+#include <algorithm>
+
 namespace Expe
 {
 
@@ -65,20 +67,12 @@ HalfedgeConnectivity::HalfedgeConnectivity(MeshPtr pMesh, Verbosity verb)
     
     for (uint submeshId=0 ; submeshId<mpMesh->getNofSubMeshes() ; ++submeshId)
     {
-        const SubMesh* pSubMesh = mpMesh->getSubMesh(submeshId);
         HalfedgeIdArray* pSubFaceToHalfedge = new HalfedgeIdArray;
-        pSubFaceToHalfedge->resize(pSubMesh->getNofFaces());
+        pSubFaceToHalfedge->resize(mpMesh->getSubMesh(submeshId)->getNofFaces());
         mFaceToHalfedge.add(pSubFaceToHalfedge);
-        
-        for (uint j=0 ; j<pSubMesh->getNofFaces() ; ++j)
-        {
-            FaceId fid(submeshId,j);
-            if (!addFaceInWrapper(fid, verb))
-            {
-                editFaceStatus(fid).setDeleted(true);
-            }
-        }
     }
+    
+    buildFromMesh(verb);
 }
 
 HalfedgeConnectivity::~HalfedgeConnectivity()
@@ -233,6 +227,36 @@ void HalfedgeConnectivity::deleteFace(FaceId fid)
         adjustOutgoingHalfedge(*v_it);
 }
 
+bool HalfedgeConnectivity::syncFace(FaceId fid)
+{
+    assert(fid.isValid() && !getFaceStatus(fid).isDeleted());
+    
+    FaceHandle face = editFace(fid);
+    uint nb = face.nofVertices();
+    
+    // keep the first vertex of the face when it is still in the loop
+    HalfedgeId ref = halfedgeId(fid);
+    HalfedgeId start = ref;
+    HalfedgeId hid = ref;
+    uint count = 0;
+    do {
+        if (toVertexId(hid)==face.vertexId(0))
+            start = hid;
+        count++;
+        hid = nextHalfedgeId(hid);
+    } while (hid!=ref && count<=nb);
+    if (count!=nb)
+        return false;
+    
+    hid = start;
+    for (uint k=0 ; k<nb ; ++k)
+    {
+        face.vertexId(k) = toVertexId(hid);
+        hid = nextHalfedgeId(hid);
+    }
+    return true;
+}
+
 uint HalfedgeConnectivity::computeValence(VertexId vid) const
 {
     uint count = 0;
@@ -255,6 +279,339 @@ Vector3 HalfedgeConnectivity::computeNormal(FaceId fid) const
         .cross(getVertex(vids[2]).position() - getVertex(vids[0]).position()).normalized();
 }
 
+namespace
+{
+
+static const uint NoCorner = 0xffffffff;
+
+/** Stable LSD radix sort of 64 bits keys, 8 bits per pass.
+    Each pass histograms and scatters contiguous blocks in parallel, and the passes
+    for which all the keys have the same digit are skipped.
+*/
+void radixSort(std::vector<uint64>& keys, std::vector<uint>& values)
+{
+    uint n = keys.size();
+    if (n<2)
+        return;
+    uint nofBlocks = std::min<uint>(64, n/16384+1);
+    uint blockSize = (n+nofBlocks-1)/nofBlocks;
+    std::vector<uint64> tmpKeys(n);
+    std::vector<uint> tmpValues(n);
+    std::vector<uint> offsets(nofBlocks*256);
+    
+    for (uint shift=0 ; shift<64 ; shift+=8)
+    {
+        #pragma omp parallel for
+        for (int b=0 ; b<int(nofBlocks) ; ++b)
+        {
+            uint* count = &offsets[b*256];
+            std::fill(count, count+256, 0);
+            uint end = std::min(n, (b+1)*blockSize);
+            for (uint i=b*blockSize ; i<end ; ++i)
+                count[(keys[i]>>shift) & 0xff]++;
+        }
+        
+        uint digit = (keys[0]>>shift) & 0xff;
+        uint same = 0;
+        for (uint b=0 ; b<nofBlocks ; ++b)
+            same += offsets[b*256+digit];
+        if (same==n)
+            continue;
+        
+        // exclusive prefix sum in digit then block order keeps the sort stable
+        uint sum = 0;
+        for (uint d=0 ; d<256 ; ++d)
+        {
+            for (uint b=0 ; b<nofBlocks ; ++b)
+            {
+                uint count = offsets[b*256+d];
+                offsets[b*256+d] = sum;
+                sum += count;
+            }
+        }
+        
+        #pragma omp parallel for
+        for (int b=0 ; b<int(nofBlocks) ; ++b)
+        {
+            uint* offset = &offsets[b*256];
+            uint end = std::min(n, (b+1)*blockSize);
+            for (uint i=b*blockSize ; i<end ; ++i)
+            {
+                uint j = offset[(keys[i]>>shift) & 0xff]++;
+                tmpKeys[j] = keys[i];
+                tmpValues[j] = values[i];
+            }
+        }
+        keys.swap(tmpKeys);
+        values.swap(tmpValues);
+    }
+}
+
+/** Flat list of the face corners used to build the connectivity.
+    The corner c of a face is the halfedge going from its vertex to the next vertex of the face.
+*/
+struct CornerTable
+{
+    std::vector<uint> faceStart;
+    std::vector<uint> vertex;
+    std::vector<uint> face;
+    
+    inline uint next(uint c) const { uint f = face[c]; return c+1==faceStart[f+1] ? faceStart[f] : c+1; }
+    inline uint previous(uint c) const { uint f = face[c]; return c==faceStart[f] ? faceStart[f+1]-1 : c-1; }
+};
+
+}
+
+void HalfedgeConnectivity::buildFromMesh(Verbosity verb)
+{
+    uint nofVertices = mpMesh->getNofVertices();
+    
+    // flatten the faces
+    std::vector<FaceId> faceIds;
+    CornerTable corners;
+    faceIds.reserve(getNofFaces());
+    corners.faceStart.reserve(getNofFaces()+1);
+    corners.faceStart.push_back(0);
+    for (uint subId=0 ; subId<mpMesh->getNofSubMeshes() ; ++subId)
+    {
+        const SubMesh* pSubMesh = mpMesh->getSubMesh(subId);
+        for (uint j=0 ; j<pSubMesh->getNofFaces() ; ++j)
+        {
+            faceIds.push_back(FaceId(subId,j));
+            corners.faceStart.push_back(corners.faceStart.back() + pSubMesh->getFace(j).nofVertices());
+        }
+    }
+    uint nofFaces = faceIds.size();
+    uint nofCorners = corners.faceStart.back();
+    corners.vertex.resize(nofCorners);
+    corners.face.resize(nofCorners);
+    
+    // faces which cannot be added at once are inserted one by one at the end
+    std::vector<char> deferred(nofFaces, 0);
+    #pragma omp parallel for
+    for (int f=0 ; f<int(nofFaces) ; ++f)
+    {
+        ConstFaceHandle face = getFace(faceIds[f]);
+        uint c0 = corners.faceStart[f];
+        uint nb = face.nofVertices();
+        bool ok = nb>2;
+        for (uint i=0 ; i<nb ; ++i)
+        {
+            uint vid = face.vertexId(i);
+            corners.vertex[c0+i] = vid;
+            corners.face[c0+i] = f;
+            ok = ok && vid<nofVertices;
+            for (uint k=0 ; k<i ; ++k)
+                ok = ok && corners.vertex[c0+k]!=vid;
+        }
+        deferred[f] = !ok;
+    }
+    
+    // sort the corners per edge, since the sort is stable the first corner of an edge comes first
+    std::vector<uint64> keys(nofCorners);
+    std::vector<uint> sorted(nofCorners);
+    #pragma omp parallel for
+    for (int c=0 ; c<int(nofCorners) ; ++c)
+    {
+        uint64 v0 = corners.vertex[c];
+        uint64 v1 = corners.vertex[corners.next(c)];
+        keys[c] = v0<v1 ? (v0<<32)|v1 : (v1<<32)|v0;
+        sorted[c] = c;
+    }
+    radixSort(keys, sorted);
+    
+    // a manifold edge has one corner or two corners of opposite directions
+    std::vector<char> complex(nofCorners, 0);
+    #pragma omp parallel for
+    for (int i=0 ; i<int(nofCorners) ; ++i)
+    {
+        if (i>0 && keys[i]==keys[i-1])
+            continue;
+        uint j = i+1;
+        while (j<nofCorners && keys[j]==keys[i])
+            ++j;
+        if (!(j==uint(i)+1 || (j==uint(i)+2 && corners.vertex[sorted[i]]!=corners.vertex[sorted[i+1]])))
+        {
+            for (uint k=i ; k<j ; ++k)
+                complex[sorted[k]] = 1;
+        }
+    }
+    #pragma omp parallel for
+    for (int f=0 ; f<int(nofFaces) ; ++f)
+    {
+        for (uint c=corners.faceStart[f] ; c<corners.faceStart[f+1] ; ++c)
+            if (complex[c])
+                deferred[f] = 1;
+    }
+    
+    // corners around each vertex (counting sort)
+    std::vector<uint> vertexStart(nofVertices+1, 0);
+    for (uint c=0 ; c<nofCorners ; ++c)
+        if (corners.vertex[c]<nofVertices)
+            vertexStart[corners.vertex[c]+1]++;
+    for (uint v=0 ; v<nofVertices ; ++v)
+        vertexStart[v+1] += vertexStart[v];
+    std::vector<uint> vertexCorners(vertexStart[nofVertices]);
+    {
+        std::vector<uint> fill(vertexStart.begin(), vertexStart.end()-1);
+        for (uint c=0 ; c<nofCorners ; ++c)
+            if (corners.vertex[c]<nofVertices)
+                vertexCorners[fill[corners.vertex[c]]++] = c;
+    }
+    
+    // Pair the corners of the accepted faces, and check that the faces around each vertex
+    // form either a single fan or a set of open fans. Removing the faces of a vertex
+    // only opens the fans of its neighbors, so this loop ends after a second pass.
+    std::vector<uint> twin(nofCorners);
+    std::vector<char> complexVertex(nofVertices);
+    for (bool done=false ; !done ; )
+    {
+        #pragma omp parallel for
+        for (int i=0 ; i<int(nofCorners) ; ++i)
+        {
+            uint c = sorted[i];
+            uint other = NoCorner;
+            if (i>0 && keys[i]==keys[i-1])
+                other = sorted[i-1];
+            else if (uint(i)+1<nofCorners && keys[i+1]==keys[i])
+                other = sorted[i+1];
+            if (other!=NoCorner && (deferred[corners.face[c]] || deferred[corners.face[other]]))
+                other = NoCorner;
+            twin[c] = other;
+        }
+        
+        #pragma omp parallel for
+        for (int v=0 ; v<int(nofVertices) ; ++v)
+        {
+            uint n = 0, visited = 0, first = NoCorner;
+            for (uint k=vertexStart[v] ; k<vertexStart[v+1] ; ++k)
+            {
+                uint c = vertexCorners[k];
+                if (deferred[corners.face[c]])
+                    continue;
+                if (first==NoCorner)
+                    first = c;
+                n++;
+            }
+            for (uint k=vertexStart[v] ; k<vertexStart[v+1] ; ++k)
+            {
+                uint c = vertexCorners[k];
+                if (deferred[corners.face[c]] || twin[corners.previous(c)]!=NoCorner)
+                    continue;
+                // walk the open fan starting at c
+                for (uint cur=c ; visited<=n ; cur=corners.next(twin[cur]))
+                {
+                    visited++;
+                    if (twin[cur]==NoCorner)
+                        break;
+                }
+            }
+            if (visited==0 && first!=NoCorner)
+            {
+                // a closed fan
+                uint cur = first;
+                do {
+                    visited++;
+                    cur = twin[cur]==NoCorner ? NoCorner : corners.next(twin[cur]);
+                } while (cur!=first && cur!=NoCorner && visited<=n);
+            }
+            complexVertex[v] = visited!=n;
+        }
+        
+        done = true;
+        for (uint v=0 ; v<nofVertices ; ++v)
+        {
+            if (complexVertex[v])
+            {
+                for (uint k=vertexStart[v] ; k<vertexStart[v+1] ; ++k)
+                    deferred[corners.face[vertexCorners[k]]] = 1;
+                done = false;
+            }
+        }
+    }
+    
+    // the edges are numbered in the order of their first corner, as with a face by face insertion
+    std::vector<uint> cornerHalfedge(nofCorners);
+    uint nofEdges = 0;
+    for (uint c=0 ; c<nofCorners ; ++c)
+    {
+        if (!deferred[corners.face[c]] && (twin[c]==NoCorner || c<twin[c]))
+            cornerHalfedge[c] = 2*(nofEdges++);
+    }
+    mEdges.resize(nofEdges);
+    #pragma omp parallel for
+    for (int c=0 ; c<int(nofCorners) ; ++c)
+    {
+        if (!deferred[corners.face[c]] && twin[c]!=NoCorner && uint(c)>twin[c])
+            cornerHalfedge[c] = cornerHalfedge[twin[c]]+1;
+    }
+    
+    #pragma omp parallel for
+    for (int c=0 ; c<int(nofCorners) ; ++c)
+    {
+        if (deferred[corners.face[c]])
+            continue;
+        uint next = corners.next(c);
+        Halfedge& h = editHalfedge(cornerHalfedge[c]);
+        h.faceId = faceIds[corners.face[c]];
+        h.toVertexId = corners.vertex[next];
+        h.nextHalfedgeId = cornerHalfedge[next];
+        if (twin[c]==NoCorner)
+            editHalfedge(cornerHalfedge[c]^1).toVertexId = corners.vertex[c];
+    }
+    
+    #pragma omp parallel for
+    for (int f=0 ; f<int(nofFaces) ; ++f)
+    {
+        if (!deferred[f])
+            setFaceToHalfedge(faceIds[f], cornerHalfedge[corners.faceStart[f+1]-1]);
+    }
+    
+    // link the boundary halfedges around each vertex and pick its outgoing halfedge
+    #pragma omp parallel for
+    for (int v=0 ; v<int(nofVertices) ; ++v)
+    {
+        HalfedgeId firstOut, lastIn;
+        HalfedgeId outgoing;
+        for (uint k=vertexStart[v] ; k<vertexStart[v+1] ; ++k)
+        {
+            uint c = vertexCorners[k];
+            if (deferred[corners.face[c]])
+                continue;
+            if (!outgoing.isValid())
+                outgoing = cornerHalfedge[c];
+            uint prev = corners.previous(c);
+            if (twin[prev]!=NoCorner)
+                continue;
+            
+            // open fan from c to end
+            uint end = c;
+            while (twin[end]!=NoCorner)
+                end = corners.next(twin[end]);
+            HalfedgeId out(cornerHalfedge[prev]^1);
+            HalfedgeId in(cornerHalfedge[end]^1);
+            if (lastIn.isValid())
+                setHalfedgeToHalfedge(lastIn, out);
+            else
+                firstOut = out;
+            lastIn = in;
+        }
+        if (lastIn.isValid())
+        {
+            setHalfedgeToHalfedge(lastIn, firstOut);
+            outgoing = firstOut;
+        }
+        if (outgoing.isValid())
+            setVertexToHalfedge(v, outgoing);
+    }
+    
+    for (uint f=0 ; f<nofFaces ; ++f)
+    {
+        if (deferred[f] && !addFaceInWrapper(faceIds[f], verb))
+            editFaceStatus(faceIds[f]).setDeleted(true);
+    }
+}
+
 namespace
 {
 template <class _Handle>
@@ -297,9 +654,9 @@ bool HalfedgeConnectivity::addFaceInWrapper(FaceId fid, Verbosity verb)
     // don't allow degenerated faces
     assert (nb > 2);
     
-    HalfedgeId* halfedgeIds = (HalfedgeId*) malloc(nb * sizeof(HalfedgeId));
-    bool* isNew = (bool*) malloc(nb * sizeof(bool));
-    bool* needs_adjust = (bool*) malloc(nb * sizeof(bool));
+    std::vector<HalfedgeId> halfedgeIds(nb);
+    std::vector<bool> isNew(nb, false);
+    std::vector<bool> needs_adjust(nb, false);
     
     // search for old half edge and check manifolness
     for (i=0, ii=1; i<nb; ++i, ++ii, ii%=nb)
@@ -477,12 +834,6 @@ bool HalfedgeConnectivity::addFaceInWrapper(FaceId fid, Verbosity verb)
         if (needs_adjust[i])
             adjustOutgoingHalfedge(face.vertexId(i));
 
-
-	free(halfedgeIds);
-    free(isNew);
-    free(needs_adjust);
-
-
     return true;
 }
 
@@ -538,6 +889,7 @@ void HalfedgeConnectivity::collapse(HalfedgeId hid)
     HalfedgeId h1 = nextHalfedgeId(h0);
     HalfedgeId o0 = oppositeHalfedgeId(h0);
     HalfedgeId o1 = nextHalfedgeId(o0);
+    VertexId vh = toVertexId(h0);
     
     // remove edge
     collapse_edge(h0);
@@ -550,6 +902,13 @@ void HalfedgeConnectivity::collapse(HalfedgeId hid)
     
     if (nextHalfedgeId(nextHalfedgeId(o1)) == o1)
         collapse_loop(o1);
+    
+    // only the faces around the remaining vertex have changed in the IFS mesh
+    for (VertexCirculator vf_it(this,vh) ; vf_it; ++vf_it)
+    {
+        if (vf_it.ccwFaceId().isValid())
+            syncFace(vf_it.ccwFaceId());
+    }
 }
 
 //-----------------------------------------------------------------------------
@@ -810,7 +1169,8 @@ void HalfedgeConnectivity::garbage_collection(bool _v, bool _e, bool _f)
     
     std::vector<VertexId>    vh_map;
     std::vector<HalfedgeId>  hh_map;
-    std::map<FaceId,FaceId>  fh_map;
+    // face map per sub mesh
+    std::vector< std::vector<FaceId> > fh_map(mFaceToHalfedge.getNofSets());
     
     // setup id mapping:
     vh_map.reserve(nV);
@@ -821,10 +1181,13 @@ void HalfedgeConnectivity::garbage_collection(bool _v, bool _e, bool _f)
     for (i=0; i<nH; ++i)
         hh_map.push_back(HalfedgeId(i));
     
-    //fh_map.reserve(nF);
-    FaceConnectivityList::iterator f_it(mFaceToHalfedge.begin()), f_end(mFaceToHalfedge.end());
-    for ( ; f_it!=f_end ; ++f_it)
-        fh_map[f_it.id()] = f_it.id();
+    for (uint subId=0 ; subId<fh_map.size() ; ++subId)
+    {
+        uint nofSubFaces = mFaceToHalfedge.getSet(subId)->size();
+        fh_map[subId].reserve(nofSubFaces);
+        for (uint j=0 ; j<nofSubFaces ; ++j)
+            fh_map[subId].push_back(FaceId(subId,j));
+    }
     
     // remove deleted vertices
     if (_v && nV > 0)
@@ -901,7 +1264,7 @@ void HalfedgeConnectivity::garbage_collection(bool _v, bool _e, bool _f)
                 
                     // swap
                     std::swap(subFaceToHalfedge[i0], subFaceToHalfedge[i1]);
-                    std::swap(fh_map[FaceId(subId,i0)], fh_map[FaceId(subId,i1)]);
+                    std::swap(fh_map[subId][i0], fh_map[subId][i1]);
                     subMesh.swapFaces(i0,i1);
                 };
             
@@ -940,14 +1303,14 @@ void HalfedgeConnectivity::garbage_collection(bool _v, bool _e, bool _f)
         setHalfedgeToHalfedge(hid, hh_map[nextHalfedgeId(hid)]);
         if (!getHalfedge(hid).isBoundary())
         {
-            setHalfedgeToFace(hid, fh_map[faceId(hid)]);
+            setHalfedgeToFace(hid, fh_map[faceId(hid).getSetId()][faceId(hid).getElementId()]);
         }
         
         hid+=1;
         setHalfedgeToHalfedge(hid, hh_map[nextHalfedgeId(hid)]);
         if (!getHalfedge(hid).isBoundary())
         {
-            setHalfedgeToFace(hid, fh_map[faceId(hid)]);
+            setHalfedgeToFace(hid, fh_map[faceId(hid).getSetId()][faceId(hid).getElementId()]);
         }
     }
     
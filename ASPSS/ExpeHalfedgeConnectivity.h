@@ -150,6 +150,12 @@ public:
     
 public:
 
+    /** Builds the connectivity of all the faces of pMesh.
+        \par
+        The halfedges are paired by sorting their vertex pairs, so the construction is linear and parallel.
+        Faces touching a non-manifold edge or vertex are then inserted one by one like with createFace,
+        and those which cannot be inserted are marked as deleted.
+    */
     HalfedgeConnectivity(MeshPtr pMesh, Verbosity verb = Verbose);
     
     ~HalfedgeConnectivity(void);
@@ -266,6 +272,12 @@ public:
     void deleteFace(FaceId fid);
     
     void deleteVertex(VertexId vid);
+    
+    /** Copy the vertices of the halfedge loop of a face to the IFS mesh.
+        Local operators call it on the faces they modify, so that the IFS mesh does not have to be rebuilt.
+        \return false if the loop and the face do not have the same number of vertices.
+    */
+    bool syncFace(FaceId fid);
     //@}
     
     /** \name status get/set
@@ -324,6 +336,8 @@ public:
 protected:
 
     // internal methods
+    void buildFromMesh(Verbosity verb);
+    
     bool addFaceInWrapper(FaceId fid, Verbosity verb = Verbose);
     
     HalfedgeId createEdge(VertexId v0, VertexId v1);
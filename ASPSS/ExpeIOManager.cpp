@@ -165,6 +165,23 @@ void IOManager::writeToFile(const SerializableObject* pObject, const QString& fi
         pWriter->write(pObject, options);
         delete pWriter;
     }
+    else
+    {
+        // try another way (for complex extension)
+        for (WriterFactoryMap::iterator it = mWriterFactories.begin() ; it!=mWriterFactories.end() ; ++it)
+        {
+            if (filename.endsWith(QString(it->first)))
+            {
+                assert(it->second->match(pObject));
+                QFile file(filename);
+                Writer * pWriter = it->second->create(&file);
+                pWriter->write(pObject, options);
+                delete pWriter;
+                return;
+            }
+        }
+        LOG_ERROR("Cannot find any Writer for " + ext + " file type.");
+    }
 }
 
 }
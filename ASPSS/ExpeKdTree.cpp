@@ -33,7 +33,6 @@ http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
 
 
 #include "ExpeKdTree.h"
-#include <stack>
 #include <limits>
 
 namespace Expe
@@ -74,135 +73,73 @@ KdTree::~KdTree()
 
 void KdTree::doQueryBall(const Vector3& p, Real dMax)
 {
-    mNeighborQueue.init();
-    mNeighborQueue.insert(0xffffffff,dMax*dMax);
-    
-    mQueryPosition = p;
-    mQueryOffset = Vector3::ZERO;
-    queryNode(*mRootNode, mAABB.squaredDistanceTo(p));
-    
-    if (mNeighborQueue.getTopIndex() == 0xffffffff)
-        mNeighborQueue.removeTop();
-    
-    mNofFoundNeighbors = mNeighborQueue.getNofElements();
+    mNofFoundNeighbors = search(p, dMax*dMax, mNeighborQueue);
 }
 
 void KdTree::doQueryK(const Vector3& p)
 {
-    mNeighborQueue.init();
-    mNeighborQueue.insert(0xffffffff,std::numeric_limits<float>::max());
-    
-    #if 1
-    mQueryPosition = p;
-    mQueryOffset = Vector3::ZERO;
-    queryNode(*mRootNode, mAABB.squaredDistanceTo(p));
-    
-    #else
-    std::stack<QueryNode> nodeStack;
-    //nodeStack.reserve(20);
-    nodeStack.push(QueryNode(mRootNode,mAABB.squaredDistanceTo(p)));
+    mNofFoundNeighbors = search(p, std::numeric_limits<float>::max(), mNeighborQueue);
+}
+
+void KdTree::queryBall(const Vector3& p, Real dMax, QueryResult& result) const
+{
+    NeighborPriorityQueue queue(result.neighbors);
+    result.nofFoundNeighbors = search(p, dMax*dMax, queue);
+}
+
+void KdTree::queryK(const Vector3& p, QueryResult& result) const
+{
+    NeighborPriorityQueue queue(result.neighbors);
+    result.nofFoundNeighbors = search(p, std::numeric_limits<float>::max(), queue);
+}
+
+uint KdTree::search(const Vector3& p, Real maxSqDist, NeighborPriorityQueue& queue) const
+{
+    queue.init();
+    queue.insert(0xffffffff,maxSqDist);
     
-    Vector3 offset(Vector3::ZERO);
+    Vector3 offset = Vector3::ZERO;
+    queryNode(*mRootNode, mAABB.squaredDistanceTo(p), p, offset, queue);
     
-    while (!nodeStack.empty())
-    {
-        QueryNode& qnode = nodeStack.top();
-        Node& node = *qnode.pNode;
-        
-        if (node.leaf)
-        {
-            for (uint i=node.start ; i<node.end ; ++i)
-            {
-                mNeighborQueue.insert(EL_INDEX(mElements[i]), p.squaredDistanceTo(EL_POSITION(mElements[i])));
-            }
-            nodeStack.pop();
-        }
-        else
-        {
-            // for a non-leaf node we have three states
-            if (qnode.nextChildId & 0x2)
-            {
-                // 1 - this is the second visit, check if have to process the second child
-                if (qnode.sqDist < 2.1*mNeighborQueue.getTopWeight())
-                {
-                    offset[node.dim] = qnode.newOffset;
-                    nodeStack.push(QueryNode(qnode.pNode->children[uint(qnode.nextChildId & 0x1)], qnode.sqDist));
-                    qnode.nextChildId = 0x4;
-                }
-                else
-                {
-                    // restore and pop
-                    offset[node.dim] = qnode.oldOffset;
-                    nodeStack.pop();
-                }
-            }
-            else if (qnode.nextChildId & 0x4)
-            {
-                // 2 - this is the third visit
-                // restore and pop
-                offset[node.dim] = qnode.oldOffset;
-                nodeStack.pop();
-            }
-            else
-            {
-                // 3 - this is the first visit
-                qnode.oldOffset = offset[node.dim];
-                qnode.newOffset = p[node.dim] - node.splitValue;
-                if (qnode.newOffset < 0)
-                {
-                    nodeStack.push(QueryNode(node.children[0],qnode.sqDist));
-                    qnode.nextChildId = 1 | 0x2;
-                }
-                else
-                {
-                    nodeStack.push(QueryNode(node.children[1],qnode.sqDist));
-                    qnode.nextChildId = 0 | 0x2;
-                }
-                qnode.sqDist += qnode.newOffset*qnode.newOffset - qnode.oldOffset*qnode.oldOffset;
-            }
-        }
-    }
-    #endif
-
-    if (mNeighborQueue.getTopIndex() == 0xffffffff)
-        mNeighborQueue.removeTop();
+    if (queue.getTopIndex() == 0xffffffff)
+        queue.removeTop();
     
-    mNofFoundNeighbors = mNeighborQueue.getNofElements();
+    return queue.getNofElements();
 }
 
-void KdTree::queryNode(Node& node, Real sq)
+void KdTree::queryNode(const Node& node, Real sq, const Vector3& p, Vector3& offset, NeighborPriorityQueue& queue) const
 {
     if (node.leaf)
     {
         for (uint i=node.start ; i<node.end ; ++i)
         {
-            mNeighborQueue.insert(EL_INDEX(mElements[i]), mQueryPosition.squaredDistanceTo(EL_POSITION(mElements[i])));
+            queue.insert(EL_INDEX(mElements[i]), p.squaredDistanceTo(EL_POSITION(mElements[i])));
         }
     }
     else
     {
-        Real old_off = mQueryOffset[node.dim];
-        Real new_off = mQueryPosition[node.dim] - node.splitValue;
+        Real old_off = offset[node.dim];
+        Real new_off = p[node.dim] - node.splitValue;
         if (new_off < 0)
         {
-            queryNode(*node.children[0],sq);
+            queryNode(*node.children[0], sq, p, offset, queue);
             sq = sq - old_off*old_off + new_off*new_off;
-            if (sq < mNeighborQueue.getTopWeight())
+            if (sq < queue.getTopWeight())
             {
-                mQueryOffset[node.dim] = new_off;
-                queryNode(*node.children[1], sq);
-                mQueryOffset[node.dim] = old_off;
+                offset[node.dim] = new_off;
+                queryNode(*node.children[1], sq, p, offset, queue);
+                offset[node.dim] = old_off;
             }
         }
         else
         {
-            queryNode(*node.children[1],sq);
+            queryNode(*node.children[1], sq, p, offset, queue);
             sq = sq - old_off*old_off + new_off*new_off;
-            if (sq < mNeighborQueue.getTopWeight())
+            if (sq < queue.getTopWeight())
             {
-                mQueryOffset[node.dim] = new_off;
-                queryNode(*node.children[0], sq);
-                mQueryOffset[node.dim] = old_off;
+                offset[node.dim] = new_off;
+                queryNode(*node.children[0], sq, p, offset, queue);
+                offset[node.dim] = old_off;
             }
         }
     }
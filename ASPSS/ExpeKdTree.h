@@ -104,27 +104,19 @@ public:
 
     virtual void doQueryK(const Vector3& p);
 
-protected:
+    virtual void queryBall(const Vector3& p, Real dMax, QueryResult& result) const;
 
-    struct QueryNode
-    {
-        QueryNode() {}
-        QueryNode(Node* apNode, Real asqDist) : pNode(apNode), sqDist(asqDist), nextChildId(0) {}
-        Node* pNode;
-        Real oldOffset;
-        Real newOffset;
-        Real sqDist;
-        byte nextChildId;
-    };
+    virtual void queryK(const Vector3& p, QueryResult& result) const;
+
+protected:
 
     void split(uint start, uint end, uint dim, float splitValue, uint &midId);
     void createTree(Node &node, uint start, uint end);
-    void queryNode(Node& node, Real sq);
-    Vector3 mQueryPosition, mQueryOffset;
+    uint search(const Vector3& p, Real maxSqDist, NeighborPriorityQueue& queue) const;
+    void queryNode(const Node& node, Real sq, const Vector3& p, Vector3& offset, NeighborPriorityQueue& queue) const;
 
 protected:
 
-    typedef MaxPriorityQueueWrapper<NeighborList> NeighborPriorityQueue;
     NeighborPriorityQueue mNeighborQueue;
 
     uint mTargetCellSize;
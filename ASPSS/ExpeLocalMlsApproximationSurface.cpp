@@ -36,6 +36,7 @@ http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
 
 #include "ExpeNeighborhood.h"
 #include "ExpeWeightingFunction.h"
+#include <algorithm>
 //#include "ExpeLazzyUi.h"
 
 namespace Expe
@@ -172,6 +173,44 @@ bool LocalMlsApproximationSurface::project(Vector3& position, Vector3& normal, C
     return true;
 }
 
+void LocalMlsApproximationSurface::sortQueries(const std::vector<Vector3>& positions, std::vector<uint>& order) const
+{
+    std::vector<std::pair<uint,uint> > keys(positions.size());
+    for (uint i=0 ; i<positions.size() ; ++i)
+        keys[i] = std::make_pair(mNeighborhood->getBatchKey(positions[i]), i);
+    std::sort(keys.begin(), keys.end());
+    
+    order.resize(positions.size());
+    for (uint i=0 ; i<keys.size() ; ++i)
+        order[i] = keys[i].second;
+}
+
+void LocalMlsApproximationSurface::potentielBatch(const std::vector<Vector3>& positions, RealArray& values, const std::vector<uint>* order) const
+{
+    values.resize(positions.size());
+    mNeighborhood->beginBatch();
+    for (uint i=0 ; i<positions.size() ; ++i)
+    {
+        uint id = order ? (*order)[i] : i;
+        values[id] = potentiel(positions[id]);
+    }
+    mNeighborhood->endBatch();
+}
+
+void LocalMlsApproximationSurface::projectBatch(std::vector<Vector3>& positions, std::vector<Vector3>& normals, std::vector<char>& ok, const std::vector<uint>* order) const
+{
+    normals.resize(positions.size());
+    ok.resize(positions.size());
+    Color c;
+    mNeighborhood->beginBatch();
+    for (uint i=0 ; i<positions.size() ; ++i)
+    {
+        uint id = order ? (*order)[i] : i;
+        ok[id] = project(positions[id], normals[id], c);
+    }
+    mNeighborhood->endBatch();
+}
+
 bool LocalMlsApproximationSurface::isValid(const Vector3& position) const
 {
     if (mCachedPosition!=position)
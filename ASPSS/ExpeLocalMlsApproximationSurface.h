@@ -83,6 +83,22 @@ public:
     
     virtual bool isValid(const Vector3& position) const;
     
+    /** Computes the order in which a set of queries should be evaluated,
+        i.e., queries falling in the same region of the neighborhood structure are consecutive.
+    */
+    void sortQueries(const std::vector<Vector3>& positions, std::vector<uint>& order) const;
+    
+    /** Evaluates the potentiel at each position, in batch mode.
+        \param order optional evaluation order (see sortQueries()), results are stored by position.
+    */
+    void potentielBatch(const std::vector<Vector3>& positions, RealArray& values, const std::vector<uint>* order = 0) const;
+    
+    /** Projects each position onto the surface, in batch mode (see project()).
+        \param ok stores for each position whether its projection succeeded.
+        \param order optional evaluation order (see sortQueries()), results are stored by position.
+    */
+    void projectBatch(std::vector<Vector3>& positions, std::vector<Vector3>& normals, std::vector<char>& ok, const std::vector<uint>* order = 0) const;
+    
     /** Output some statistics.
     */
     virtual void flushStatistics(void);
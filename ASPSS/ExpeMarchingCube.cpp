@@ -37,6 +37,7 @@ http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
 
 #include "ExpeCliProgressBar.h"
 #include "ExpeImplicitSurface.h"
+#include "ExpeLocalMlsApproximationSurface.h"
 #include "ExpeMesh.h"
 #include "ExpeQueryGrid.h"
 #include "ExpeHalfedgeConnectivity.h"
@@ -45,6 +46,10 @@ http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
 #include "ExpeTimer.h"
 #include "ExpeStringHelper.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace Expe
 {
 
@@ -85,6 +90,32 @@ MarchingCube::~MarchingCube(void)
     delete mStats;
 }
 
+namespace {
+// the progress bars are updated by the master thread only
+inline bool _isMasterThread(void)
+{
+    #ifdef _OPENMP
+    return omp_get_thread_num()==0;
+    #else
+    return true;
+    #endif
+}
+}
+
+int MarchingCube::_nofSurfaceThreads(void) const
+{
+    return mThreadSurfaces.empty() ? 1 : int(mThreadSurfaces.size());
+}
+
+const ImplicitSurface* MarchingCube::_threadSurface(void) const
+{
+    #ifdef _OPENMP
+    if (!mThreadSurfaces.empty())
+        return mThreadSurfaces[omp_get_thread_num()];
+    #endif
+    return mpSurface;
+}
+
 inline Vector3 MarchingCube::interpolEdge(const GridElement& v1, const GridElement& v2)
 {
     Real epsilon = 1e-4;
@@ -160,6 +191,12 @@ bool MarchingCube::_polygonize()
     
     GridElement grid[maxBlockSize*maxBlockSize*maxBlockSize];
     
+    // the local MLS surfaces evaluate the corners of a block in batch mode
+    const LocalMlsApproximationSurface* pMls = dynamic_cast<const LocalMlsApproximationSurface*>(mpSurface);
+    std::vector<Vector3> positions;
+    std::vector<uint> order;
+    RealArray values;
+    
     // start a new mesh
     DESTROY_PTR(mConnectivity);
     mpMesh = new Mesh();
@@ -203,13 +240,27 @@ bool MarchingCube::_polygonize()
         uint ci[3]; // local cell id
         
         // for each corner...
+        positions.clear();
         for(ci[0]=0 ; ci[0]<gridSize[0] ; ++ci[0])
         for(ci[1]=0 ; ci[1]<gridSize[1] ; ++ci[1])
         for(ci[2]=0 ; ci[2]<gridSize[2] ; ++ci[2])
         {
             GridElement& el = grid[(ci[2]*maxBlockSize + ci[1])*maxBlockSize + ci[0]];
             el.position = origin+step*Vector3(ci[0],ci[1],ci[2]);
-            el.value = mpSurface->potentiel(el.position);
+            if (pMls)
+                positions.push_back(el.position);
+            else
+                el.value = mpSurface->potentiel(el.position);
+        }
+        if (pMls)
+        {
+            pMls->sortQueries(positions, order);
+            pMls->potentielBatch(positions, values, &order);
+            uint j = 0;
+            for(ci[0]=0 ; ci[0]<gridSize[0] ; ++ci[0])
+            for(ci[1]=0 ; ci[1]<gridSize[1] ; ++ci[1])
+            for(ci[2]=0 ; ci[2]<gridSize[2] ; ++ci[2])
+                grid[(ci[2]*maxBlockSize + ci[1])*maxBlockSize + ci[0]].value = values[j++];
         }
         
         // polygonize the grid (marching cube)
@@ -324,10 +375,17 @@ void MarchingCube::_computeNormalsFromNumericGradient(void)
     uint nb = mpMesh->getNofVertices();
     Real eps = 0.05 * (mAABB.max() - mAABB.min()).maxComponent()/Real(mResolution);
     CliProgressBarT<int> progressBar(0,nb-1);
-    for(uint i=0 ; i<nb ; i++)
+    #pragma omp parallel num_threads(_nofSurfaceThreads())
     {
-        mpMesh->vertex(i).normal() = mpSurface->numericalGradient(mpMesh->vertex(i).position(), eps).normalized();
-        progressBar.update(i);
+        const ImplicitSurface* pSurface = _threadSurface();
+        bool master = _isMasterThread();
+        #pragma omp for schedule(dynamic, 256)
+        for(int i=0 ; i<int(nb) ; i++)
+        {
+            mpMesh->vertex(i).normal() = pSurface->numericalGradient(mpMesh->vertex(i).position(), eps).normalized();
+            if (master)
+                progressBar.update(i);
+        }
     }
 }
 
@@ -338,53 +396,93 @@ void MarchingCube::_projection(void)
     
     LOG_MESSAGE("MarchingCube - Accurate projection...");
     mStats->projectionTimer.start();
-    Vector3 position;
-    Vector3 normal;
-    Color c;
     Real step = (mAABB.max() - mAABB.min()).maxComponent()/Real(mResolution);
     bool hasNormal = mpMesh->getVertices().hasAttribute(Mesh::VertexList::Attribute_normal);
     
-    HalfedgeConnectivity hec = editConnectivity();
-
-    CliProgressBarT<int> progressBar(0,mpMesh->getNofVertices()-1);
-    for(uint i=0 ; i<mpMesh->getNofVertices() ; i++)
+    HalfedgeConnectivity& hec = editConnectivity();
+    
+    // the vertices are projected in parallel, per chunk of consecutive vertices,
+    // and the ones which failed are removed afterward since it changes the connectivity
+    static const int chunkSize = 4096;
+    int nofVertices = mpMesh->getNofVertices();
+    int nofChunks = (nofVertices + chunkSize - 1) / chunkSize;
+    std::vector<char> remove(nofVertices, 0);
+    CliProgressBarT<int> progressBar(0,nofVertices-1);
+    #pragma omp parallel num_threads(_nofSurfaceThreads())
     {
-        if (hec.getVertexStatus(i).isDeleted())
-            continue;
-        
-        Mesh::VertexHandle v = mpMesh->vertex(i);
-        position = v.position();
-        bool remove = false;
-        if (mpSurface->project(position, normal, c))
+        const ImplicitSurface* pSurface = _threadSurface();
+        // the local MLS surfaces project a chunk in batch mode
+        const LocalMlsApproximationSurface* pMls = dynamic_cast<const LocalMlsApproximationSurface*>(pSurface);
+        bool master = _isMasterThread();
+        std::vector<int> ids;
+        std::vector<Vector3> positions;
+        std::vector<Vector3> normals;
+        std::vector<char> ok;
+        std::vector<uint> order;
+        Color c;
+        #pragma omp for schedule(dynamic, 1)
+        for(int chunk=0 ; chunk<nofChunks ; chunk++)
         {
-            Real d = position.distanceTo(v.position());
-            if (d>step)
+            int end = std::min(nofVertices, (chunk+1)*chunkSize);
+            ids.clear();
+            positions.clear();
+            for(int i=chunk*chunkSize ; i<end ; i++)
+            {
+                if (hec.getVertexStatus(i).isDeleted())
+                    continue;
+                ids.push_back(i);
+                positions.push_back(mpMesh->vertex(i).position());
+            }
+            
+            if (pMls)
             {
-                remove = true;
+                pMls->sortQueries(positions, order);
+                pMls->projectBatch(positions, normals, ok, &order);
             }
             else
             {
-                v.position() = position;
-                if (hasNormal)
-                    v.normal() = normal;
+                normals.resize(positions.size());
+                ok.resize(positions.size());
+                for(uint j=0 ; j<positions.size() ; j++)
+                    ok[j] = pSurface->project(positions[j], normals[j], c);
             }
+            
+            for(uint j=0 ; j<ids.size() ; j++)
+            {
+                Mesh::VertexHandle v = mpMesh->vertex(ids[j]);
+                if (ok[j])
+                {
+                    Real d = positions[j].distanceTo(v.position());
+                    if (d>step)
+                    {
+                        remove[ids[j]] = 1;
+                    }
+                    else
+                    {
+                        v.position() = positions[j];
+                        if (hasNormal)
+                            v.normal() = normals[j];
+                    }
+                }
+                else
+                {
+                    LOG_DEBUG_MSG(5,"MarchingCube::_projection: projection failed");
+                    remove[ids[j]] = 1;
+                }
+            }
+            if (master)
+                progressBar.update(end-1);
         }
-        else
-        {
-            LOG_DEBUG_MSG(5,"MarchingCube::_projection: projection failed");
-            remove = true;
-        }
-        if (remove)
-        {
+    }
+    for(int i=0 ; i<nofVertices ; i++)
+    {
+        if (remove[i] && (!hec.getVertexStatus(i).isDeleted()))
             hec.deleteVertex(i);
-        }
-        progressBar.update(i);
     }
     hec.garbage_collection();
     mStats->projectionTimer.stop();
 }
 
-
 namespace {
 double _cosAngle(const Vector3d* p, uint i0, uint i1, uint i2)
 {
@@ -399,6 +497,108 @@ Vector3 _computeNormal(const Vector3d* p, uint i0, uint i1, uint i2)
 {
     return vector_cast<Vector3>((p[i1] - p[i0]).cross(p[i2] - p[i0]).normalized());
 }
+
+// flip the edge eid if it improves the valence of its vertices
+void _optimizeEdgeValence(HalfedgeConnectivity& hec, HEC::EdgeId eid)
+{
+    if (hec.getEdgeStatus(eid).isDeleted() || (!hec.isFlipOk(eid)))
+        return;
+    
+    // check if an edge flip would improve the valence
+    // compute the initial valence of each vertex
+    HEC::EdgeHandle e = hec.editEdge(eid);
+    HEC::VertexId vids[4];
+    vids[0] = e.halfedges[0].toVertexId;
+    vids[1] = e.halfedges[1].toVertexId;
+    vids[2] = hec.toVertexId(e.halfedges[0].nextHalfedgeId);
+    vids[3] = hec.toVertexId(e.halfedges[1].nextHalfedgeId);
+    
+    Vector3d p[4];
+    for (uint k=0 ; k<4 ; ++k)
+        p[k] = vector_cast<Vector3d>(hec.getVertex(vids[k]).position());
+
+    /* the following test aims to avoid these cases:
+               O
+             / /
+           /  /
+        /    /
+        O---O
+        \   \
+          \  \
+            \ \
+              O
+    */
+    if (   (_angle(p,0,2,1)+_angle(p,0,1,3) > Math::PI)
+        || (_angle(p,1,0,2)+_angle(p,1,3,0) > Math::PI) )
+    {
+        return;
+    }
+    
+    // compute the valence errors
+    uint vals[4];
+    uint initError = 0;
+    for (uint k=0 ; k<4 ; ++k)
+    {
+        vals[k] = hec.computeValence(vids[k]);
+        initError += (vals[k]-6)*(vals[k]-6);
+    }
+    vals[0]--; vals[1]--; vals[2]++; vals[3]++;
+    uint flipError = 0;
+    for (uint k=0 ; k<4 ; ++k)
+        flipError += (vals[k]-6)*(vals[k]-6);
+    
+    // crease and valley stuff
+    HEC::FaceId fa1 = hec.faceId(hec.oppositeHalfedgeId(e.halfedges[0].nextHalfedgeId));
+    HEC::FaceId fa2 = hec.faceId(hec.oppositeHalfedgeId(hec.nextHalfedgeId(e.halfedges[0].nextHalfedgeId)));
+    HEC::FaceId fb1 = hec.faceId(hec.oppositeHalfedgeId(e.halfedges[1].nextHalfedgeId));
+    HEC::FaceId fb2 = hec.faceId(hec.oppositeHalfedgeId(hec.nextHalfedgeId(e.halfedges[1].nextHalfedgeId)));
+    
+    Real initNerr=0., flipNerr=0.;
+    if ( fa1.isValid() && fa2.isValid() && fb1.isValid() && fb2.isValid() )
+    {
+        Vector3 nfa1 = hec.computeNormal(fa1);
+        Vector3 nfa2 = hec.computeNormal(fa2);
+        Vector3 nfb1 = hec.computeNormal(fb1);
+        Vector3 nfb2 = hec.computeNormal(fb2);
+        
+        Vector3 nfa = hec.computeNormal(e.halfedges[0].faceId);
+        Vector3 nfb = hec.computeNormal(e.halfedges[1].faceId);
+        
+        Vector3 nfabis = _computeNormal(p,1,3,2);
+        Vector3 nfbbis = _computeNormal(p,0,2,3);
+        
+        // dilema, should we use the max of the angle or the average... ?
+        initNerr = Math::Max(Math::Max(acos(nfa.dot(nfa1)), acos(nfa.dot(nfa2))), Math::Max(acos(nfb.dot(nfb1)), acos(nfb.dot(nfb2))));
+        flipNerr = Math::Max(Math::Max(acos(nfabis.dot(nfa2)), acos(nfabis.dot(nfb1))), Math::Max(acos(nfbbis.dot(nfa1)), acos(nfbbis.dot(nfb2))));
+
+//                 initNerr = acos(nfa.dot(nfa1)) + acos(nfa.dot(nfa2)) + acos(nfb.dot(nfb1)) + acos(nfb.dot(nfb2));
+//                 flipNerr = acos(nfabis.dot(nfa2)) + acos(nfabis.dot(nfb1)) + acos(nfbbis.dot(nfa1)) + acos(nfbbis.dot(nfb2));
+
+        if ((!Math::isFinite(initNerr)) || (!Math::isFinite(flipNerr)))
+        {
+            if (flipError<initError)
+                hec.flip(eid);
+        }
+        else  if (flipError<initError && (flipNerr<2.*initNerr)) // take care to not increase the local curvature too much
+        {
+            hec.flip(eid);
+        }
+    }
+    else if (flipError<initError)
+    {
+            hec.flip(eid);
+    }
+}
+
+// priority of an edge in the parallel rounds of _optimizeValence, unique per edge
+inline uint64 _edgePriority(uint e)
+{
+    uint h = e * 0x9e3779b1u;
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    return ((uint64(h)<<32) | uint64(e)) + 1;
+}
 }
 
 void MarchingCube::_optimizeValence(void)
@@ -407,96 +607,69 @@ void MarchingCube::_optimizeValence(void)
         return;
     HalfedgeConnectivity& hec = editConnectivity();
     
-    for (uint i=0 ; i<hec.getNofEdges() ; ++i)
+    // Evaluating and flipping an edge only reads and writes the faces around the vertices of its two faces.
+    // The edges are thus processed by rounds of edges which do not share any of these vertices,
+    // so that their flips are independent. An edge enters a round when it has the highest priority
+    // among the remaining edges sharing one of its vertices (Jones-Plassmann coloring).
+    // The priorities being a hash of the edge ids, the result only depends on the mesh.
+    int nofEdges = hec.getNofEdges();
+    std::vector<uint> candidates;
+    for (int i=0 ; i<nofEdges ; ++i)
     {
         HEC::EdgeId eid(i);
-        if ((!hec.getEdgeStatus(eid).isDeleted()) && hec.isFlipOk(eid))
+        if ((!hec.getEdgeStatus(eid).isDeleted()) && (!hec.isBoundary(eid)))
+            candidates.push_back(i);
+    }
+    
+    // for each vertex, the highest priority of the remaining edges having the vertex in their faces
+    std::vector<uint64> best(hec.getNofVertices(), 0);
+    std::vector<HEC::VertexId> quads;
+    std::vector<char> selected;
+    while (!candidates.empty())
+    {
+        int nofCandidates = candidates.size();
+        
+        // the vertices of the faces of the edges, which change with the flips of the previous round
+        quads.resize(4*nofCandidates);
+        #pragma omp parallel for schedule(dynamic, 1024)
+        for (int i=0 ; i<nofCandidates ; ++i)
         {
-            // check if an edge flip would improve the valence
-            // compute the initial valence of each vertex
-            HEC::EdgeHandle e = hec.editEdge(eid);
-            HEC::VertexId vids[4];
-            vids[0] = e.halfedges[0].toVertexId;
-            vids[1] = e.halfedges[1].toVertexId;
-            vids[2] = hec.toVertexId(e.halfedges[0].nextHalfedgeId);
-            vids[3] = hec.toVertexId(e.halfedges[1].nextHalfedgeId);
-            
-            Vector3d p[4];
-            for (uint k=0 ; k<4 ; ++k)
-                p[k] = vector_cast<Vector3d>(hec.getVertex(vids[k]).position());
-
-            /* the following test aims to avoid these cases:
-                       O
-                     / /
-                   /  /
-                /    /
-                O---O
-                \   \
-                  \  \
-                    \ \
-                      O
-            */
-            if (   (_angle(p,0,2,1)+_angle(p,0,1,3) > Math::PI)
-                || (_angle(p,1,0,2)+_angle(p,1,3,0) > Math::PI) )
-            {
-                continue;
-            }
-            
-            // compute the valence errors
-            uint vals[4];
-            uint initError = 0;
-            for (uint k=0 ; k<4 ; ++k)
-            {
-                vals[k] = hec.computeValence(vids[k]);
-                initError += (vals[k]-6)*(vals[k]-6);
-            }
-            vals[0]--; vals[1]--; vals[2]++; vals[3]++;
-            uint flipError = 0;
+            HEC::HalfedgeId h0 = hec.halfedgeId(HEC::EdgeId(candidates[i]), 0);
+            HEC::HalfedgeId h1 = hec.halfedgeId(HEC::EdgeId(candidates[i]), 1);
+            quads[4*i+0] = hec.toVertexId(h0);
+            quads[4*i+1] = hec.toVertexId(h1);
+            quads[4*i+2] = hec.toVertexId(hec.nextHalfedgeId(h0));
+            quads[4*i+3] = hec.toVertexId(hec.nextHalfedgeId(h1));
+        }
+        for (int i=0 ; i<4*nofCandidates ; ++i)
+            best[quads[i]] = 0;
+        for (int i=0 ; i<nofCandidates ; ++i)
+        {
+            uint64 p = _edgePriority(candidates[i]);
             for (uint k=0 ; k<4 ; ++k)
-                flipError += (vals[k]-6)*(vals[k]-6);
-            
-            // crease and valley stuff
-            HEC::FaceId fa1 = hec.faceId(hec.oppositeHalfedgeId(e.halfedges[0].nextHalfedgeId));
-            HEC::FaceId fa2 = hec.faceId(hec.oppositeHalfedgeId(hec.nextHalfedgeId(e.halfedges[0].nextHalfedgeId)));
-            HEC::FaceId fb1 = hec.faceId(hec.oppositeHalfedgeId(e.halfedges[1].nextHalfedgeId));
-            HEC::FaceId fb2 = hec.faceId(hec.oppositeHalfedgeId(hec.nextHalfedgeId(e.halfedges[1].nextHalfedgeId)));
-            
-            Real initNerr=0., flipNerr=0.;
-            if ( fa1.isValid() && fa2.isValid() && fb1.isValid() && fb2.isValid() )
-            {
-                Vector3 nfa1 = hec.computeNormal(fa1);
-                Vector3 nfa2 = hec.computeNormal(fa2);
-                Vector3 nfb1 = hec.computeNormal(fb1);
-                Vector3 nfb2 = hec.computeNormal(fb2);
-                
-                Vector3 nfa = hec.computeNormal(e.halfedges[0].faceId);
-                Vector3 nfb = hec.computeNormal(e.halfedges[1].faceId);
-                
-                Vector3 nfabis = _computeNormal(p,1,3,2);
-                Vector3 nfbbis = _computeNormal(p,0,2,3);
-                
-                // dilema, should we use the max of the angle or the average... ?
-                initNerr = Math::Max(Math::Max(acos(nfa.dot(nfa1)), acos(nfa.dot(nfa2))), Math::Max(acos(nfb.dot(nfb1)), acos(nfb.dot(nfb2))));
-                flipNerr = Math::Max(Math::Max(acos(nfabis.dot(nfa2)), acos(nfabis.dot(nfb1))), Math::Max(acos(nfbbis.dot(nfa1)), acos(nfbbis.dot(nfb2))));
-
-//                 initNerr = acos(nfa.dot(nfa1)) + acos(nfa.dot(nfa2)) + acos(nfb.dot(nfb1)) + acos(nfb.dot(nfb2));
-//                 flipNerr = acos(nfabis.dot(nfa2)) + acos(nfabis.dot(nfb1)) + acos(nfbbis.dot(nfa1)) + acos(nfbbis.dot(nfb2));
-
-                if ((!Math::isFinite(initNerr)) || (!Math::isFinite(flipNerr)))
-                {
-                    if (flipError<initError)
-                        hec.flip(eid);
-                }
-                else  if (flipError<initError && (flipNerr<2.*initNerr)) // take care to not increase the local curvature too much
-                {
-                    hec.flip(eid);
-                }
-            }
-            else if (flipError<initError)
-            {
-                    hec.flip(eid);
-            }
+                best[quads[4*i+k]] = Math::Max(best[quads[4*i+k]], p);
+        }
+        
+        // flip the edges of the round
+        selected.resize(nofCandidates);
+        #pragma omp parallel for schedule(dynamic, 256)
+        for (int i=0 ; i<nofCandidates ; ++i)
+        {
+            uint64 p = _edgePriority(candidates[i]);
+            selected[i] = (best[quads[4*i+0]]==p) && (best[quads[4*i+1]]==p)
+                       && (best[quads[4*i+2]]==p) && (best[quads[4*i+3]]==p);
+            if (selected[i])
+                _optimizeEdgeValence(hec, HEC::EdgeId(candidates[i]));
         }
+        
+        // remove the processed edges
+        int n = 0;
+        for (int i=0 ; i<nofCandidates ; ++i)
+        {
+            if (!selected[i])
+                candidates[n++] = candidates[i];
+        }
+        candidates.resize(n);
     }
 }
 
@@ -692,10 +865,14 @@ void MarchingCube::_relaxation(void)
         return;
     HalfedgeConnectivity& hec = editConnectivity();
     
-    Color dummy_c;
-    for (uint i=0 ; i<hec.getNofVertices() ; ++i)
+    // the new positions are computed from the previous ones only,
+    // and written back once all the vertices have been processed
+    int nofVertices = hec.getNofVertices();
+    std::vector<Vector3> newPositions(nofVertices);
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for (int i=0 ; i<nofVertices ; ++i)
     {
-        HEC::VertexHandle v = hec.editVertex(i);
+        Vector3 position = hec.getVertex(i).position();
         Vector3 p1, p2;
         Vector3 cog(Vector3::ZERO);
         uint valence = 0;
@@ -710,28 +887,32 @@ void MarchingCube::_relaxation(void)
             ++vv_it;
             p2 = hec.getVertex(vv_it.vertexId()).position();
             
-            Vector3 nf = (p1-v.position()).normalized().cross( (p2-v.position()).normalized() );
+            Vector3 nf = (p1-position).normalized().cross( (p2-position).normalized() );
             Real lnf;
             if ( (lnf=nf.length())>0.1 )
                 normal += nf / lnf;
             else
                 nok = false;
         }
-        cog = (cog+v.position())/Real(valence+1);
+        cog = (cog+position)/Real(valence+1);
         if (nok)
         {
             normal.normalize();
-            v.position() = cog - (cog-v.position()).dot(normal) * normal;
+            newPositions[i] = cog - (cog-position).dot(normal) * normal;
         }
         else
         {
             // fall back to accurate projection
             //if (pSurface->project(cog, normal, dummy_c))
             {
-                v.position() = cog;
+                newPositions[i] = cog;
             }
         }
     }
+    
+    #pragma omp parallel for
+    for (int i=0 ; i<nofVertices ; ++i)
+        hec.editVertex(i).position() = newPositions[i];
 }
 
 HalfedgeConnectivity& MarchingCube::editConnectivity(void)
@@ -90,6 +90,13 @@ public:
     */
     void setSurface(const ImplicitSurface* pSurface) {mpSurface = pSurface;}
     
+    /** Specifies one surface per thread for the post-processing passes (projection, normals).
+        The surface queries are not thread safe, so each thread needs its own instance which must
+        define the same surface as the one given to setSurface. The passes use as many threads
+        as given surfaces, and run serially on the main surface if none is given.
+    */
+    void setThreadSurfaces(const std::vector<const ImplicitSurface*>& surfaces) {mThreadSurfaces = surfaces;}
+    
     /** Specifies the reconstruction domain.
         \warning this is mandatory before starting the reconstruction
     */
@@ -145,7 +152,8 @@ public:
     
     /** Move each vertices toward their respective center of gravity (computed from the one ring neighborhood).
         The vertices are kept onto the surface as most as possible by moving along their respective tangent plane.
-        This function perform a single iteration.
+        This function perform a single iteration. The new positions are computed from the previous ones only
+        (Jacobi iteration), so that the vertices are moved in parallel with a result independent of the number of threads.
         Afater, you might call _projection() to indeed project the vertices onto the surface.
         \see _projection()
     */
@@ -153,6 +161,8 @@ public:
     
     /** Optimize the mesh connectivity (edge flip) to improve the vertex valence while trying to preserve features.
         This function perform a single iteration.
+        The edges are processed in parallel by rounds of edges whose faces do not share any vertex.
+        The rounds only depend on the mesh, not on the number of threads.
     */
     void _optimizeValence(void);
     
@@ -185,6 +195,12 @@ public:
 protected:
 
     HalfedgeConnectivity& editConnectivity(void);
+    
+    /** \returns the number of threads of the surface queries */
+    int _nofSurfaceThreads(void) const;
+    
+    /** \returns the surface of the calling thread */
+    const ImplicitSurface* _threadSurface(void) const;
 
 protected:
 
@@ -201,6 +217,7 @@ protected:
 //     uint mResolution;
     
     const ImplicitSurface* mpSurface;
+    std::vector<const ImplicitSurface*> mThreadSurfaces;
 
     inline Vector3 interpolEdge(const GridElement& v1, const GridElement& v2);
     
@@ -67,15 +67,23 @@ bool MeshNormalEvaluator::apply(void)
     if (pMesh->isRegularIFS())
     {
         // set the normals to zero
-        uint nofVertices = pMesh->getNofVertices();
-        for (uint i=0 ; i<nofVertices ; ++i)
+        int nofVertices = pMesh->getNofVertices();
+        #pragma omp parallel for
+        for (int i=0 ; i<nofVertices ; ++i)
             pMesh->vertex(i).normal() = Vector3f::ZERO;
         
         // accumulate the normals of each faces
+        std::vector<Vector3f> faceNormals;
         for (uint j=0 ; j<pMesh->getNofSubMeshes() ; ++j)
         {
             SubMesh* pSubMesh = pMesh->editSubMesh(j);
-            for (uint i=0 ; i<pSubMesh->getNofFaces() ; ++i)
+            int nofFaces = pSubMesh->getNofFaces();
+            
+            // the weighted normals are computed in parallel, and accumulated sequentially
+            // since the faces share their vertices
+            faceNormals.resize(3*nofFaces);
+            #pragma omp parallel for
+            for (int i=0 ; i<nofFaces ; ++i)
             {
                 Mesh::FaceHandle face = pSubMesh->editFace(i);
                 
@@ -96,14 +104,22 @@ bool MeshNormalEvaluator::apply(void)
                 pMesh->normals[face.vertexId(1)] += a1 * normal;
                 pMesh->normals[face.vertexId(2)] += a2 * normal;*/
                 
-                pMesh->vertex(face.vertexId(0)).normal() += a0 * normal;
-                pMesh->vertex(face.vertexId(1)).normal() += a1 * normal;
-                pMesh->vertex(face.vertexId(2)).normal() += a2 * normal;
+                faceNormals[3*i+0] = a0 * normal;
+                faceNormals[3*i+1] = a1 * normal;
+                faceNormals[3*i+2] = a2 * normal;
+            }
+            for (int i=0 ; i<nofFaces ; ++i)
+            {
+                Mesh::FaceHandle face = pSubMesh->editFace(i);
+                pMesh->vertex(face.vertexId(0)).normal() += faceNormals[3*i+0];
+                pMesh->vertex(face.vertexId(1)).normal() += faceNormals[3*i+1];
+                pMesh->vertex(face.vertexId(2)).normal() += faceNormals[3*i+2];
             }
         }
         
         // normalize the normals
-        for (uint i=0 ; i<nofVertices ; ++i)
+        #pragma omp parallel for
+        for (int i=0 ; i<nofVertices ; ++i)
             pMesh->vertex(i).normal().normalize();
     }
     else
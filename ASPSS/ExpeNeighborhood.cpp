@@ -45,6 +45,7 @@ Neighborhood::Neighborhood(ConstPointSetPtr pPoints)
 {
     mNofFoundNeighbors = 0;
     mCurrentFilterRadius = 0.;
+    mPackedValid = false;
 }
 
 Neighborhood::~Neighborhood()
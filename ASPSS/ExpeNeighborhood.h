@@ -58,7 +58,7 @@ public:
     
     virtual ~Neighborhood();
     
-    //inline const PointSet* getPoints(void) const {return mpPoints;}
+    inline const PointSet* getPoints(void) const {return mpPoints;}
     
     virtual void computeNeighborhood(const Vector3& p, const WeightingFunction* pWeightingFunc = 0) = 0;
     
@@ -73,6 +73,26 @@ public:
     Real getCurrentFilterRadius(void) const;
     void sortNeighbors(void);
     
+    /** Neighbor positions and normals packed in arrays, in the same order as getNeighbor().
+        Only available after queries that produce them (see beginBatch()), 0 otherwise.
+    */
+    struct PackedNeighbors
+    {
+        RealArray px, py, pz;
+        RealArray nx, ny, nz;
+    };
+    inline const PackedNeighbors* getPackedNeighbors(void) const;
+    inline const Real* getNeighborWeights(void) const;
+    
+    /** Batched queries.
+        Between beginBatch() and endBatch() a neighborhood may keep data shared by nearby queries.
+        The found neighbors and weights are the same as without batching.
+        Queries sorted by getBatchKey() are the ones that benefit the most.
+    */
+    virtual void beginBatch(void) {}
+    virtual void endBatch(void) {}
+    virtual uint getBatchKey(const Vector3& p) { return 0; }
+    
 protected:
     
     ConstPointSetPtr mpPoints;
@@ -82,6 +102,8 @@ protected:
     RealArray mDerivativeWeights;
     Real mCurrentFilterRadius;
     Vector3 mQueriedPoint;
+    PackedNeighbors mPacked;
+    bool mPackedValid;
 };
 
 
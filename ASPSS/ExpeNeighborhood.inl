@@ -75,3 +75,12 @@ inline Real Neighborhood::getNeighborDerivativeWeight(uint i) const
     return mDerivativeWeights[i];
 }
 
+inline const Neighborhood::PackedNeighbors* Neighborhood::getPackedNeighbors(void) const
+{
+    return mPackedValid ? &mPacked : 0;
+}
+
+inline const Real* Neighborhood::getNeighborWeights(void) const
+{
+    return &mWeights[0];
+}
@@ -98,43 +98,60 @@ bool NormalConstrainedSphereFitter::fit(const Neighborhood* pNeighborhood)
     }
     
     // fill the covariance matrix and value vector
-    for (uint i=0; i<nofSamples; i++)
+    const Neighborhood::PackedNeighbors* pPacked = pNeighborhood->getPackedNeighbors();
+    if (pPacked)
+        accumulate(&pPacked->px[0], &pPacked->py[0], &pPacked->pz[0],
+                   &pPacked->nx[0], &pPacked->ny[0], &pPacked->nz[0],
+                   pNeighborhood->getNeighborWeights(), nofSamples);
+    else
     {
-        PointSet::ConstPointHandle nei = pNeighborhood->getNeighbor(i);
+        PointSet::ConstVector3Span positions = pNeighborhood->getPoints()->span(PointSet::Attribute_position);
+        PointSet::ConstVector3Span normals = pNeighborhood->getPoints()->span(PointSet::Attribute_normal);
+        for (uint i=0; i<nofSamples; i++)
+        {
+            Index id = pNeighborhood->getNeighborId(i);
         
-        LocalVector3 p = vector_cast<LocalVector3>(nei.position());
-        LocalVector3 n = vector_cast<LocalVector3>(nei.normal());
-        LocalFloat w = pNeighborhood->getNeighborWeight(i);
-        LocalFloat l2 = p.squaredLength();
-        LocalVector3 wp = w * p;
-        LocalFloat wl2 = w*l2;
+            LocalVector3 p = vector_cast<LocalVector3>(positions[id]);
+            LocalVector3 n = vector_cast<LocalVector3>(normals[id]);
+            LocalFloat w = pNeighborhood->getNeighborWeight(i);
+            LocalFloat l2 = p.squaredLength();
+            LocalVector3 wp = w * p;
+            LocalFloat wl2 = w*l2;
         
-        mCovMat[0][0] += w;
+            mCovMat[0][0] += w;
         
-        mCovMat[1][1] += wp.x*p.x;
-        mCovMat[2][2] += wp.y*p.y;
-        mCovMat[3][3] += wp.z*p.z;
-        mCovMat[4][4] += wl2*l2;
+            mCovMat[1][1] += wp.x*p.x;
+            mCovMat[2][2] += wp.y*p.y;
+            mCovMat[3][3] += wp.z*p.z;
+            mCovMat[4][4] += wl2*l2;
         
-        mCovMat[0][1] += wp.x;
-        mCovMat[0][2] += wp.y;
-        mCovMat[0][3] += wp.z;
-        mCovMat[0][4] += wl2;
+            mCovMat[0][1] += wp.x;
+            mCovMat[0][2] += wp.y;
+            mCovMat[0][3] += wp.z;
+            mCovMat[0][4] += wl2;
         
-        mCovMat[1][2] += wp.x*p.y;
-        mCovMat[1][3] += wp.x*p.z;
-        mCovMat[2][3] += wp.y*p.z;
+            mCovMat[1][2] += wp.x*p.y;
+            mCovMat[1][3] += wp.x*p.z;
+            mCovMat[2][3] += wp.y*p.z;
         
-        mCovMat[1][4] += wp.x*l2;
-        mCovMat[2][4] += wp.y*l2;
-        mCovMat[3][4] += wp.z*l2;
+            mCovMat[1][4] += wp.x*l2;
+            mCovMat[2][4] += wp.y*l2;
+            mCovMat[3][4] += wp.z*l2;
         
-        mVecB[1] += w*n.x;
-        mVecB[2] += w*n.y;
-        mVecB[3] += w*n.z;
-        mVecB[4] += w*p.dot(n);
+            mVecB[1] += w*n.x;
+            mVecB[2] += w*n.y;
+            mVecB[3] += w*n.z;
+            mVecB[4] += w*p.dot(n);
+        }
     }
     
+    solve(beta);
+
+    return true;
+}
+
+void NormalConstrainedSphereFitter::solve(LocalFloat beta)
+{
     // finish the work
     mCovMat[1][4] += beta*2.*mCovMat[0][1];
     mCovMat[2][4] += beta*2.*mCovMat[0][2];
@@ -196,8 +213,6 @@ bool NormalConstrainedSphereFitter::fit(const Neighborhood* pNeighborhood)
         u[i] = vecX[i];
     
     this->endEdit();
-
-    return true;
 }
 
 Vector3 NormalConstrainedSphereFitter::mlsGradient(const Neighborhood* pNeighborhood, const Vector3& position) const
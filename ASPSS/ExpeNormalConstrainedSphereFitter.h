@@ -36,12 +36,11 @@ http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
 #define _ExpeNormalConstrainedSphereFitter_h_
 
 #include "ExpeAlgebraicSphere.h"
+#include "ExpeNeighborhood.h"
 
 namespace Expe
 {
 
-class Neighborhood;
-
 /** Fit a sphere in a MLS sense using the normals and the method described in [Guennebaud and Gross 2007].
 */
 
@@ -59,6 +58,13 @@ public:
     */
     bool fit(const Neighborhood* pNeighborhood);
     
+    /** Does the fitting on the neighbors of a static query (see StaticNeighbors),
+        the weights are evaluated inline from the scaled squared distances.
+        \return false if the fitting failed.
+    */
+    template <class NeighborsT, class WeightingFunctionT>
+    inline bool fit(const NeighborsT& neighbors, const WeightingFunctionT& weightingFunction);
+    
     /** Compute the gradient of the MLS surface.
         \warning the function fit must be called before !
     */
@@ -69,6 +75,18 @@ protected:
     static const uint N=5;
     typedef double LocalFloat;
     typedef GetVector<3,LocalFloat>::Type LocalVector3;
+    
+    /** Fills the sums of the covariance matrix and value vector from the packed
+        positions and normals of the neighbors and their weights.
+    */
+    inline void accumulate(const Real* px, const Real* py, const Real* pz,
+                           const Real* nx, const Real* ny, const Real* nz,
+                           const Real* weights, uint nofSamples);
+    
+    /** Adds the normal constraints to the sums and solves the system.
+    */
+    void solve(LocalFloat beta);
+    
     LocalFloat mCovMat[N][N];
     LocalFloat mMatU[N][N];
     LocalFloat mVecB[N];
@@ -78,6 +96,8 @@ protected:
     
 };
 
+#include "ExpeNormalConstrainedSphereFitter.inl"
+
 }
 
 #endif
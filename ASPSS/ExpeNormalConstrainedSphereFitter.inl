@@ -0,0 +1,125 @@
+/*
+----------------------------------------------------------------------
+
+This source file is part of Expé
+(EXperimental Point Engine)
+
+Copyright (c) 2004-2007 by
+ - Computer Graphics Laboratory, ETH Zurich
+ - IRIT, University of Toulouse
+ - Gael Guennebaud.
+
+----------------------------------------------------------------------
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330,
+Boston, MA  02111-1307, USA.
+
+http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+----------------------------------------------------------------------
+*/
+
+
+
+
+
+inline void NormalConstrainedSphereFitter::accumulate(const Real* px, const Real* py, const Real* pz,
+                                                      const Real* nx, const Real* ny, const Real* nz,
+                                                      const Real* weights, uint nofSamples)
+{
+    // same sums as the generic loop of fit(), kept in scalars so that the loop vectorizes
+    LocalFloat c00=0., c11=0., c22=0., c33=0., c44=0.;
+    LocalFloat c01=0., c02=0., c03=0., c04=0.;
+    LocalFloat c12=0., c13=0., c23=0.;
+    LocalFloat c14=0., c24=0., c34=0.;
+    LocalFloat b1=0., b2=0., b3=0., b4=0.;
+    #pragma omp simd reduction(+:c00,c11,c22,c33,c44,c01,c02,c03,c04,c12,c13,c23,c14,c24,c34,b1,b2,b3,b4)
+    for (int i=0; i<int(nofSamples); i++)
+    {
+        LocalFloat x = px[i], y = py[i], z = pz[i];
+        LocalFloat w = weights[i];
+        LocalFloat l2 = x*x + y*y + z*z;
+        LocalFloat wx = w*x, wy = w*y, wz = w*z;
+        LocalFloat wl2 = w*l2;
+        
+        c00 += w;
+        
+        c11 += wx*x;
+        c22 += wy*y;
+        c33 += wz*z;
+        c44 += wl2*l2;
+        
+        c01 += wx;
+        c02 += wy;
+        c03 += wz;
+        c04 += wl2;
+        
+        c12 += wx*y;
+        c13 += wx*z;
+        c23 += wy*z;
+        
+        c14 += wx*l2;
+        c24 += wy*l2;
+        c34 += wz*l2;
+        
+        b1 += w*nx[i];
+        b2 += w*ny[i];
+        b3 += w*nz[i];
+        b4 += w*(x*nx[i] + y*ny[i] + z*nz[i]);
+    }
+    mCovMat[0][0] = c00;
+    mCovMat[1][1] = c11; mCovMat[2][2] = c22; mCovMat[3][3] = c33; mCovMat[4][4] = c44;
+    mCovMat[0][1] = c01; mCovMat[0][2] = c02; mCovMat[0][3] = c03; mCovMat[0][4] = c04;
+    mCovMat[1][2] = c12; mCovMat[1][3] = c13; mCovMat[2][3] = c23;
+    mCovMat[1][4] = c14; mCovMat[2][4] = c24; mCovMat[3][4] = c34;
+    mVecB[0] = 0.;
+    mVecB[1] = b1; mVecB[2] = b2; mVecB[3] = b3; mVecB[4] = b4;
+}
+
+template <class NeighborsT, class WeightingFunctionT>
+inline bool NormalConstrainedSphereFitter::fit(const NeighborsT& nei, const WeightingFunctionT& weightingFunction)
+{
+    uint nofSamples = nei.size;
+    if (nofSamples==0)
+    {
+        return false;
+    }
+    else if (nofSamples==1)
+    {
+        u13() = Vector3(nei.nx[0],nei.ny[0],nei.nz[0]);
+        u[0] = -Vector3(nei.px[0],nei.py[0],nei.pz[0]).dot(u13());
+        u[4] = 0.;
+        return true;
+    }
+    
+    // the weights first, in a loop the compiler vectorizes
+    Real weights[NeighborsT::Capacity];
+    const Real* x2 = nei.x2;
+    for (uint i=0; i<nofSamples; i++)
+        weights[i] = weightingFunction.f2(x2[i]);
+    accumulate(nei.px, nei.py, nei.pz, nei.nx, nei.ny, nei.nz, weights, nofSamples);
+    
+    LocalFloat beta = mNormalParameter;
+    if (mNormalization)
+    {
+        // the filter radius of the neighborhood is the distance to the farthest neighbor
+        Real maxD2 = 0.;
+        for (uint i=0 ; i<nofSamples ; ++i)
+            maxD2 = Math::Max(maxD2, nei.d2[i]);
+        beta *= Math::Sqrt(maxD2);
+    }
+    solve(beta * beta);
+    
+    return true;
+}
@@ -42,7 +42,7 @@ namespace Expe
 extern "C" void startPlugin(void)
 {
     IOManager::Instance().registerReader( new MeshReaderFactoryT<ObjMeshReader>("ObjMesh","obj;obj.gz") );
-    IOManager::Instance().registerWriter( new MeshWriterFactoryT<ObjMeshWriter>("ObjMesh","obj") );
+    IOManager::Instance().registerWriter( new MeshWriterFactoryT<ObjMeshWriter>("ObjMesh","obj;obj.gz") );
 }
 
 extern "C" void stopPlugin(void)
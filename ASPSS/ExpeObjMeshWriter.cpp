@@ -34,6 +34,9 @@ http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
 
 #include "ExpeObjMeshWriter.h"
 #include "ExpeMesh.h"
+#include "ExpeBlockGzip.h"
+#include "ExpeLogManager.h"
+#include <QBuffer>
 
 
 namespace Expe
@@ -50,10 +53,17 @@ ObjMeshWriter::~ObjMeshWriter()
 
 void ObjMeshWriter::writeMesh(const Mesh* apMesh, Options& options)
 {
-    if ( (!mpDevice->isOpen()) && (!mpDevice->open(QFile::WriteOnly)) )
+    // .obj.gz files are written to memory first, then block compressed in parallel
+    QFile* pFile = qobject_cast<QFile*>(mpDevice);
+    bool compressed = pFile && BlockGzip::IsCompressed(pFile->fileName().toStdString());
+    QByteArray text;
+    QBuffer textBuffer(&text);
+    if (compressed)
+        textBuffer.open(QIODevice::WriteOnly);
+    else if ( (!mpDevice->isOpen()) && (!mpDevice->open(QFile::WriteOnly)) )
         return;
     
-    QTextStream stream(mpDevice);
+    QTextStream stream(compressed ? &textBuffer : mpDevice);
     
     bool swapFaces = options.has("swap") && options["swap"].toBool();
     
@@ -119,6 +129,14 @@ void ObjMeshWriter::writeMesh(const Mesh* apMesh, Options& options)
         }
     }
     
+    if (compressed)
+    {
+        stream.flush();
+        BlockGzipWriter writer;
+        if (!writer.open(pFile->fileName().toStdString()) || !writer.write(text.constData(), text.size()) || !writer.close())
+            LOG_ERROR("ObjMeshWriter: cannot write " << pFile->fileName());
+    }
+    
     if (pMesh!=apMesh)
         delete pMesh;
 }
@@ -61,7 +61,7 @@ PointSet* PointSet::clone(void) const
 {
     // FIXME : use memcpy !
     
-    PointSet* clonePoints = new PointSet(this->getFormat().getAttributes());
+    PointSet* clonePoints = new PointSet(this->getFormat().getAttributes(), this->getLayout());
     clonePoints->reserve(this->size());
     for(PointSet::const_iterator point_it = this->begin() ; point_it!=this->end() ; ++point_it)
     {
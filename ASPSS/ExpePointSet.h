@@ -72,7 +72,7 @@ public:
 
         inline EXPE_UBERVECTOR_GETTYPEREF_WITH_CONSTNESS(position) position (void) const
         {
-            return *reinterpret_cast<EXPE_UBERVECTOR_GETTYPEPTR_WITH_CONSTNESS(position)>(this->mAddr);
+            return *reinterpret_cast<EXPE_UBERVECTOR_GETTYPEPTR_WITH_CONSTNESS(position)>(this->mpFormat->address(this->mAddr, _MetaAttribute_position_::Id));
         }
 
         EXPE_UBERVECTOR_BUILTIN_ACCESSOR(radius);
@@ -105,12 +105,12 @@ public:
 
     static const AttributeList DefaultFormat;
 
-    PointSet(const AttributeList& al = DefaultFormat)
-        : Super(al)
+    PointSet(const AttributeList& al = DefaultFormat, Layout layout = ArrayOfStructures)
+        : Super(al, layout)
     {}
     
-    PointSet(const Format& f)
-        : Super(f)
+    PointSet(const Format& f, Layout layout = ArrayOfStructures)
+        : Super(f, layout)
     {}
 
     virtual ~PointSet()
@@ -118,6 +118,9 @@ public:
 
     typedef ElementHandle PointHandle;
     typedef ConstElementHandle ConstPointHandle;
+    
+    typedef AttributeSpanT<const Vector3f> ConstVector3Span;
+    typedef AttributeSpanT<const float> ConstFloatSpan;
 
     PointSet* clone(void) const;
     AxisAlignedBox computeAABB(void) const;
@@ -135,7 +138,24 @@ public:
     /// Default point set format
     static const AttributeList DefaultFormat;
 
-    PointSet(const AttributeList& al = DefaultFormat);
+    PointSet(const AttributeList& al = DefaultFormat, Layout layout = ArrayOfStructures);
+    
+    /** Memory layout of the points, the handles behave the same with both layouts.
+        - ArrayOfStructures: the attributes of a point are interleaved (default).
+        - StructureOfArrays: one aligned array per attribute, best for loops touching a few attributes.
+    */
+    void setLayout(Layout layout);
+    Layout getLayout(void) const;
+    
+    /** Strided view of one attribute of all the points, e.g.:
+        \code
+            PointSet::ConstVector3Span positions = pPoints->span(PointSet::Attribute_position);
+            for (uint i=0 ; i<pPoints->size() ; ++i)
+                aabb.extend(positions[i]);
+        \endcode
+        With the StructureOfArrays layout the values are contiguous.
+    */
+    AttributeSpanT<attributetype> span(const MetaAttribute& a);
 
     /** Allow to access the attributes of a point.
         A PointHandle has a behavior close a reference but the = operator behaves like with pointers.
@@ -41,8 +41,8 @@ namespace Expe
 
 extern "C" void startPlugin(void)
 {
-    IOManager::Instance().registerReader( new PointSetReaderFactoryT<PtsReader>("Pts","pts;bpts;apts") );
-    IOManager::Instance().registerWriter( new PointSetWriterFactoryT<BinaryPtsWriter>("BinaryPts","pts;bpts") );
+    IOManager::Instance().registerReader( new PointSetReaderFactoryT<PtsReader>("Pts","pts;bpts;apts;pts.gz") );
+    IOManager::Instance().registerWriter( new PointSetWriterFactoryT<BinaryPtsWriter>("BinaryPts","pts;bpts;pts.gz") );
     IOManager::Instance().registerWriter( new PointSetWriterFactoryT<AsciiPtsWriter>("AsciiPts","apts") );
 }
 
@@ -36,6 +36,10 @@ http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
 #include "ExpePointSet.h"
 #include "ExpeColor.h"
 #include "ExpeLogManager.h"
+#include "ExpeBlockGzip.h"
+
+#include <QFile>
+#include <QBuffer>
 
 namespace Expe
 {
@@ -85,6 +89,26 @@ uint getSizeOfPropertyType(const QString& type)
 
 void PtsReader::readPointSet(PointSet* pDest, Options& options)
 {
+    // .gz files are decompressed in parallel and parsed from memory
+    QFile* pFile = qobject_cast<QFile*>(mpDevice);
+    if (pFile && BlockGzip::IsCompressed(pFile->fileName().toStdString()))
+    {
+        BlockGzipReader reader;
+        std::vector<char> data;
+        if (!reader.open(pFile->fileName().toStdString()) || !reader.readAll(data))
+        {
+            LOG_ERROR("pts reader : cannot read " << pFile->fileName());
+            return;
+        }
+        QByteArray bytes = QByteArray::fromRawData(data.empty() ? "" : &data[0], data.size());
+        QBuffer buffer(&bytes);
+        QIODevice* pDevice = mpDevice;
+        mpDevice = &buffer;
+        readPointSet(pDest, options);
+        mpDevice = pDevice;
+        return;
+    }
+    
     if ( (!mpDevice->isOpen()) && (!mpDevice->open(QFile::ReadOnly)) )
         return;
     
@@ -215,7 +239,13 @@ void PtsReader::readPointSet(PointSet* pDest, Options& options)
     mpDevice->seek(streamPos);
 
     if(header[2]=="Binary")
+    {
+        // the records are converted into interleaved points
+        PointSet::Layout layout = pDest->getLayout();
+        pDest->setLayout(ArrayOfStructures);
         appendBinaryData(pDest, nofPoints, fileProperties, pointSize);
+        pDest->setLayout(layout);
+    }
     else if(header[2]=="Ascii")
         appendAsciiData(pDest, nofPoints, fileProperties);
     
@@ -279,35 +309,125 @@ void PtsReader::appendAsciiData(PointSet* pDest, uint nofPoints, const FilePrope
     }
 }
 
+/** One contiguous range of bytes copied from a file record to a point.
+*/
+struct BinaryCopy
+{
+    uint srcOffset;
+    uint dstOffset;
+    uint size;
+};
+
+/** Copies nofPoints file records to consecutive points of the destination.
+*/
+static void convertBinaryRecords(const ubyte* src, uint srcStride, ubyte* dst, uint dstStride,
+    uint nofPoints, const std::vector<BinaryCopy>& copies)
+{
+    if (copies.size()==1 && copies[0].size==srcStride && srcStride==dstStride)
+    {
+        // same layout: bulk copy
+        memcpy(dst, src, size_t(nofPoints)*srcStride);
+        return;
+    }
+    for (uint i=0 ; i<nofPoints ; ++i)
+    {
+        const ubyte* s = src + size_t(i)*srcStride;
+        ubyte* d = dst + size_t(i)*dstStride;
+        for (uint k=0 ; k<copies.size() ; ++k)
+            memcpy(d+copies[k].dstOffset, s+copies[k].srcOffset, copies[k].size);
+    }
+}
+
 void PtsReader::appendBinaryData(PointSet* pDest, uint nofPoints, const FileProperties& fileProperties, uint pointSize)
 {
-    QDataStream stream(const_cast<QIODevice*>(mpDevice));
-    ubyte* data = (ubyte*) malloc(pointSize * sizeof(ubyte));
-    
     // skip \n
-    stream.skipRawData(1);
+    char c;
+    mpDevice->getChar(&c);
     
-    for(uint i=0 ; i<nofPoints ; ++i)
+    // byte ranges to copy from a record to a point, adjacent ones are merged
+    std::vector<BinaryCopy> copies;
+    uint offset = 0;
+    for(uint k=0 ; k<fileProperties.size() ; ++k)
     {
-        stream.readRawData(reinterpret_cast<char*>(data), pointSize);
+        if(fileProperties[k].hasProperty)
+        {
+            BinaryCopy copy;
+            copy.srcOffset = offset;
+            copy.dstOffset = fileProperties[k].pPropertyHandle->offset();
+            copy.size = fileProperties[k].size;
+            if (!copies.empty()
+                && copies.back().srcOffset+copies.back().size==copy.srcOffset
+                && copies.back().dstOffset+copies.back().size==copy.dstOffset)
+                copies.back().size += copy.size;
+            else
+                copies.push_back(copy);
+        }
+        offset += fileProperties[k].size;
+    }
+    
+    uint dstStride = pDest->getFormat().size();
+    uint first = pDest->size();
+    pDest->resize(first + nofPoints);
+    ubyte* dst = pDest->data(first);
+    
+    LOG_DEBUG_MSG(5,"pts reader " << "\t" << copies.size() << " copies per point, "
+        << (copies.size()==1 && copies[0].size==pointSize && pointSize==dstStride ? "same layout" : "converted"));
+    
+    // records are converted in blocks of this many points, in parallel
+    const uint BlockSize = 1<<16;
+    int nofBlocks = (nofPoints+BlockSize-1)/BlockSize;
+    
+    // a regular file is mapped as a whole
+    QFile* pFile = qobject_cast<QFile*>(mpDevice);
+    qint64 dataPos = mpDevice->pos();
+    uchar* mapped = 0;
+    if (pFile && nofPoints>0)
+        mapped = pFile->map(dataPos, qint64(nofPoints)*pointSize);
+    
+    if (mapped)
+    {
+        #pragma omp parallel for schedule(dynamic,1)
+        for (int b=0 ; b<nofBlocks ; ++b)
+        {
+            uint begin = b*BlockSize;
+            uint count = Math::Min(BlockSize, nofPoints-begin);
+            convertBinaryRecords(mapped + size_t(begin)*pointSize, pointSize,
+                dst + size_t(begin)*dstStride, dstStride, count, copies);
+        }
+        pFile->unmap(mapped);
+        mpDevice->seek(dataPos + qint64(nofPoints)*pointSize);
+        return;
+    }
+    
+    // other devices (compressed streams...) are read block per block
+    std::vector<ubyte> buffer(size_t(Math::Min(BlockSize, nofPoints))*pointSize);
+    for (int b=0 ; b<nofBlocks ; ++b)
+    {
+        uint begin = b*BlockSize;
+        uint count = Math::Min(BlockSize, nofPoints-begin);
+        qint64 bytes = qint64(count)*pointSize;
+        qint64 done = 0;
+        while (done<bytes)
+        {
+            qint64 n = mpDevice->read(reinterpret_cast<char*>(&buffer[0])+done, bytes-done);
+            if (n<=0)
+                break;
+            done += n;
+        }
+        if (done<bytes)
+        {
+            LOG_ERROR("pts reader : unexpected end of file after " << begin + done/pointSize << " points");
+            pDest->resize(first + begin + done/pointSize);
+            return;
+        }
         
-        PointSet::PointHandle point = pDest->append(); //.copyFrom(PointSet::Point(point, fileFormat));
-        uint offset = 0;
-        for(uint k=0 ; k<fileProperties.size() ; ++k)
+        #pragma omp parallel for
+        for (int i=0 ; i<int(count) ; i+=4096)
         {
-            if(fileProperties[k].hasProperty)
-            {
-                memcpy(
-                    point.attributePtr(*(fileProperties[k].pPropertyHandle)),
-                    (data+offset),
-                    fileProperties[k].size);
-                //point.setProperty(fileProperties[k].name, data+offset);
-            }
-            offset += fileProperties[k].size;
+            convertBinaryRecords(&buffer[0] + size_t(i)*pointSize, pointSize,
+                dst + size_t(begin+i)*dstStride, dstStride, Math::Min(4096u, count-i), copies);
         }
     }
-
-	free(data);
 }
 
 
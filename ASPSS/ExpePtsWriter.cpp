@@ -35,6 +35,8 @@ http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
 #include "ExpePtsWriter.h"
 #include "ExpePointSet.h"
 #include "ExpeColor.h"
+#include "ExpeBlockGzip.h"
+#include "ExpeLogManager.h"
 
 namespace Expe
 {
@@ -74,14 +76,11 @@ BinaryPtsWriter::~BinaryPtsWriter()
 
 void BinaryPtsWriter::writePointSet(const PointSet* pPoints, Options& options)
 {
-    if ( (!mpDevice->isOpen()) && (!mpDevice->open(QFile::WriteOnly)) )
-        return;
-    
-    QTextStream tstream(mpDevice);
-    
     QString version="0.2";
     
     // write header
+    QByteArray header;
+    QTextStream tstream(&header, QIODevice::WriteOnly);
     if(version=="0.1")
         tstream << Header_EPSB01 << "\n";
     else if(version=="0.2")
@@ -114,25 +113,39 @@ void BinaryPtsWriter::writePointSet(const PointSet* pPoints, Options& options)
     }
     
     tstream << "nofpoints " << pPoints->size() << "\n" << "data" << "\n";
+    tstream.flush();
     
-    tstream.setDevice(0);
-    mpDevice->close();
-    if ( (!mpDevice->isOpen()) && (!mpDevice->open(QFile::WriteOnly | QFile::Append)) )
-        return;
-    
-    
-//     qint64 streamPos = tstream.pos();
-//     tstream.setDevice(0);
-//     mpDevice->reset();
-//     mpDevice->seek(streamPos);
-    
-    QDataStream bstream(mpDevice);
+    // the records are contiguous, which requires the interleaved layout
+    PointSetPtr pInterleaved;
+    if (pPoints->getLayout()!=ArrayOfStructures)
+    {
+        pInterleaved = pPoints->clone();
+        pInterleaved->setLayout(ArrayOfStructures);
+        pPoints = pInterleaved;
+    }
+    const char* records = pPoints->size()>0 ? (const char *)(pPoints->begin()->position().data()) : "";
+    qint64 nofBytes = qint64(size) * pPoints->size();
     
-    for(PointSet::const_iterator point_iter = pPoints->begin() ; point_iter!=pPoints->end() ; ++point_iter)
+    // .gz files are block compressed in parallel
+    QFile* pFile = qobject_cast<QFile*>(mpDevice);
+    if (pFile && BlockGzip::IsCompressed(pFile->fileName().toStdString()))
     {
-        bstream.writeRawData((const char *)(point_iter->position().data()),size);
-//         writeData(reinterpret_cast<ConstPointer>(point_iter->position().data()),format.size(),1);
+        BlockGzipWriter writer;
+        if ( !writer.open(pFile->fileName().toStdString())
+            || !writer.write(header.constData(), header.size())
+            || !writer.write(records, nofBytes)
+            || !writer.close() )
+        {
+            LOG_ERROR("pts writer : cannot write " << pFile->fileName());
+        }
+        return;
     }
+    
+    if ( (!mpDevice->isOpen()) && (!mpDevice->open(QFile::WriteOnly)) )
+        return;
+    
+    mpDevice->write(header);
+    mpDevice->write(records, nofBytes);
 }
 
 AsciiPtsWriter::AsciiPtsWriter(QIODevice* pDevice)
@@ -108,6 +108,11 @@ void QueryDataStructure::sortNeighbors(void)
     std::sort(mNeighborList.begin(),end);
 }
 
+void QueryDataStructure::QueryResult::sortNeighbors(void)
+{
+    std::sort(neighbors.begin(), neighbors.begin() + nofFoundNeighbors);
+}
+
 
 
 } // namespace
@@ -70,6 +70,27 @@ public:
     */
     virtual Real getAverageDistance(void);
     
+    typedef std::vector< PriorityQueueElement<Index,Real> > NeighborList;
+    
+    /** Result of the const queries, owned by the caller.
+        Since the queries do not modify the data structure, several threads can
+        query the same structure at the same time, each one with its own result.
+    */
+    struct QueryResult
+    {
+        QueryResult(uint maxNofNeighbors = 1) : neighbors(maxNofNeighbors), nofFoundNeighbors(0) {}
+        
+        inline void setMaxNofNeighbors(uint nb) {neighbors.resize(nb);}
+        inline uint getMaxNofNeighbors(void) const {return neighbors.size();}
+        inline uint getNofFoundNeighbors(void) const {return nofFoundNeighbors;}
+        inline Index getNeighborId(uint i) const {assert(i<nofFoundNeighbors); return neighbors[i].index;}
+        inline Real getNeighborSquaredDistance(uint i) const {assert(i<nofFoundNeighbors); return neighbors[i].weight;}
+        void sortNeighbors(void);
+        
+        NeighborList neighbors;
+        uint nofFoundNeighbors;
+    };
+    
     /** Search all points which are in the sphere of center p and radius dMax.
     */
     virtual void doQueryBall(const Vector3& p, Real dMax) = 0;
@@ -78,6 +99,15 @@ public:
     */
     virtual void doQueryK(const Vector3& p) = 0;
     
+    /** Reentrant version of doQueryBall(), the neighbors are stored in result.
+        The number of neighbors is limited by result.getMaxNofNeighbors().
+    */
+    virtual void queryBall(const Vector3& p, Real dMax, QueryResult& result) const = 0;
+    
+    /** Reentrant version of doQueryK() where k is result.getMaxNofNeighbors().
+    */
+    virtual void queryK(const Vector3& p, QueryResult& result) const = 0;
+    
     inline uint getNofFoundNeighbors(void) const;
     inline PointSet::ConstPointHandle getNeighbor(uint i) const;
     inline Index getNeighborId(uint i) const;
@@ -85,12 +115,12 @@ public:
     
     void sortNeighbors(void);
     
-    typedef std::vector< PriorityQueueElement<Index,Real> > NeighborList;
-    
     const NeighborList* getNeighborList(void) const {return &mNeighborList;}
     
 protected:
     
+    typedef MaxPriorityQueueWrapper<NeighborList> NeighborPriorityQueue;
+    
     NeighborList mNeighborList;
     uint mNofFoundNeighbors;
     
@@ -41,6 +41,9 @@ namespace Expe
 
 #define EXPE_QUERYGRID_BRUTEFORCE
 
+const uint QueryGrid::EmptyCell;
+const uint QueryGrid::ChunkSize;
+
 QueryGrid::QueryGrid(const PointSet* pPoints, int nofBits /*=-1*/, Real diam /*=-1*/, bool autoInsertion /*= true*/)
     : QueryDataStructure(pPoints), mNeighborQueue(mNeighborList)
 {
@@ -70,12 +73,8 @@ QueryGrid::QueryGrid(const PointSet* pPoints, int nofBits /*=-1*/, Real diam /*=
     }
 
     // construct the grid
-    int nofCells;
-
-    mNofBits = nofBits;
+    mNofBits = Math::Min(nofBits, 21);
     mMask = getNofCellsPerAxis() - 1;
-    nofCells = getNofCells();
-    mCells = 0;
     
     mCellSize = diam / (Real)getNofCellsPerAxis();
     mCellSize_1 = 1./mCellSize;
@@ -83,12 +82,10 @@ QueryGrid::QueryGrid(const PointSet* pPoints, int nofBits /*=-1*/, Real diam /*=
     mAvgRadius = mCellSize;
 
     mNofCellsPerAxis = getNofCellsPerAxis();
-
-    mCells = new Element*[nofCells];
-    for (int i=0; i<nofCells; i++)
-    {
-        mCells[i] = 0;
-    }
+    
+    // above a few millions cells only the non-empty ones are stored
+    mSparse = mNofBits > EXPE_QUERYGRID_MAX_DENSE_BITS;
+    clear();
 
     mNeighborQueue.init();
 
@@ -101,212 +98,289 @@ QueryGrid::QueryGrid(const PointSet* pPoints, int nofBits /*=-1*/, Real diam /*=
 
 QueryGrid::~QueryGrid()
 {
-    clear();
-    DESTROY_TAB(mCells);
 }
 
 
 void QueryGrid::clear(void)
 {
-    if (mCells)
+    if (mSparse)
     {
-        uint nofCells = getNofCells();
-        for (uint i=0; i<nofCells; i++)
-        {
-            for (Element *e=mCells[i]; e; )
-            {
-                Element* tmp = e->next;
-                delete e;
-                e = tmp;
-            }
-        }
-        
-        for (uint i=0; i<nofCells; i++)
-        {
-            mCells[i] = 0;
-        }
+        mNofSlots = 0;
+        mHashKeys.clear();
+        mHashSlots.clear();
+        rehash(1024);
+    }
+    else
+    {
+        mNofSlots = getNofCells();
     }
+    
+    mStatic = true;
+    mCellStart.assign(mNofSlots+1, 0);
+    mIndices.clear();
+    mPositions.clear();
+    
+    std::vector<uint>().swap(mCellHead);
+    std::vector<Chunk>().swap(mChunks);
+    mFreeChunk = EmptyCell;
 }
 
 void QueryGrid::insertAll(void)
 {
     clear();
     
-    uint i=0;
-    for(PointSet::const_iterator point_it = mpPoints->begin() ; point_it!=mpPoints->end() ; ++point_it, ++i)
+    // counting sort of the samples by cell
+    uint nb = mpPoints->size();
+    std::vector<uint> slots(nb);
+    for (uint i=0 ; i<nb ; ++i)
     {
-        Element **b;
-        b = getCell(point_it->position());
-        Element *e = new Element;
-        ELEMENT_2_INDEX(*e) = i;
-        #ifdef EXPE_QUERY_DS_EMBEDED
-        ELEMENT_2_POSITION(*e) = point_it->position();
-        #endif
-        e->next = *b;
-        *b = e;
+        slots[i] = getSlot(getCellKey(mpPoints->at(i).position()));
+    }
+    
+    mCellStart.assign(mNofSlots+1, 0);
+    for (uint i=0 ; i<nb ; ++i)
+        mCellStart[slots[i]+1]++;
+    for (uint s=0 ; s<mNofSlots ; ++s)
+        mCellStart[s+1] += mCellStart[s];
+    
+    mIndices.resize(nb);
+    mPositions.resize(nb);
+    std::vector<uint> fill(mCellStart.begin(), mCellStart.end()-1);
+    for (uint i=0 ; i<nb ; ++i)
+    {
+        uint k = fill[slots[i]]++;
+        mIndices[k] = i;
+        mPositions[k] = mpPoints->at(i).position();
     }
-
-//     // comptute and print stats
-//     uint nofCells = getNofCells();
-//     int nofPtPerCell, nofPtPerCellMin, nofPtPerCellMax, nofNotEmtyCell;
-//     nofPtPerCell = 0;
-//     nofPtPerCellMin = mpPoints->size();
-//     nofPtPerCellMax = 0;
-//     nofNotEmtyCell = 0;
-// 
-//     for (uint i=0; i<nofCells; i++)
-//     {
-//         int nofElements = 0;
-//         for (Element *e=mCells[i]; e; e=e->next)
-//         {
-//             nofElements++;
-//         }
-//         if(nofElements)
-//         {
-//             nofPtPerCell += nofElements;
-//             nofNotEmtyCell++;
-//             nofPtPerCellMin = Math::Min(nofPtPerCellMin, nofElements);
-//             nofPtPerCellMax = Math::Max(nofPtPerCellMax, nofElements);
-//         }
-//     }
-//     std::cout << "********************************" << std::endl;
-//     std::cout << "NofElements = " << nofPtPerCell << " (" << mpPoints->size() << ")" << std::endl;
-//     std::cout << "NofElementsPerSell = " << nofPtPerCell/nofNotEmtyCell << std::endl;
-//     std::cout << "MinMax = " << nofPtPerCellMin << " / " << nofPtPerCellMax << std::endl;
-//     std::cout << "NofNotEmtyCell = " << nofNotEmtyCell << " (" << getNofCells() << ")" << std::endl;
-//     std::cout << "********************************" << std::endl;
 }
 
-void QueryGrid::doQueryBall(const Vector3& p, Real dMax)
+////////////////////////////////////////////////////////////////////////////////
+// slots
+////////////////////////////////////////////////////////////////////////////////
+
+uint QueryGrid::getSlot(CellKey key)
 {
-    mNeighborQueue.init();
+    if (!mSparse)
+        return uint(key);
+    
+    uint h = hashKey(key);
+    while (mHashSlots[h]!=EmptyCell)
+    {
+        if (mHashKeys[h]==key)
+            return mHashSlots[h];
+        h = (h+1) & (mHashKeys.size()-1);
+    }
+    
+    // new cell
+    uint slot = mNofSlots++;
+    mHashKeys[h] = key;
+    mHashSlots[h] = slot;
+    if (!mStatic)
+        mCellHead.push_back(EmptyCell);
+    if (2*mNofSlots > mHashKeys.size())
+        rehash(2*mHashKeys.size());
+    return slot;
+}
 
-    Real d2Max = dMax*dMax;
-    Real sqrDist;
-    Vector3 vAux;
+void QueryGrid::rehash(uint size)
+{
+    std::vector<CellKey> oldKeys;
+    std::vector<uint> oldSlots;
+    oldKeys.swap(mHashKeys);
+    oldSlots.swap(mHashSlots);
+    
+    mHashKeys.resize(size);
+    mHashSlots.assign(size, EmptyCell);
+    for (uint i=0 ; i<oldSlots.size() ; ++i)
+    {
+        if (oldSlots[i]==EmptyCell)
+            continue;
+        uint h = hashKey(oldKeys[i]);
+        while (mHashSlots[h]!=EmptyCell)
+            h = (h+1) & (size-1);
+        mHashKeys[h] = oldKeys[i];
+        mHashSlots[h] = oldSlots[i];
+    }
+}
 
-    // indices of cell containing the point p
-    #ifndef EXPE_QUERYGRID_BRUTEFORCE
-    Vector3i c = _floorf(p*mCellSize_1);
-    #endif
+////////////////////////////////////////////////////////////////////////////////
+// dynamic mode
+////////////////////////////////////////////////////////////////////////////////
 
-    Vector3i c0, c1;
-    c0 = _floorf((p - dMax) * mCellSize_1);
-    c1 = _floorf((p + dMax) * mCellSize_1);
+void QueryGrid::makeDynamic(void)
+{
+    if (!mStatic)
+        return;
     
-    int size = (c1-c0).maxComponent() + 1;
+    mStatic = false;
+    mCellHead.assign(mNofSlots, EmptyCell);
+    mChunks.reserve(mIndices.size()/ChunkSize + mNofSlots/4 + 1);
+    for (uint s=0 ; s<mNofSlots ; ++s)
+    {
+        for (uint i=mCellStart[s] ; i<mCellStart[s+1] ; ++i)
+            insertInSlot(s, mIndices[i], mPositions[i]);
+    }
+    std::vector<uint>().swap(mCellStart);
+    std::vector<uint>().swap(mIndices);
+    std::vector<Vector3>().swap(mPositions);
+}
 
-    if (size==1)
+uint QueryGrid::newChunk(void)
+{
+    if (mFreeChunk!=EmptyCell)
     {
-        // the sphere fits in a single cell
-        Element *e = *getCell(c0.x & mMask, c0.y & mMask, c0.z & mMask);
-        for(; e; e=e->next)
+        uint c = mFreeChunk;
+        mFreeChunk = mChunks[c].next;
+        return c;
+    }
+    mChunks.push_back(Chunk());
+    return mChunks.size()-1;
+}
+
+void QueryGrid::insertInSlot(uint slot, uint id, const Vector3& pos)
+{
+    uint head = mCellHead[slot];
+    if (head==EmptyCell || mChunks[head].count==ChunkSize)
+    {
+        uint c = newChunk();
+        mChunks[c].count = 0;
+        mChunks[c].next = head;
+        mCellHead[slot] = c;
+        head = c;
+    }
+    Chunk& chunk = mChunks[head];
+    chunk.indices[chunk.count] = id;
+    chunk.positions[chunk.count] = pos;
+    chunk.count++;
+}
+
+void QueryGrid::removeFromSlot(uint slot, uint id)
+{
+    assert(slot!=EmptyCell);
+    
+    uint head = mCellHead[slot];
+    for (uint c=head ; c!=EmptyCell ; c=mChunks[c].next)
+    {
+        Chunk& chunk = mChunks[c];
+        for (uint i=0 ; i<chunk.count ; ++i)
         {
-            sqrDist = ELEMENT_2_POSITION(*e).squaredDistanceTo(p);
-            if (sqrDist < d2Max)
+            if (chunk.indices[i]!=id)
+                continue;
+            
+            // only the first chunk of a cell is not full
+            Chunk& first = mChunks[head];
+            first.count--;
+            chunk.indices[i] = first.indices[first.count];
+            chunk.positions[i] = first.positions[first.count];
+            if (first.count==0)
             {
-                mNeighborQueue.insert(ELEMENT_2_INDEX(*e), sqrDist);
+                mCellHead[slot] = first.next;
+                first.next = mFreeChunk;
+                mFreeChunk = head;
             }
+            return;
         }
     }
-    else if (size > mNofCellsPerAxis)
+    assert(false && "QueryGrid::remove: element not found");
+}
+
+void QueryGrid::insert(uint id)
+{
+    assert(id<mpPoints->size());
+    
+    makeDynamic();
+    Vector3 pos = mpPoints->at(id).position();
+    insertInSlot(getSlot(getCellKey(pos)), id, pos);
+}
+
+void QueryGrid::remove(uint id)
+{
+    assert(id<mpPoints->size());
+    
+    makeDynamic();
+    removeFromSlot(findSlot(getCellKey(mpPoints->at(id).position())), id);
+}
+
+void QueryGrid::notifyMoveFrom(uint id, const Vector3& oldPos)
+{
+    // the stored position has to be updated even if the cell is the same
+    makeDynamic();
+    Vector3 pos = mpPoints->at(id).position();
+    removeFromSlot(findSlot(getCellKey(oldPos)), id);
+    insertInSlot(getSlot(getCellKey(pos)), id, pos);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// queries
+////////////////////////////////////////////////////////////////////////////////
+
+void QueryGrid::doQueryBall(const Vector3& p, Real dMax)
+{
+    mNofFoundNeighbors = searchBall(p, dMax, 0xffffffff, mNeighborQueue);
+}
+
+void QueryGrid::doQueryBall(uint id, Real dMax)
+{
+    mNofFoundNeighbors = searchBall(mpPoints->at(id).position(), dMax, id, mNeighborQueue);
+}
+
+void QueryGrid::doQueryK(const Vector3& p)
+{
+    mNofFoundNeighbors = searchK(p, mMaxNofNeighbors, mNeighborQueue);
+}
+
+void QueryGrid::queryBall(const Vector3& p, Real dMax, QueryResult& result) const
+{
+    NeighborPriorityQueue queue(result.neighbors);
+    result.nofFoundNeighbors = searchBall(p, dMax, 0xffffffff, queue);
+}
+
+void QueryGrid::queryK(const Vector3& p, QueryResult& result) const
+{
+    NeighborPriorityQueue queue(result.neighbors);
+    result.nofFoundNeighbors = searchK(p, result.getMaxNofNeighbors(), queue);
+}
+
+void QueryGrid::scanSlot(uint slot, const Vector3& p, Real d2Max, uint excludeId, NeighborPriorityQueue& queue) const
+{
+    if (slot==EmptyCell)
+        return;
+    
+    if (mStatic)
     {
-        // the sphere contains the whole grid => loop on every cells
-        int i;
-        int nofCells = getNofCells();
-        Element *e;
-        for (i=0; i<nofCells; i++)
+        for (uint i=mCellStart[slot], end=mCellStart[slot+1] ; i<end ; ++i)
         {
-            for (e=mCells[i]; e; e=e->next)
-            {
-                sqrDist = ELEMENT_2_POSITION(*e).squaredDistanceTo(p);
-                if (sqrDist < d2Max)
-                {
-                    mNeighborQueue.insert(e->index, sqrDist);
-                }
-            }
+            Real sqrDist = mPositions[i].squaredDistanceTo(p);
+            if (sqrDist < d2Max && mIndices[i]!=excludeId)
+                queue.insert(mIndices[i], sqrDist);
         }
     }
     else
     {
-        // visit all cells within bounding box of the sphere
-        int x, y, z;
-        #ifndef EXPE_QUERYGRID_BRUTEFORCE
-        Real dx,dy, dz, r2_x2_y2;
-        #endif
-        for (x=c0.x ; x<=c1.x ; ++x)
+        for (uint c=mCellHead[slot] ; c!=EmptyCell ; c=mChunks[c].next)
         {
-            #ifndef EXPE_QUERYGRID_BRUTEFORCE
-            if (x<c.x)
-                dx = (x+1)*mCellSize - p.x;
-            else if (x>c.x)
-                dx = x*mCellSize - p.x;
-            else
-                dx = 0;
-            #endif
-
-            for (y=c0.y ; y<=c1.y ; ++y)
+            const Chunk& chunk = mChunks[c];
+            for (uint i=0 ; i<chunk.count ; ++i)
             {
-                #ifndef EXPE_QUERYGRID_BRUTEFORCE
-                if (y<c.y)
-                    dy = (y+1)*mCellSize - p.y;
-                else if (y>c.y)
-                    dy = y*mCellSize - p.y;
-                else
-                    dy = 0;
-
-                r2_x2_y2 = d2Max - dx*dx - dy*dy;
-                if (r2_x2_y2 < 0)
-                    continue;
-                #endif
-
-                for (z=c0.z ; z<=c1.z ; ++z)
-                {
-                    #ifndef EXPE_QUERYGRID_BRUTEFORCE
-                    if (z<c.z)
-                        dz = (z+1)*mCellSize - p.z;
-                    else if (z>c.z)
-                        dz = z*mCellSize - p.z;
-                    else
-                        dz = 0;
-
-                    // skip cells that do not intersect the sphere of radius r
-                    if (dz*dz < r2_x2_y2)
-                    #endif
-                    {
-                        Element* e = mCells[(( ((x&mMask)<<mNofBits) | (y&mMask)) <<mNofBits) | (z&mMask)];
-                        for ( ; e ; e=e->next)
-                        {
-                            sqrDist = ELEMENT_2_POSITION(*e).squaredDistanceTo(p);
-                            if ( (sqrDist < d2Max) )
-                            {
-                                mNeighborQueue.insert(e->index, sqrDist);
-                            }
-                        }
-                    }
-                }
+                Real sqrDist = chunk.positions[i].squaredDistanceTo(p);
+                if (sqrDist < d2Max && chunk.indices[i]!=excludeId)
+                    queue.insert(chunk.indices[i], sqrDist);
             }
         }
     }
-
-    mNofFoundNeighbors = mNeighborQueue.getNofElements();
 }
 
-void QueryGrid::doQueryBall(uint id, Real dMax)
+uint QueryGrid::searchBall(const Vector3& p, Real dMax, uint excludeId, NeighborPriorityQueue& queue) const
 {
-    Vector3 p = mpPoints->at(id).position();
-
-    mNeighborQueue.init();
+    queue.init();
 
     Real d2Max = dMax*dMax;
-    Real sqrDist;
-    Vector3 vAux;
 
     // indices of cell containing the point p
     #ifndef EXPE_QUERYGRID_BRUTEFORCE
     Vector3i c = _floorf(p*mCellSize_1);
     #endif
-    // find bounding box of sphere of radius r around p
+
     Vector3i c0, c1;
     c0 = _floorf((p - dMax) * mCellSize_1);
     c1 = _floorf((p + dMax) * mCellSize_1);
@@ -316,43 +390,19 @@ void QueryGrid::doQueryBall(uint id, Real dMax)
     if (size==1)
     {
         // the sphere fits in a single cell
-        Element *e = *getCell(c0.x & mMask, c0.y & mMask, c0.z & mMask);
-        for(; e; e=e->next)
-        {
-            if(id!=e->index)
-            {
-                sqrDist = ELEMENT_2_POSITION(*e).squaredDistanceTo(p);
-                if (sqrDist < d2Max)
-                {
-                    mNeighborQueue.insert(ELEMENT_2_INDEX(*e), sqrDist);
-                }
-            }
-        }
+        scanSlot(findSlot(getCellKey(c0.x, c0.y, c0.z)), p, d2Max, excludeId, queue);
     }
     else if (size > mNofCellsPerAxis)
     {
         // the sphere contains the whole grid => loop on every cells
-        int i;
-        int nofCells = getNofCells();
-        Element *e;
-        for (i=0; i<nofCells; i++)
+        for (uint slot=0 ; slot<mNofSlots ; ++slot)
         {
-            for (e=mCells[i]; e; e=e->next)
-            {
-                if(id!=e->index)
-                {
-                    sqrDist = ELEMENT_2_POSITION(*e).squaredDistanceTo(p);
-                    if (sqrDist < d2Max)
-                    {
-                        mNeighborQueue.insert(e->index, sqrDist);
-                    }
-                }
-            }
+            scanSlot(slot, p, d2Max, excludeId, queue);
         }
     }
     else
     {
-        // visit all cells within the bounding box of the sphere
+        // visit all cells within bounding box of the sphere
         int x, y, z;
         #ifndef EXPE_QUERYGRID_BRUTEFORCE
         Real dx,dy, dz, r2_x2_y2;
@@ -397,39 +447,28 @@ void QueryGrid::doQueryBall(uint id, Real dMax)
                     if (dz*dz < r2_x2_y2)
                     #endif
                     {
-                        Element* e = mCells[(( ((x&mMask)<<mNofBits) | (y&mMask)) <<mNofBits) | (z&mMask)];
-                        for ( ; e ; e=e->next)
-                        {
-                            if(id!=e->index)
-                            {
-                                sqrDist = ELEMENT_2_POSITION(*e).squaredDistanceTo(p);
-                                if ( (sqrDist < d2Max) )
-                                {
-                                    mNeighborQueue.insert(e->index, sqrDist);
-                                }
-                            }
-                        }
+                        scanSlot(findSlot(getCellKey(x, y, z)), p, d2Max, excludeId, queue);
                     }
                 }
             }
         }
     }
-    
-    mNofFoundNeighbors = mNeighborQueue.getNofElements();
+
+    return queue.getNofElements();
 }
 
-void QueryGrid::doQueryK(const Vector3& p)
+uint QueryGrid::searchK(const Vector3& p, uint k, NeighborPriorityQueue& queue) const
 {
-    uint k = Math::Min(mMaxNofNeighbors, mpPoints->size());
+    k = Math::Min(k, mpPoints->size());
     Real queryRadius = 0.5*mCellSize;
     Real maxQuerySize = getSize();
+    uint nofFound;
     do
     {
-        doQueryBall(p, queryRadius);
+        nofFound = searchBall(p, queryRadius, 0xffffffff, queue);
         queryRadius += mCellSize;
-    } while(getNofFoundNeighbors()<k && queryRadius<maxQuerySize);
+    } while(nofFound<k && queryRadius<maxQuerySize);
+    return nofFound;
 }
 
 } // namespace
-
-
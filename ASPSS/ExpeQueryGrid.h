@@ -42,36 +42,39 @@ namespace Expe
 {
 
 /** A basic infinite (modulo) grid
+
+    The grid has two storage modes:
+     - static: after insertAll() the samples are counting-sorted by cell into contiguous arrays,
+     - dynamic: insert(), remove() and notifyMoveFrom() switch to cells made of small chunks
+       taken from a pool. All chunks of a cell but the first one are full, removed samples
+       are replaced by the last sample of the cell, and empty chunks go back to the pool.
+    In both modes the positions are copied next to the indices.
+    Above EXPE_QUERYGRID_MAX_DENSE_BITS bits per axis only the non-empty cells are stored,
+    in a hash table.
 */
 
+#define EXPE_QUERYGRID_MAX_DENSE_BITS 7
+
 class QueryGrid : public QueryDataStructure
 {
 
 #define EXPE_QUERYGRID_BRUTEFORCE
 
-#ifdef EXPE_QUERY_DS_EMBEDED
-    #define ELEMENT_2_POSITION(EL)    (EL).position
-    #define ELEMENT_2_INDEX(EL)       (EL).index
-#else
-    #define ELEMENT_2_POSITION(EL)    mpPoints->at((EL).index).position()
-    #define ELEMENT_2_INDEX(EL)       (EL).index
-#endif
-
 protected:
     
-    struct Element
+    typedef unsigned long long CellKey;
+    
+    static const uint EmptyCell = 0xffffffff;
+    static const uint ChunkSize = 8;
+    
+    /** A piece of a cell in dynamic mode.
+    */
+    struct Chunk
     {
-        Element(){}
-        #ifdef EXPE_QUERY_DS_EMBEDED
-        Element(uint id, const Vector3& pos) : index(id), position(pos) {}
-        #else
-        Element(uint id) : index(id) {}
-        #endif
-        uint index;
-        #ifdef EXPE_QUERY_DS_EMBEDED
-        Vector3 position;
-        #endif
-        Element* next;
+        uint indices[ChunkSize];
+        Vector3 positions[ChunkSize];
+        uint count;
+        uint next;
     };
 
 public:
@@ -82,56 +85,12 @@ public:
     
     /** Insert the element #id of the point set into the grid.
     */
-    inline void insert(uint id)
-    {
-        assert(id<mpPoints->size());
-        
-        Element **b;
-        Vector3 pos = mpPoints->at(id).position();
-        b = getCell(pos);
-        Element *e = new Element;
-        ELEMENT_2_INDEX(*e) = id;
-        #ifdef EXPE_QUERY_DS_EMBEDED
-        ELEMENT_2_POSITION(*e) = pos;
-        #endif
-        e->next = *b;
-        *b = e;
-    }
+    void insert(uint id);
     
     /** Remove the element #id of the point set from the grid.
         \warning the element #id must still be in the point set with the correct position.
     */
-    inline void remove(uint id)
-    {
-        assert(id<mpPoints->size());
-        
-        Element **b;
-        Vector3 pos = mpPoints->at(id).position();
-        
-        b = getCell(pos);
-        Element* e = *b;
-        if(ELEMENT_2_INDEX(*e)==id)
-        {
-            *b = e->next;
-            delete e;
-        }
-        else
-        {
-            bool still = true;
-            while(still && e->next)
-            {
-                if(ELEMENT_2_INDEX(*(e->next))==id)
-                {
-                    Element* aux = e->next;
-                    e->next = aux->next;
-                    delete aux;
-                    still = false;
-                }
-                e = e->next;
-            }
-            assert(!still);
-        }
-    }
+    void remove(uint id);
     
     /** Notifies the point #id moved from the position oldPos.
         For instance:
@@ -141,51 +100,7 @@ public:
             pGrid->notifyMoveFrom(i,aux);
         \endcode
     */
-    inline void notifyMoveFrom(uint id, const Vector3& oldPos)
-    {
-        Element **oldB;
-        oldB = getCell(oldPos);
-        
-        Vector3 pos = mpPoints->at(id).position();
-        Element **b;
-        b = getCell(pos);
-        
-        if (b!=oldB)
-        {
-            // remove
-            Element* e = *oldB;
-            if(ELEMENT_2_INDEX(*e)==id)
-            {
-                *oldB = e->next;
-                delete e;
-            }
-            else
-            {
-                bool still = true;
-                while(still && e->next)
-                {
-                    if(ELEMENT_2_INDEX(*(e->next))==id)
-                    {
-                        Element* aux = e->next;
-                        e->next = aux->next;
-                        delete aux;
-                        still = false;
-                    }
-                    e = e->next;
-                }
-                assert(!still);
-            }
-            
-            // insert
-            e = new Element;
-            ELEMENT_2_INDEX(*e) = id;
-            #ifdef EXPE_QUERY_DS_EMBEDED
-            ELEMENT_2_POSITION(*e) = pos;
-            #endif
-            e->next = *b;
-            *b = e;
-        }
-    }
+    void notifyMoveFrom(uint id, const Vector3& oldPos);
     
     /** Remove all samples from the grid.
     */
@@ -206,17 +121,21 @@ public:
     */
     virtual void doQueryK(const Vector3& p);
     
-    inline Element** getCell(int x, int y, int z) const
+    virtual void queryBall(const Vector3& p, Real dMax, QueryResult& result) const;
+    
+    virtual void queryK(const Vector3& p, QueryResult& result) const;
+    
+    inline CellKey getCellKey(int x, int y, int z) const
     {
-        return &mCells[(( (x<<mNofBits) | y) <<mNofBits) | z];
+        return (( CellKey(x & mMask)<<mNofBits | CellKey(y & mMask)) <<mNofBits) | CellKey(z & mMask);
     }
 
-    inline Element** getCell(const Vector3& pos)
+    inline CellKey getCellKey(const Vector3& pos) const
     {
-        return getCell(
-            _floorf(pos.x*mCellSize_1) & mMask,
-            _floorf(pos.y*mCellSize_1) & mMask,
-            _floorf(pos.z*mCellSize_1) & mMask);
+        return getCellKey(
+            _floorf(pos.x*mCellSize_1),
+            _floorf(pos.y*mCellSize_1),
+            _floorf(pos.z*mCellSize_1));
     }
 
     Real getAvgRadius(void) const
@@ -230,34 +149,77 @@ protected:
     {
         return 1<<mNofBits;
     }
-    inline int getNofCells() const
+    inline CellKey getNofCells() const
     {
-        return 1<<(3*mNofBits);
+        return CellKey(1)<<(3*mNofBits);
     }
     inline Real getSize() const
     {
         return getNofCellsPerAxis()*mCellSize;
     }
     
-    inline int _floorf(Real x)
+    inline int _floorf(Real x) const
     {
         return x>0. ? int(x) : int(x) - 1;
     }
     
-    inline Vector3i _floorf(Vector3 v)
+    inline Vector3i _floorf(Vector3 v) const
     {
         return Vector3i(
             v.x>0. ? int(v.x) : int(v.x) - 1,
             v.y>0. ? int(v.y) : int(v.y) - 1,
             v.z>0. ? int(v.z) : int(v.z) - 1);
     }
+    
+    /** Returns the slot of a cell, i.e., its position in the cell arrays.
+        Without creation, EmptyCell is returned for a cell that has no slot.
+    */
+    inline uint findSlot(CellKey key) const
+    {
+        if (!mSparse)
+            return uint(key);
+        uint h = hashKey(key);
+        for (;;)
+        {
+            if (mHashSlots[h]==EmptyCell || mHashKeys[h]==key)
+                return mHashSlots[h];
+            h = (h+1) & (mHashKeys.size()-1);
+        }
+    }
+    uint getSlot(CellKey key);
+    
+    inline uint hashKey(CellKey key) const
+    {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        return uint(key) & (mHashKeys.size()-1);
+    }
+    void rehash(uint size);
+    
+    /** Inserts the samples of a slot in the queue.
+    */
+    void scanSlot(uint slot, const Vector3& p, Real d2Max, uint excludeId, NeighborPriorityQueue& queue) const;
+    
+    /** Moves the samples from the static arrays to chunks.
+    */
+    void makeDynamic(void);
+    uint newChunk(void);
+    void insertInSlot(uint slot, uint id, const Vector3& pos);
+    void removeFromSlot(uint slot, uint id);
+
+    /** Ball query skipping the sample excludeId, returns the number of neighbors.
+    */
+    uint searchBall(const Vector3& p, Real dMax, uint excludeId, NeighborPriorityQueue& queue) const;
+    
+    /** Grows a ball query until k neighbors are found, returns the number of neighbors.
+    */
+    uint searchK(const Vector3& p, uint k, NeighborPriorityQueue& queue) const;
 
 protected:
 
-    typedef MaxPriorityQueueWrapper<NeighborList> NeighborPriorityQueue;
     NeighborPriorityQueue mNeighborQueue;
 
-    Element **mCells;
 	int mNofBits; // number of bits per dimension for hash table
     int mNofCellsPerAxis;
 	int mMask; // for hashing, mMask = 2^nbit - 1
@@ -265,10 +227,26 @@ protected:
     Real mCellSize_1;
 	Real mAvgRadius; // average radius of queries, in world space
 	Real mDiam; // diameter of object cloud, in world space
+    
+    // slots of the non-empty cells (sparse mode)
+    bool mSparse;
+    uint mNofSlots;
+    std::vector<CellKey> mHashKeys;
+    std::vector<uint> mHashSlots;
+    
+    // static mode: samples of slot s are in [mCellStart[s], mCellStart[s+1])
+    bool mStatic;
+    std::vector<uint> mCellStart;
+    std::vector<uint> mIndices;
+    std::vector<Vector3> mPositions;
+    
+    // dynamic mode: first chunk of each slot, and the pool of chunks
+    std::vector<uint> mCellHead;
+    std::vector<Chunk> mChunks;
+    uint mFreeChunk;
 
 };
 
 }
 
 #endif
-
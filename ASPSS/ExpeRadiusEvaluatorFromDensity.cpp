@@ -35,7 +35,7 @@ http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
 #include "ExpeRadiusEvaluatorFromDensity.h"
 
 #include "ExpeStaticInitializer.h"
-#include "ExpeKdTree.h"
+#include "ExpeFlatKdTree.h"
 #include "ExpeQueryGrid.h"
 
 namespace Expe
@@ -72,13 +72,18 @@ bool RadiusEvaluatorFromDensity::apply(void)
     if (!pPoints->hasAttribute(PointSet::Attribute_radius))
         pPoints->addAttribute(PointSet::Attribute_radius);
     
-    KdTree kdtree(pPoints, 16);
-    kdtree.setMaxNofNeighbors(mNofNeighbors);
+    FlatKdTree kdtree(pPoints, 16);
     
-    for (uint i=0, end=pPoints->size() ; i<end ; ++i)
+    // the tree is shared, each thread has its own result
+    #pragma omp parallel
     {
-        kdtree.doQueryK(pPoints->at(i).position());
-        pPoints->at(i).radius() = 2. * Math::Sqrt(kdtree.getNeighborSquaredDistance(0)/Real(kdtree.getNofFoundNeighbors()));
+        QueryDataStructure::QueryResult neighbors(mNofNeighbors);
+        #pragma omp for schedule(dynamic, 1024)
+        for (int i=0 ; i<int(pPoints->size()) ; ++i)
+        {
+            kdtree.queryK(pPoints->at(i).position(), neighbors);
+            pPoints->at(i).radius() = 2. * Math::Sqrt(neighbors.getNeighborSquaredDistance(0)/Real(neighbors.getNofFoundNeighbors()));
+        }
     }
     return true;
 }
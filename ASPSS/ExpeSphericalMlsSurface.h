@@ -41,6 +41,12 @@ http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
 namespace Expe
 {
 
+/** Projects position onto a fitted algebraic sphere (or plane), and gives the normal there and the moved distance.
+    This is the projection step of SphericalMlsSurfaceT and StaticMlsSurface.
+*/
+template <class AlgebraicSphereT>
+inline bool projectOnAlgebraicSphere(const AlgebraicSphereT& sphere, Vector3& position, Vector3& normal, Real& delta);
+
 /** Template class to easily build a MLS surface definition based on algebraic spherical fit.
     You basically only have to provide the fitter class.
     \param AlgebraicSphereFitterT the spherical fitter class
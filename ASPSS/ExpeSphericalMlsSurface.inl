@@ -54,49 +54,55 @@ Vector3 SphericalMlsSurfaceT<AlgebraicSphereFitterT>::evalMlsGradient(const Vect
     return mAlgebraicSphere.mlsGradient(mNeighborhood,position);
 }
 
-template <class AlgebraicSphereFitterT>
-bool SphericalMlsSurfaceT<AlgebraicSphereFitterT>::doProjection(Vector3& position, Vector3& normal, Real& delta)
+template <class AlgebraicSphereT>
+inline bool projectOnAlgebraicSphere(const AlgebraicSphereT& sphere, Vector3& position, Vector3& normal, Real& delta)
 {
     // re-implement the projection here in order to save compuation of the approximated normal and delta value.
-    if (mAlgebraicSphere.state()==ASS_SPHERE)
+    if (sphere.state()==ASS_SPHERE)
     {
-        normal = position-mAlgebraicSphere.asSphere().center();
+        normal = position-sphere.asSphere().center();
         delta = normal.length();
         normal /= delta;
-        delta = mAlgebraicSphere.asSphere().radius() - delta;
-        position = normal * mAlgebraicSphere.asSphere().radius() + mAlgebraicSphere.asSphere().center();
-        if (mAlgebraicSphere.u[4]<0.)
+        delta = sphere.asSphere().radius() - delta;
+        position = normal * sphere.asSphere().radius() + sphere.asSphere().center();
+        if (sphere.u[4]<0.)
             normal = -normal;
         return true;
     }
     
-    if (mAlgebraicSphere.state()==ASS_PLANE)
+    if (sphere.state()==ASS_PLANE)
     {
-        normal = mAlgebraicSphere.asPlane().normal();
-        delta = mAlgebraicSphere.asPlane().distanceTo(position);
+        normal = sphere.asPlane().normal();
+        delta = sphere.asPlane().distanceTo(position);
         position = position - delta*normal;
         return true;
     }
 
     // else, tedious case, fall back to an iterative method
     Vector3 grad;
-    normal = mAlgebraicSphere.u13()+2.*mAlgebraicSphere.u[4]*position;
+    normal = sphere.u13()+2.*sphere.u[4]*position;
     Real ilg = 1./normal.length();
     normal *= ilg;
-    Real ad = mAlgebraicSphere.u[0] + mAlgebraicSphere.u13().dot(position) + mAlgebraicSphere.u[4] * position.squaredLength();
+    Real ad = sphere.u[0] + sphere.u13().dot(position) + sphere.u[4] * position.squaredLength();
     delta = -ad*Math::Min<Real>(ilg,1.);
     position = position + normal*delta;
     for (int i=0 ; i<5 ; ++i)
     {
-        grad = mAlgebraicSphere.u13()+2.*mAlgebraicSphere.u[4]*position;
+        grad = sphere.u13()+2.*sphere.u[4]*position;
         ilg = 1./grad.length();
-        delta = -(  mAlgebraicSphere.u[0] + mAlgebraicSphere.u13().dot(position)
-                + mAlgebraicSphere.u[4] * position.squaredLength())*Math::Min<Real>(ilg,1.);
+        delta = -(  sphere.u[0] + sphere.u13().dot(position)
+                + sphere.u[4] * position.squaredLength())*Math::Min<Real>(ilg,1.);
         position += normal*delta;
     }
     return true;
 }
 
+template <class AlgebraicSphereFitterT>
+bool SphericalMlsSurfaceT<AlgebraicSphereFitterT>::doProjection(Vector3& position, Vector3& normal, Real& delta)
+{
+    return projectOnAlgebraicSphere(mAlgebraicSphere, position, normal, delta);
+}
+
 
 
 
@@ -0,0 +1,131 @@
+/*
+----------------------------------------------------------------------
+
+This source file is part of Expé
+(EXperimental Point Engine)
+
+Copyright (c) 2004-2007 by
+ - Computer Graphics Laboratory, ETH Zurich
+ - IRIT, University of Toulouse
+ - Gael Guennebaud.
+
+----------------------------------------------------------------------
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330,
+Boston, MA  02111-1307, USA.
+
+http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+----------------------------------------------------------------------
+*/
+
+
+
+#ifndef _ExpeStaticMlsSurface_h_
+#define _ExpeStaticMlsSurface_h_
+
+#include <algorithm>
+
+#include "ExpeBallQuery.h"
+#include "ExpeSphericalMlsSurface.h"
+
+namespace Expe
+{
+
+/** MLS surface over an algebraic sphere fit whose parts are chosen at compile time.
+    \param NeighborhoodQueryT the neighbor search, built from the point set and a filter scale (e.g. BallQuery)
+    \param WeightingFunctionT a weighting function class with an inline f2() (e.g. Wf_OneMinusX2Power4)
+    \param AlgebraicSphereFitterT a fitter with a fit(neighbors, weightingFunction) member (e.g. NormalConstrainedSphereFitter)
+    \param CapacityT maximal number of neighbors of a query
+    
+    This is the evaluation path of SphericalMlsSurfaceT with a basic projection, without virtual calls and
+    heap allocations: the weights are computed in the fitting loop and the neighbors and the fitted sphere
+    of a query are kept by the caller in an Evaluation, usually on the stack. The surface itself is not modified
+    by the queries, so one surface can be shared by all the threads.
+    The runtime configurable surfaces (QUICK_* members) remain the way to go for the tools.
+*/
+template <class NeighborhoodQueryT, class WeightingFunctionT, class AlgebraicSphereFitterT, uint CapacityT = 1024>
+class StaticMlsSurface
+{
+public:
+
+    typedef StaticNeighbors<CapacityT> Neighbors;
+    
+    /** State of a query: the neighbors and the sphere of the last fit.
+    */
+    struct Evaluation
+    {
+        Neighbors neighbors;
+        AlgebraicSphereFitterT sphere;
+    };
+
+    StaticMlsSurface(ConstPointSetPtr pPoints, Real filterScale = 2.);
+    
+    ~StaticMlsSurface() {}
+    
+    /** Signed distance to the sphere fitted at position, or 1e9 if the fit failed.
+    */
+    Real potentiel(const Vector3& position, Evaluation& eval) const;
+    
+    /** Same iterations as LocalMlsApproximationSurface::project() in basic mode.
+        \return false if the projection failed or ends out of the definition domain.
+    */
+    bool project(Vector3& position, Vector3& normal, Evaluation& eval) const;
+    
+    /** Restricted domain test of the projected position with the neighbors of the last fit.
+    */
+    bool isValid(const Vector3& position, const Neighbors& neighbors) const;
+    
+    /** Queries with the same key have the same neighbor candidates.
+    */
+    inline uint getBatchKey(const Vector3& p) const { return mQuery.getLeafId(p); }
+    
+    /** Order of the positions so that consecutive queries share their neighbor candidates.
+    */
+    void sortQueries(const std::vector<Vector3>& positions, std::vector<uint>& order) const;
+
+protected:
+
+    inline bool fit(Evaluation& eval) const
+    {
+        if (eval.neighbors.size<4)
+            return false;
+        return eval.sphere.fit(eval.neighbors, mWeightingFunction);
+    }
+
+public:
+
+    ConstPointSetPtr mpInputPoints;
+    Real mObjectScale;
+    Real mProjectionAccuracy;
+    uint mMaxNofProjectionIterations;
+    
+    bool mCheckRestrictedDomain;
+    uint mDomainMinNofSamples;
+    Real mDomainRadiusScale;
+    Real mDomainNormalScale;
+
+protected:
+
+    NeighborhoodQueryT mQuery;
+    WeightingFunctionT mWeightingFunction;
+    bool mHasNormal;
+};
+
+#include "ExpeStaticMlsSurface.inl"
+
+}
+
+#endif
+
@@ -0,0 +1,142 @@
+/*
+----------------------------------------------------------------------
+
+This source file is part of Expé
+(EXperimental Point Engine)
+
+Copyright (c) 2004-2007 by
+ - Computer Graphics Laboratory, ETH Zurich
+ - IRIT, University of Toulouse
+ - Gael Guennebaud.
+
+----------------------------------------------------------------------
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330,
+Boston, MA  02111-1307, USA.
+
+http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+----------------------------------------------------------------------
+*/
+
+
+
+
+
+template <class NeighborhoodQueryT, class WeightingFunctionT, class AlgebraicSphereFitterT, uint CapacityT>
+StaticMlsSurface<NeighborhoodQueryT,WeightingFunctionT,AlgebraicSphereFitterT,CapacityT>::StaticMlsSurface(ConstPointSetPtr pPoints, Real filterScale)
+    : mpInputPoints(pPoints), mQuery(pPoints, filterScale)
+{
+    // defaults of MlsSurface and LocalMlsApproximationSurface
+    AxisAlignedBox aabb = pPoints->computeAABB();
+    mObjectScale = (aabb.max()-aabb.min()).length();
+    mProjectionAccuracy = 1e-3;
+    mMaxNofProjectionIterations = 20;
+    
+    mCheckRestrictedDomain = true;
+    mDomainMinNofSamples = 4;
+    mDomainRadiusScale = 1.5;
+    mDomainNormalScale = 0.9;
+    
+    mHasNormal = pPoints->hasAttribute((UberVectorBaseT<_PointSetBuiltinData>::Attribute)(PointSet::Attribute_normal));
+}
+
+template <class NeighborhoodQueryT, class WeightingFunctionT, class AlgebraicSphereFitterT, uint CapacityT>
+Real StaticMlsSurface<NeighborhoodQueryT,WeightingFunctionT,AlgebraicSphereFitterT,CapacityT>::potentiel(const Vector3& position, Evaluation& eval) const
+{
+    mQuery.query(position, eval.neighbors);
+    if (eval.neighbors.size==0)
+        return 1e9;
+    
+    if (!fit(eval))
+        return 1e9;
+    
+    return eval.sphere.euclideanDistance(position);
+}
+
+template <class NeighborhoodQueryT, class WeightingFunctionT, class AlgebraicSphereFitterT, uint CapacityT>
+bool StaticMlsSurface<NeighborhoodQueryT,WeightingFunctionT,AlgebraicSphereFitterT,CapacityT>::project(Vector3& position, Vector3& normal, Evaluation& eval) const
+{
+    uint iterationCount = 0;
+    float delta;
+    float epsilon = mProjectionAccuracy * mObjectScale;
+    
+    do {
+        mQuery.query(position, eval.neighbors);
+        if (!fit(eval))
+            return false;
+        
+        Real d;
+        if (!projectOnAlgebraicSphere(eval.sphere, position, normal, d))
+            return false;
+        delta = d;
+    } while ( delta<epsilon && ++iterationCount<mMaxNofProjectionIterations);
+    
+    if (delta>epsilon)
+        return false;
+    
+    if (mCheckRestrictedDomain)
+    {
+        // check if the point is into the surface definition domain
+        if (!isValid(position, eval.neighbors))
+            return false;
+    }
+    
+    return true;
+}
+
+template <class NeighborhoodQueryT, class WeightingFunctionT, class AlgebraicSphereFitterT, uint CapacityT>
+bool StaticMlsSurface<NeighborhoodQueryT,WeightingFunctionT,AlgebraicSphereFitterT,CapacityT>::isValid(const Vector3& position, const Neighbors& nei) const
+{
+    uint nb = nei.size;
+    if (nb<mDomainMinNofSamples)
+        return false;
+    
+    if (mDomainNormalScale==1.f || (!mHasNormal))
+    {
+        for (uint i=0 ; i<nb ; ++i)
+        {
+            Real rs2 = nei.radius[i] * mDomainRadiusScale;
+            rs2 = rs2*rs2;
+            if (nei.d2[i] <= rs2)
+                return true;
+        }
+    }
+    else
+    {
+        Real s = 1./(mDomainNormalScale*mDomainNormalScale) - 1.f;
+        for (uint i=0 ; i<nb ; ++i)
+        {
+            Real rs2 = nei.radius[i] * mDomainRadiusScale;
+            rs2 = rs2*rs2;
+            Real dn = Vector3(nei.nx[i],nei.ny[i],nei.nz[i]).dot(position-Vector3(nei.px[i],nei.py[i],nei.pz[i]));
+            if (nei.d2[i] + s*dn*dn <= rs2)
+                return true;
+        }
+    }
+    return false;
+}
+
+template <class NeighborhoodQueryT, class WeightingFunctionT, class AlgebraicSphereFitterT, uint CapacityT>
+void StaticMlsSurface<NeighborhoodQueryT,WeightingFunctionT,AlgebraicSphereFitterT,CapacityT>::sortQueries(const std::vector<Vector3>& positions, std::vector<uint>& order) const
+{
+    std::vector<std::pair<uint,uint> > keys(positions.size());
+    for (uint i=0 ; i<positions.size() ; ++i)
+        keys[i] = std::make_pair(getBatchKey(positions[i]), i);
+    std::sort(keys.begin(), keys.end());
+    
+    order.resize(positions.size());
+    for (uint i=0 ; i<keys.size() ; ++i)
+        order[i] = keys[i].second;
+}
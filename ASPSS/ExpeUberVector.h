@@ -77,12 +77,12 @@ namespace Expe
     inline EXPE_UBERVECTOR_GETTYPEREF_WITH_CONSTNESS(NAME) NAME (void) const \
     { \
         assert(this->mpFormat->offsets[_MetaAttribute_##NAME##_::Id]!=0xffffffff); \
-        return * ( EXPE_UBERVECTOR_GETTYPEPTR_WITH_CONSTNESS(NAME) )(this->mAddr + this->mpFormat->offsets[_MetaAttribute_##NAME##_::Id]); \
+        return * ( EXPE_UBERVECTOR_GETTYPEPTR_WITH_CONSTNESS(NAME) )(this->mpFormat->address(this->mAddr, _MetaAttribute_##NAME##_::Id)); \
     } \
     inline EXPE_UBERVECTOR_GETTYPEREF_WITH_CONSTNESS(NAME) NAME (uint i) const \
     { \
         assert( i < NAME##_count ()); \
-        return * ( EXPE_UBERVECTOR_GETTYPEPTR_WITH_CONSTNESS(NAME) )(this->mAddr + this->mpFormat->offsets[_MetaAttribute_##NAME##_::Id] + i*sizeof(_MetaAttribute_##NAME##_::Type)); \
+        return * ( EXPE_UBERVECTOR_GETTYPEPTR_WITH_CONSTNESS(NAME) )(this->mpFormat->address(this->mAddr, _MetaAttribute_##NAME##_::Id) + i*sizeof(_MetaAttribute_##NAME##_::Type)); \
     } \
     inline uint NAME##_count (void) const \
     { \
@@ -97,10 +97,19 @@ namespace Expe
 
 typedef uint Mask;
 
+/** Memory layout of the elements of an UberVectorT.
+    - ArrayOfStructures: the attributes of an element are interleaved in a single record (default).
+    - StructureOfArrays: each attribute is stored in its own array, aligned on 64 bytes.
+    The element handles behave the same in both layouts.
+*/
+enum UberVectorLayout {ArrayOfStructures, StructureOfArrays};
+
 template <class CoreData> class UberVectorBaseT
 {
 public:
 
+    typedef UberVectorLayout Layout;
+
     class Attribute;
     typedef std::vector<Attribute> AttributeList;
     
@@ -309,15 +318,17 @@ public:
     class AttributeHandle
     {
     public:
-        AttributeHandle(uint offset, uint multiplicity)
-            : mOffset(offset), mMultiplicity(multiplicity)
+        AttributeHandle(uint offset, uint multiplicity, uint id = 0)
+            : mOffset(offset), mMultiplicity(multiplicity), mId(id)
         {
         }
         AttributeHandle(void)
-            : mOffset(0)
+            : mOffset(0), mId(0)
         {
         }
         
+        /** Offset of the attribute in an interleaved record.
+        */
         inline uint offset(void) const
         {
             return mOffset;
@@ -328,9 +339,51 @@ public:
             return mMultiplicity;
         }
         
+        inline uint id(void) const
+        {
+            return mId;
+        }
+        
     protected:
         uint mOffset;
         uint mMultiplicity;
+        uint mId;
+    };
+    
+    /** Strided access to one attribute of all the elements of a container.
+        The stride is the size of the records with the ArrayOfStructures layout,
+        and the size of the attribute with the StructureOfArrays layout, in which case
+        the values are contiguous and loops over them can be vectorized.
+        \see UberVectorT::span()
+    */
+    template<class T> class AttributeSpanT
+    {
+    public:
+        AttributeSpanT(void)
+            : mBase(0), mStride(0)
+        {}
+        
+        AttributeSpanT(ConstPointer base, ArithPtr stride)
+            : mBase(base), mStride(stride)
+        {}
+        
+        inline T& operator[](uint i) const
+        {
+            return *(T*)(mBase + ArithPtr(i)*mStride);
+        }
+        
+        /** \returns the stride in bytes between two consecutive values */
+        inline ArithPtr stride(void) const {return mStride;}
+        
+        /** \returns true if the values are stored in a plain array, see data() */
+        inline bool isContiguous(void) const {return mStride==ArithPtr(sizeof(T));}
+        
+        /** \returns the address of the first value */
+        inline T* data(void) const {return (T*)mBase;}
+        
+    protected:
+        ConstPointer mBase;
+        ArithPtr mStride;
     };
 
     template<class T> class AttributeHandleT : public AttributeHandle
@@ -368,6 +421,7 @@ public:
     {
     public:
         FormatT(const AttributeList& as)
+            : mLayout(ArrayOfStructures)
         {
             mAttributes = as;
             std::sort(mAttributes.begin(), mAttributes.end());
@@ -380,6 +434,74 @@ public:
             std::sort(mAttributes.begin(), mAttributes.end());
             computeOffsets();
         }
+        
+        /** \returns the address of the attribute aid of the element of handle address addr.
+            With the ArrayOfStructures layout addr is the address of the record,
+            with the StructureOfArrays layout it is the index of the element.
+        */
+        inline Pointer address(ConstPointer addr, uint aid) const
+        {
+            return Pointer(streams[aid] + ArithPtr(addr)*strides[aid]);
+        }
+        
+        inline Layout layout(void) const
+        {
+            return mLayout;
+        }
+        
+        /** Distance between the handle addresses of two consecutive elements
+            (the record size, or 1 with the StructureOfArrays layout).
+        */
+        inline ArithPtr stride(void) const
+        {
+            return mStride;
+        }
+        
+        /** \returns the number of bytes to store n elements with the StructureOfArrays layout
+        */
+        inline ArithPtr storageSize(ArithPtr n) const
+        {
+            ArithPtr bytes = 64;
+            for (iterator attrib_iter = mAttributes.begin() ; attrib_iter!=mAttributes.end() ; ++attrib_iter)
+                bytes += alignedStreamSize(n * attrib_iter->size() * attrib_iter->multiplicity());
+            return bytes;
+        }
+        
+        /** \internal Sets the layout, and with the StructureOfArrays layout
+            the arrays of n elements in the storage data (of storageSize(n) bytes).
+        */
+        void setStreams(Layout layout, Pointer data, ArithPtr n)
+        {
+            mLayout = layout;
+            if (mLayout==ArrayOfStructures)
+            {
+                for (iterator attrib_iter = mAttributes.begin() ; attrib_iter!=mAttributes.end() ; ++attrib_iter)
+                {
+                    if (attrib_iter->id() < ATTRIBUTE_custom) // FIXME ATTRIBUTE_custom
+                    {
+                        streams[attrib_iter->id()] = offsets[attrib_iter->id()];
+                        strides[attrib_iter->id()] = 1;
+                    }
+                }
+                mStride = mSize;
+            }
+            else
+            {
+                ArithPtr start = (ArithPtr(data)+63) & ~ArithPtr(63);
+                for (iterator attrib_iter = mAttributes.begin() ; attrib_iter!=mAttributes.end() ; ++attrib_iter)
+                {
+                    // the custom attributes have no stream, they only exist with the ArrayOfStructures layout
+                    assert(attrib_iter->id() < ATTRIBUTE_custom);
+                    if (attrib_iter->id() < ATTRIBUTE_custom) // FIXME ATTRIBUTE_custom
+                    {
+                        streams[attrib_iter->id()] = start;
+                        strides[attrib_iter->id()] = attrib_iter->size() * attrib_iter->multiplicity();
+                        start += alignedStreamSize(n * strides[attrib_iter->id()]);
+                    }
+                }
+                mStride = 1;
+            }
+        }
 
         inline bool operator == (const FormatT& rkFormat)
         {
@@ -460,12 +582,16 @@ public:
     
                 mAttributes.push_back(a);
     
-                mAttributeHandles[a.id()] = new AttributeHandle(mSize,1);
+                mAttributeHandles[a.id()] = new AttributeHandle(mSize,1,a.id());
                 if (a.id() < ATTRIBUTE_custom) // FIXME ATTRIBUTE_custom
                 {
                     offsets[a.id()] = mSize;
+                    streams[a.id()] = mSize;
+                    strides[a.id()] = 1;
                 }
                 mSize += a.size();
+                if (mLayout==ArrayOfStructures)
+                    mStride = mSize;
             }
         }
 
@@ -515,6 +641,11 @@ public:
 
     protected:
     
+        static inline ArithPtr alignedStreamSize(ArithPtr bytes)
+        {
+            return (bytes+63) & ~ArithPtr(63);
+        }
+    
         void reset(void)
         {
             mMask = 0;
@@ -531,6 +662,12 @@ public:
             mMask = 0;
             mSize = 0;
             mAttributeHandles.clear();
+            for (uint i=0 ; i<NofBuiltinAttribsT ; ++i)
+            {
+                offsets[i] = 0xffffffff;
+                streams[i] = 0;
+                strides[i] = 0;
+            }
 
             for (typename AttributeList::iterator attribute_iter = mAttributes.begin() ; attribute_iter != mAttributes.end() ; ++attribute_iter)
             {
@@ -538,15 +675,19 @@ public:
 
                 mMask |= (1 << attributeId);
 
-                mAttributeHandles[attributeId] = new AttributeHandle(mSize,attribute_iter->multiplicity());
+                mAttributeHandles[attributeId] = new AttributeHandle(mSize,attribute_iter->multiplicity(),attributeId);
 
                 if(attributeId < ATTRIBUTE_custom)
                 {
                     offsets[attributeId] = mSize;
+                    streams[attributeId] = mSize;
+                    strides[attributeId] = 1;
                 }
 
                 mSize += attribute_iter->size() * attribute_iter->multiplicity();
             }
+            mLayout = ArrayOfStructures;
+            mStride = mSize;
         }
 
     public:
@@ -569,9 +710,15 @@ public:
 
         AttributeList mAttributes;
         uint offsets[NofBuiltinAttribsT];
+        
+        /// per attribute base address and multiplier of the handle addresses (see address())
+        ArithPtr streams[NofBuiltinAttribsT];
+        ArithPtr strides[NofBuiltinAttribsT];
 
         uint mSize;
         Mask mMask;
+        Layout mLayout;
+        ArithPtr mStride;
     };
 
     //--------------------------------------------------------------------------------
@@ -596,14 +743,15 @@ public:
             : mAddr(ptr), mpFormat(pFmt)
         {}
         
+        // with the StructureOfArrays layout the addresses are indices, hence the format is compared too
         inline bool operator == (const BaseAccessorT& el)
         {
-            return this->mAddr == el.mAddr;
+            return this->mAddr == el.mAddr && this->mpFormat == el.mpFormat;
         }
 
         inline bool operator != (const BaseAccessorT& el)
         {
-            return this->mAddr != el.mAddr;
+            return this->mAddr != el.mAddr || this->mpFormat != el.mpFormat;
         }
 
         inline BaseAccessorT& operator = (const BaseAccessorT& el)
@@ -625,7 +773,7 @@ public:
         inline typename MTP::IF<isConst,const T&,T&>::RET attribute(const AttributeHandleT<T>& ph) const
         {
             //return * (T*)(mAddr + mFormat.customAttributeOffset[ph.id()]);
-            return * (T*)(this->mAddr + ph.offset());
+            return * (T*)(this->mpFormat->address(this->mAddr, ph.id()));
         }
         
 //         template<class T>
@@ -641,12 +789,12 @@ public:
         {
             assert(i<ph.multiplicity());
             //return * (T*)(mAddr + mFormat.customAttributeOffset[ph.id()]);
-            return * (T*)(this->mAddr + ph.offset() + i*sizeof(T));
+            return * (T*)(this->mpFormat->address(this->mAddr, ph.id()) + i*sizeof(T));
         }
 
         inline PointerT attributePtr(const AttributeHandle& ph) const
         {
-            return (this->mAddr + ph.offset());
+            return this->mpFormat->address(this->mAddr, ph.id());
         }
 
         /// \internal
@@ -708,9 +856,9 @@ public:
         */
         inline const AccessorT& copyFrom(const ConstAccessorT& el)
         {
-            if(Super::mAddr != el.mAddr)
+            if(Super::mAddr != el.mAddr || Super::mpFormat != el.mpFormat)
             {
-                if(Super::mpFormat == el.mpFormat)
+                if(Super::mpFormat == el.mpFormat && Super::mpFormat->layout()==ArrayOfStructures)
                 {
                     // simply do a memcopy !
                     //std::cout << "copyFrom:: single memcopy\n";
@@ -757,6 +905,7 @@ public:
     typedef typename Traits::ElementHandle ElementHandle;
     typedef typename Traits::ConstElementHandle ConstElementHandle;
     typedef typename Traits::Attribute Attribute;
+    typedef typename Traits::Layout Layout;
 
     //--------------------------------------------------------------------------------
 
@@ -770,13 +919,13 @@ public:
 
         inline iterator& operator++(void)
         {
-            mAddr += mFormat.mSize;
+            mAddr += mFormat.stride();
             return *this;
         }
 
         inline iterator& operator+=(int inc)
         {
-            mAddr += inc * mFormat.mSize;
+            mAddr += inc * mFormat.stride();
             return *this;
         }
 
@@ -814,13 +963,13 @@ public:
 
         inline const_iterator& operator++(void)
         {
-            mAddr += mFormat.mSize;
+            mAddr += mFormat.stride();
             return *this;
         }
 
         inline const_iterator& operator+=(int inc)
         {
-            mAddr += inc * mFormat.mSize;
+            mAddr += inc * mFormat.stride();
             return *this;
         }
 
@@ -850,37 +999,23 @@ public:
 
 public:
 
-    UberVectorT(const typename Traits::AttributeList& as)
-        : mFormat(as)
+    UberVectorT(const typename Traits::AttributeList& as, Layout layout = ArrayOfStructures)
+        : mFormat(as), mData(0)
     {
-        mIncrementSize = ArithPtr(mFormat.size()) * ArithPtr(10000);
-        #ifdef UBERVECTOR_USE_MALLOC
-        mFirst = mLast = (Pointer)malloc(mIncrementSize);
-        #else
-        mFirst = mLast = new ubyte[mIncrementSize];
-        #endif
-        mLastReserved = Pointer(ArithPtr(mFirst) + mIncrementSize);
+        mIncrementSize = 10000;
+        _allocate(layout, mIncrementSize, 0);
     }
     
-    UberVectorT(const Format& f)
-        : mFormat(f)
+    UberVectorT(const Format& f, Layout layout = ArrayOfStructures)
+        : mFormat(f), mData(0)
     {
-        mIncrementSize = ArithPtr(mFormat.size()) * ArithPtr(10000);
-        #ifdef UBERVECTOR_USE_MALLOC
-        mFirst = mLast = (Pointer)malloc(mIncrementSize);
-        #else
-        mFirst = mLast = new ubyte[mIncrementSize];
-        #endif
-        mLastReserved = Pointer(ArithPtr(mFirst) + mIncrementSize);
+        mIncrementSize = 10000;
+        _allocate(layout, mIncrementSize, 0);
     }
 
     virtual ~UberVectorT()
     {
-        #ifdef UBERVECTOR_USE_MALLOC
-        free(mFirst);
-        #else
-        delete[] mFirst;
-        #endif
+        _free(mData);
     }
 
     private:
@@ -895,20 +1030,7 @@ public:
     {
         if (n>capacity())
         {
-            #ifdef UBERVECTOR_USE_MALLOC
-            Pointer newFirst = (Pointer)malloc(ArithPtr(n * mFormat.size()));
-            #else
-            Pointer newFirst = new ubyte[ArithPtr(n * mFormat.size())];
-            #endif
-            memcpy(newFirst, mFirst, ArithPtr(mLast)-ArithPtr(mFirst));
-            #ifdef UBERVECTOR_USE_MALLOC
-            free(mFirst);
-            #else
-            delete[] mFirst;
-            #endif
-            mLast = (Pointer)(ArithPtr(newFirst) + ArithPtr(mLast) - ArithPtr(mFirst));
-            mLastReserved = Pointer(ArithPtr(mLast) + ArithPtr(mFormat.size()*n));
-            mFirst = newFirst;
+            _allocate(mFormat.layout(), n, size());
         }
     }
 
@@ -917,21 +1039,8 @@ public:
     */
     inline void resize(uint n)
     {
-        n++; // allocate one more element to be able to perform some operation
-        #ifdef UBERVECTOR_USE_MALLOC
-        Pointer newFirst = (Pointer)malloc(n * mFormat.size());
-        #else
-        Pointer newFirst = new ubyte[n * mFormat.size()];
-        #endif
-        memcpy(newFirst, mFirst, Math::Min(ArithPtr(n * mFormat.size()),ArithPtr(mLast)-ArithPtr(mFirst)));
-        #ifdef UBERVECTOR_USE_MALLOC
-        free(mFirst);
-        #else
-        delete[] mFirst;
-        #endif
-        mLastReserved = Pointer(ArithPtr(newFirst) + ArithPtr(n * mFormat.size()));
-        mLast = Pointer(ArithPtr(newFirst) + ArithPtr((n-1) * mFormat.size()));
-        mFirst = newFirst;
+        _allocate(mFormat.layout(), n+1, Math::Min(n,size())); // allocate one more element to be able to perform some operation
+        mLast = _addr(n);
     }
     
     inline void clear(void)
@@ -941,19 +1050,10 @@ public:
     
     inline void clear(const typename Traits::AttributeList& as)
     {
+        Layout layout = mFormat.layout();
         mFormat.clear(as);
-        #ifdef UBERVECTOR_USE_MALLOC
-        free(mFirst);
-        #else
-        delete[] mFirst;
-        #endif
-        mIncrementSize = ArithPtr(mFormat.size()) * ArithPtr(10000);
-        #ifdef UBERVECTOR_USE_MALLOC
-        mFirst = mLast = (Pointer)malloc(mIncrementSize);
-        #else
-        mFirst = mLast = new ubyte[mIncrementSize];
-        #endif
-        mLastReserved = Pointer(ArithPtr(mFirst) + ArithPtr(mIncrementSize));
+        mIncrementSize = 10000;
+        _allocate(layout, mIncrementSize, 0);
     }
 
     /** Add one new element at the end of the container and the return this element.
@@ -961,37 +1061,24 @@ public:
     */
     inline ElementHandle append(void)
     {
-        mLast = Pointer(ArithPtr(mLast)+ArithPtr(mFormat.size()));
+        mLast = Pointer(ArithPtr(mLast)+mFormat.stride());
         if(mLast>=mLastReserved)
         {
-            mIncrementSize = ArithPtr(mFormat.size()) * ArithPtr(capacity()/2);
+            uint n = size();
+            mIncrementSize = Math::Max<ArithPtr>(capacity()/2, 1);
             //LOG_DEBUG("increase buffer size, old capacity =  " + QString::toString((int)capacity()) );
-            #ifdef UBERVECTOR_USE_MALLOC
-            Pointer newFirst = (Pointer)malloc((ArithPtr)mLastReserved-(ArithPtr)mFirst + mIncrementSize);
-            #else
-            Pointer newFirst = new ubyte[ArithPtr(mLastReserved)-ArithPtr(mFirst) + mIncrementSize];
-            #endif
-            memcpy(newFirst, mFirst, ArithPtr(mLastReserved)-ArithPtr(mFirst));
-            #ifdef UBERVECTOR_USE_MALLOC
-            free(mFirst);
-            #else
-            delete[] mFirst;
-            #endif
-            mLast = Pointer(ArithPtr(newFirst) + ArithPtr(mLast) - ArithPtr(mFirst));
-            mLastReserved = Pointer(ArithPtr(newFirst) + ArithPtr(mLastReserved) - ArithPtr(mFirst) + mIncrementSize);
-            mFirst = newFirst;
+            _allocate(mFormat.layout(), capacity() + mIncrementSize, n-1);
+            mLast = _addr(n);
             //LOG_DEBUG("increase buffer size : new capacity = " + QString::toString((int)capacity()) );
         }
-        return ElementHandle(Pointer(ArithPtr(mLast)-ArithPtr(mFormat.size())), mFormat);
+        return ElementHandle(Pointer(ArithPtr(mLast)-mFormat.stride()), mFormat);
     }
     
     inline void erase(uint i)
     {
-        UBERVECTOR_MEMMOVE( Pointer(ArithPtr(mFirst)+ArithPtr(i*mFormat.size())),
-            Pointer(ArithPtr(mFirst)+ArithPtr((i+1)*mFormat.size())),
-            ArithPtr((size()-(i+1))*mFormat.size()) );
+        _move(i, i+1, size()-(i+1));
 
-        Pointer tempLast = Pointer(ArithPtr(mLast) - ArithPtr(mFormat.size()));
+        Pointer tempLast = Pointer(ArithPtr(mLast) - mFormat.stride());
         if(tempLast>=mFirst)
         {
             mLast=tempLast;
@@ -1031,9 +1118,7 @@ public:
                 int nb = id - prevId - 1;
                 if (nb>0)
                 {
-                    UBERVECTOR_MEMMOVE( Pointer(ArithPtr(mFirst)+ArithPtr(((moveTo)*mFormat.size()))),
-                            Pointer(ArithPtr(mFirst)+ArithPtr((prevId+1)*mFormat.size())),
-                            ArithPtr(nb*mFormat.size()) );
+                    _move(moveTo, prevId+1, nb);
                     moveTo += nb;
                 }
                 prevId = id;
@@ -1044,13 +1129,11 @@ public:
             int nb = size() - prevId - 1;
             if (nb>0)
             {
-                UBERVECTOR_MEMMOVE( Pointer(ArithPtr(mFirst)+ArithPtr((moveTo)*mFormat.size())),
-                        Pointer(ArithPtr(mFirst)+ArithPtr((prevId+1)*mFormat.size())),
-                        ArithPtr(nb*mFormat.size()) );
+                _move(moveTo, prevId+1, nb);
             }
         }
         
-        mLast = Pointer(ArithPtr(mLast)-ArithPtr(countDeleted*mFormat.size()));
+        mLast = Pointer(ArithPtr(mLast)-ArithPtr(countDeleted)*mFormat.stride());
     }
 
     /** Remove the last element of the container.
@@ -1058,7 +1141,7 @@ public:
     inline void popBack()
     {
         /// \todo fixme
-        Pointer tempLast = Pointer(ArithPtr(mLast) - ArithPtr(mFormat.size()));
+        Pointer tempLast = Pointer(ArithPtr(mLast) - mFormat.stride());
         if(tempLast>=mFirst)
         {
             mLast=tempLast;
@@ -1074,7 +1157,7 @@ public:
     inline void pop_back()
     {
         /// \todo fixme
-        Pointer tempLast = Pointer(ArithPtr(mLast) - ArithPtr(mFormat.size()));
+        Pointer tempLast = Pointer(ArithPtr(mLast) - mFormat.stride());
         if(tempLast>=mFirst)
         {
             mLast=tempLast;
@@ -1100,41 +1183,93 @@ public:
     */
     inline uint size(void) const
     {
-        return (ArithPtr(mLast)-ArithPtr(mFirst))/ArithPtr(mFormat.size());
+        return (ArithPtr(mLast)-ArithPtr(mFirst))/mFormat.stride();
     }
 
     /** Return the number of elements plus the numeber of elements that can be stored into the pre-allocated parts.
     */
     inline uint capacity(void) const
     {
-        return (ArithPtr(mLastReserved)-ArithPtr(mFirst))/ArithPtr(mFormat.size());
+        return (ArithPtr(mLastReserved)-ArithPtr(mFirst))/mFormat.stride();
     }
 
     /** Free the pre-allocated memory parts. This is equivalent to reserve(0);
     */
     void squeeze(void)
     {
-        #ifdef UBERVECTOR_USE_MALLOC
-        Pointer newFirst = (Pointer)malloc( (ArithPtr)(size() * mFormat.size()) );
-        #else
-        Pointer newFirst = new ubyte[ArithPtr(size() * mFormat.size())];
-        #endif
-        memcpy(newFirst, mFirst, ArithPtr(mLast)-ArithPtr(mFirst));
-        #ifdef UBERVECTOR_USE_MALLOC
-        free(mFirst);
-        #else
-        delete[] mFirst;
-        #endif
-        mLast = Pointer(ArithPtr(newFirst) + ArithPtr(mLast) - ArithPtr(mFirst));
-        mLastReserved = mLast;
-        mFirst = newFirst;
+        _allocate(mFormat.layout(), size(), size());
     }
 
     /** Get the address of the begin of the data.
+        \warning the records only exist with the ArrayOfStructures layout, 0 is returned otherwise (see span()).
     */
     Pointer data(uint i = 0)
     {
-        return Pointer(ArithPtr(mFirst)+ArithPtr(i*mFormat.size()));
+        assert(mFormat.layout()==ArrayOfStructures);
+        if (mFormat.layout()!=ArrayOfStructures)
+            return 0;
+        return _addr(i);
+    }
+    
+    /** Returns the memory layout of the elements.
+    */
+    inline Layout getLayout(void) const
+    {
+        return mFormat.layout();
+    }
+    
+    /** Changes the memory layout of the elements, their values are kept.
+        \warning the existing element handles and iterators become invalid.
+    */
+    void setLayout(Layout layout)
+    {
+        if (layout==mFormat.layout())
+            return;
+        
+        uint n = size();
+        Format oldFormat = mFormat;
+        Pointer oldData = mData;
+        Pointer oldFirst = mFirst;
+        mData = 0;
+        _allocate(layout, capacity(), 0);
+        mLast = _addr(n);
+        
+        // copy the attributes one by one
+        for (typename Format::iterator attrib_iter = mFormat.begin() ; attrib_iter!=mFormat.end() ; ++attrib_iter)
+        {
+            uint aid = attrib_iter->id();
+            ArithPtr attribSize = attrib_iter->size() * attrib_iter->multiplicity();
+            #pragma omp parallel for
+            for (int i=0 ; i<int(n) ; ++i)
+            {
+                memcpy(mFormat.address(_addr(i), aid),
+                    oldFormat.address(Pointer(ArithPtr(oldFirst) + ArithPtr(i)*oldFormat.stride()), aid),
+                    attribSize);
+            }
+        }
+        _free(oldData);
+    }
+    
+    /** Returns a strided view of the attribute a of all the elements.
+        With the StructureOfArrays layout the values are contiguous.
+        \warning the view becomes invalid when the container is reallocated.
+    */
+    template< class _MetaAttributeT >
+    inline typename Traits::template AttributeSpanT<typename _MetaAttributeT::Type> span(const _MetaAttributeT& a)
+    {
+        assert(mFormat.hasAttribute(a));
+        return typename Traits::template AttributeSpanT<typename _MetaAttributeT::Type>(
+            mFormat.address(mFirst, a.id), mFormat.stride()*mFormat.strides[a.id]);
+    }
+    
+    /** Returns a strided view of the attribute a of all the elements. (for read-only use)
+    */
+    template< class _MetaAttributeT >
+    inline typename Traits::template AttributeSpanT<const typename _MetaAttributeT::Type> span(const _MetaAttributeT& a) const
+    {
+        assert(mFormat.hasAttribute(a));
+        return typename Traits::template AttributeSpanT<const typename _MetaAttributeT::Type>(
+            mFormat.address(mFirst, a.id), mFormat.stride()*mFormat.strides[a.id]);
     }
 
     /** Get an iterator to the fist element.
@@ -1169,21 +1304,21 @@ public:
     */
     inline ElementHandle back(void)
     {
-        return ElementHandle(mLast-mFormat.size(), mFormat);
+        return ElementHandle(Pointer(ArithPtr(mLast)-mFormat.stride()), mFormat);
     }
 
     /** Get the last element. (for read-only use)
     */
     inline ConstElementHandle back(void) const
     {
-        return ElementHandle(Pointer(ArithPtr(mLast)-ArithPtr(mFormat.size())), mFormat);
+        return ElementHandle(Pointer(ArithPtr(mLast)-mFormat.stride()), mFormat);
     }
 
     /** Get the element number i of the array;.
     */
     inline ElementHandle at(uint i)
     {
-        return ElementHandle(Pointer(ArithPtr(mFirst)+ArithPtr(i*mFormat.size())), mFormat);
+        return ElementHandle(_addr(i), mFormat);
     }
 
     /** Get the element number i of the array.
@@ -1191,14 +1326,14 @@ public:
     inline ElementHandle operator[](uint i)
     {
         //return at(i);
-        return ElementHandle(Pointer(ArithPtr(mFirst)+ArithPtr(i*mFormat.size())), mFormat);
+        return ElementHandle(_addr(i), mFormat);
     }
 
     /** Get the element number i of the array. (for read-only use)
     */
     inline ConstElementHandle at(uint i) const
     {
-        return ElementHandle(Pointer(ArithPtr(mFirst)+ArithPtr(i*mFormat.size())), mFormat);
+        return ElementHandle(_addr(i), mFormat);
     }
 
     /** Get the element number i of the array. (for read-only use)
@@ -1206,14 +1341,14 @@ public:
     inline ConstElementHandle operator[](uint i) const
     {
         //return at(i);
-        return ElementHandle(Pointer(ArithPtr(mFirst)+ArithPtr(i*mFormat.size())), mFormat);
+        return ElementHandle(_addr(i), mFormat);
     }
 
     /** Get the index of an element in the array.
     */
     inline int getIndexOf(const ElementHandle& el)
     {
-        return (ArithPtr(el._getAddr()) - ArithPtr(mFirst)) / ArithPtr(mFormat.size());
+        return (ArithPtr(el._getAddr()) - ArithPtr(mFirst)) / mFormat.stride();
     }
     
     /** swap two elements
@@ -1252,28 +1387,40 @@ public:
     {
 //         LOG_ERROR("Have to be fixed !");
 
+        ArithPtr nofReservedElement = capacity();
+        ArithPtr nofElement = size();
+        
+        if (mFormat.layout()==StructureOfArrays)
+        {
+            // the existing arrays are simply moved to the new storage
+            Format oldFormat = mFormat;
+            Pointer oldData = mData;
+            mFormat.addAttribute(a);
+            mData = 0;
+            _allocate(StructureOfArrays, nofReservedElement, 0);
+            mLast = _addr(nofElement);
+            for (typename Format::iterator attrib_iter = oldFormat.begin() ; attrib_iter!=oldFormat.end() ; ++attrib_iter)
+            {
+                uint aid = attrib_iter->id();
+                memcpy(mFormat.address(0,aid), oldFormat.address(0,aid), nofElement*oldFormat.strides[aid]);
+            }
+            _free(oldData);
+            return;
+        }
+        
         ArithPtr oldStride = ArithPtr(mFormat.size());
-        ArithPtr nofReservedElement = (ArithPtr(mLastReserved)-ArithPtr(mFirst))/oldStride;
-        ArithPtr nofElement = (ArithPtr(mLast)-ArithPtr(mFirst))/oldStride;
         mFormat.addAttribute(a);
         ArithPtr newStride = ArithPtr(mFormat.size());
 
         // resize the vector and update data stride
-        #ifdef UBERVECTOR_USE_MALLOC
-        Pointer newFirst = (Pointer)malloc(nofReservedElement * ArithPtr(mFormat.size()));
-        #else
-        Pointer newFirst = new ubyte[nofReservedElement * ArithPtr(mFormat.size())];
-        #endif
+        Pointer newFirst = _allocateBytes(nofReservedElement * ArithPtr(mFormat.size()));
         // copy with stride
         for(ArithPtr i=0 ; i<nofElement ; ++i)
         {
             memcpy(Pointer(ArithPtr(newFirst) + i*newStride), Pointer(ArithPtr(mFirst) + i*oldStride), oldStride);
         }
-        #ifdef UBERVECTOR_USE_MALLOC
-        free(mFirst);
-        #else
-        delete[] mFirst;
-        #endif
+        _free(mData);
+        mData = newFirst;
         mLast = Pointer(ArithPtr(newFirst) + newStride * nofElement);
         mLastReserved = Pointer(ArithPtr(newFirst) + newStride * nofReservedElement);
         mFirst = newFirst;
@@ -1293,10 +1440,89 @@ public:
     }
 
 protected:
+    
+    /// \internal handle address of the element i
+    inline Pointer _addr(ArithPtr i) const
+    {
+        return Pointer(ArithPtr(mFirst) + i*mFormat.stride());
+    }
+    
+    static Pointer _allocateBytes(ArithPtr bytes)
+    {
+        #ifdef UBERVECTOR_USE_MALLOC
+        return (Pointer)malloc(bytes);
+        #else
+        return new ubyte[bytes];
+        #endif
+    }
+    
+    static void _free(Pointer data)
+    {
+        #ifdef UBERVECTOR_USE_MALLOC
+        free(data);
+        #else
+        delete[] data;
+        #endif
+    }
+    
+    /** \internal Moves the elements to a new storage of n elements with the given layout.
+        The nb first elements are kept, they must be stored with this layout.
+        After this call the container has nb elements.
+    */
+    void _allocate(Layout layout, ArithPtr n, ArithPtr nb)
+    {
+        Pointer newData;
+        if (layout==ArrayOfStructures)
+        {
+            newData = _allocateBytes(n * ArithPtr(mFormat.size()));
+            if (nb>0)
+                memcpy(newData, mFirst, nb * ArithPtr(mFormat.size()));
+            mFormat.setStreams(ArrayOfStructures, newData, n);
+            mFirst = newData;
+        }
+        else
+        {
+            Format oldFormat = mFormat;
+            newData = _allocateBytes(mFormat.storageSize(n));
+            mFormat.setStreams(StructureOfArrays, newData, n);
+            for (typename Format::iterator attrib_iter = mFormat.begin() ; nb>0 && attrib_iter!=mFormat.end() ; ++attrib_iter)
+            {
+                uint aid = attrib_iter->id();
+                memcpy(mFormat.address(0,aid), oldFormat.address(0,aid), nb*mFormat.strides[aid]);
+            }
+            // the handle addresses are the indices
+            mFirst = 0;
+        }
+        _free(mData);
+        mData = newData;
+        mLast = _addr(nb);
+        mLastReserved = _addr(n);
+    }
+    
+    /** \internal Moves nb elements from src to dst (the ranges may overlap).
+    */
+    void _move(ArithPtr dst, ArithPtr src, ArithPtr nb)
+    {
+        if (nb<=0)
+            return;
+        if (mFormat.layout()==ArrayOfStructures)
+        {
+            UBERVECTOR_MEMMOVE(_addr(dst), _addr(src), nb*ArithPtr(mFormat.size()));
+            return;
+        }
+        for (typename Format::iterator attrib_iter = mFormat.begin() ; attrib_iter!=mFormat.end() ; ++attrib_iter)
+        {
+            uint aid = attrib_iter->id();
+            UBERVECTOR_MEMMOVE(mFormat.address(Pointer(dst),aid), mFormat.address(Pointer(src),aid), nb*mFormat.strides[aid]);
+        }
+    }
 
     Format mFormat;
     Pointer mFirst, mLast, mLastReserved;
     ArithPtr mIncrementSize;
+    
+    /// the allocated memory, mFirst with the ArrayOfStructures layout
+    Pointer mData;
 
 };
 
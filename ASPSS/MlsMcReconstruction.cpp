@@ -47,6 +47,10 @@ http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
 #include "ExpeTimer.h"
 #include "ExpeCliProgressBar.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 using namespace Expe;
 
 void printUsage(void);
@@ -294,12 +298,12 @@ int main(int argc, char* argv[])
     mls->selectWeightingFunction(args.weightFunction);
     if (args.weightFunctionOptions=="help")
     {
-        printManagedObjectHelp<NeighborhoodManager>("Neighborhood", args.neighborhoodType, mls->editNeighborhood());
+        printManagedObjectHelp<WeightingFunctionManager>("WeightingFunction", args.weightFunction, mls->editWeightingFunction());
         helpQueried = true;
     }
     else
     {
-        assignOptionsToObject(args.neighborhoodOptions,mls->editNeighborhood());
+        assignOptionsToObject(args.weightFunctionOptions,mls->editWeightingFunction());
     }
     
     // do Marching Cube reconstruction
@@ -340,6 +344,23 @@ int main(int argc, char* argv[])
     mc->setIsoValue(0.);
     mc->setSurface(mls);
     
+    // the projection and normal passes run in parallel with one MLS surface per thread,
+    // configured exactly as the main one
+    std::vector<const ImplicitSurface*> threadSurfaces;
+    #ifdef _OPENMP
+    for (int i=0 ; i<omp_get_max_threads() ; ++i)
+    {
+        MlsSurface* threadMls = MlsSurfaceManager::Instance().create(args.mlsVariant,pPoints);
+        assignOptionsToObject(args.mlsOptions,threadMls);
+        threadMls->selectNeighborhood(args.neighborhoodType);
+        assignOptionsToObject(args.neighborhoodOptions,threadMls->editNeighborhood());
+        threadMls->selectWeightingFunction(args.weightFunction);
+        assignOptionsToObject(args.weightFunctionOptions,threadMls->editWeightingFunction());
+        threadSurfaces.push_back(threadMls);
+    }
+    #endif
+    mc->setThreadSurfaces(threadSurfaces);
+    
     bool mcok;
     if (args.mcRaw)
     {
@@ -416,6 +437,10 @@ int main(int argc, char* argv[])
         exit(1);
     }
     
+    mc->setThreadSurfaces(std::vector<const ImplicitSurface*>());
+    for (uint i=0 ; i<threadSurfaces.size() ; ++i)
+        delete threadSurfaces[i];
+    
     return 0;
 }
 
@@ -13,9 +13,20 @@
 #include "ObjFormat.h"
 #include <iostream>
 #include <fstream>
-#include "gzstream.h"
+#include "ExpeBlockGzip.h"
 #include <assert.h>
 #include <dirent.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <iterator>
+
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 //--------------------------------------------------------------------------------
 // ObjMaterial implementation
@@ -471,7 +482,8 @@ ObjMesh* ObjMesh::LoadFromStream(IStream& in, const ObjString& texturePath)
             if (words.size()!=4)
             {
                 std::cerr << "ObjLoader: Error parsing line : " << buffer << "\n";
-                return false;
+                delete pMesh;
+                return 0;
             }
             pMesh->positions.push_back(args.toVector3());
         }
@@ -480,7 +492,8 @@ ObjMesh* ObjMesh::LoadFromStream(IStream& in, const ObjString& texturePath)
             if (words.size()<3)
             {
                 std::cerr << "ObjLoader: Error parsing line : " << buffer << "\n";
-                return false;
+                delete pMesh;
+                return 0;
             }
             pMesh->texcoords.push_back(args.toVector2());
         }
@@ -489,7 +502,8 @@ ObjMesh* ObjMesh::LoadFromStream(IStream& in, const ObjString& texturePath)
             if (words.size()!=4)
             {
                 std::cerr << "ObjLoader: Error parsing line : " << buffer << "\n";
-                return false;
+                delete pMesh;
+                return 0;
             }
             pMesh->normals.push_back(args.toVector3());
 //             std::cout << args.toVector3() << " ";
@@ -499,7 +513,8 @@ ObjMesh* ObjMesh::LoadFromStream(IStream& in, const ObjString& texturePath)
             if (words.size()<4)
             {
                 std::cerr << "ObjLoader: Error parsing line : " << buffer << "\n";
-                return false;
+                delete pMesh;
+                return 0;
             }
             
             int nofVertices = words.size()-1;
@@ -585,6 +600,419 @@ ObjMesh* ObjMesh::LoadFromStream(IStream& in, const ObjString& texturePath)
     return pMesh;
 }
 
+template ObjMesh* ObjMesh::LoadFromStream<std::istream>(std::istream& in, const ObjString& texturePath);
+
+//--------------------------------------------------------------------------------
+// Parallel parser
+//--------------------------------------------------------------------------------
+
+// The file is cut into chunks at line boundaries which are parsed concurrently.
+// Vertex attributes and faces are stored per chunk, the lines changing the state
+// of the parser (groups, materials) are kept as events. The chunks are then merged
+// in file order, which replays the events and creates the faces exactly as
+// LoadFromStream does.
+
+namespace
+{
+    // same limit as the getline() buffer of LoadFromStream
+    const size_t MaxLineLength = 2048;
+    
+    const size_t ChunkSize = 1<<22;
+    
+    inline bool isBlank(char c)
+    {
+        return c==' ' || c=='\t' || c=='\r' || c=='\n';
+    }
+    
+    inline bool isDigit(char c)
+    {
+        return c>='0' && c<='9';
+    }
+    
+    // atoi() on [b,e)
+    inline int scanInt(const char* b, const char* e)
+    {
+        while (b<e && (*b==' ' || (*b>='\t' && *b<='\r')))
+            ++b;
+        bool neg = false;
+        if (b<e && (*b=='-' || *b=='+'))
+            neg = *b++=='-';
+        const char* digits = b;
+        int v = 0;
+        while (b<e && isDigit(*b) && b-digits<9)
+            v = 10*v + (*b++ - '0');
+        if (b<e && isDigit(*b))
+            return atoi(std::string(digits-(neg?1:0), e).c_str());
+        return neg ? -v : v;
+    }
+    
+    // atof() on [b,e) as a float. Plain decimal numbers with at most 15 digits and a small
+    // exponent are converted exactly, anything else goes through atof().
+    inline float scanFloat(const char* b, const char* e)
+    {
+        static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+            1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+        const char* p = b;
+        bool neg = false;
+        if (p<e && (*p=='-' || *p=='+'))
+            neg = *p++=='-';
+        unsigned long long m = 0;
+        int nofDigits = 0, exp10 = 0;
+        for ( ; p<e && isDigit(*p) ; ++p, ++nofDigits)
+            m = 10*m + (*p - '0');
+        if (p<e && *p=='.')
+        {
+            for (++p ; p<e && isDigit(*p) ; ++p, ++nofDigits, --exp10)
+                m = 10*m + (*p - '0');
+        }
+        if (nofDigits>0 && p<e && (*p=='e' || *p=='E'))
+        {
+            ++p;
+            bool negExp = false;
+            if (p<e && (*p=='-' || *p=='+'))
+                negExp = *p++=='-';
+            int x = 0;
+            const char* expDigits = p;
+            for ( ; p<e && isDigit(*p) && p-expDigits<4 ; ++p)
+                x = 10*x + (*p - '0');
+            if (p==expDigits)
+                nofDigits = 0;
+            exp10 += negExp ? -x : x;
+        }
+        if (p!=e || nofDigits==0 || nofDigits>15 || exp10<-22 || exp10>22)
+            return atof(std::string(b, e).c_str());
+        double v = double(m);
+        v = exp10<0 ? v/powers[-exp10] : v*powers[exp10];
+        return neg ? -v : v;
+    }
+    
+    // ObjString::toVector3/toVector2 on [b,e)
+    inline void scanVector(const char* b, const char* e, float* v, int n)
+    {
+        int count = 1;
+        for (const char* p=b ; p<e ; ++p)
+            if (*p==' ' || *p=='\t' || *p=='\n')
+                ++count;
+        for (int i=0 ; i<n ; ++i)
+            v[i] = 0;
+        if (count!=n)
+            return;
+        for (int i=0 ; i<n ; ++i)
+        {
+            const char* end = b;
+            while (end<e && *end!=' ' && *end!='\t' && *end!='\n')
+                ++end;
+            v[i] = scanFloat(b, end);
+            b = end+1;
+        }
+    }
+    
+    struct ObjChunk
+    {
+        enum EventType {Command, Error, Stop};
+        
+        struct Event
+        {
+            EventType type;
+            ObjString command, args;
+            // number of faces and vertex attributes parsed before the event
+            size_t nofFaces, nofPositions, nofTexcoords, nofNormals;
+        };
+        
+        std::vector<ObjVector3> positions;
+        std::vector<ObjVector2> texcoords;
+        std::vector<ObjVector3> normals;
+        
+        std::vector<uint> faceSizes;
+        std::vector<unsigned char> faceOptions;
+        std::vector<int> positionIds, texcoordIds, normalIds;
+        
+        std::vector<Event> events;
+        
+        void addEvent(EventType type, const ObjString& command, const ObjString& args)
+        {
+            Event ev;
+            ev.type = type;
+            ev.command = command;
+            ev.args = args;
+            ev.nofFaces = faceSizes.size();
+            ev.nofPositions = positions.size();
+            ev.nofTexcoords = texcoords.size();
+            ev.nofNormals = normals.size();
+            events.push_back(ev);
+        }
+        
+        void parse(const char* begin, const char* end);
+    };
+    
+    void ObjChunk::parse(const char* begin, const char* end)
+    {
+        const char* ls = begin;
+        while (ls<end)
+        {
+            const char* le = (const char*)memchr(ls, '\n', end-ls);
+            if (!le)
+                le = end;
+            if (size_t(le-ls)>=MaxLineLength)
+            {
+                addEvent(Stop, "", "");
+                return;
+            }
+            const char* next = le+1;
+            
+            // remove comments
+            const char* nul = (const char*)memchr(ls, '\0', le-ls);
+            if (nul)
+                le = nul;
+            const char* ce = (const char*)memchr(ls, '#', le-ls);
+            if (!ce)
+                ce = le;
+            
+            const char* sp = (const char*)memchr(ls, ' ', ce-ls);
+            const char* cmdEnd = sp ? sp : ce;
+            uint cmdLength = cmdEnd-ls;
+            
+            // trimmed arguments
+            const char* ab = sp ? sp+1 : ce;
+            const char* ae = ce;
+            while (ab<ae && isBlank(*ab))
+                ++ab;
+            while (ae>ab && isBlank(ae[-1]))
+                --ae;
+            
+            uint nofWords = 1;
+            for (const char* p=cmdEnd ; p<ce ; ++p)
+                if (*p==' ')
+                    ++nofWords;
+            
+            if (cmdLength==1 && ls[0]=='v')
+            {
+                if (nofWords!=4)
+                {
+                    addEvent(Error, "", ObjString(std::string(ls, le)));
+                    return;
+                }
+                ObjVector3 v;
+                scanVector(ab, ae, v, 3);
+                positions.push_back(v);
+            }
+            else if (cmdLength==2 && ls[0]=='v' && ls[1]=='t')
+            {
+                if (nofWords<3)
+                {
+                    addEvent(Error, "", ObjString(std::string(ls, le)));
+                    return;
+                }
+                ObjVector2 v;
+                scanVector(ab, ae, v, 2);
+                texcoords.push_back(v);
+            }
+            else if (cmdLength==2 && ls[0]=='v' && ls[1]=='n')
+            {
+                if (nofWords!=4)
+                {
+                    addEvent(Error, "", ObjString(std::string(ls, le)));
+                    return;
+                }
+                ObjVector3 v;
+                scanVector(ab, ae, v, 3);
+                normals.push_back(v);
+            }
+            else if (cmdLength==1 && ls[0]=='f')
+            {
+                if (nofWords<4)
+                {
+                    addEvent(Error, "", ObjString(std::string(ls, le)));
+                    return;
+                }
+                
+                // a vertex has texcoord/normal ids only if it has two slashes
+                bool hasTexcoordIds = false;
+                bool hasNormalIds = false;
+                for (const char* wb=cmdEnd+1 ; wb<=ce ; )
+                {
+                    const char* we = (const char*)memchr(wb, ' ', ce-wb);
+                    if (!we)
+                        we = ce;
+                    const char* s1 = (const char*)memchr(wb, '/', we-wb);
+                    const char* s2 = s1 ? (const char*)memchr(s1+1, '/', we-s1-1) : 0;
+                    if (s2 && !memchr(s2+1, '/', we-s2-1))
+                    {
+                        hasTexcoordIds = hasTexcoordIds || s2>s1+1;
+                        hasNormalIds = hasNormalIds || we>s2+1;
+                    }
+                    wb = we+1;
+                }
+                
+                faceSizes.push_back(nofWords-1);
+                faceOptions.push_back((hasTexcoordIds?Obj::Texcoord:0) | (hasNormalIds?Obj::Normal:0));
+                for (const char* wb=cmdEnd+1 ; wb<=ce ; )
+                {
+                    const char* we = (const char*)memchr(wb, ' ', ce-wb);
+                    if (!we)
+                        we = ce;
+                    positionIds.push_back(scanInt(wb, we)-1);
+                    const char* s1 = (const char*)memchr(wb, '/', we-wb);
+                    const char* s2 = s1 ? (const char*)memchr(s1+1, '/', we-s1-1) : 0;
+                    bool threeIds = s2 && !memchr(s2+1, '/', we-s2-1);
+                    if (hasTexcoordIds)
+                        texcoordIds.push_back(threeIds && s2>s1+1 ? scanInt(s1+1, s2)-1 : -1);
+                    if (hasNormalIds)
+                        normalIds.push_back(threeIds && we>s2+1 ? scanInt(s2+1, we)-1 : -1);
+                    wb = we+1;
+                }
+            }
+            else if ( (cmdLength==1 && ls[0]=='g')
+                   || (cmdLength==6 && (!strncmp(ls, "mtllib", 6) || !strncmp(ls, "usemtl", 6) || !strncmp(ls, "usemap", 6))) )
+            {
+                addEvent(Command, ObjString(std::string(ls, cmdEnd)), ObjString(std::string(ab, ae)));
+            }
+            
+            ls = next;
+        }
+    }
+}
+
+ObjMesh* ObjMesh::LoadFromMemory(const char* data, size_t size, const ObjString& texturePath)
+{
+    // cut at line boundaries
+    std::vector<const char*> bounds(1, data);
+    while (bounds.back()<data+size)
+    {
+        const char* b = bounds.back() + std::min(ChunkSize, size_t(data+size-bounds.back()));
+        const char* nl = (const char*)memchr(b, '\n', data+size-b);
+        bounds.push_back(nl ? nl+1 : data+size);
+    }
+    
+    int nofChunks = bounds.size()-1;
+    std::vector<ObjChunk> chunks(nofChunks);
+    #pragma omp parallel for schedule(dynamic,1)
+    for (int i=0 ; i<nofChunks ; ++i)
+    {
+        chunks[i].parse(bounds[i], bounds[i+1]);
+    }
+    
+    ObjMesh* pMesh = new ObjMesh();
+    pMesh->mTexturePath = texturePath;
+    
+    ObjSubMesh* pSubMesh = pMesh->createSubMesh();
+    bool emptySubMesh = true;
+    
+    ObjString usemap = "";
+    ObjString usemtl = "";
+    int currentMaterialId = -1;
+    
+    // merge the chunks in order
+    for (int i=0 ; i<nofChunks ; ++i)
+    {
+        ObjChunk& chunk = chunks[i];
+        size_t face = 0, vertex = 0, texcoord = 0, normal = 0;
+        bool stop = false;
+        for (size_t e=0 ; e<=chunk.events.size() && !stop ; ++e)
+        {
+            size_t nofFaces = e<chunk.events.size() ? chunk.events[e].nofFaces : chunk.faceSizes.size();
+            for ( ; face<nofFaces ; ++face)
+            {
+                uint nofVertices = chunk.faceSizes[face];
+                Obj::Options options = Obj::Options(chunk.faceOptions[face]);
+                ObjFaceHandle fh = pSubMesh->createFace(nofVertices, options, currentMaterialId);
+                for (uint k=0 ; k<nofVertices ; ++k)
+                {
+                    fh.vPositionId(k) = chunk.positionIds[vertex+k];
+                    if (options&Obj::Texcoord)
+                        fh.vTexcoordId(k) = chunk.texcoordIds[texcoord+k];
+                    if (options&Obj::Normal)
+                        fh.vNormalId(k) = chunk.normalIds[normal+k];
+                }
+                vertex += nofVertices;
+                if (options&Obj::Texcoord)
+                    texcoord += nofVertices;
+                if (options&Obj::Normal)
+                    normal += nofVertices;
+                emptySubMesh = false;
+            }
+            if (e==chunk.events.size())
+                break;
+            
+            const ObjChunk::Event& ev = chunk.events[e];
+            const ObjString& command = ev.command;
+            const ObjString& args = ev.args;
+            if (ev.type==ObjChunk::Error)
+            {
+                std::cerr << "ObjLoader: Error parsing line : " << args << "\n";
+                delete pMesh;
+                return 0;
+            }
+            else if (ev.type==ObjChunk::Stop)
+            {
+                // the serial parser stops at the first line that is too long
+                chunk.positions.resize(ev.nofPositions);
+                chunk.texcoords.resize(ev.nofTexcoords);
+                chunk.normals.resize(ev.nofNormals);
+                stop = true;
+            }
+            else if (command=="mtllib")
+            {
+                pMesh->loadMaterialFile(pMesh->getTexturePath() + args);
+            }
+            else if (command=="g")
+            {
+                if (!emptySubMesh)
+                {
+                    pSubMesh = pMesh->createSubMesh(args);
+                    emptySubMesh = true;
+                    std::cout << "\tObjMeshReader: new group " << args << std::endl;
+                }
+                else
+                {
+                    pSubMesh->rename(args);
+                    std::cout << "\tObjMeshReader: skip group, new group = " << args << std::endl;
+                }
+            }
+            else if ( (command=="usemtl" && usemtl!=args) || (command=="usemap" && usemap!=args))
+            {
+                if (command=="usemtl")
+                    usemtl = args;
+                else if (command=="usemap")
+                    usemap = args;
+                
+                if (usemtl!="")
+                {
+                    if (pMesh->getMaterial(usemtl)==0)
+                    {
+                        std::cerr << "ObjLoader::Warbing - Material \"" << usemtl << "\" not found.\n";
+                    }
+                    
+                    if (usemap!="")
+                    {
+                        ObjString matName = pMesh->createUsemapMaterial(usemap,usemtl);
+                        currentMaterialId = pMesh->getOrCreateMaterialId(matName);
+                    }
+                    else
+                    {
+                        currentMaterialId = pMesh->getOrCreateMaterialId(usemtl);
+                    }
+                }
+                else if (usemap!="")
+                {
+                    ObjString matName = pMesh->createUsemapMaterial(usemap);
+                    currentMaterialId = pMesh->getOrCreateMaterialId(matName);
+                }
+            }
+        }
+        
+        pMesh->positions.insert(pMesh->positions.end(), chunk.positions.begin(), chunk.positions.end());
+        pMesh->texcoords.insert(pMesh->texcoords.end(), chunk.texcoords.begin(), chunk.texcoords.end());
+        pMesh->normals.insert(pMesh->normals.end(), chunk.normals.begin(), chunk.normals.end());
+        chunk = ObjChunk();
+        
+        if (stop)
+            break;
+    }
+    
+    return pMesh;
+}
+
 ObjMesh* ObjMesh::LoadFromFile(const ObjString& filename)
 {
     // get the texture path
@@ -595,25 +1023,50 @@ ObjMesh* ObjMesh::LoadFromFile(const ObjString& filename)
     
     if (filename.endsWith(".obj"))
     {
-        std::ifstream ifs(filename);
+        #ifndef WIN32
+        int fd = open(filename.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd<0 || fstat(fd, &st)!=0)
+        {
+            if (fd>=0)
+                close(fd);
+            std::cerr << "ObjLoader: Could not open input obj file " << filename << "\n";
+            return 0;
+        }
+        size_t size = st.st_size;
+        void* data = size>0 ? mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0) : 0;
+        close(fd);
+        if (data==MAP_FAILED)
+        {
+            std::cerr << "ObjLoader: Could not map input obj file " << filename << "\n";
+            return 0;
+        }
+        pMesh = LoadFromMemory(static_cast<const char*>(data), size, texturePath);
+        if (data)
+            munmap(data, size);
+        #else
+        std::ifstream ifs(filename, std::ios::binary);
         if (!ifs)
         {
             std::cerr << "ObjLoader: Could not open input obj file " << filename << "\n";
             return 0;
         }
-        
-        pMesh = LoadFromStream(ifs,texturePath);
+        std::vector<char> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        pMesh = LoadFromMemory(data.empty() ? "" : &data[0], data.size(), texturePath);
+        #endif
     }
     else if (filename.endsWith(".obj.gz"))
     {
-        igzstream ifs(filename);
-        if (!ifs)
+        // the blocks are decompressed in parallel
+        Expe::BlockGzipReader reader;
+        std::vector<char> data;
+        if (!reader.open(filename) || !reader.readAll(data))
         {
             std::cerr << "ObjLoader: Could not open input obj file " << filename << "\n";
             return 0;
         }
         
-        pMesh = LoadFromStream(ifs,texturePath);
+        pMesh = LoadFromMemory(data.empty() ? "" : &data[0], data.size(), texturePath);
     }
     else
     {
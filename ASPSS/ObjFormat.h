@@ -267,6 +267,17 @@ public:
     */
     static ObjMesh* LoadFromFile(const ObjString& filename);
     
+    /** Create a mesh from the content of an obj file.
+        The text is cut at line boundaries into chunks parsed in parallel,
+        the result is the same as LoadFromStream.
+    */
+    static ObjMesh* LoadFromMemory(const char* data, size_t size, const ObjString& texturePath);
+    
+    /** Serial parser reading the stream line per line.
+        \note Only instantiated for std::istream.
+    */
+    template <typename IStream> static ObjMesh* LoadFromStream(IStream& in, const ObjString& texturePath);
+    
     /** Create a mesh where all the attribute indices of a vertex are the same
         and where all the faces of a sub mesh have the material and some number of vertices.
         \param options determines which attributes have to be preserved.
@@ -329,8 +340,6 @@ protected:
     
     bool loadMaterialFile(const ObjString& filename);
     
-    template <typename IStream> static ObjMesh* LoadFromStream(IStream& in, const ObjString& texturePath);
-    
     ObjString findTexture(const ObjString& textureFile, bool isMBC = false) const;
 
     ObjString mTexturePath;
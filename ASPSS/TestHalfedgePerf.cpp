@@ -0,0 +1,214 @@
+/*
+----------------------------------------------------------------------
+
+This source file is part of Expé
+(EXperimental Point Engine)
+
+Copyright (c) 2004-2007 by
+ - Computer Graphics Laboratory, ETH Zurich
+ - IRIT, University of Toulouse
+ - Gael Guennebaud.
+
+----------------------------------------------------------------------
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330,
+Boston, MA  02111-1307, USA.
+
+http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+----------------------------------------------------------------------
+*/
+
+
+
+#include "ExpeCore.h"
+#include "ExpeTimer.h"
+#include "ExpeMesh.h"
+#include "ExpeHalfedgeConnectivity.h"
+
+#include <cstdlib>
+
+using namespace Expe;
+
+// n x n grid of triangles, with optional defects: diagonal holes (two fans per vertex),
+// fins (three faces per edge), duplicated and degenerated faces
+Mesh* createGrid(uint n, bool defects)
+{
+    Mesh* pMesh = new Mesh();
+    for (uint j=0 ; j<=n ; ++j)
+        for (uint i=0 ; i<=n ; ++i)
+            pMesh->addVertex(Vector3f(i, j, 0.1*((i*7+j*3)%5)));
+    SubMesh* pSubMesh = pMesh->createSubMesh("grid");
+    
+    uint extra = pMesh->getNofVertices();
+    for (uint j=0 ; j<n ; ++j)
+    {
+        for (uint i=0 ; i<n ; ++i)
+        {
+            // two holes touching at a corner
+            if (defects && ((i%17==3 && j%13==5) || (i%17==4 && j%13==6)))
+                continue;
+            uint a = j*(n+1)+i, b = a+1, c = a+n+2, d = a+n+1;
+            uint tris[2][3] = {{a,b,c},{a,c,d}};
+            for (uint t=0 ; t<2 ; ++t)
+            {
+                Mesh::FaceHandle face = pSubMesh->createFace(3);
+                for (uint k=0 ; k<3 ; ++k)
+                    face.vertexId(k) = tris[t][k];
+            }
+            if (defects && (i*31+j*17)%997==0)
+            {
+                if ((i+j)%3==0)
+                {
+                    // fin on the diagonal
+                    pMesh->addVertex(Vector3f(i+0.5, j+0.5, 1.));
+                    Mesh::FaceHandle face = pSubMesh->createFace(3);
+                    face.vertexId(0) = a; face.vertexId(1) = c; face.vertexId(2) = extra++;
+                }
+                else if ((i+j)%3==1)
+                {
+                    // duplicated face
+                    Mesh::FaceHandle face = pSubMesh->createFace(3);
+                    face.vertexId(0) = a; face.vertexId(1) = b; face.vertexId(2) = c;
+                }
+                else
+                {
+                    // degenerated face
+                    Mesh::FaceHandle face = pSubMesh->createFace(3);
+                    face.vertexId(0) = a; face.vertexId(1) = b; face.vertexId(2) = a;
+                }
+            }
+        }
+    }
+    return pMesh;
+}
+
+// reference connectivity built face by face with createFace
+HalfedgeConnectivity* buildIncremental(const Mesh* pSrc, MeshPtr& pDst)
+{
+    pDst = new Mesh();
+    for (uint i=0 ; i<pSrc->getNofVertices() ; ++i)
+        pDst->addVertex(pSrc->getVertex(i).position());
+    pDst->createSubMesh("grid");
+    HalfedgeConnectivity* pHec = new HalfedgeConnectivity(pDst, Quiet);
+    const SubMesh* pSubMesh = pSrc->getSubMesh(0);
+    for (uint j=0 ; j<pSubMesh->getNofFaces() ; ++j)
+    {
+        Mesh::ConstFaceHandle face = pSubMesh->getFace(j);
+        IndexArray vertexIds;
+        for (uint k=0 ; k<face.nofVertices() ; ++k)
+            vertexIds.push_back(face.vertexId(k));
+        pHec->createFace(vertexIds, 0, Quiet);
+    }
+    return pHec;
+}
+
+uint countFaces(HalfedgeConnectivity* pHec)
+{
+    uint count = 0;
+    for (uint j=0 ; j<pHec->getNofFaces() ; ++j)
+        if (!pHec->getFaceStatus(HEC::FaceId(0,j)).isDeleted())
+            count++;
+    return count;
+}
+
+// the halfedges of a clean mesh do not depend on the construction
+bool sameHalfedges(const HalfedgeConnectivity* pA, const HalfedgeConnectivity* pB)
+{
+    if (pA->getNofEdges()!=pB->getNofEdges() || pA->getNofVertices()!=pB->getNofVertices())
+        return false;
+    for (uint i=0 ; i<pA->getNofHalfedges() ; ++i)
+    {
+        const HEC::Halfedge& a = pA->getHalfedge(i);
+        const HEC::Halfedge& b = pB->getHalfedge(i);
+        if (a.toVertexId!=b.toVertexId || a.faceId!=b.faceId || a.nextHalfedgeId!=b.nextHalfedgeId)
+            return false;
+    }
+    for (uint v=0 ; v<pA->getNofVertices() ; ++v)
+    {
+        if (pA->isBoundary(HEC::VertexId(v))!=pB->isBoundary(HEC::VertexId(v))
+            || pA->computeValence(v)!=pB->computeValence(v))
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    // usage: TestHalfedgePerf [grid size]
+    uint n = argc>1 ? atoi(argv[1]) : 700;
+    Timer timer;
+    bool ok = true;
+    
+    for (uint defects=0 ; defects<2 ; ++defects)
+    {
+        MeshPtr pMesh = createGrid(n, defects);
+        std::cout << (defects ? "grid with defects: " : "clean grid: ") << pMesh->getNofFaces() << " faces\n";
+        
+        timer.reset(); timer.start();
+        MeshPtr pRefMesh;
+        HalfedgeConnectivity* pRef = buildIncremental(pMesh, pRefMesh);
+        timer.stop();
+        std::cout << "  face by face:\t" << timer.value() << "s\t" << countFaces(pRef) << " faces\n";
+        
+        timer.reset(); timer.start();
+        HalfedgeConnectivity* pHec = new HalfedgeConnectivity(pMesh, Quiet);
+        timer.stop();
+        std::cout << "  bulk:        \t" << timer.value() << "s\t" << countFaces(pHec) << " faces\n";
+        
+        bool valid = pHec->checkIntegrity();
+        std::cout << "  integrity: " << (valid ? "ok" : "FAILED") << "\n";
+        ok = ok && valid;
+        if (!defects)
+        {
+            bool same = sameHalfedges(pRef, pHec);
+            std::cout << "  identical halfedges: " << (same ? "yes" : "NO") << "\n";
+            ok = ok && same;
+        }
+        
+        // local updates keep the IFS mesh in sync
+        uint nofFlips = 0;
+        for (uint e=0 ; e<pHec->getNofEdges() ; e+=7)
+        {
+            if (!pHec->getEdgeStatus(e).isDeleted() && pHec->isFlipOk(e))
+            {
+                pHec->flip(e);
+                nofFlips++;
+            }
+        }
+        uint nofCollapses = 0;
+        for (uint e=3 ; e<pHec->getNofEdges() ; e+=101)
+        {
+            HEC::HalfedgeId hid = pHec->halfedgeId(HEC::EdgeId(e), 0);
+            if (pHec->isCollapseOk(hid))
+            {
+                pHec->collapse(hid);
+                nofCollapses++;
+            }
+        }
+        pHec->garbage_collection();
+        delete pHec;
+        
+        // a rebuild from the updated IFS mesh must give a valid connectivity with the same faces
+        uint nofFaces = pMesh->getNofFaces();
+        pHec = new HalfedgeConnectivity(pMesh, Quiet);
+        valid = pHec->checkIntegrity() && countFaces(pHec)==nofFaces;
+        std::cout << "  " << nofFlips << " flips, " << nofCollapses << " collapses, rebuild: " << (valid ? "ok" : "FAILED") << "\n";
+        ok = ok && valid;
+        
+        delete pHec;
+        delete pRef;
+    }
+    return ok ? 0 : 1;
+}
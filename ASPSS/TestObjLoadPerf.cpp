@@ -0,0 +1,164 @@
+/*
+----------------------------------------------------------------------
+
+This source file is part of Expé
+(EXperimental Point Engine)
+
+Copyright (c) 2004-2007 by
+ - Computer Graphics Laboratory, ETH Zurich
+ - IRIT, University of Toulouse
+ - Gael Guennebaud.
+
+----------------------------------------------------------------------
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330,
+Boston, MA  02111-1307, USA.
+
+http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+----------------------------------------------------------------------
+*/
+
+
+
+#include "ExpeTimer.h"
+#include "ObjFormat.h"
+
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace Expe;
+
+// a mesh with the different vertex and face syntaxes
+void writeTestFile(const char* filename, uint n)
+{
+    FILE* fp = fopen(filename, "wb");
+    fprintf(fp, "# test mesh\n");
+    for (uint i=0 ; i<n ; ++i)
+    {
+        for (uint j=0 ; j<n ; ++j)
+        {
+            float x = float(i)/n, y = float(j)/n, z = 1e-3f*float(rand())/RAND_MAX;
+            if ((i+j)%7==0)
+                fprintf(fp, "v %.9g %.9g %.9e\r\n", x, y, z);
+            else
+                fprintf(fp, "v %g %g %g\n", x, y, z);
+            fprintf(fp, "vn %.6f %.6f 1\n", z, -z);
+            fprintf(fp, "vt %g %g # uv\n", x, y);
+        }
+    }
+    // the faces of a group all have the same attributes
+    for (uint i=0 ; i+1<n ; ++i)
+    {
+        uint group = i/(n/4+1);
+        if (i%(n/4+1)==0)
+            fprintf(fp, "g part%d\nusemtl mat%d\n", group, i%3);
+        for (uint j=0 ; j+1<n ; ++j)
+        {
+            uint a = i*n+j+1, b = a+1, c = a+n+1, d = a+n;
+            if (group%3==0)
+                fprintf(fp, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, c, c, c);
+            else if (group%3==1)
+                fprintf(fp, "f %d//%d %d//%d %d//%d %d//%d\n", a, a, b, b, c, c, d, d);
+            else
+                fprintf(fp, "f %d %d %d\n", a, c, d);
+        }
+    }
+    fclose(fp);
+}
+
+bool sameMesh(const ObjMesh* a, const ObjMesh* b)
+{
+    if (a->positions.size()!=b->positions.size() || a->normals.size()!=b->normals.size()
+        || a->texcoords.size()!=b->texcoords.size() || a->getNofSubMeshes()!=b->getNofSubMeshes()
+        || a->getNofMaterials()!=b->getNofMaterials())
+        return false;
+    if ( (!a->positions.empty() && memcmp(&a->positions[0], &b->positions[0], a->positions.size()*sizeof(ObjVector3)))
+        || (!a->normals.empty() && memcmp(&a->normals[0], &b->normals[0], a->normals.size()*sizeof(ObjVector3)))
+        || (!a->texcoords.empty() && memcmp(&a->texcoords[0], &b->texcoords[0], a->texcoords.size()*sizeof(ObjVector2))) )
+        return false;
+    for (uint s=0 ; s<a->getNofSubMeshes() ; ++s)
+    {
+        const ObjSubMesh* sa = a->getSubMesh(s);
+        const ObjSubMesh* sb = b->getSubMesh(s);
+        if (sa->getName()!=sb->getName() || sa->getNofFaces()!=sb->getNofFaces()
+            || sa->getConstNofVerticesPerFace()!=sb->getConstNofVerticesPerFace())
+            return false;
+        for (uint f=0 ; f<sa->getNofFaces() ; ++f)
+        {
+            ObjConstFaceHandle fa = sa->getFace(f);
+            ObjConstFaceHandle fb = sb->getFace(f);
+            if (fa.nofVertices()!=fb.nofVertices() || fa.materialId()!=fb.materialId())
+                return false;
+            for (uint k=0 ; k<fa.nofVertices() ; ++k)
+            {
+                if (fa.vPositionId(k)!=fb.vPositionId(k))
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    // usage: TestObjLoadPerf [file.obj] or TestObjLoadPerf -n [grid size]
+    std::string filename = "/tmp/TestObjLoadPerf.obj";
+    if (argc>2 && std::string(argv[1])=="-n")
+        writeTestFile(filename.c_str(), atoi(argv[2]));
+    else if (argc>1)
+        filename = argv[1];
+    else
+        writeTestFile(filename.c_str(), 700);
+    
+    Timer timer;
+    
+    timer.reset(); timer.start();
+    std::ifstream ifs(filename.c_str());
+    ObjMesh* pSerial = ObjMesh::LoadFromStream<std::istream>(ifs, "");
+    timer.stop();
+    Real tSerial = timer.value();
+    
+    timer.reset(); timer.start();
+    ObjMesh* pParallel = ObjMesh::LoadFromFile(filename);
+    timer.stop();
+    Real tParallel = timer.value();
+    
+    if (!pSerial || !pParallel)
+    {
+        std::cout << "could not load " << filename << "\n";
+        return 1;
+    }
+    
+    uint nofFaces = 0;
+    for (uint s=0 ; s<pParallel->getNofSubMeshes() ; ++s)
+        nofFaces += pParallel->getSubMesh(s)->getNofFaces();
+    
+    // the texcoord and normal ids are compared through the indexed face sets
+    ObjMesh* pSerialIFS = pSerial->createIndexedFaceSet();
+    ObjMesh* pParallelIFS = pParallel->createIndexedFaceSet();
+    bool same = sameMesh(pSerial, pParallel) && sameMesh(pSerialIFS, pParallelIFS);
+    delete pSerialIFS;
+    delete pParallelIFS;
+    std::cout << pParallel->positions.size() << " vertices, " << nofFaces << " faces\n";
+    std::cout << "  LoadFromStream:\t" << tSerial << "s\n";
+    std::cout << "  LoadFromFile:  \t" << tParallel << "s\t(x" << tSerial/tParallel << ")\n";
+    std::cout << "  identical meshes: " << (same ? "yes" : "NO") << "\n";
+    
+    delete pSerial;
+    delete pParallel;
+    return same ? 0 : 1;
+}
@@ -95,6 +95,67 @@ int main(int argc, char* argv[])
         }
     }
     
+    // layout test: round trip through the structure of arrays layout
+    {
+        PointSet* pRef = new PointSet(PointSet::Attribute_position
+            | PointSet::Attribute_radius
+            | 3*PointSet::Attribute_normal
+            | PointSet::Attribute_color);
+        PointSet* pSoA = new PointSet(PointSet::Attribute_position
+            | PointSet::Attribute_radius
+            | 3*PointSet::Attribute_normal
+            | PointSet::Attribute_color, StructureOfArrays);
+        PointSet* pConverted = new PointSet(PointSet::Attribute_position
+            | PointSet::Attribute_radius
+            | 3*PointSet::Attribute_normal
+            | PointSet::Attribute_color);
+        
+        PointSet* sets[3] = {pRef, pSoA, pConverted};
+        for (int k=0 ; k<3 ; ++k)
+        {
+            // enough points to reallocate several times
+            for (int i=0 ; i<30000 ; ++i)
+            {
+                PointSet::PointHandle pt = sets[k]->append();
+                pt.position() = Vector3(i,i+1,i+2);
+                pt.radius() = 0.5*i;
+                pt.normal(0) = 2*Vector3(i,i+1,i+2);
+                pt.normal(1) = 3*Vector3(i,i+1,i+2);
+                pt.normal(2) = 4*Vector3(i,i+1,i+2);
+                pt.color() = Rgba(i%256,(i/256)%256,0,255);
+            }
+            if (k==2)
+                sets[k]->setLayout(StructureOfArrays);
+            sets[k]->erase(uint(5));
+        }
+        pConverted->setLayout(ArrayOfStructures);
+        
+        bool ok = pSoA->getLayout()==StructureOfArrays && pConverted->getLayout()==ArrayOfStructures;
+        PointSet::ConstVector3Span positions = static_cast<const PointSet*>(pSoA)->span(PointSet::Attribute_position);
+        ok = ok && positions.isContiguous();
+        for (int k=1 ; k<3 ; ++k)
+        {
+            ok = ok && sets[k]->size()==pRef->size();
+            for (uint i=0 ; ok && i<pRef->size() ; ++i)
+            {
+                PointSet::PointHandle a = pRef->at(i);
+                PointSet::PointHandle b = sets[k]->at(i);
+                ok = a.position()==b.position() && a.radius()==b.radius()
+                    && a.normal(0)==b.normal(0) && a.normal(1)==b.normal(1) && a.normal(2)==b.normal(2)
+                    && a.color()==b.color();
+            }
+        }
+        for (uint i=0 ; ok && i<pRef->size() ; ++i)
+            ok = positions[i]==pRef->at(i).position();
+        
+        std::cout << "layout test " << (ok ? "passed" : "FAILED") << "\n";
+        delete pRef;
+        delete pSoA;
+        delete pConverted;
+        if (!ok)
+            return 1;
+    }
+    
     // test const
     {
 //         const PointSet* pConstPoints = pPoints;
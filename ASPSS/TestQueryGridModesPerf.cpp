@@ -0,0 +1,119 @@
+/*
+----------------------------------------------------------------------
+
+This source file is part of Expé
+(EXperimental Point Engine)
+
+Copyright (c) 2004-2007 by
+ - Computer Graphics Laboratory, ETH Zurich
+ - IRIT, University of Toulouse
+ - Gael Guennebaud.
+
+----------------------------------------------------------------------
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation version 2
+of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330,
+Boston, MA  02111-1307, USA.
+
+http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+----------------------------------------------------------------------
+*/
+
+
+
+
+
+#include "ExpeCore.h"
+#include "ExpeVector3.h"
+
+#include "ExpePointSet.h"
+#include "ExpeQueryGrid.h"
+#include "ExpeTimer.h"
+
+
+using namespace Expe;
+
+// ball queries at every sample, returns the time, the number of neighbors and the sum of their distances
+Real runBallQueries(QueryGrid* pGrid, const PointSet* pPoints, Real radius, Real& checksum, uint& nofFound)
+{
+    Timer timer;
+    checksum = 0.;
+    nofFound = 0;
+    timer.reset(); timer.start();
+    for (uint k=0 ; k<pPoints->size() ; ++k)
+    {
+        pGrid->doQueryBall(pPoints->at(k).position(), radius);
+        nofFound += pGrid->getNofFoundNeighbors();
+        for (uint j=0 ; j<pGrid->getNofFoundNeighbors() ; ++j)
+            checksum += pGrid->getNeighborSquaredDistance(j);
+    }
+    timer.stop();
+    return timer.value();
+}
+
+int main(int argc, char* argv[])
+{
+    // usage: TestQueryGridModesPerf [nb points] [nb bits] [radius] [k]
+    // Only the public API of QueryGrid is used, so that the same program can be
+    // built against other versions of ExpeQueryGrid.cpp to compare them.
+    uint nb = argc>1 ? atoi(argv[1]) : 200000;
+    int nofBits = argc>2 ? atoi(argv[2]) : 7;
+    Real radius = argc>3 ? atof(argv[3]) : 1.0;
+    uint k = argc>4 ? atoi(argv[4]) : 16;
+    
+    // create a random set of points on a sphere
+    srand(1);
+    PointSet* pPoints = new PointSet(PointSet::Attribute_position);
+    for (uint i=0 ; i<nb ; ++i)
+    {
+        PointSet::PointHandle pt = pPoints->append();
+        pt.position() = (Vector3::Random()-0.5).normalized()*50.;
+    }
+    std::cout << nb << " points, " << nofBits << " bits, radius " << radius << ", at most " << k << " neighbors\n";
+    
+    Timer timer;
+    Real checksum;
+    uint nofFound;
+    Real t;
+    
+    // static grid, filled by insertAll()
+    timer.reset(); timer.start();
+    QueryGrid* pGrid = new QueryGrid(pPoints, nofBits, 100., true);
+    timer.stop(); std::cout << "  insertAll:\t" << timer.value() << "s\n";
+    pGrid->setMaxNofNeighbors(k);
+    t = runBallQueries(pGrid, pPoints, radius, checksum, nofFound);
+    std::cout << "  ball static:\t" << t << "s\t" << nofFound << " neighbors\tchecksum " << checksum << "\n";
+    delete pGrid;
+    
+    // dynamic grid, filled by insert()
+    pGrid = new QueryGrid(pPoints, nofBits, 100., false);
+    pGrid->setMaxNofNeighbors(k);
+    timer.reset(); timer.start();
+    for (uint i=0 ; i<nb ; ++i)
+        pGrid->insert(i);
+    timer.stop(); std::cout << "  insert:\t" << timer.value() << "s\n";
+    t = runBallQueries(pGrid, pPoints, radius, checksum, nofFound);
+    std::cout << "  ball dynamic:\t" << t << "s\t" << nofFound << " neighbors\tchecksum " << checksum << "\n";
+    
+    timer.reset(); timer.start();
+    for (uint i=0 ; i<nb ; i+=2)
+        pGrid->remove(i);
+    timer.stop(); std::cout << "  remove half:\t" << timer.value() << "s\n";
+    t = runBallQueries(pGrid, pPoints, radius, checksum, nofFound);
+    std::cout << "  ball removed:\t" << t << "s\t" << nofFound << " neighbors\tchecksum " << checksum << "\n";
+    
+    delete pGrid;
+    delete pPoints;
+    return 0;
+}
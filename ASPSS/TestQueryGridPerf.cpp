@@ -39,17 +39,57 @@ http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
 #include "ExpePointSet.h"
 #include "ExpeQueryGrid.h"
 #include "ExpeKdTree.h"
+#include "ExpeFlatKdTree.h"
 #include "ExpeTimer.h"
 
 
 using namespace Expe;
 
+// runs the same queries on a structure and returns the time and the sum of the found distances
+template <class QueryT>
+Real runQueries(QueryT* pQuery, const PointSet* pPoints, uint nofQueries, Real radius, Real& checksum, uint& nofFound)
+{
+    Timer timer;
+    checksum = 0.;
+    nofFound = 0;
+    timer.reset(); timer.start();
+    for (uint k=0 ; k<nofQueries ; ++k)
+    {
+        // queries are taken slightly off the samples
+        Vector3 q = pPoints->at(k%pPoints->size()).position() + Vector3(0.01,-0.02,0.015);
+        if (radius>0.)
+            pQuery->doQueryBall(q, radius);
+        else
+            pQuery->doQueryK(q);
+        nofFound += pQuery->getNofFoundNeighbors();
+        for (uint j=0 ; j<pQuery->getNofFoundNeighbors() ; ++j)
+            checksum += pQuery->getNeighborSquaredDistance(j);
+    }
+    timer.stop();
+    return timer.value();
+}
+
+template <class QueryT>
+void report(const char* name, QueryT* pQuery, const PointSet* pPoints, uint nofQueries, Real radius)
+{
+    Real checksum;
+    uint nofFound;
+    Real t = runQueries(pQuery, pPoints, nofQueries, radius, checksum, nofFound);
+    std::cout << "  " << name << ":\t" << t << "s\t" << Real(nofQueries)/t*1e-6 << " Mq/s\t"
+              << nofFound << " neighbors\tchecksum " << checksum << "\n";
+}
+
 int main(int argc, char* argv[])
 {
-    // create a random set of points
+    // usage: TestQueryGridPerf [nb points] [k] [radius] [nb queries]
+    uint nb = argc>1 ? atoi(argv[1]) : 100000;
+    uint k = argc>2 ? atoi(argv[2]) : 12;
+    Real radius = argc>3 ? atof(argv[3]) : 0.15;
+    uint nofQueries = argc>4 ? atoi(argv[4]) : 100000;
+    
+    // create a random set of points on a sphere
     PointSet* pPoints = new PointSet(PointSet::Attribute_position);
-    uint nb = 100000;
-    for (int i=0 ; i<nb ; ++i)
+    for (uint i=0 ; i<nb ; ++i)
     {
         PointSet::PointHandle pt = pPoints->append();
         pt.position() = (Vector3::Random()-0.5).normalized()*50.;
@@ -60,55 +100,67 @@ int main(int argc, char* argv[])
     
     timer.reset(); timer.start();
     QueryGrid* pGrid = new QueryGrid(pPoints);
-    timer.stop(); std::cout << "QueryGrid construction: " << timer.value() << "s\n";
+    timer.stop(); std::cout << "QueryGrid construction:  " << timer.value() << "s\n";
     
     timer.reset(); timer.start();
     KdTree* pKdTree = new KdTree(pPoints,12);
-    timer.stop(); std::cout << "KdTree construction:    " << timer.value() << "s\n";
+    timer.stop(); std::cout << "KdTree construction:     " << timer.value() << "s\n";
     
-    pGrid->setMaxNofNeighbors(12);
-    pKdTree->setMaxNofNeighbors(12);
-
+    timer.reset(); timer.start();
+    FlatKdTree* pFlatKdTree = new FlatKdTree(pPoints,12);
+    timer.stop(); std::cout << "FlatKdTree construction: " << timer.value() << "s\n";
+    
+    pGrid->setMaxNofNeighbors(k);
+    pKdTree->setMaxNofNeighbors(k);
+    pFlatKdTree->setMaxNofNeighbors(k);
     
+    std::cout << "k-NN queries (k=" << k << ")\n";
+    report("KdTree", pKdTree, pPoints, nofQueries, 0.);
+    report("FlatKdTree", pFlatKdTree, pPoints, nofQueries, 0.);
     
-    for (;;)
+    std::cout << "ball queries (r=" << radius << ", at most " << k << ")\n";
+    report("QueryGrid", pGrid, pPoints, nofQueries, radius);
+    report("KdTree", pKdTree, pPoints, nofQueries, radius);
+    report("FlatKdTree", pFlatKdTree, pPoints, nofQueries, radius);
+    
+    // both trees must find the same neighbors
+    uint nofMismatches = 0;
+    for (uint i=0 ; i<nofQueries ; ++i)
     {
-        timer.reset();
-        timer.start();
-        for (int k=0 ; k<100000 ; ++k)
-        {
-            //pGrid->doQueryK(pPoints->at(k%nb).position());
-            pGrid->doQueryBall(pPoints->at(k%nb).position(), 0.15);
-//             pGrid->sortNeighbors();
-//             pKdTree->doQueryK(pPoints->at(k%nb).position());
-//             pKdTree->sortNeighbors();
-//             
-//             if (pGrid->getNeighborId(pGrid->getNofFoundNeighbors()-1) != pKdTree->getNeighborId(pKdTree->getNofFoundNeighbors()-1))
-//             {
-//                 for (uint j=0 ; j<pGrid->getNofFoundNeighbors() ; ++j)
-//                     std::cout << pGrid->getNeighborId(j)<<","
-//                         <<pGrid->getNeighborSquaredDistance(j)/*<<","
-//                         <<pGrid->getNeighbor(j).position()*/ << " ";
-//                 std::cout << "\n";
-//                 for (uint j=0 ; j<pKdTree->getNofFoundNeighbors() ; ++j)
-//                     std::cout << pKdTree->getNeighborId(j)<<","
-//                         <<pKdTree->getNeighborSquaredDistance(j)/*<<","
-//                         <<pKdTree->getNeighbor(j).position()*/ << " ";
-//                 std::cout << "\n";
-//                 std::cout << "\n";
-//             }
-        }
-        timer.stop();
-        std::cout << "Time for querygrid:\t" << timer.value() << "\n";
-        
-        timer.reset();
-        timer.start();
-        for (int k=0 ; k<100000 ; ++k)
+        Vector3 q = pPoints->at(i%nb).position() + Vector3(0.01,-0.02,0.015);
+        pKdTree->doQueryK(q);
+        pFlatKdTree->doQueryK(q);
+        pKdTree->sortNeighbors();
+        pFlatKdTree->sortNeighbors();
+        bool same = pKdTree->getNofFoundNeighbors()==pFlatKdTree->getNofFoundNeighbors();
+        for (uint j=0 ; same && j<pKdTree->getNofFoundNeighbors() ; ++j)
+            same = pKdTree->getNeighborSquaredDistance(j)==pFlatKdTree->getNeighborSquaredDistance(j);
+        if (!same)
+            nofMismatches++;
+    }
+    std::cout << "k-NN mismatches between KdTree and FlatKdTree: " << nofMismatches << "\n";
+    
+    // const queries on the shared tree, one result per thread
+    Real checksum = 0.;
+    timer.reset(); timer.start();
+    #pragma omp parallel reduction(+:checksum)
+    {
+        QueryDataStructure::QueryResult neighbors(k);
+        #pragma omp for
+        for (int i=0 ; i<int(nofQueries) ; ++i)
         {
-            pKdTree->doQueryK(pPoints->at(k%nb).position());
+            Vector3 q = pPoints->at(i%nb).position() + Vector3(0.01,-0.02,0.015);
+            pFlatKdTree->queryK(q, neighbors);
+            for (uint j=0 ; j<neighbors.getNofFoundNeighbors() ; ++j)
+                checksum += neighbors.getNeighborSquaredDistance(j);
         }
-        timer.stop();
-        std::cout << "Time for kdtree:\t" << timer.value() << "\n";
     }
-    return 0;
+    timer.stop();
+    std::cout << "parallel k-NN queries on a shared FlatKdTree:\t" << timer.value() << "s\tchecksum " << checksum << "\n";
+    
+    delete pFlatKdTree;
+    delete pKdTree;
+    delete pGrid;
+    delete pPoints;
+    return nofMismatches==0 ? 0 : 1;
 }
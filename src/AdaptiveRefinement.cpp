@@ -0,0 +1,145 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#include "AdaptiveRefinement.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// error statistics
+////////////////////////////////////////////////////////////////////////////////
+
+AdaptiveRefinement::AdaptiveRefinement(map<string, string>& parameters, long _grid_size)
+    : grid_size(_grid_size), disc_changed(true)
+{
+    enabled = (atoi(parameters["ADAPTIVE"].c_str()) != 0);
+    target = atof(parameters["TARGET_ERROR"].c_str());
+    double b = atof(parameters["SAMPLE_BUDGET"].c_str());
+    budget = (b < 1.0) ? long(b * grid_size) : long(b);
+    stall = parameters["STALL_RATIO"].empty() ? 0.01 : atof(parameters["STALL_RATIO"].c_str());
+    batch = atoi(parameters["NEWSAMPLES"].c_str());
+}
+
+void AdaptiveRefinement::Observe(const vector<float>* errm, int dim, long npts)
+{
+    double sum = 0.0;
+    double maxe = 0.0;
+    for (int cdim = 0; cdim < dim; cdim++)
+    {
+        #pragma omp parallel for reduction(+:sum)
+        for (int i = 0; i < errm[cdim].size(); i++)
+            sum += errm[cdim][i];
+    }
+    #pragma omp parallel for reduction(max:maxe)
+    for (int i = 0; i < errm[0].size(); i++)
+    {
+        double e = 0.0;
+        for (int cdim = 0; cdim < dim; cdim++)
+            e += errm[cdim][i];
+        maxe = max(maxe, e);
+    }
+    mass.push_back(sum);
+    samples.push_back(npts);
+    printf("Error map: mean %e, max %e, %ld samples.\n", sum / grid_size, maxe, npts);
+}
+
+bool AdaptiveRefinement::Done() const
+{
+    if (!enabled || mass.empty())
+        return false;
+
+    int k = mass.size() - 1;
+    if ((target > 0.0) && (mass[k] / grid_size <= target))
+    {
+        printf("Target error %e reached.\n", target);
+        return true;
+    }
+    if ((budget > 0) && (samples[k] >= budget))
+    {
+        printf("Sample budget %ld reached.\n", budget);
+        return true;
+    }
+    if ((k > 0) && (mass[k - 1] - mass[k] < stall * mass[k - 1]))
+    {
+        printf("Error decreased by less than %2.2lf%%, stopping.\n", 100.0 * stall);
+        return true;
+    }
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// batch size
+////////////////////////////////////////////////////////////////////////////////
+
+int AdaptiveRefinement::NextBatch(long npts) const
+{
+    if (!enabled)
+        return batch;
+
+    long n = batch;
+    int k = mass.size() - 1;
+    if ((target > 0.0) && (k > 0) && (samples[k] > samples[k - 1]) && (mass[k - 1] > mass[k]))
+    {
+        // samples needed if the next ones remove as much error as the last
+        double per_sample = (mass[k - 1] - mass[k]) / (samples[k] - samples[k - 1]);
+        double left = mass[k] - target * grid_size;
+        n = long(left / per_sample);
+        n = min(max(n, long(batch / 4)), long(4 * batch));
+    }
+    if (budget > 0)
+        n = min(n, budget - npts);
+    n = max(n, 1L);
+    printf("Adding %ld samples.\n", n);
+    return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// discontinuities
+////////////////////////////////////////////////////////////////////////////////
+
+void AdaptiveRefinement::Refined(const vector<int>& nids, const vector<closest_site>& query_cls, const DiscontinuitySurfaces* surfaces, int dim)
+{
+    if (disc_changed || (surfaces == NULL))
+    {
+        disc_changed = true;
+        return;
+    }
+    for (int i = 0; (i < nids.size()) && !disc_changed; i++)
+    {
+        int site = query_cls[nids[i]].id;
+        for (int cdim = 0; cdim < dim; cdim++)
+        {
+            const vector<set<int> >& discs = surfaces[cdim].site2discs;
+            if ((site >= 0) && (site < discs.size()) && !discs[site].empty())
+            {
+                disc_changed = true;
+                break;
+            }
+        }
+    }
+}
+
+bool AdaptiveRefinement::ModifiedNeeded(bool last) const
+{
+    return !enabled || last || disc_changed;
+}
+
+void AdaptiveRefinement::ModifiedDone()
+{
+    disc_changed = false;
+}
@@ -0,0 +1,85 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#pragma once
+
+#ifndef __ADAPTIVEREFINEMENT_H__
+#define __ADAPTIVEREFINEMENT_H__
+
+#include "DiscreteSibson.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Adaptive control of the refinement loop (ADAPTIVE=1). After every regular
+// Sibson step the error map (the sum over the components of errm) is
+// observed, and:
+//   - the loop ends when its mean is below TARGET_ERROR, when the samples
+//     reach SAMPLE_BUDGET (a count, or a fraction of the grid when below 1),
+//     or when an iteration lowered the error mass by less than STALL_RATIO
+//     (0.01 by default). That iteration still gets its modified step and
+//     outputs, it is only not refined.
+//   - the next batch is sized from the error mass left above the target and
+//     the mass the last batch removed per sample, between NEWSAMPLES/4 and
+//     4*NEWSAMPLES. Without a target, or before two iterations are known,
+//     it is NEWSAMPLES.
+//   - the modified Sibson step is skipped when none of the samples added
+//     since it last ran is closest to a site of its discontinuities, the
+//     surfaces it would find are the same. The last iteration always runs it.
+// MAX_ITER stays an upper bound, and is not needed with ADAPTIVE=1.
+
+class AdaptiveRefinement
+{
+public:
+	bool enabled;
+	double target;               // mean error, 0 for none
+	long budget;                 // total samples, 0 for none
+	double stall;
+	int batch;                   // NEWSAMPLES
+	long grid_size;
+
+	// error mass and samples of every observed iteration
+	vector<double> mass;
+	vector<long> samples;
+
+	AdaptiveRefinement(map<string, string>& parameters, long _grid_size);
+
+	// error map of the regular Sibson step with npts samples
+	void Observe(const vector<float>* errm, int dim, long npts);
+
+	// true when the loop should stop after this iteration
+	bool Done() const;
+
+	// samples to add to the npts there are
+	int NextBatch(long npts) const;
+
+	// the sites nids were closest to, before they are added
+	void Refined(const vector<int>& nids, const vector<closest_site>& query_cls, const DiscontinuitySurfaces* surfaces, int dim);
+
+	// whether the modified Sibson step has to run, and that it did
+	bool ModifiedNeeded(bool last) const;
+	void ModifiedDone();
+
+private:
+	bool disc_changed;
+};
+
+#endif
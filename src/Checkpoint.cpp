@@ -0,0 +1,255 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#include "Checkpoint.h"
+
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// aligned blocks
+////////////////////////////////////////////////////////////////////////////////
+
+size_t AlignedSize(size_t bytes)
+{
+    return (bytes + CHECKPOINT_ALIGN - 1) & ~size_t(CHECKPOINT_ALIGN - 1);
+}
+
+bool WriteBlock(FILE* fp, const void* data, size_t bytes)
+{
+    static const char zeros[CHECKPOINT_ALIGN] = {0};
+    if ((bytes > 0) && (fwrite(data, 1, bytes, fp) != bytes))
+        return false;
+    size_t pad = AlignedSize(bytes) - bytes;
+    return (pad == 0) || (fwrite(zeros, 1, pad, fp) == pad);
+}
+
+bool MappedCheckpoint::open(const string& filename, bool sequential)
+{
+#ifndef WIN32
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    size = st.st_size;
+    void* p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+        return false;
+    madvise(p, size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+    data = (char*) p;
+    mapped = true;
+    return true;
+#else
+    FILE* fp = fopen(filename.c_str(), "rb");
+    if (fp == NULL)
+        return false;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    data = (char*) malloc(size);
+    bool ok = (fread(data, 1, size, fp) == size);
+    fclose(fp);
+    return ok;
+#endif
+}
+
+MappedCheckpoint::~MappedCheckpoint()
+{
+    if (data == NULL)
+        return;
+#ifndef WIN32
+    if (mapped)
+    {
+        munmap(data, size);
+        return;
+    }
+#endif
+    free(data);
+}
+
+// copy the next block of the mapping into a vector
+template <typename T>
+bool ReadBlock(const MappedCheckpoint& file, size_t& offset, size_t count, vector<T>& out)
+{
+    size_t bytes = count * sizeof(T);
+    if (offset + bytes > file.size)
+        return false;
+    out.resize(count);
+    if (bytes > 0)
+        memcpy(&out[0], file.data + offset, bytes);
+    offset += AlignedSize(bytes);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// write the state of an iteration
+////////////////////////////////////////////////////////////////////////////////
+
+bool WriteCheckpoint(
+        const string& filename,
+        int iter,
+        int seq_idx,
+        int dim,
+        vector<Sample_point>* pts,
+        vector<int>& tree_order,
+        vector<float>* errm,
+        vector<float>& errmt)
+{
+    Timer timer;
+    timer.start();
+
+    CheckpointHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CHECKPOINT_MAGIC, 8);
+    hdr.version = CHECKPOINT_VERSION;
+    hdr.iter = iter;
+    hdr.seq_idx = seq_idx;
+    hdr.dim = dim;
+    hdr.size = errmt.size();
+    hdr.npts = pts[0].size();
+    hdr.ntree = tree_order.size();
+    hdr.sizeof_sample = sizeof(Sample_point);
+
+    // read the generator state without changing it
+#ifndef WIN32
+    unsigned short tmp[3] = {0, 0, 0};
+    unsigned short* cur = seed48(tmp);
+    memcpy(hdr.rng, cur, sizeof(hdr.rng));
+    seed48(hdr.rng);
+#endif
+
+    // write to a temporary file first so a crash never leaves a broken checkpoint
+    string tmpname = filename + string(".tmp");
+    FILE* fp = fopen(tmpname.c_str(), "wb");
+    if (fp == NULL)
+    {
+        printf("Error: could not open %s for writing!\n", tmpname.c_str());
+        return false;
+    }
+    bool ok = WriteBlock(fp, &hdr, sizeof(hdr));
+    for (int cdim = 0; cdim < dim; cdim++)
+        ok = ok && WriteBlock(fp, pts[cdim].empty() ? NULL : &pts[cdim][0], pts[cdim].size() * sizeof(Sample_point));
+    ok = ok && WriteBlock(fp, tree_order.empty() ? NULL : &tree_order[0], tree_order.size() * sizeof(int));
+    for (int cdim = 0; cdim < dim; cdim++)
+        ok = ok && WriteBlock(fp, errm[cdim].empty() ? NULL : &errm[cdim][0], errm[cdim].size() * sizeof(float));
+    ok = ok && WriteBlock(fp, errmt.empty() ? NULL : &errmt[0], errmt.size() * sizeof(float));
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || (rename(tmpname.c_str(), filename.c_str()) != 0))
+    {
+        printf("Error: could not write checkpoint %s!\n", filename.c_str());
+        remove(tmpname.c_str());
+        return false;
+    }
+
+    timer.stop();
+    printf("Write '%s' in %lf sec.\n", filename.c_str(), 0.001 * timer.getElapsedTimeInMilliSec());
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// read the state of an iteration
+////////////////////////////////////////////////////////////////////////////////
+
+bool ReadCheckpoint(
+        const string& filename,
+        int& iter,
+        int& seq_idx,
+        int dim,
+        vector<Sample_point>* pts,
+        vector<int>& tree_order,
+        vector<float>* errm,
+        vector<float>& errmt)
+{
+    Timer timer;
+    timer.start();
+
+    MappedCheckpoint file;
+    if (!file.open(filename))
+    {
+        printf("Error: could not open checkpoint %s!\n", filename.c_str());
+        return false;
+    }
+
+    // check that the file was written by this program for this grid
+    CheckpointHeader hdr;
+    if (file.size < sizeof(hdr))
+    {
+        printf("Error: %s is too short!\n", filename.c_str());
+        return false;
+    }
+    memcpy(&hdr, file.data, sizeof(hdr));
+    if ((memcmp(hdr.magic, CHECKPOINT_MAGIC, 8) != 0) || (hdr.version != CHECKPOINT_VERSION) ||
+        (hdr.dim != dim) || (hdr.sizeof_sample != sizeof(Sample_point)) ||
+        (hdr.size < 0) || (hdr.npts < 0) || (hdr.ntree < 0))
+    {
+        printf("Error: %s is not a compatible checkpoint!\n", filename.c_str());
+        return false;
+    }
+    if ((errmt.size() != 0) && (errmt.size() != hdr.size))
+    {
+        printf("Error: checkpoint grid has %d points instead of %d!\n", hdr.size, int(errmt.size()));
+        return false;
+    }
+
+    size_t offset = AlignedSize(sizeof(hdr));
+    bool ok = true;
+    for (int cdim = 0; cdim < dim; cdim++)
+        ok = ok && ReadBlock(file, offset, hdr.npts, pts[cdim]);
+    ok = ok && ReadBlock(file, offset, hdr.ntree, tree_order);
+    for (int cdim = 0; cdim < dim; cdim++)
+        ok = ok && ReadBlock(file, offset, hdr.size, errm[cdim]);
+    ok = ok && ReadBlock(file, offset, hdr.size, errmt);
+    if (!ok)
+    {
+        printf("Error: checkpoint %s is truncated!\n", filename.c_str());
+        return false;
+    }
+
+    // the kd-tree is rebuilt from the sites in this order
+    for (int i = 0; i < hdr.ntree; i++)
+    {
+        if ((tree_order[i] < 0) || (tree_order[i] >= hdr.npts))
+        {
+            printf("Error: checkpoint %s has an invalid kd-tree site %d!\n", filename.c_str(), tree_order[i]);
+            return false;
+        }
+    }
+
+    // continue the same random sequence
+#ifndef WIN32
+    seed48(hdr.rng);
+#endif
+    iter = hdr.iter;
+    seq_idx = hdr.seq_idx;
+
+    timer.stop();
+    printf("Read '%s' (iteration %d, %d samples) in %lf sec.\n", filename.c_str(), iter, hdr.npts, 0.001 * timer.getElapsedTimeInMilliSec());
+    return true;
+}
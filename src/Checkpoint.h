@@ -0,0 +1,102 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#pragma once
+
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include "DiscreteSibson.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Binary checkpoint of the refinement state. The file is a fixed header
+// followed by raw arrays, each starting on a 64 byte boundary so that
+// they can be used straight from a memory mapping:
+//   - the sample sites of every component
+//   - the order in which the sites were inserted in the kd-tree
+//   - the error maps of every component and their sum
+// The state of the drand48() generator used by Refine() is kept in the
+// header. The closest sites and natural neighbors are not saved, the next
+// regular Sibson step recomputes them. Neither is the state of
+// AdaptiveRefinement and SibsonPyramid, so a resumed run only follows the
+// same path as an uninterrupted one without ADAPTIVE and MULTIRES.
+
+#define CHECKPOINT_MAGIC "SPARSECK"
+#define CHECKPOINT_VERSION 2
+#define CHECKPOINT_ALIGN 64
+
+struct CheckpointHeader
+{
+	char magic[8];
+	int version;
+	int iter;
+	int seq_idx;
+	int dim;
+	int size;              // number of grid points
+	int npts;              // number of sites per component
+	int ntree;             // number of sites in the kd-tree
+	int sizeof_sample;     // sizeof(Sample_point) of the writer
+	unsigned short rng[3]; // drand48() state
+	unsigned short pad;
+};
+
+// a whole file in memory, mapped when possible. Sequential files are read
+// ahead, the others only page in what is touched.
+struct MappedCheckpoint
+{
+	char* data;
+	size_t size;
+	bool mapped;
+
+	MappedCheckpoint() : data(NULL), size(0), mapped(false) {}
+	~MappedCheckpoint();
+
+	bool open(const string& filename, bool sequential = true);
+};
+
+// blocks padded to CHECKPOINT_ALIGN bytes
+size_t AlignedSize(size_t bytes);
+bool WriteBlock(FILE* fp, const void* data, size_t bytes);
+
+bool WriteCheckpoint(
+	const string& filename,
+	int iter,
+	int seq_idx,
+	int dim,
+	vector<Sample_point>* pts,
+	vector<int>& tree_order,
+	vector<float>* errm,
+	vector<float>& errmt);
+
+// returns false if the file can not be used
+bool ReadCheckpoint(
+	const string& filename,
+	int& iter,
+	int& seq_idx,
+	int dim,
+	vector<Sample_point>* pts,
+	vector<int>& tree_order,
+	vector<float>* errm,
+	vector<float>& errmt);
+
+#endif
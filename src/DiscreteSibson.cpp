@@ -19,6 +19,7 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <https://www.gnu.org/licenses/>.
 **************************************************************************/
 #include "DiscreteSibson.h"
+#include "FTLE.h"
 
 //get function for the property map
 My_point_property_map::reference 
@@ -40,12 +41,6 @@ int lrand48()
 
 
 
-void dumpMallinfo(void) 
-{
-  struct mallinfo m = mallinfo();
-  printf("uordblks = %zu, fordblks = %zu, hblkhd = %zu\n", m.uordblks, m.fordblks, m.hblkhd);
-}
-
 void VisFitPts(void* reconsc, vector<float3>& fitpts, vector<float3>& fitpts_n)
 {
     printf("Start creating scene\n");
@@ -166,27 +161,27 @@ void VisFitPts(void* reconsc, vector<float3>& fitpts, vector<float3>& fitpts_n)
 ////////////////////////////////////////////////////////////////////////////////
 // find the potential at a point
 ////////////////////////////////////////////////////////////////////////////////
-double FindPotential(NormalConstrainedSphericalMlsSurface* surface, Vector3f& cpt)
+double FindPotential(DiscSurface* surface, Vector3f& cpt, DiscSurface::Evaluation& eval)
 {
     // find the potential
-    double b = surface->potentiel(cpt);
+    double b = surface->potentiel(cpt, eval);
     if (abs(b) > 1e+6)
     {
         return b;
     }
 
     // project point
-    Vector3f Cv = surface->mAlgebraicSphere.asSphere().mCenter;
+    Vector3f Cv = eval.sphere.asSphere().mCenter;
     float3 C = make_float3(Cv.x, Cv.y, Cv.z);
     Vector3f ppt = cpt;
     Vector3f gpt;
-    Expe::Color col;
-    bool ret = surface->project(ppt, gpt, col);
+    bool ret = surface->project(ppt, gpt, eval);
     float3 A = make_float3(cpt.x, cpt.y, cpt.z);
     float3 B = make_float3(ppt.x, ppt.y, ppt.z);
 
     // check number of samples
-    int nofn = surface->editNeighborhood()->getNofFoundNeighbors();
+    const DiscSurface::Neighbors& nei = eval.neighbors;
+    int nofn = nei.size;
     if (nofn < 5)
     {
         return 1e9;
@@ -198,12 +193,12 @@ double FindPotential(NormalConstrainedSphericalMlsSurface* surface, Vector3f& cp
     double r1;
     for (int k = 0; k < nofn; k++)
     {
-        float3 t = make_float3(surface->editNeighborhood()->getNeighbor(k).position().x, surface->editNeighborhood()->getNeighbor(k).position().y, surface->editNeighborhood()->getNeighbor(k).position().z);
+        float3 t = make_float3(nei.px[k], nei.py[k], nei.pz[k]);
         if (length(t - B) < mind)
         {
             mind = length(t - B);
             N1 = t;
-            r1 = surface->editNeighborhood()->getNeighbor(k).radius();
+            r1 = nei.radius[k];
         }
     }
     if (dot(normalize(C - B), normalize(C - N1)) < 0.9)
@@ -232,9 +227,10 @@ void FindClosest(
         vector<bool>& site_is_disc,
         Tree*& tree,
         int nosurf,
-        vector<NormalConstrainedSphericalMlsSurface*>& surfaces,
+        vector<DiscSurface*>& surfaces,
         vector<set<int> >& site2discs)
 {
+    ProfileScope scope("closest");
     NrrdWrapper3D* recons = (NrrdWrapper3D*) reconsc;
     double min_spc = recons->min_spc;
 
@@ -259,47 +255,159 @@ void FindClosest(
 
     // Find the closest site to each of the grid points
     query_cls.resize(recons->Size());
-    #pragma omp parallel for
-    for (int i = 0; i < query_cls.size(); i++)
+    #pragma omp parallel
     {
-        float3 qc = recons->Addr2Space(i);
+        // neighbors and fit of the surface queries of this thread
+        int thn = omp_get_thread_num();
+        DiscSurface::Evaluation eval;
+        #pragma omp for
+        for (int i = 0; i < query_cls.size(); i++)
+        {
+            float3 qc = recons->Addr2Space(i);
 
-        Point_3 query(qc.x, qc.y, qc.z);
-        K_neighbor_search search(*tree, query, 1);
-        Distance tr_dist;
-        query_cls[i].id = boost::get<1>(search.begin()->first);
-        query_cls[i].dist = tr_dist.inverse_of_transformed_distance(search.begin()->second);
-        if (nosurf == 0)
-            continue;
+            Point_3 query(qc.x, qc.y, qc.z);
+            K_neighbor_search search(*tree, query, 1);
+            Distance tr_dist;
+            query_cls[i].id = boost::get<1>(search.begin()->first);
+            query_cls[i].dist = tr_dist.inverse_of_transformed_distance(search.begin()->second);
+            if (nosurf == 0)
+                continue;
 
-        // check if it has a natural neighbor for a particular surface
-        // requires that the natural coordinates be available
-        vector<bool> ps(nosurf);
-        for (int it = 0; it < query_nc[i].size(); it++)
-        {
-            int site = query_nc[i].nv[it];
-            for (set<int>::iterator it2 = site2discs[site].begin(); it2 != site2discs[site].end(); it2++)
+            // check if it has a natural neighbor for a particular surface
+            // requires that the natural coordinates be available
+            vector<bool> ps(nosurf);
+            for (int it = 0; it < query_nc[i].size(); it++)
+            {
+                int site = query_nc[i].nv[it];
+                for (set<int>::iterator it2 = site2discs[site].begin(); it2 != site2discs[site].end(); it2++)
+                {
+                    ps[*it2] = true;
+                }
+            }
+
+            // now check closest surface that is 
+            int soff = thn * nosurf;
+            Vector3f cpt = Vector3(qc.x / min_spc, qc.y / min_spc, qc.z / min_spc);
+            for (int k = 0; k < nosurf; k++)
             {
-                ps[*it2] = true;
+                if (!ps[k])
+                    continue;
+                double p = FindPotential(surfaces[soff + k], cpt, eval);
+                if ((abs(p) * min_spc) < query_cls[i].dist)
+                {
+                    query_cls[i].id = -(k + 1);
+                    query_cls[i].dist = abs(p) * min_spc;
+                }
             }
         }
+    }
+}
 
-        // now check closest surface that is 
-        int thn = omp_get_thread_num();
-        int soff = thn * nosurf;
-        Vector3f cpt = Vector3(qc.x / min_spc, qc.y / min_spc, qc.z / min_spc);
-        for (int k = 0; k < nosurf; k++)
+////////////////////////////////////////////////////////////////////////////////
+// discrete balls
+////////////////////////////////////////////////////////////////////////////////
+
+// largest balls kept by each thread and how many, largest box of counts
+#define BALL_CACHE_RADIUS 16
+#define BALL_CACHE_SIZE 4096
+#define BALL_BOX_MAX (1 << 22)
+
+// The grid points of the ball of (grid) radius fdist around a grid point as
+// runs along x: row (dy, dz) is |dx| <= Span(dy, dz), or empty when it is
+// negative. A point is in the ball when dx^2 + dy^2 + dz^2 <= fdist^2 with
+// the square taken in float, as the natural neighbors always were.
+class BallSpans
+{
+public:
+    int radius;
+    vector<short> span;
+
+    void Build(float fdist)
+    {
+        radius = ceil(fdist);
+        float r2 = fdist * fdist;
+        int n = 2 * radius + 1;
+        span.resize(n * n);
+        for (int dz = -radius; dz <= radius; dz++)
         {
-            if (!ps[k])
-                continue;
-            double p = FindPotential(surfaces[soff + k], cpt);
-            if ((abs(p) * min_spc) < query_cls[i].dist)
+            for (int dy = -radius; dy <= radius; dy++)
             {
-                query_cls[i].id = -(k + 1);
-                query_cls[i].dist = abs(p) * min_spc;
+                int s = dy * dy + dz * dz;
+                int h = -1;
+                if (s <= r2)
+                {
+                    // from the square root, then exact in the same test
+                    h = min(int(sqrt(max(r2 - s, 0.0f))), radius);
+                    while ((h < radius) && ((h + 1) * (h + 1) + s <= r2))
+                        h++;
+                    while ((h >= 0) && (h * h + s > r2))
+                        h--;
+                }
+                span[(dy + radius) + n * (dz + radius)] = h;
             }
         }
     }
+
+    int Span(int dy, int dz) const
+    {
+        return span[(dy + radius) + (2 * radius + 1) * (dz + radius)];
+    }
+};
+
+// The distances of grid points to their closest site take few values when
+// the sites are on the grid, the small balls are built once per thread.
+class BallCache
+{
+public:
+    ~BallCache()
+    {
+        for (map<float, BallSpans*>::iterator it = balls.begin(); it != balls.end(); it++)
+            delete it->second;
+    }
+
+    const BallSpans* Get(float fdist)
+    {
+        map<float, BallSpans*>::iterator it = balls.find(fdist);
+        if (it != balls.end())
+            return it->second;
+        if ((fdist > BALL_CACHE_RADIUS) || (balls.size() >= BALL_CACHE_SIZE))
+        {
+            scratch.Build(fdist);
+            return &scratch;
+        }
+        BallSpans* ball = new BallSpans;
+        ball->Build(fdist);
+        balls[fdist] = ball;
+        return ball;
+    }
+
+private:
+    map<float, BallSpans*> balls;
+    BallSpans scratch;
+};
+
+inline void AddNaturalWeight(vector<NaturalNeighbors>& query_nc, vector<omp_lock_t>& writelock, int idx, int id, float w)
+{
+    int it = query_nc[idx].find(id);
+    if (it < 0)
+    {
+        // lock only the map at idx for insertion
+        if (!omp_test_lock(&(writelock[idx])))
+        {
+            ProfileCount(PROF_LOCK_CONTENTION);
+            omp_set_lock(&(writelock[idx]));
+        }
+        if ((it = query_nc[idx].find(id)) < 0)
+        {
+            it = query_nc[idx].insert(id, 0.0);
+        }
+        omp_unset_lock(&(writelock[idx]));
+    }
+
+    // update the value
+    float* fp = &(query_nc[idx].nw[it]);
+    #pragma omp atomic
+    (*fp) += w;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -312,8 +420,9 @@ void FindNaturalCoordinates(
         vector<NaturalNeighbors>& query_nc,
         vector<Sample_point>& pts, 
         int nosurf,
-        vector<NormalConstrainedSphericalMlsSurface*>& surfaces)
+        vector<DiscSurface*>& surfaces)
 {
+    ProfileScope scope("natural");
     NrrdWrapper3D* recons = (NrrdWrapper3D*) reconsc;
     double min_spc = recons->min_spc;
 
@@ -336,83 +445,112 @@ void FindNaturalCoordinates(
     int l1 = recons->width() - 1;
     int l2 = recons->height() - 1;
     int l3 = recons->depth() - 1;
-    #pragma omp parallel for schedule(dynamic)
+
+    // group the grid points by closest site, surfaces first
+    int ngroups = pts.size() + nosurf;
+    vector<int> start(ngroups + 1, 0);
+    vector<int> order(query_cls.size());
     for (int i = 0; i < query_cls.size(); i++)
+        start[query_cls[i].id + nosurf + 1]++;
+    for (int g = 1; g <= ngroups; g++)
+        start[g] += start[g - 1];
     {
-        int3 c = recons->Addr2Coord(i);
-
-        // find its closest site info
-        int id = query_cls[i].id;
-        float fdist = query_cls[i].dist;
-
-        // compute the distance in grid space
-        fdist = fdist / min_spc;
-
-        // assumes the data grid is isotropic
-        int dist = ceil(fdist);
+        vector<int> next(start.begin(), start.end() - 1);
+        for (int i = 0; i < query_cls.size(); i++)
+            order[next[query_cls[i].id + nosurf]++] = i;
+    }
 
-        // squared distance
-        fdist *= fdist;
-        
-        // now loop on all points in range
-        int3 d;
-        vector<int> idxs;
-        for (int x = c.x - dist; x <= c.x + dist; x++)
+    // the balls of the points of a site are counted in a box around them,
+    // then every point of the box is added once to the neighbor lists
+    #pragma omp parallel
+    {
+        BallCache balls;
+        vector<int> counts;
+        #pragma omp for schedule(dynamic)
+        for (int g = 0; g < ngroups; g++)
         {
-            if ((x < 0) || (x > l1))
+            if (start[g] == start[g + 1])
                 continue;
-            d.x = x - c.x;
-            d.x *= d.x;
+            int id = g - nosurf;
 
-            for (int y = c.y - dist; y <= c.y + dist; y++)
+            // box of the balls, the distance is in grid space (isotropic grid)
+            int3 lo = make_int3(l1, l2, l3);
+            int3 hi = make_int3(0, 0, 0);
+            for (int k = start[g]; k < start[g + 1]; k++)
             {
-                if ((y < 0) || (y > l2))
-                    continue;
-                d.y = y - c.y;
-                d.y *= d.y;
-                if ((d.x + d.y) > fdist)
-                    continue;
-
-                for (int z = c.z - dist; z <= c.z + dist; z++)
+                int3 c = recons->Addr2Coord(order[k]);
+                int r = ceil(float(query_cls[order[k]].dist / min_spc));
+                lo = make_int3(min(lo.x, c.x - r), min(lo.y, c.y - r), min(lo.z, c.z - r));
+                hi = make_int3(max(hi.x, c.x + r), max(hi.y, c.y + r), max(hi.z, c.z + r));
+            }
+            lo = make_int3(max(lo.x, 0), max(lo.y, 0), max(lo.z, 0));
+            hi = make_int3(min(hi.x, l1), min(hi.y, l2), min(hi.z, l3));
+            int bw = hi.x - lo.x + 1;
+            int bh = hi.y - lo.y + 1;
+            long volume = long(bw) * bh * (hi.z - lo.z + 1);
+            bool boxed = (volume <= BALL_BOX_MAX);
+            if (boxed)
+                counts.assign(volume, 0);
+
+            for (int k = start[g]; k < start[g + 1]; k++)
+            {
+                int i = order[k];
+                int3 c = recons->Addr2Coord(i);
+                float fdist = query_cls[i].dist / min_spc;
+                const BallSpans* ball = balls.Get(fdist);
+
+                // clip the rows to the grid once, the runs along x are contiguous
+                int r = ball->radius;
+                int z0 = max(-r, -c.z);
+                int z1 = min(r, l3 - c.z);
+                int y0 = max(-r, -c.y);
+                int y1 = min(r, l2 - c.y);
+                for (int dz = z0; dz <= z1; dz++)
                 {
-                    if ((z < 0) || (z > l3))
-                        continue;
-                    d.z = z - c.z;
-                    d.z *= d.z;        
-                    if ((d.x + d.y + d.z) > fdist)
-                        continue;
-
-                    int idx = recons->Coord2Addr(x, y, z);
-                    idxs.push_back(idx);
+                    for (int dy = y0; dy <= y1; dy++)
+                    {
+                        int h = ball->Span(dy, dz);
+                        if (h < 0)
+                            continue;
+                        int x0 = max(c.x - h, 0);
+                        int x1 = min(c.x + h, l1);
+                        if (boxed)
+                        {
+                            int* row = &counts[(c.x - lo.x) + bw * ((c.y + dy - lo.y) + bh * (c.z + dz - lo.z)) - c.x];
+                            for (int x = x0; x <= x1; x++)
+                                row[x]++;
+                        }
+                        else
+                        {
+                            int row = recons->Coord2Addr(0, c.y + dy, c.z + dz);
+                            for (int x = x0; x <= x1; x++)
+                                AddNaturalWeight(query_nc, writelock, row + x, id, 1.0);
+                        }
+                    }
                 }
             }
-        }
 
-        // loop idxs
-        for (int k = 0; k < idxs.size(); k++)
-        {
-            int idx = idxs[k];
-            int it = query_nc[idx].find(id);
-            if (it < 0)
+            if (boxed)
             {
-                // lock only the map at idx for insertion
-                omp_set_lock(&(writelock[idx]));
-                if ((it = query_nc[idx].find(id)) < 0)
+                int k = 0;
+                for (int z = lo.z; z <= hi.z; z++)
                 {
-                    it = query_nc[idx].insert(id, 0.0);
+                    for (int y = lo.y; y <= hi.y; y++)
+                    {
+                        int row = recons->Coord2Addr(0, y, z);
+                        for (int x = lo.x; x <= hi.x; x++, k++)
+                        {
+                            if (counts[k] > 0)
+                                AddNaturalWeight(query_nc, writelock, row + x, id, counts[k]);
+                        }
+                    }
                 }
-                omp_unset_lock(&(writelock[idx]));
             }
-            
-            // update the value
-            float* fp = &(query_nc[idx].nw[it]);
-            #pragma omp atomic
-            (*fp) += 1.0;
-        }
 
-        if ((i%1048576) == 0)
-        {
-            printf("."); fflush(stdout);
+            if ((start[g] / 1048576) != (start[g + 1] / 1048576))
+            {
+                printf("."); fflush(stdout);
+            }
         }
     }
     for (int i = 0; i < query_nc.size(); i++)
@@ -431,6 +569,13 @@ void FindNaturalCoordinates(
     //}
     //printf("Maximum number of natural neighbors is %d\n", maxi);
 
+    NormalizeNaturalCoordinates(query_cls, query_nc);
+}
+
+void NormalizeNaturalCoordinates(
+        vector<closest_site>& query_cls,
+        vector<NaturalNeighbors>& query_nc)
+{
     // a natural neighbor that has a zero weight
     #pragma omp parallel for
     for (int i = 0; i < query_nc.size(); i++)
@@ -462,6 +607,8 @@ void FindNaturalCoordinates(
         {
             query_nc[i].nw[itc] /= sum;
         }
+        ProfileCount(PROF_VOXELS);
+        ProfileCount(PROF_NATURAL_NEIGHBORS, query_nc[i].size());
     }
 }
 
@@ -484,7 +631,7 @@ int FindSurfaceFit(
         vector<NaturalNeighbors>& query_nc,
         vector<Sample_point>& pts, 
         int nosurf,
-        vector<NormalConstrainedSphericalMlsSurface*>& surfaces,
+        vector<DiscSurface*>& surfaces,
         int qid,
         int surf_no,
         double& ptdist,
@@ -496,13 +643,15 @@ int FindSurfaceFit(
     int thn = omp_get_thread_num();
     int soff = thn * nosurf;
     float3 P = recons->Addr2Space(qid);
+    ProfileCount(PROF_SURFACE_FITS);
 
     // rets: 0 failed, 1 succeeded, 2 out of range but succeeded
     int rets = 1;
 
     // distance from the point to the surface
     Vector3f cpt = Vector3(P.x / min_spc, P.y / min_spc, P.z / min_spc);
-    double qx = FindPotential(surfaces[soff + surf_no], cpt);
+    DiscSurface::Evaluation eval;
+    double qx = FindPotential(surfaces[soff + surf_no], cpt, eval);
     ptdist = abs(qx);
     if (ptdist > 1e+6)
     {
@@ -515,10 +664,10 @@ int FindSurfaceFit(
     set<int> nids;
 
     // get points that are surface neighbors
-    int nofn = surfaces[soff + surf_no]->editNeighborhood()->getNofFoundNeighbors();
+    int nofn = eval.neighbors.size;
     for (int k = 0; k < nofn; k++)
     {
-        PointSet::ConstPointHandle cph = surfaces[soff + surf_no]->editNeighborhood()->getNeighbor(k);
+        PointSet::ConstPointHandle cph = surfaces[soff + surf_no]->mpInputPoints->at(eval.neighbors.id[k]);
         nids.insert(cph.siteid());
     }
 
@@ -724,14 +873,35 @@ double SibsonInterpolation(
         vector<Sample_point>& pts, 
         Tree*& tree,
         int nosurf,
-        vector<NormalConstrainedSphericalMlsSurface*>& surfaces,
+        vector<DiscSurface*>& surfaces,
         int qid,
         vector<vector<float> >& sites_pot,
-        vector<vector<float> >& sites_pgr)
+        vector<vector<float> >& sites_pgr,
+        float* grad = NULL)
 {
     float3 P = recons->Addr2Space(qid);
     vector<float2> wv;
 
+    // gradient of the interpolant for the FTLE, the unclamped gradients of
+    // the natural neighbor sites weighted by their natural coordinates
+    if (grad != NULL)
+    {
+        double gsum[3] = {0.0, 0.0, 0.0};
+        double wsum = 0.0;
+        for (int it = 0; it < query_nc[qid].size(); it++)
+        {
+            int id = query_nc[qid].nv[it];
+            double w = query_nc[qid].nw[it];
+            if ((id < 0) || (w == 0.0))
+                continue;
+            for (int k = 0; k < 3; k++)
+                gsum[k] += w * pts[id].unclamped_gradient[k];
+            wsum += w;
+        }
+        for (int k = 0; k < 3; k++)
+            grad[k] = (wsum > 0.0) ? gsum[k] / wsum : 0.0;
+    }
+
     // Sibson's interpolation
     float3 p_i;
     double z_i;
@@ -768,6 +938,7 @@ double SibsonInterpolation(
             if (status == 0)
             {
                 // if error occured use value from regular sibson
+                ProfileCount(PROF_FAILED_FITS);
                 int3 c = recons->Addr2Coord(qid);
                 return recons->ProbeValueAt(c.x, c.y, c.z);
             }
@@ -1163,7 +1334,7 @@ void FindDiscSurfaces(
     vector<NaturalNeighbors>& query_nc,
     vector<Sample_point>& pts, 
     int nosurf,
-    vector<NormalConstrainedSphericalMlsSurface*>& surfaces,
+    vector<DiscSurface*>& surfaces,
     vector<vector<int> >& comps)
 {
     // create surfaces with points
@@ -1231,21 +1402,165 @@ void FindDiscSurfaces(
         }
 
         // fitting
-        #pragma omp parallel for
-        for (int j = 0; j < omptn; j++)
+        FitDiscSurface(pPointsNormals, i, numsurfs, surfaces);
+    }
+    printf("\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// one surface over the point set, shared by the thread slots
+////////////////////////////////////////////////////////////////////////////////
+
+void FitDiscSurface(
+    PointSet* points,
+    int surf_no,
+    int nosurf,
+    vector<DiscSurface*>& surfaces)
+{
+    // the queries do not modify the surface, every thread uses the same
+    DiscSurface* ncsurface = new DiscSurface(points);
+    int omptn = surfaces.size() / nosurf;
+    for (int j = 0; j < omptn; j++)
+        surfaces[j * nosurf + surf_no] = ncsurface;
+}
+
+void FreeDiscSurfaces(vector<DiscSurface*>& surfaces, int nosurf)
+{
+    for (int i = 0; i < min(int(surfaces.size()), nosurf); i++)
+    {
+        // the points are deleted with the surface holding them
+        delete surfaces[i];
+    }
+    surfaces.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// potential of the sample sites with respect to the surfaces
+////////////////////////////////////////////////////////////////////////////////
+
+void FindSitePotentials(
+    NrrdWrapper3D* recons,
+    vector<Sample_point>& pts,
+    int nosurf,
+    vector<DiscSurface*>& surfaces,
+    vector<vector<float> >& sites_pot,
+    vector<vector<float> >& sites_pgr)
+{
+    sites_pot.resize(pts.size());
+    sites_pgr.resize(pts.size());
+    for (int k = 0; k < pts.size(); k++)
+    {
+        sites_pot[k].resize(nosurf);
+        //sites_pgr[k].resize(nosurf);
+    }
+    // the sites are visited leaf by leaf of each surface, so that
+    // consecutive queries read the same samples of the surface tree
+    vector<Vector3> site_cpts(pts.size());
+    for (int k = 0; k < pts.size(); k++)
+    {
+        site_cpts[k] = Vector3(pts[k].coordinate.x / recons->min_spc, pts[k].coordinate.y / recons->min_spc, pts[k].coordinate.z / recons->min_spc);
+    }
+    for (int i = 0; i < nosurf; i++)
+    {
+        vector<uint> order;
+        surfaces[i]->sortQueries(site_cpts, order);
+        #pragma omp parallel
         {
-            NormalConstrainedSphericalMlsSurface* ncsurface = new NormalConstrainedSphericalMlsSurface(pPointsNormals);
-            BallNeighborhood* ballneighborhood = new BallNeighborhood(ncsurface->mpInputPoints);
-            Wf_OneMinusX2Power4* weightfunction = new Wf_OneMinusX2Power4();
-            ncsurface->setNeighborhood(ballneighborhood);
-            ncsurface->setWeightingFunction(weightfunction);
-            surfaces[j * numsurfs + i] = ncsurface;
-
-            Vector3f cpt = Vector3(0.0,0.0,0.0);
-            surfaces[j * numsurfs + i]->potentiel(cpt);
+            DiscSurface* surface = surfaces[i];
+            DiscSurface::Evaluation eval;
+            #pragma omp for schedule(dynamic, 64)
+            for (int j = 0; j < order.size(); j++)
+            {
+                int k = order[j];
+                Vector3f cpt = site_cpts[k];
+                float3 grad = make_float3(pts[k].gradient[0], pts[k].gradient[1], pts[k].gradient[2]);
+
+                // find the potential
+                sites_pot[k][i] = FindPotential(surface, cpt, eval);
+                /*if (abs(sites_pot[k][i]) < 1e6)
+                {
+                    // directional gradient
+                    Vector3f ppt = cpt;
+                    Vector3f gpt;
+                    Expe::Color col;
+                    bool ret = surface->project(ppt, gpt, col);
+                    float3 gqx = make_float3(ppt.x - cpt.x, ppt.y - cpt.y, ppt.z - cpt.z);
+                    float3 gpx =  make_float3(gpt.x, gpt.y, gpt.z);
+
+                    //printf("%f %f,", length(gqx), abs(dot(normalize(gpx), normalize(gqx)))); 
+                    //if ( abs(dot(normalize(gpx), normalize(gqx))) < 0.7)
+                    //    printf("%f\n", abs(dot(normalize(gpx), normalize(gqx)))); 
+
+                    // check the gradient is not zero
+                    if (length(gqx) == 0.0)
+                        gqx = gpx;
+                    if (length(gqx) != 0.0)
+                        gqx = normalize(gqx);
+                    
+                    // now computed the directed gradient and its magnitude
+                    double g = dot(grad, gqx) * recons->min_spc;
+                    if (sites_pot[k][i] > 0.0)
+                        g = -g;
+                    sites_pgr[k][i] = g;
+                }*/
+            }
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Sibson's interpolation across the surfaces
+////////////////////////////////////////////////////////////////////////////////
+
+float ModifiedSibsonInterpolation(
+    NrrdWrapper3D* recons,
+    vector<float>& errm,
+    vector<Sample_point>& pts,
+    vector<bool>& site_is_disc,
+    int nosurf,
+    vector<DiscSurface*>& surfaces,
+    vector<set<int> >& site2discs,
+    vector<vector<float> >& sites_pot,
+    vector<vector<float> >& sites_pgr,
+    vector<closest_site>& query_cls,
+    vector<NaturalNeighbors>& query_nc,
+    FTLEField* ftle,
+    int cdim)
+{
+    // find the closest site to each point
+    Tree* tree = NULL;
+    FindClosest(recons, query_cls, query_nc, pts, site_is_disc, tree, nosurf, surfaces, site2discs);
+    float max_dist = 0.0;
+    for (int i = 0; i < query_cls.size(); i++)
+    {
+        max_dist = max(max_dist, query_cls[i].dist);
+    }
+
+    // find the natural coordinates
+    FindNaturalCoordinates(recons, query_cls, query_nc, pts, nosurf, surfaces);
+    
+    // sibson interpolation
+    {
+        ProfileScope scope("interpolation");
+        #pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < query_cls.size(); i++)
+        {
+            int3 c = recons->Addr2Coord(i);
+            float grad[3];
+            double msibv = SibsonInterpolation(recons, errm, query_cls, query_nc, pts, tree, nosurf, surfaces, i, sites_pot, sites_pgr, (ftle != NULL) ? grad : NULL);
+            recons->Set(c.x, c.y, c.z, msibv);
+            if (ftle != NULL)
+                ftle->SetRow(i, cdim, grad);
+            if ((i%1048576) == 0)
+            {
+                printf("."); fflush(stdout);
+            }
         }
     }
     printf("\n");
+
+    delete tree;
+    return max_dist;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1259,35 +1574,44 @@ void DiscreteSisbon(
     vector<Sample_point>& pts, 
     Tree*& tree, 
     vector<closest_site>& query_cls,
-    vector<NaturalNeighbors>& query_nc)
+    vector<NaturalNeighbors>& query_nc,
+    FTLEField* ftle,
+    int cdim)
 {
     // main variables
     NrrdWrapper3D* origin = (NrrdWrapper3D*) originc;
     NrrdWrapper3D* recons = (NrrdWrapper3D*) reconsc;
-    vector<NormalConstrainedSphericalMlsSurface*> surfaces;
+    vector<DiscSurface*> surfaces;
     int nosurf = 0;
 
     // sibson interpolation
+    ProfileScope scope("interpolation");
     vector<vector<float> > sites_pot;
     vector<vector<float> > sites_pgr;
     #pragma omp parallel for
     for (int i = 0; i < query_cls.size(); i++)
     {
-        double msibv = SibsonInterpolation(recons, errm, query_cls, query_nc, pts, tree, nosurf, surfaces, i, sites_pot, sites_pgr);
+        float grad[3];
+        double msibv = SibsonInterpolation(recons, errm, query_cls, query_nc, pts, tree, nosurf, surfaces, i, sites_pot, sites_pgr, (ftle != NULL) ? grad : NULL);
         int3 c = recons->Addr2Coord(i);
         recons->Set(c.x, c.y, c.z, msibv);
+        if (ftle != NULL)
+            ftle->SetRow(i, cdim, grad);
     }
 
-    // compute mse 
-    double mse = 0.0;
-    for (int i = 0; i < query_cls.size(); i++)
+    // compute mse, there is no reference when the samples are computed on demand
+    if (origin != NULL)
     {
-        int3 c = recons->Addr2Coord(i);
-        double v = origin->ProbeValueAt(c.x, c.y, c.z);
-        mse += pow(v - recons->ProbeValueAt(c.x, c.y, c.z), 2.0);
+        double mse = 0.0;
+        for (int i = 0; i < query_cls.size(); i++)
+        {
+            int3 c = recons->Addr2Coord(i);
+            double v = origin->ProbeValueAt(c.x, c.y, c.z);
+            mse += pow(v - recons->ProbeValueAt(c.x, c.y, c.z), 2.0);
+        }
+        mse /= query_cls.size();
+        printf("MSE error is %e\n", mse);
     }
-    mse /= query_cls.size();
-    printf("MSE error is %e\n", mse);
 }
 
 void DiscreteSisbonWithSurfaces(
@@ -1298,13 +1622,15 @@ void DiscreteSisbonWithSurfaces(
     vector<float> errm, 
     vector<Sample_point>& pts, 
     vector<closest_site> query_cls,
-    vector<NaturalNeighbors> query_nc)
+    vector<NaturalNeighbors> query_nc,
+    DiscontinuitySurfaces* keep,
+    FTLEField* ftle)
 {
     // main variables
     NrrdWrapper3D* origin = (NrrdWrapper3D*) originc;
     NrrdWrapper3D* recons = (NrrdWrapper3D*) reconsc;
     vector<set<int> > site2discs(pts.size());
-    vector<NormalConstrainedSphericalMlsSurface*> surfaces;
+    vector<DiscSurface*> surfaces;
     int nosurf = 0;
 
     // edge file name
@@ -1322,11 +1648,17 @@ void DiscreteSisbonWithSurfaces(
     recons->Write("sibtmp.nrrd");
 
     // find the edges from the signal
-    FindDiscontinuitySignal(iter, field, recons, pts, string("sibtmp.nrrd"), filename);
+    {
+        ProfileScope scope("edges");
+        FindDiscontinuitySignal(iter, field, recons, pts, string("sibtmp.nrrd"), filename);
+    }
 
     // read the edges image and find connected components
     vector<vector<int> > comps;
-    FindConnectedComponents(recons, filename, filename, comps);
+    {
+        ProfileScope scope("components");
+        FindConnectedComponents(recons, filename, filename, comps);
+    }
     nosurf = comps.size();
     printf("Number of surfaces is %d.\n", nosurf); 
 
@@ -1334,7 +1666,10 @@ void DiscreteSisbonWithSurfaces(
     FindDiscSites(recons, query_cls, query_nc, pts, comps, site2discs);
 
     // find the discontinutity surfaces
-    FindDiscSurfaces(recons, query_cls, query_nc, pts, nosurf, surfaces, comps);
+    {
+        ProfileScope scope("surfaces");
+        FindDiscSurfaces(recons, query_cls, query_nc, pts, nosurf, surfaces, comps);
+    }
 
     // scale gradient when is too high
     //for (int i = 0; i < pts.size(); i++)
@@ -1350,52 +1685,9 @@ void DiscreteSisbonWithSurfaces(
     //}
     
     // find the potential of each sample site with respect to all surfaces
-    vector<vector<float> > sites_pot(pts.size());
-    vector<vector<float> > sites_pgr(pts.size());
-    for (int k = 0; k < pts.size(); k++)
-    {
-        sites_pot[k].resize(nosurf);
-        //sites_pgr[k].resize(nosurf);
-    }
-    #pragma omp parallel for schedule(dynamic)
-    for (int k = 0; k < pts.size(); k++)
-    {
-        int thn = omp_get_thread_num();
-        int soff = thn * nosurf;
-        Vector3f cpt = Vector3(pts[k].coordinate.x / recons->min_spc, pts[k].coordinate.y / recons->min_spc, pts[k].coordinate.z / recons->min_spc);
-        float3 grad = make_float3(pts[k].gradient[0], pts[k].gradient[1], pts[k].gradient[2]);
-        for (int i = 0; i < nosurf; i++)
-        {
-            // find the potential
-            sites_pot[k][i] = FindPotential(surfaces[soff + i], cpt);
-            /*if (abs(sites_pot[k][i]) < 1e6)
-            {
-                // directional gradient
-                Vector3f ppt = cpt;
-                Vector3f gpt;
-                Expe::Color col;
-                bool ret = surfaces[soff + i]->project(ppt, gpt, col);
-                float3 gqx = make_float3(ppt.x - cpt.x, ppt.y - cpt.y, ppt.z - cpt.z);
-                float3 gpx =  make_float3(gpt.x, gpt.y, gpt.z);
-
-                //printf("%f %f,", length(gqx), abs(dot(normalize(gpx), normalize(gqx)))); 
-                //if ( abs(dot(normalize(gpx), normalize(gqx))) < 0.7)
-                //    printf("%f\n", abs(dot(normalize(gpx), normalize(gqx)))); 
-
-                // check the gradient is not zero
-                if (length(gqx) == 0.0)
-                    gqx = gpx;
-                if (length(gqx) != 0.0)
-                    gqx = normalize(gqx);
-                
-                // now computed the directed gradient and its magnitude
-                double g = dot(grad, gqx) * recons->min_spc;
-                if (sites_pot[k][i] > 0.0)
-                    g = -g;
-                sites_pgr[k][i] = g;
-            }*/
-        }
-    }
+    vector<vector<float> > sites_pot;
+    vector<vector<float> > sites_pgr;
+    FindSitePotentials(recons, pts, nosurf, surfaces, sites_pot, sites_pgr);
 
     // set discontinuity site as such when it is very closer to a point than any
     vector<bool> site_is_disc(pts.size());
@@ -1432,56 +1724,51 @@ void DiscreteSisbonWithSurfaces(
         }
     }*/
 
-    // find the closest site to each point
-    Tree* tree = NULL;
-    FindClosest(recons, query_cls, query_nc, pts, site_is_disc, tree, nosurf, surfaces, site2discs);
+    // interpolate with the surfaces
+    float max_dist = ModifiedSibsonInterpolation(recons, errm, pts, site_is_disc, nosurf, surfaces, site2discs, sites_pot, sites_pgr, query_cls, query_nc, ftle, field);
 
-    // find the natural coordinates
-    FindNaturalCoordinates(recons, query_cls, query_nc, pts, nosurf, surfaces);
-    
-    // sibson interpolation
-    #pragma omp parallel for schedule(dynamic)
-    for (int i = 0; i < query_cls.size(); i++)
+    // compute mse, there is no reference when the samples are computed on demand
+    if (origin != NULL)
     {
-        int3 c = recons->Addr2Coord(i);
-        double msibv = SibsonInterpolation(recons, errm, query_cls, query_nc, pts, tree, nosurf, surfaces, i, sites_pot, sites_pgr);
-        recons->Set(c.x, c.y, c.z, msibv);
-        if ((i%1048576) == 0)
+        double mse = 0.0;
+        for (int i = 0; i < query_cls.size(); i++)
         {
-            printf("."); fflush(stdout);
+            int3 c = recons->Addr2Coord(i);
+            double v = origin->ProbeValueAt(c.x, c.y, c.z);
+            mse += pow(v - recons->ProbeValueAt(c.x, c.y, c.z), 2.0);
         }
+        mse /= query_cls.size();
+        printf("MSE error is %e\n", mse);
     }
-    printf("\n");
-
-    // compute mse 
-    double mse = 0.0;
-    for (int i = 0; i < query_cls.size(); i++)
-    {
-        int3 c = recons->Addr2Coord(i);
-        double v = origin->ProbeValueAt(c.x, c.y, c.z);
-        mse += pow(v - recons->ProbeValueAt(c.x, c.y, c.z), 2.0);
-    }
-    mse /= query_cls.size();
-    printf("MSE error is %e\n", mse);
 
-    // free surface memory
-    delete tree;
-    for (int i = 0; i < surfaces.size(); i++)
+    // keep what the interpolation needs besides the samples
+    if (keep != NULL)
     {
-        // delete neighborhood
-        BallNeighborhood* ballneighborhood = (BallNeighborhood*) (surfaces[i]->editNeighborhood());
-        delete ballneighborhood;
-
-        // delete weighting function
-        Wf_OneMinusX2Power4* weightfunction = (Wf_OneMinusX2Power4*) (surfaces[i]->editWeightingFunction());
-        delete weightfunction;
-
-        // delete the points
-        if (i < nosurf)
+        keep->site_is_disc = site_is_disc;
+        keep->site2discs = site2discs;
+        keep->max_dist = max_dist;
+        keep->points.resize(nosurf);
+        for (int i = 0; i < nosurf; i++)
         {
-            delete surfaces[i]->mpInputPoints;
+            PointSet* ps = surfaces[i]->mpInputPoints;
+            keep->points[i].resize(ps->size());
+            for (int k = 0; k < ps->size(); k++)
+            {
+                SurfacePoint& sp = keep->points[i][k];
+                sp.position[0] = ps->at(k).position().x;
+                sp.position[1] = ps->at(k).position().y;
+                sp.position[2] = ps->at(k).position().z;
+                sp.normal[0] = ps->at(k).normal().x;
+                sp.normal[1] = ps->at(k).normal().y;
+                sp.normal[2] = ps->at(k).normal().z;
+                sp.radius = ps->at(k).radius();
+                sp.site = ps->at(k).siteid();
+            }
         }
     }
+
+    // free surface memory
+    FreeDiscSurfaces(surfaces, nosurf);
     
     // write the output
     //recons->Write("sibtmp.nrrd");
@@ -1491,10 +1778,11 @@ void DiscreteSisbonWithSurfaces(
     cout << "Time for modified Sibson's step is " << (0.001 * timer.getElapsedTimeInMilliSec()) << " sec.\n\n";
 }
 
-void Refine(int iter, void* originc, vector<int>& nids, vector<float>& errm, vector<Sample_point>& pts, Tree*& tree, vector<closest_site>& query_cls)
+void Refine(int iter, void* originc, vector<int>& nids, vector<float>& errm, vector<Sample_point>& pts, Tree*& tree, vector<closest_site>& query_cls, int nnews)
 {
     double lambda = atof(parameters["LAMBDA"].c_str());
-    int nnews = atoi(parameters["NEWSAMPLES"].c_str());
+    if (nnews < 0)
+        nnews = atoi(parameters["NEWSAMPLES"].c_str());
 
     NrrdWrapper3D* origin = (NrrdWrapper3D*) originc;
 
@@ -1625,7 +1913,7 @@ void Refine(int iter, void* originc, vector<int>& nids, vector<float>& errm, vec
     free(data);
 }
 
-void GenerateSurfaceMesh(void* reconsc, vector<NormalConstrainedSphericalMlsSurface*>& surfaces, int nosurf, vector<int> items)
+void GenerateSurfaceMesh(void* reconsc, vector<DiscSurface*>& surfaces, int nosurf, vector<int> items)
 {
     printf("Start extracting discontinuity mesh.\n");
 
@@ -1634,26 +1922,31 @@ void GenerateSurfaceMesh(void* reconsc, vector<NormalConstrainedSphericalMlsSurf
     memset(data->ni->data, 0, data->Size() * sizeof(float));
 
     // fill nrrd with the potential info
-    #pragma omp parallel for
-    for (int i = 0; i < data->Size(); i++)
+    #pragma omp parallel
     {
+        // neighbors and fit of the surface queries of this thread
         int thn = omp_get_thread_num();
-        int soff = thn * nosurf;
-        float3 pt = data->Addr2Space(i);
-        int3 gt = data->Addr2Coord(i);
-
-        Vector3f cpt = Vector3f(pt.x / data->min_spc, pt.y / data->min_spc, pt.z / data->min_spc);
-        double d = numeric_limits<double>::max();
-        for (int k = 0; k < items.size(); k++)
+        DiscSurface::Evaluation eval;
+        #pragma omp for
+        for (int i = 0; i < data->Size(); i++)
         {
-            int sid = items[k];
-            d = min(d, FindPotential(surfaces[soff + sid], cpt)); 
-        }
-        ((float*)(data->ni->data))[i] = d;
+            int soff = thn * nosurf;
+            float3 pt = data->Addr2Space(i);
+            int3 gt = data->Addr2Coord(i);
 
-        if (i%(256 * 1024) == 0)
-        {
-            printf("."); fflush(stdout);
+            Vector3f cpt = Vector3f(pt.x / data->min_spc, pt.y / data->min_spc, pt.z / data->min_spc);
+            double d = numeric_limits<double>::max();
+            for (int k = 0; k < items.size(); k++)
+            {
+                int sid = items[k];
+                d = min(d, FindPotential(surfaces[soff + sid], cpt, eval)); 
+            }
+            ((float*)(data->ni->data))[i] = d;
+
+            if (i%(256 * 1024) == 0)
+            {
+                printf("."); fflush(stdout);
+            }
         }
     }
 
@@ -134,6 +134,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "ASPSS/ExpePointSet.h"
 #include "ASPSS/ExpeNormalConstrainedSphericalMlsSurface.h"
+#include "ASPSS/ExpeStaticMlsSurface.h"
 #include "ASPSS/ExpeBallNeighborhood.h"
 #include "ASPSS/ExpeEigenSphericalMlsSurface.h"
 #include "ASPSS/ExpeKdTree.h"
@@ -152,6 +153,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <omp.h>
 
 #include "Timer.h"
+#include "Profiler.h"
 
 using namespace std;
 using namespace Expe;
@@ -190,12 +192,35 @@ typedef CGAL::Orthogonal_k_neighbor_search<Traits> K_neighbor_search;
 typedef K_neighbor_search::Tree Tree;
 typedef K_neighbor_search::Distance Distance;
 
+// APSS surface of a discontinuity, with the neighbor search, weighting
+// function and fit fixed at compile time. The surface is not modified by the
+// queries, so all the threads share it, and the neighbors and the sphere of
+// a query are kept by the caller in a DiscSurface::Evaluation.
+typedef StaticMlsSurface<BallQuery, Wf_OneMinusX2Power4, NormalConstrainedSphereFitter> DiscSurface;
+
 // structure to hold info per grid point about closest site
 struct closest_site {
   int id; //+ve mean site and -ve means curve
   float dist;
 };
 
+// point of the APSS point set of a discontinuity surface (grid units)
+struct SurfacePoint {
+  float position[3];
+  float normal[3];
+  float radius;
+  int site;
+};
+
+// what a modified Sibson step needs besides the samples, kept to rebuild
+// the surfaces later (see SparseFlowMap.h)
+struct DiscontinuitySurfaces {
+  vector<vector<SurfacePoint> > points; // point set of each surface
+  vector<bool> site_is_disc;            // sites left out of the closest search
+  vector<set<int> > site2discs;         // surfaces near each site
+  float max_dist;                       // largest distance to the closest site
+};
+
 
 extern map<string, string> parameters;
 
@@ -384,7 +409,8 @@ public:
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void dumpMallinfo(void);
+// FTLE.h, filled by the interpolation sweeps when it is not NULL
+class FTLEField;
 
 void FindClosest(
 	void* reconsc,
@@ -394,7 +420,7 @@ void FindClosest(
 	vector<bool>& site_is_disc,
 	Tree*& tree,
 	int nosurf,
-	vector<NormalConstrainedSphericalMlsSurface*>& surfaces,
+	vector<DiscSurface*>& surfaces,
 	vector<set<int> >& site2discs);
 
 void FindNaturalCoordinates(
@@ -403,7 +429,13 @@ void FindNaturalCoordinates(
 	vector<NaturalNeighbors>& query_nc,
 	vector<Sample_point>& pts,
 	int nosurf,
-	vector<NormalConstrainedSphericalMlsSurface*>& surfaces);
+	vector<DiscSurface*>& surfaces);
+
+// the last steps of FindNaturalCoordinates: zero weights removed, a single
+// neighbor at the sites, weights summing to one
+void NormalizeNaturalCoordinates(
+	vector<closest_site>& query_cls,
+	vector<NaturalNeighbors>& query_nc);
 
 void DiscreteSisbon(
 	void* originc,
@@ -412,7 +444,9 @@ void DiscreteSisbon(
 	vector<Sample_point>& pts,
 	Tree*& tree,
 	vector<closest_site>& query_cls,
-	vector<NaturalNeighbors>& query_nc);
+	vector<NaturalNeighbors>& query_nc,
+	FTLEField* ftle = NULL,
+	int cdim = 0);
 
 void DiscreteSisbonWithSurfaces(
 	int iter,
@@ -422,7 +456,44 @@ void DiscreteSisbonWithSurfaces(
 	vector<float> errm,
 	vector<Sample_point>& pts,
 	vector<closest_site> query_cls,
-	vector<NaturalNeighbors> query_nc);
+	vector<NaturalNeighbors> query_nc,
+	DiscontinuitySurfaces* keep = NULL,
+	FTLEField* ftle = NULL);
+
+// the steps of DiscreteSisbonWithSurfaces once the surfaces are known
+void FitDiscSurface(
+	PointSet* points,
+	int surf_no,
+	int nosurf,
+	vector<DiscSurface*>& surfaces);
+
+void FreeDiscSurfaces(
+	vector<DiscSurface*>& surfaces,
+	int nosurf);
+
+void FindSitePotentials(
+	NrrdWrapper3D* recons,
+	vector<Sample_point>& pts,
+	int nosurf,
+	vector<DiscSurface*>& surfaces,
+	vector<vector<float> >& sites_pot,
+	vector<vector<float> >& sites_pgr);
+
+// returns the largest distance to the closest site or surface
+float ModifiedSibsonInterpolation(
+	NrrdWrapper3D* recons,
+	vector<float>& errm,
+	vector<Sample_point>& pts,
+	vector<bool>& site_is_disc,
+	int nosurf,
+	vector<DiscSurface*>& surfaces,
+	vector<set<int> >& site2discs,
+	vector<vector<float> >& sites_pot,
+	vector<vector<float> >& sites_pgr,
+	vector<closest_site>& query_cls,
+	vector<NaturalNeighbors>& query_nc,
+	FTLEField* ftle = NULL,
+	int cdim = 0);
 
 void Refine(
 	int iter,
@@ -431,11 +502,12 @@ void Refine(
 	vector<float>& errm,
 	vector<Sample_point>& pts,
 	Tree*& tree,
-	vector<closest_site>& query_cls);
+	vector<closest_site>& query_cls,
+	int nnews = -1);   // NEWSAMPLES when negative
 
 void GenerateSurfaceMesh(
 	void* reconsc,
-	vector<NormalConstrainedSphericalMlsSurface*>& surfaces,
+	vector<DiscSurface*>& surfaces,
 	int nosurf,
 	vector<int> items);
 
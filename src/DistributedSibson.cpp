@@ -0,0 +1,503 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#include "DistributedSibson.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// decomposition of the grid in slabs
+////////////////////////////////////////////////////////////////////////////////
+
+void SetupSlabDecomposition(
+        SlabDecomposition& slab,
+        MPI_Comm comm,
+        int3 gdims,
+        const double* spc,
+        int halo)
+{
+    slab.comm = comm;
+    MPI_Comm_rank(comm, &slab.rank);
+    MPI_Comm_size(comm, &slab.nranks);
+    slab.gdims = gdims;
+    slab.spc[0] = spc[0];
+    slab.spc[1] = spc[1];
+    slab.spc[2] = spc[2];
+    slab.halo = halo;
+
+    if (slab.nranks > gdims.z)
+    {
+        if (slab.rank == 0)
+            printf("Error: more ranks (%d) than z planes (%d)!\n", slab.nranks, gdims.z);
+        MPI_Abort(comm, -1);
+    }
+
+    // balanced split of the planes, the first ranks get one more
+    int base = gdims.z / slab.nranks;
+    int extra = gdims.z % slab.nranks;
+    slab.z0 = slab.rank * base + min(slab.rank, extra);
+    slab.z1 = slab.z0 + base + ((slab.rank < extra) ? 1 : 0);
+
+    // add the halo
+    slab.h0 = max(0, slab.z0 - halo);
+    slab.h1 = min(gdims.z, slab.z1 + halo);
+
+    printf("Rank %d owns planes [%d, %d) and keeps [%d, %d)\n", slab.rank, slab.z0, slab.z1, slab.h0, slab.h1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// read a slab of a nrrd file
+////////////////////////////////////////////////////////////////////////////////
+
+void ReadNrrdDims(const char* filename, MPI_Comm comm, int& ncomp, int3& gdims, double* spc)
+{
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    // only the header is read
+    int info[4] = {0, 0, 0, 0};
+    if (rank == 0)
+    {
+        Nrrd* nin = nrrdNew();
+        NrrdIoState* nio = nrrdIoStateNew();
+        nio->skipData = AIR_TRUE;
+        if (nrrdLoad(nin, filename, nio) || (nin->dim != 4) || (nin->type != nrrdTypeFloat))
+        {
+            printf("Error: %s is not a 4D float nrrd!\n", filename);
+            MPI_Abort(comm, -1);
+        }
+        for (int i = 0; i < 4; i++)
+            info[i] = nin->axis[i].size;
+        for (int i = 0; i < 3; i++)
+            spc[i] = nin->axis[i + 1].spacing;
+        nio = nrrdIoStateNix(nio);
+        nrrdNix(nin);
+    }
+    MPI_Bcast(info, 4, MPI_INT, 0, comm);
+    MPI_Bcast(spc, 3, MPI_DOUBLE, 0, comm);
+
+    ncomp = info[0];
+    gdims = make_int3(info[1], info[2], info[3]);
+}
+
+Nrrd* ReadSlabNrrd(const char* filename, SlabDecomposition& slab, int& ncomp)
+{
+    int3 gdims;
+    double spc[3];
+    ReadNrrdDims(filename, slab.comm, ncomp, gdims, spc);
+    if ((gdims.x != slab.gdims.x) || (gdims.y != slab.gdims.y) || (gdims.z != slab.gdims.z))
+    {
+        if (slab.rank == 0)
+            printf("Error: %s does not match the decomposed grid!\n", filename);
+        MPI_Abort(slab.comm, -1);
+    }
+
+    // one z plane with all components is the unit of transfer
+    size_t plane = size_t(ncomp) * gdims.x * gdims.y;
+    MPI_Datatype planetype;
+    MPI_Type_contiguous(plane, MPI_FLOAT, &planetype);
+    MPI_Type_commit(&planetype);
+
+    float* data = (float*) malloc(plane * slab.localDepth() * sizeof(float));
+    if (slab.rank == 0)
+    {
+        // the root holds the whole file only while it is scattered
+        Nrrd* nin = readNrrd(filename);
+        if (nin == NULL)
+        {
+            printf("Error: could not read %s!\n", filename);
+            MPI_Abort(slab.comm, -1);
+        }
+        float* all = (float*) nin->data;
+        for (int r = 1; r < slab.nranks; r++)
+        {
+            int range[2];
+            MPI_Recv(range, 2, MPI_INT, r, 0, slab.comm, MPI_STATUS_IGNORE);
+            MPI_Send(all + plane * range[0], range[1] - range[0], planetype, r, 1, slab.comm);
+        }
+        memcpy(data, all + plane * slab.h0, plane * slab.localDepth() * sizeof(float));
+        nrrdNuke(nin);
+    }
+    else
+    {
+        int range[2] = {slab.h0, slab.h1};
+        MPI_Send(range, 2, MPI_INT, 0, 0, slab.comm);
+        MPI_Recv(data, slab.localDepth(), planetype, 0, 1, slab.comm, MPI_STATUS_IGNORE);
+    }
+    MPI_Type_free(&planetype);
+
+    vector<size_t> dims;
+    dims.push_back(ncomp);
+    dims.push_back(gdims.x);
+    dims.push_back(gdims.y);
+    dims.push_back(slab.localDepth());
+    vector<double> spacing;
+    spacing.push_back(1.0);
+    spacing.push_back(spc[0]);
+    spacing.push_back(spc[1]);
+    spacing.push_back(spc[2]);
+
+    return create_nrrd(data, nrrdTypeFloat, dims, spacing);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// sample sites exchange
+////////////////////////////////////////////////////////////////////////////////
+
+void SamplesToGlobal(const SlabDecomposition& slab, vector<Sample_point>& pts)
+{
+    float shift = slab.zshift();
+    for (int i = 0; i < pts.size(); i++)
+        pts[i].coordinate.z += shift;
+}
+
+void SamplesToLocal(const SlabDecomposition& slab, vector<Sample_point>& pts)
+{
+    float shift = slab.zshift();
+    for (int i = 0; i < pts.size(); i++)
+        pts[i].coordinate.z -= shift;
+}
+
+void ExchangeSamples(
+        const SlabDecomposition& slab,
+        vector<Sample_point>& local_new,
+        vector<Sample_point>& all_new)
+{
+    // sample points are plain data so they travel as bytes
+    int bytes = local_new.size() * sizeof(Sample_point);
+    vector<int> counts(slab.nranks);
+    vector<int> displs(slab.nranks);
+    MPI_Allgather(&bytes, 1, MPI_INT, &counts[0], 1, MPI_INT, slab.comm);
+
+    int total = 0;
+    for (int r = 0; r < slab.nranks; r++)
+    {
+        displs[r] = total;
+        total += counts[r];
+    }
+
+    all_new.resize(total / sizeof(Sample_point));
+    MPI_Allgatherv(
+        local_new.empty() ? NULL : &local_new[0], bytes, MPI_BYTE,
+        all_new.empty() ? NULL : &all_new[0], &counts[0], &displs[0], MPI_BYTE,
+        slab.comm);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// global reductions
+////////////////////////////////////////////////////////////////////////////////
+
+void GlobalMinMax(MPI_Comm comm, double& mine, double& maxe)
+{
+    // a single min reduction for both values
+    double lmm[2] = {mine, -maxe};
+    double gmm[2];
+    MPI_Allreduce(lmm, gmm, 2, MPI_DOUBLE, MPI_MIN, comm);
+    mine = gmm[0];
+    maxe = -gmm[1];
+}
+
+double GlobalMaxClosestDistance(
+        const SlabDecomposition& slab,
+        double min_spc,
+        vector<closest_site>& query_cls)
+{
+    double lmax = 0.0;
+    for (int i = slab.ownedBegin(); i < slab.ownedEnd(); i++)
+    {
+        lmax = max(lmax, double(query_cls[i].dist));
+    }
+    lmax /= min_spc;
+
+    double gmax;
+    MPI_Allreduce(&lmax, &gmax, 1, MPI_DOUBLE, MPI_MAX, slab.comm);
+    return gmax;
+}
+
+double GlobalMSE(
+        const SlabDecomposition& slab,
+        NrrdWrapper3D* origin,
+        NrrdWrapper3D* recons)
+{
+    float* o = (float*) origin->ni->data;
+    float* r = (float*) recons->ni->data;
+    double lsum[2] = {0.0, 0.0};
+    for (int i = slab.ownedBegin(); i < slab.ownedEnd(); i++)
+    {
+        lsum[0] += pow(double(o[i]) - double(r[i]), 2.0);
+        lsum[1] += 1.0;
+    }
+
+    double gsum[2];
+    MPI_Allreduce(lsum, gsum, 2, MPI_DOUBLE, MPI_SUM, slab.comm);
+    return gsum[0] / gsum[1];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// refinement with a global error histogram
+////////////////////////////////////////////////////////////////////////////////
+
+void DistributedRefine(
+        int iter,
+        const SlabDecomposition& slab,
+        void* originc,
+        vector<int>& nids,
+        vector<float>& errm,
+        vector<Sample_point>& pts,
+        vector<closest_site>& query_cls)
+{
+    double lambda = atof(parameters["LAMBDA"].c_str());
+    int nnews = atoi(parameters["NEWSAMPLES"].c_str());
+
+    NrrdWrapper3D* origin = (NrrdWrapper3D*) originc;
+    int ob = slab.ownedBegin();
+    int oe = slab.ownedEnd();
+
+    // find min and max. do scaling and log
+    double mine = numeric_limits<double>::max();
+    double maxe = numeric_limits<double>::min();
+    for (int i = ob; i < oe; i++)
+    {
+        mine = min(mine, double(errm[i]));
+        maxe = max(maxe, double(errm[i]));
+    }
+    GlobalMinMax(slab.comm, mine, maxe);
+    #pragma omp parallel for
+    for (int i = 0; i < errm.size(); i++)
+    {
+        // halo voxels belong to the neighbors
+        if ((errm[i] == 0.0) || (!slab.owns(i)))
+        {
+            errm[i] = -1.0;
+            continue;
+        }
+        errm[i] = (errm[i] - mine) / (maxe - mine);
+        if (errm[i] <= 0.0)
+        {
+            errm[i] = -1.0;
+            continue;
+        }
+        errm[i] = -log(errm[i]);
+    }
+
+    // now do the binning on the global range
+    mine = numeric_limits<double>::max();
+    maxe = numeric_limits<double>::min();
+    for (int i = ob; i < oe; i++)
+    {
+        if (errm[i] == -1.0)
+            continue;
+        mine = min(mine, double(errm[i]));
+        maxe = max(maxe, double(errm[i]));
+    }
+    GlobalMinMax(slab.comm, mine, maxe);
+
+    int nobins = 256;
+    int ncand = 0;
+    vector<vector<int> > bins(nobins);
+    vector<double> bins_prob(nobins);
+    for (int i = ob; i < oe; i++)
+    {
+        if (errm[i] == -1.0)
+            continue;
+        int idx = myround(nobins * (errm[i] - mine) / (maxe - mine));
+        idx = min(idx, nobins - 1);
+        bins[idx].push_back(i);
+        ncand++;
+
+        // compute the prob. for the point
+        double p = 5.0 * (errm[i] - mine) / (maxe - mine);
+        p = lambda * exp(-lambda * p);
+        bins_prob[idx] += p;
+    }
+
+    // global histogram
+    vector<double> gbins_prob(nobins);
+    MPI_Allreduce(&bins_prob[0], &gbins_prob[0], nobins, MPI_DOUBLE, MPI_SUM, slab.comm);
+
+    // the share of new samples follows the share of the global probability mass
+    double lmass = 0.0;
+    double gmass = 0.0;
+    for (int i = 0; i < nobins; i++)
+    {
+        lmass += bins_prob[i];
+        gmass += gbins_prob[i];
+    }
+    double before = 0.0;
+    MPI_Exscan(&lmass, &before, 1, MPI_DOUBLE, MPI_SUM, slab.comm);
+    if (slab.rank == 0)
+        before = 0.0;
+    int nlocal = 0;
+    if (gmass > 0.0)
+    {
+        nlocal = int(floor(nnews * (before + lmass) / gmass + 0.5)) - int(floor(nnews * before / gmass + 0.5));
+    }
+    if (nlocal > ncand)
+    {
+        printf("Rank %d can only add %d of its %d new samples\n", slab.rank, ncand, nlocal);
+        nlocal = ncand;
+    }
+
+    // local cdf, the bins of this rank are drawn with their global probability
+    double sum = 0.0;
+    vector<double> cdf(nobins);
+    for (int i = 0; i < nobins; i++)
+    {
+         sum += bins_prob[i];
+         cdf[i] = sum;
+    }
+    for (int i = 0 ; i < nobins; ++i)
+    {
+         cdf[i] /= sum;
+    }
+
+    // write the error to a file
+    float* data = (float*) malloc(errm.size() * sizeof(float));
+    memset(data, 0, errm.size() * sizeof(float));
+
+    // select a set
+    vector<int> o2nc(pts.size());
+    #pragma omp parallel for
+    for (int i = 0; i < nlocal; i++)
+    {
+        bool failed = true;
+        while (failed)
+        {
+            // find the bin
+            double r = drand48();
+            int bin = -1;
+            for (int k = 0; k < nobins; k++)
+            {
+                if (((k == 0) || (cdf[k - 1] < r)) && (cdf[k] >= r) && (bins[k].size() > 0))
+                {
+                    bin = k;
+                    break;
+                }
+            }
+            if (bin < 0)
+                continue;
+
+            // select a random member of the bin
+            int idx = lrand48() % bins[bin].size();
+            idx = bins[bin][idx];
+
+            // find closest and reduce probability based on it
+            int closest = query_cls[idx].id;
+            int cnt = o2nc[closest];
+            double p = (cnt == 0) ? 1.0 : 1.0 / cnt;
+            r = drand48();
+            if (r > p)
+                continue;
+
+            // if alread in the list continue
+            #pragma omp critical
+            {
+                if (data[idx] == 0.0)
+                {
+                    nids.push_back(idx);
+                    data[idx] = 1.0;
+                    o2nc[closest]++;
+                    failed = false;
+                }
+            }
+        }
+    }
+
+    int gnew = 0;
+    int lnew = nids.size();
+    MPI_Reduce(&lnew, &gnew, 1, MPI_INT, MPI_SUM, 0, slab.comm);
+    if (slab.rank == 0)
+        printf("Selected %d new samples over %d ranks\n", gnew, slab.nranks);
+
+    // write the refinment information
+    char iters[12];
+    sprintf(iters, "%d", iter);
+    string filename = parameters["OUTPUT_REFINE"] + string("_") + string(iters) + string(".nrrd");
+    WriteSlabNrrd(filename, slab, data + ob, 1);
+    free(data);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// parallel output
+////////////////////////////////////////////////////////////////////////////////
+
+void WriteSlabNrrd(
+        const string& filename,
+        const SlabDecomposition& slab,
+        const float* data,
+        int ncomp)
+{
+    // the root builds the header of an attached raw nrrd
+    string header;
+    if (slab.rank == 0)
+    {
+        int one = 1;
+        bool little = (*((char*) &one) == 1);
+
+        stringstream ss;
+        ss << "NRRD0004\n";
+        ss << "# Complete NRRD file format specification at:\n";
+        ss << "# http://teem.sourceforge.net/nrrd/format.html\n";
+        ss << "type: float\n";
+        if (ncomp > 1)
+        {
+            ss << "dimension: 4\n";
+            ss << "sizes: " << ncomp << " " << slab.gdims.x << " " << slab.gdims.y << " " << slab.gdims.z << "\n";
+            ss << "spacings: 1 " << slab.spc[0] << " " << slab.spc[1] << " " << slab.spc[2] << "\n";
+        }
+        else
+        {
+            ss << "dimension: 3\n";
+            ss << "sizes: " << slab.gdims.x << " " << slab.gdims.y << " " << slab.gdims.z << "\n";
+            ss << "spacings: " << slab.spc[0] << " " << slab.spc[1] << " " << slab.spc[2] << "\n";
+        }
+        ss << "endian: " << (little ? "little" : "big") << "\n";
+        ss << "encoding: raw\n\n";
+        header = ss.str();
+    }
+    long long hlen = header.size();
+    MPI_Bcast(&hlen, 1, MPI_LONG_LONG, 0, slab.comm);
+
+    MPI_File fh;
+    if (MPI_File_open(slab.comm, (char*) filename.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS)
+    {
+        if (slab.rank == 0)
+            printf("Error: could not open %s for writing!\n", filename.c_str());
+        MPI_Abort(slab.comm, -1);
+    }
+    MPI_File_set_size(fh, 0);
+    if (slab.rank == 0)
+    {
+        MPI_File_write_at(fh, 0, (void*) header.c_str(), hlen, MPI_CHAR, MPI_STATUS_IGNORE);
+    }
+
+    // every rank writes its planes at their final place
+    size_t plane = size_t(ncomp) * slab.gdims.x * slab.gdims.y;
+    MPI_Datatype planetype;
+    MPI_Type_contiguous(plane, MPI_FLOAT, &planetype);
+    MPI_Type_commit(&planetype);
+    MPI_Offset offset = hlen + MPI_Offset(plane * slab.z0 * sizeof(float));
+    MPI_File_write_at_all(fh, offset, (void*) data, slab.ownedDepth(), planetype, MPI_STATUS_IGNORE);
+    MPI_Type_free(&planetype);
+    MPI_File_close(&fh);
+
+    if (slab.rank == 0)
+    {
+        printf("Write '%s'\n", filename.c_str()); fflush(stdout);
+    }
+}
@@ -0,0 +1,122 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#pragma once
+
+#ifndef __DISTRIBUTEDSIBSON_H__
+#define __DISTRIBUTEDSIBSON_H__
+
+#include <mpi.h>
+
+#include "DiscreteSibson.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// The grid is split in slabs of z planes, one slab per rank. Each rank owns
+// the planes [z0, z1) and additionally keeps 'halo' ghost planes on both
+// sides [h0, h1). The ghost planes are needed because the discrete natural
+// coordinates of a voxel receive contributions from every voxel whose
+// closest-site ball covers it. As long as the halo is thicker than the
+// largest closest-site distance the owned voxels are exact.
+//
+// Sample sites are sparse, so each rank keeps the whole site set (in its
+// local slab frame). Only newly created sites are exchanged after each
+// refinement step.
+struct SlabDecomposition
+{
+	MPI_Comm comm;
+	int rank;
+	int nranks;
+
+	int3 gdims;      // size of the global grid
+	double spc[3];   // grid spacing
+	int z0, z1;      // owned planes
+	int h0, h1;      // owned planes plus halo
+	int halo;
+
+	int width() const { return gdims.x; }
+	int height() const { return gdims.y; }
+	int localDepth() const { return h1 - h0; }
+	int ownedDepth() const { return z1 - z0; }
+
+	// offset of the local frame in space (only z is shifted)
+	double zshift() const { return h0 * spc[2]; }
+
+	// range of local voxel addresses that this rank owns
+	int ownedBegin() const { return (z0 - h0) * gdims.x * gdims.y; }
+	int ownedEnd() const { return (z1 - h0) * gdims.x * gdims.y; }
+	bool owns(int lidx) const { return (lidx >= ownedBegin()) && (lidx < ownedEnd()); }
+};
+
+void SetupSlabDecomposition(
+	SlabDecomposition& slab,
+	MPI_Comm comm,
+	int3 gdims,
+	const double* spc,
+	int halo);
+
+// size of a 4D nrrd (components first) as seen by all ranks
+void ReadNrrdDims(const char* filename, MPI_Comm comm, int& ncomp, int3& gdims, double* spc);
+
+// rank 0 reads the file and sends every rank its slab including the halo
+Nrrd* ReadSlabNrrd(const char* filename, SlabDecomposition& slab, int& ncomp);
+
+// convert sites between the global frame and the local slab frame
+void SamplesToGlobal(const SlabDecomposition& slab, vector<Sample_point>& pts);
+void SamplesToLocal(const SlabDecomposition& slab, vector<Sample_point>& pts);
+
+// gather the sites created on every rank, in rank order, on all ranks
+void ExchangeSamples(
+	const SlabDecomposition& slab,
+	vector<Sample_point>& local_new,
+	vector<Sample_point>& all_new);
+
+// largest closest-site distance (in voxels) over all owned voxels
+double GlobalMaxClosestDistance(
+	const SlabDecomposition& slab,
+	double min_spc,
+	vector<closest_site>& query_cls);
+
+// mean square error over all owned voxels of all ranks
+double GlobalMSE(
+	const SlabDecomposition& slab,
+	NrrdWrapper3D* origin,
+	NrrdWrapper3D* recons);
+
+// same as Refine() but the error histogram and cdf are global
+void DistributedRefine(
+	int iter,
+	const SlabDecomposition& slab,
+	void* originc,
+	vector<int>& nids,
+	vector<float>& errm,
+	vector<Sample_point>& pts,
+	vector<closest_site>& query_cls);
+
+// write the owned planes of an interleaved ncomp-component volume with MPI-IO
+void WriteSlabNrrd(
+	const string& filename,
+	const SlabDecomposition& slab,
+	const float* data,
+	int ncomp);
+
+#endif
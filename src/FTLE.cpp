@@ -0,0 +1,116 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <teem/nrrd.h>
+
+#include "FTLE.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////
+// Cauchy-Green tensor
+////////////////////////////////////////////////////////////////////////////////
+
+FTLEField::FTLEField(int size, int _dim, double _T) : dim(_dim), T(_T)
+{
+    J.resize(9 * size, 0.0f);
+    ftle.resize(size, 0.0f);
+}
+
+void FTLEField::SetRow(int i, int cdim, const float* row)
+{
+    float* Ji = &J[9 * i];
+    Ji[3 * cdim + 0] = row[0];
+    Ji[3 * cdim + 1] = row[1];
+    Ji[3 * cdim + 2] = row[2];
+    if (cdim == dim - 1)
+        ftle[i] = FTLEFromJacobian(Ji, T);
+}
+
+double MaxEigenvalueSymmetric3(const double* a)
+{
+    // trigonometric solution of the characteristic polynomial
+    double p1 = a[1] * a[1] + a[2] * a[2] + a[4] * a[4];
+    if (p1 == 0.0)
+        return max(a[0], max(a[3], a[5]));
+
+    double q = (a[0] + a[3] + a[5]) / 3.0;
+    double d0 = a[0] - q;
+    double d1 = a[3] - q;
+    double d2 = a[5] - q;
+    double p = sqrt((d0 * d0 + d1 * d1 + d2 * d2 + 2.0 * p1) / 6.0);
+
+    // r = det((A - qI) / p) / 2
+    double det = d0 * (d1 * d2 - a[4] * a[4]) - a[1] * (a[1] * d2 - a[4] * a[2]) + a[2] * (a[1] * a[4] - d1 * a[2]);
+    double r = det / (2.0 * p * p * p);
+    r = min(max(r, -1.0), 1.0);
+    return q + 2.0 * p * cos(acos(r) / 3.0);
+}
+
+float FTLEFromJacobian(const float* J, double T)
+{
+    // C = J^T J
+    double C[6];
+    int idx = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = i; j < 3; j++)
+        {
+            double s = 0.0;
+            for (int k = 0; k < 3; k++)
+                s += double(J[3 * k + i]) * J[3 * k + j];
+            C[idx++] = s;
+        }
+    }
+    double lmax = MaxEigenvalueSymmetric3(C);
+    if ((lmax <= 0.0) || (T == 0.0))
+        return 0.0f;
+    return 0.5 * log(lmax) / fabs(T);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// output
+////////////////////////////////////////////////////////////////////////////////
+
+bool WriteFTLE(const string& filename, const FTLEField& field, const int* dims, const double* spacing)
+{
+    Nrrd* nout = nrrdNew();
+    if (nrrdWrap_va(nout, (void*) &field.ftle[0], nrrdTypeFloat, 3, size_t(dims[0]), size_t(dims[1]), size_t(dims[2])))
+    {
+        printf("Error: could not wrap the FTLE field!\n");
+        nrrdNix(nout);
+        return false;
+    }
+    nrrdAxisInfoSet_va(nout, nrrdAxisInfoSpacing, spacing[0], spacing[1], spacing[2]);
+    bool ok = (nrrdSave(filename.c_str(), nout, NULL) == 0);
+    if (!ok)
+        printf("Error: could not write %s: %s\n", filename.c_str(), biffGetDone(NRRD));
+    else
+        printf("Write '%s'\n", filename.c_str());
+
+    // the data belongs to the field
+    nrrdNix(nout);
+    return ok;
+}
@@ -0,0 +1,65 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#pragma once
+
+#ifndef __FTLE_H__
+#define __FTLE_H__
+
+#include <string>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// FTLE of the reconstruction, computed while it is interpolated. The Sibson
+// steps blend the gradients of the natural neighbor sites with the natural
+// coordinates, which gives row cdim of the Jacobian of the flow map when
+// component cdim is interpolated. The unclamped gradients of the sites are
+// blended, GRAD_LIMIT would saturate the FTLE on the ridges. In the sweep of
+// the last component the Cauchy-Green tensor J^T J is formed and its largest
+// eigenvalue found in closed form, so the flow map is never differentiated
+// or read again.
+
+class FTLEField
+{
+public:
+	int dim;                   // the FTLE is computed with row dim - 1
+	double T;                  // integration time of the flow map
+	std::vector<float> J;      // 9 values per grid point, row major
+	std::vector<float> ftle;
+
+	FTLEField(int size, int _dim, double _T);
+
+	// row cdim of the Jacobian at grid point i, and the FTLE after the last row
+	void SetRow(int i, int cdim, const float* row);
+};
+
+// largest eigenvalue of the symmetric matrix (a00, a01, a02, a11, a12, a22)
+double MaxEigenvalueSymmetric3(const double* a);
+
+// log(sqrt(lambda_max(J^T J))) / |T|
+float FTLEFromJacobian(const float* J, double T);
+
+// scalar nrrd on the grid of the reconstruction
+bool WriteFTLE(const std::string& filename, const FTLEField& field, const int* dims, const double* spacing);
+
+#endif
@@ -0,0 +1,430 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#pragma once
+
+#ifndef __FLOWFIELDS_H__
+#define __FLOWFIELDS_H__
+
+#include <math.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Analytic velocity fields with their exact velocity gradient. The flow map
+// and its Jacobian are obtained by integrating the trajectory together with
+// the variational equations dJ/dt = grad(v) J, so no finite differences are
+// involved.
+
+class AnalyticFlow
+{
+public:
+	virtual ~AnalyticFlow() {}
+
+	virtual const char* name() const = 0;
+
+	// box of the seeding domain
+	virtual void domain(double* lo, double* hi) const = 0;
+
+	// velocity v and its gradient G[i][j] = dv_i/dx_j at (x, t)
+	virtual void evaluate(const double* x, double t, double* v, double G[3][3]) const = 0;
+
+	// evaluate() at n points, x and v have 3 values per point and G 9
+	virtual void evaluateBatch(int n, const double* x, const double* t, double* v, double* G) const
+	{
+		for (int k = 0; k < n; k++)
+			evaluate(x + 3 * k, t[k], v + 3 * k, (double (*)[3]) (G + 9 * k));
+	}
+
+	// true if the field could not be evaluated everywhere (e.g. data that
+	// could not be read), the values are then not valid
+	virtual bool failed() const { return false; }
+};
+
+// Arnold-Beltrami-Childress flow on [0, 2pi]^3
+class ABCFlow : public AnalyticFlow
+{
+public:
+	double A, B, C;
+
+	ABCFlow() : A(sqrt(3.0)), B(sqrt(2.0)), C(1.0) {}
+
+	const char* name() const { return "abc"; }
+
+	void domain(double* lo, double* hi) const
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			lo[i] = 0.0;
+			hi[i] = 2.0 * M_PI;
+		}
+	}
+
+	void evaluate(const double* x, double t, double* v, double G[3][3]) const
+	{
+		double sx = sin(x[0]), cx = cos(x[0]);
+		double sy = sin(x[1]), cy = cos(x[1]);
+		double sz = sin(x[2]), cz = cos(x[2]);
+		v[0] = A * sz + C * cy;
+		v[1] = B * sx + A * cz;
+		v[2] = C * sy + B * cx;
+		G[0][0] = 0.0;     G[0][1] = -C * sy; G[0][2] = A * cz;
+		G[1][0] = B * cx;  G[1][1] = 0.0;     G[1][2] = -A * sz;
+		G[2][0] = -B * sx; G[2][1] = C * cy;  G[2][2] = 0.0;
+	}
+};
+
+// time-dependent double gyre on [0, 2] x [0, 1], extruded along z
+class DoubleGyreFlow : public AnalyticFlow
+{
+public:
+	double A, eps, omega;
+
+	DoubleGyreFlow() : A(0.1), eps(0.25), omega(2.0 * M_PI / 10.0) {}
+
+	const char* name() const { return "double_gyre"; }
+
+	void domain(double* lo, double* hi) const
+	{
+		lo[0] = 0.0; hi[0] = 2.0;
+		lo[1] = 0.0; hi[1] = 1.0;
+		lo[2] = 0.0; hi[2] = 1.0;
+	}
+
+	void evaluate(const double* x, double t, double* v, double G[3][3]) const
+	{
+		double a = eps * sin(omega * t);
+		double b = 1.0 - 2.0 * eps * sin(omega * t);
+		double f = a * x[0] * x[0] + b * x[0];
+		double fx = 2.0 * a * x[0] + b;
+		double fxx = 2.0 * a;
+		double sf = sin(M_PI * f), cf = cos(M_PI * f);
+		double sy = sin(M_PI * x[1]), cy = cos(M_PI * x[1]);
+		double pa = M_PI * A;
+		v[0] = -pa * sf * cy;
+		v[1] = pa * cf * sy * fx;
+		v[2] = 0.0;
+		G[0][0] = -pa * M_PI * cf * fx * cy;
+		G[0][1] = pa * M_PI * sf * sy;
+		G[1][0] = pa * (-M_PI * sf * fx * fx * sy + cf * sy * fxx);
+		G[1][1] = pa * M_PI * cf * cy * fx;
+		G[0][2] = G[1][2] = 0.0;
+		G[2][0] = G[2][1] = G[2][2] = 0.0;
+	}
+};
+
+// linear system v = M x on [-1, 1]^3 (spiral saddle)
+class LinearFlow : public AnalyticFlow
+{
+public:
+	double M[3][3];
+
+	LinearFlow()
+	{
+		double m[3][3] = {{0.5, -1.0, 0.0}, {1.0, 0.5, 0.0}, {0.0, 0.0, -1.0}};
+		memcpy(M, m, sizeof(M));
+	}
+
+	const char* name() const { return "linear"; }
+
+	void domain(double* lo, double* hi) const
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			lo[i] = -1.0;
+			hi[i] = 1.0;
+		}
+	}
+
+	void evaluate(const double* x, double t, double* v, double G[3][3]) const
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			v[i] = M[i][0] * x[0] + M[i][1] * x[1] + M[i][2] * x[2];
+			for (int j = 0; j < 3; j++)
+				G[i][j] = M[i][j];
+		}
+	}
+};
+
+// returns NULL for an unknown name
+inline AnalyticFlow* CreateAnalyticFlow(const std::string& name)
+{
+	if (name == "abc")
+		return new ABCFlow();
+	if (name == "double_gyre")
+		return new DoubleGyreFlow();
+	if (name == "linear")
+		return new LinearFlow();
+	return NULL;
+}
+
+// derivative of the state (x, J) of the variational equations
+inline void VariationalRHS(const AnalyticFlow& flow, const double* s, double t, double* ds)
+{
+	double G[3][3];
+	flow.evaluate(s, t, ds, G);
+	const double* J = s + 3;
+	double* dJ = ds + 3;
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+			dJ[3 * i + j] = G[i][0] * J[j] + G[i][1] * J[3 + j] + G[i][2] * J[6 + j];
+	}
+}
+
+// flow map x = phi(x0) from t0 to t0 + T and its Jacobian J[i][j] = dphi_i/dx0_j
+// with nsteps classic Runge-Kutta steps
+inline void IntegrateFlowMap(const AnalyticFlow& flow, const double* x0, double t0, double T, int nsteps, double* x, double J[3][3])
+{
+	double s[12], k1[12], k2[12], k3[12], k4[12], tmp[12];
+	memset(s, 0, sizeof(s));
+	s[0] = x0[0];
+	s[1] = x0[1];
+	s[2] = x0[2];
+	s[3] = s[7] = s[11] = 1.0;
+
+	double h = T / nsteps;
+	double t = t0;
+	for (int n = 0; n < nsteps; n++)
+	{
+		VariationalRHS(flow, s, t, k1);
+		for (int i = 0; i < 12; i++) tmp[i] = s[i] + 0.5 * h * k1[i];
+		VariationalRHS(flow, tmp, t + 0.5 * h, k2);
+		for (int i = 0; i < 12; i++) tmp[i] = s[i] + 0.5 * h * k2[i];
+		VariationalRHS(flow, tmp, t + 0.5 * h, k3);
+		for (int i = 0; i < 12; i++) tmp[i] = s[i] + h * k3[i];
+		VariationalRHS(flow, tmp, t + h, k4);
+		for (int i = 0; i < 12; i++)
+			s[i] += h * (k1[i] + 2.0 * k2[i] + 2.0 * k3[i] + k4[i]) / 6.0;
+		t += h;
+	}
+
+	x[0] = s[0];
+	x[1] = s[1];
+	x[2] = s[2];
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+			J[i][j] = s[3 + 3 * i + j];
+	}
+}
+
+// VariationalRHS for m <= DOPRI5_LANES states at the times t, with a single
+// evaluation of the velocity for all of them
+#define DOPRI5_LANES 16
+
+inline void VariationalRHSBatch(const AnalyticFlow& flow, int m, const double (*s)[12], const double* t, double (*ds)[12])
+{
+	double x[3 * DOPRI5_LANES], v[3 * DOPRI5_LANES], G[9 * DOPRI5_LANES];
+	for (int l = 0; l < m; l++)
+	{
+		x[3 * l + 0] = s[l][0];
+		x[3 * l + 1] = s[l][1];
+		x[3 * l + 2] = s[l][2];
+	}
+	flow.evaluateBatch(m, x, t, v, G);
+	for (int l = 0; l < m; l++)
+	{
+		const double* g = G + 9 * l;
+		const double* J = s[l] + 3;
+		double* dJ = ds[l] + 3;
+		ds[l][0] = v[3 * l + 0];
+		ds[l][1] = v[3 * l + 1];
+		ds[l][2] = v[3 * l + 2];
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 3; j++)
+				dJ[3 * i + j] = g[3 * i + 0] * J[j] + g[3 * i + 1] * J[3 + j] + g[3 * i + 2] * J[6 + j];
+		}
+	}
+}
+
+// flow maps of the n points x0 (3 values per point) with the adaptive
+// Dormand-Prince 5(4) scheme. The local error of the whole state (x, J) is
+// kept below eps, relative to its magnitude when it is larger than one. T
+// may be negative. Up to DOPRI5_LANES trajectories advance in lockstep so
+// that the velocity is evaluated in batches, each with its own step size,
+// and a finished trajectory makes room for the next point. x gets 3 values
+// per point, J 9 and steps the number of accepted steps, or -1 if maxsteps
+// were not enough (x and J are then the state reached so far).
+inline void IntegrateFlowMapsDopri5(const AnalyticFlow& flow, int n, const double* x0, double t0, double T, double eps, int maxsteps, double* x, double* J, int* steps)
+{
+	static const double c[7] = {0.0, 1.0 / 5.0, 3.0 / 10.0, 4.0 / 5.0, 8.0 / 9.0, 1.0, 1.0};
+	static const double a[7][6] = {
+		{0.0},
+		{1.0 / 5.0},
+		{3.0 / 40.0, 9.0 / 40.0},
+		{44.0 / 45.0, -56.0 / 15.0, 32.0 / 9.0},
+		{19372.0 / 6561.0, -25360.0 / 2187.0, 64448.0 / 6561.0, -212.0 / 729.0},
+		{9017.0 / 3168.0, -355.0 / 33.0, 46732.0 / 5247.0, 49.0 / 176.0, -5103.0 / 18656.0},
+		{35.0 / 384.0, 0.0, 500.0 / 1113.0, 125.0 / 192.0, -2187.0 / 6784.0, 11.0 / 84.0}};
+	static const double e[7] = {71.0 / 57600.0, 0.0, -71.0 / 16695.0, 71.0 / 1920.0, -17253.0 / 339200.0, 22.0 / 525.0, -1.0 / 40.0};
+	const int W = DOPRI5_LANES;
+
+	// state of the lanes, k[6] is the first stage of the next step
+	double s[W][12], k[7][W][12], tmp[W][12], tt[W];
+	double t[W], h[W];
+	int nsteps[W], id[W];
+	bool fresh[W];
+
+	double tend = t0 + T;
+	double dir = (T < 0.0) ? -1.0 : 1.0;
+	double tol = 1e-12 * std::max(1.0, fabs(tend));
+	int next = 0;
+	int m = 0;
+	while (true)
+	{
+		// retire the trajectories that are done, free lanes take the next points
+		int l = 0;
+		while ((l < m) || ((l == m) && (next < n) && (m < W)))
+		{
+			if (l == m)
+				m++;
+			else if ((dir * (tend - t[l]) > tol) && (nsteps[l] < maxsteps))
+			{
+				l++;
+				continue;
+			}
+			else
+			{
+				int p = id[l];
+				x[3 * p + 0] = s[l][0];
+				x[3 * p + 1] = s[l][1];
+				x[3 * p + 2] = s[l][2];
+				memcpy(J + 9 * p, s[l] + 3, 9 * sizeof(double));
+				steps[p] = (dir * (tend - t[l]) > tol) ? -1 : nsteps[l];
+				if (next >= n)
+				{
+					// the last lane fills the gap
+					m--;
+					if (l < m)
+					{
+						memcpy(s[l], s[m], sizeof(s[l]));
+						memcpy(k[0][l], k[0][m], sizeof(k[0][l]));
+						t[l] = t[m];
+						h[l] = h[m];
+						nsteps[l] = nsteps[m];
+						id[l] = id[m];
+						fresh[l] = fresh[m];
+					}
+					continue;
+				}
+			}
+
+			// start the next point in lane l
+			memset(s[l], 0, sizeof(s[l]));
+			s[l][0] = x0[3 * next + 0];
+			s[l][1] = x0[3 * next + 1];
+			s[l][2] = x0[3 * next + 2];
+			s[l][3] = s[l][7] = s[l][11] = 1.0;
+			t[l] = t0;
+			h[l] = dir * std::min(fabs(T), 0.1);
+			nsteps[l] = 0;
+			id[l] = next++;
+			fresh[l] = true;
+		}
+		if (m == 0)
+			break;
+
+		// first stage of the new trajectories
+		int nfresh = 0;
+		int lanes[W];
+		for (int l = 0; l < m; l++)
+		{
+			if (fresh[l])
+			{
+				memcpy(tmp[nfresh], s[l], sizeof(s[l]));
+				tt[nfresh] = t[l];
+				lanes[nfresh++] = l;
+				fresh[l] = false;
+			}
+		}
+		if (nfresh > 0)
+		{
+			double kf[W][12];
+			VariationalRHSBatch(flow, nfresh, tmp, tt, kf);
+			for (int f = 0; f < nfresh; f++)
+				memcpy(k[0][lanes[f]], kf[f], sizeof(kf[f]));
+		}
+
+		// one step of every lane, the last stage is at the new state
+		for (int l = 0; l < m; l++)
+		{
+			if (dir * (t[l] + h[l] - tend) > 0.0)
+				h[l] = tend - t[l];
+		}
+		for (int j = 1; j < 7; j++)
+		{
+			for (int l = 0; l < m; l++)
+			{
+				for (int i = 0; i < 12; i++)
+				{
+					double sum = 0.0;
+					for (int q = 0; q < j; q++)
+						sum += a[j][q] * k[q][l][i];
+					tmp[l][i] = s[l][i] + h[l] * sum;
+				}
+				tt[l] = t[l] + c[j] * h[l];
+			}
+			VariationalRHSBatch(flow, m, tmp, tt, k[j]);
+		}
+
+		for (int l = 0; l < m; l++)
+		{
+			// error of the embedded 4th order solution
+			double err = 0.0;
+			for (int i = 0; i < 12; i++)
+			{
+				double ei = 0.0;
+				for (int q = 0; q < 7; q++)
+					ei += e[q] * k[q][l][i];
+				ei *= h[l];
+				double sc = eps * std::max(1.0, std::max(fabs(s[l][i]), fabs(tmp[l][i])));
+				err = std::max(err, fabs(ei) / sc);
+			}
+
+			if (err <= 1.0)
+			{
+				// accepted, the last stage is the first one of the next step
+				t[l] += h[l];
+				memcpy(s[l], tmp[l], sizeof(s[l]));
+				memcpy(k[0][l], k[6][l], sizeof(k[0][l]));
+				nsteps[l]++;
+			}
+			double fac = (err == 0.0) ? 5.0 : std::min(5.0, std::max(0.2, 0.9 * pow(err, -0.2)));
+			h[l] *= fac;
+		}
+	}
+}
+
+// flow map of a single point with IntegrateFlowMapsDopri5, returns its steps
+inline int IntegrateFlowMapDopri5(const AnalyticFlow& flow, const double* x0, double t0, double T, double eps, int maxsteps, double* x, double J[3][3])
+{
+	int steps;
+	IntegrateFlowMapsDopri5(flow, 1, x0, t0, T, eps, maxsteps, x, &J[0][0], &steps);
+	return steps;
+}
+
+#endif
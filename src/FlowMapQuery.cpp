@@ -0,0 +1,301 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#include "FlowMapQuery.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// sources
+////////////////////////////////////////////////////////////////////////////////
+
+FlowMapQuery::FlowMapQuery(SparseFlowMap* _sparse, int _max_tiles)
+    : sparse(_sparse), dense(NULL), max_tiles(_max_tiles)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        dims[i] = sparse->hdr.dims[i];
+        spacing[i] = sparse->hdr.spacing[i];
+    }
+    Init();
+}
+
+FlowMapQuery::FlowMapQuery(NrrdWrapper3D** _dense, int _max_tiles)
+    : sparse(NULL), dense(_dense), max_tiles(_max_tiles)
+{
+    dims[0] = dense[0]->width();
+    dims[1] = dense[0]->height();
+    dims[2] = dense[0]->depth();
+    for (int i = 0; i < 3; i++)
+        spacing[i] = dense[0]->ni->axis[i].spacing;
+    Init();
+}
+
+void FlowMapQuery::Init()
+{
+    queries = 0;
+    tile_hits = 0;
+    tile_misses = 0;
+    clock = 0;
+    for (int i = 0; i < 3; i++)
+        ntiles[i] = max(1, (dims[i] - 1 + FLOWQUERY_TILE - 1) / FLOWQUERY_TILE);
+    omp_init_lock(&lock);
+}
+
+FlowMapQuery::~FlowMapQuery()
+{
+    for (map<int, Tile*>::iterator it = tiles.begin(); it != tiles.end(); it++)
+        delete it->second;
+    omp_destroy_lock(&lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// tile cache
+////////////////////////////////////////////////////////////////////////////////
+
+FlowMapQuery::Tile* FlowMapQuery::Load(int id)
+{
+    // a tile has the points of its cells, neighbor tiles share a face
+    Tile* tile = new Tile;
+    int t[3] = {id % ntiles[0], (id / ntiles[0]) % ntiles[1], id / (ntiles[0] * ntiles[1])};
+    int hi[3];
+    for (int i = 0; i < 3; i++)
+    {
+        tile->lo[i] = t[i] * FLOWQUERY_TILE;
+        hi[i] = min(tile->lo[i] + FLOWQUERY_TILE, dims[i] - 1);
+        tile->size[i] = hi[i] - tile->lo[i] + 1;
+    }
+    int size = tile->size[0] * tile->size[1] * tile->size[2];
+    tile->values.resize(3 * size);
+    tile->last_use = 0;
+    tile->users = 0;
+
+    if (sparse != NULL)
+    {
+        vector<float> box[3];
+        if (!sparse->Reconstruct(tile->lo, hi, box))
+        {
+            delete tile;
+            return NULL;
+        }
+        for (int k = 0; k < size; k++)
+        {
+            for (int cdim = 0; cdim < 3; cdim++)
+                tile->values[3 * k + cdim] = (cdim < sparse->hdr.dim) ? box[cdim][k] : 0.0f;
+        }
+        return tile;
+    }
+
+    int k = 0;
+    for (int z = tile->lo[2]; z <= hi[2]; z++)
+    {
+        for (int y = tile->lo[1]; y <= hi[1]; y++)
+        {
+            for (int x = tile->lo[0]; x <= hi[0]; x++, k++)
+            {
+                for (int cdim = 0; cdim < 3; cdim++)
+                    tile->values[3 * k + cdim] = dense[cdim]->ProbeValueAt(x, y, z);
+            }
+        }
+    }
+    return tile;
+}
+
+FlowMapQuery::Tile* FlowMapQuery::Acquire(int id)
+{
+    omp_set_lock(&lock);
+    map<int, Tile*>::iterator it = tiles.find(id);
+    if (it != tiles.end())
+    {
+        Tile* tile = it->second;
+        tile->users++;
+        tile->last_use = ++clock;
+        tile_hits++;
+        omp_unset_lock(&lock);
+        return tile;
+    }
+    omp_unset_lock(&lock);
+
+    // reconstruct without the lock, another thread may do the same tile
+    Tile* tile = Load(id);
+    if (tile == NULL)
+        return NULL;
+
+    omp_set_lock(&lock);
+    it = tiles.find(id);
+    if (it != tiles.end())
+    {
+        delete tile;
+        tile = it->second;
+    }
+    else
+    {
+        tiles[id] = tile;
+        tile_misses++;
+    }
+    tile->users++;
+    tile->last_use = ++clock;
+
+    // drop the least recently used tiles nobody holds
+    while (tiles.size() > max_tiles)
+    {
+        map<int, Tile*>::iterator oldest = tiles.end();
+        for (it = tiles.begin(); it != tiles.end(); it++)
+        {
+            if ((it->second->users == 0) && ((oldest == tiles.end()) || (it->second->last_use < oldest->second->last_use)))
+                oldest = it;
+        }
+        if (oldest == tiles.end())
+            break;
+        delete oldest->second;
+        tiles.erase(oldest);
+    }
+    omp_unset_lock(&lock);
+    return tile;
+}
+
+void FlowMapQuery::Release(Tile* tile)
+{
+    omp_set_lock(&lock);
+    tile->users--;
+    omp_unset_lock(&lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// queries
+////////////////////////////////////////////////////////////////////////////////
+
+bool FlowMapQuery::Query(int n, const double* x, double* v, double* J)
+{
+    // cell and tile of every point
+    vector<int> cell(3 * n);
+    vector<float> frac(3 * n);
+    vector<int> tile_of(n);
+    #pragma omp parallel for
+    for (int k = 0; k < n; k++)
+    {
+        int t[3];
+        for (int i = 0; i < 3; i++)
+        {
+            double g = min(max(x[3 * k + i] / spacing[i], 0.0), double(dims[i] - 1));
+            int c = min(int(floor(g)), max(dims[i] - 2, 0));
+            cell[3 * k + i] = c;
+            frac[3 * k + i] = g - c;
+            t[i] = min(c / FLOWQUERY_TILE, ntiles[i] - 1);
+        }
+        tile_of[k] = t[0] + ntiles[0] * (t[1] + ntiles[1] * t[2]);
+    }
+
+    // the points grouped by tile
+    vector<pair<int, int> > order(n);
+    for (int k = 0; k < n; k++)
+        order[k] = make_pair(tile_of[k], k);
+    sort(order.begin(), order.end());
+    vector<int> ids;
+    vector<int> first;
+    for (int k = 0; k < n; k++)
+    {
+        if (ids.empty() || (ids.back() != order[k].first))
+        {
+            ids.push_back(order[k].first);
+            first.push_back(k);
+        }
+    }
+    first.push_back(n);
+
+    // FLOWQUERY_GROUP tiles at a time (at most max_tiles) are held, the
+    // cache never grows past max_tiles plus what the other batches hold
+    int group = max(1, min(max_tiles, FLOWQUERY_GROUP));
+    bool ok = true;
+    vector<Tile*> held;
+    for (int g = 0; ok && (g < ids.size()); g += group)
+    {
+        int ng = min(group, int(ids.size()) - g);
+        held.assign(ng, (Tile*) NULL);
+        for (int i = 0; ok && (i < ng); i++)
+        {
+            held[i] = Acquire(ids[g + i]);
+            ok = (held[i] != NULL);
+        }
+        if (ok)
+        {
+            #pragma omp parallel for
+            for (int o = first[g]; o < first[g + ng]; o++)
+            {
+                int i = upper_bound(first.begin() + g, first.begin() + g + ng, o) - first.begin() - g - 1;
+                int k = order[o].second;
+                Interpolate(held[i], k, &cell[3 * k], &frac[3 * k], v, J);
+            }
+        }
+        for (int i = 0; i < ng; i++)
+        {
+            if (held[i] != NULL)
+                Release(held[i]);
+        }
+    }
+    #pragma omp atomic
+    queries += n;
+    return ok;
+}
+
+void FlowMapQuery::Interpolate(const Tile* tile, int k, const int* c, const float* f, double* v, double* J) const
+{
+    // trilinear in the cell of the point, the Jacobian is its derivative
+    int sx = tile->size[0];
+    int sy = tile->size[1];
+
+    // offsets of the corners, flat axes have a single point
+    int ox = (tile->size[0] > 1) ? 3 : 0;
+    int oy = (tile->size[1] > 1) ? 3 * sx : 0;
+    int oz = (tile->size[2] > 1) ? 3 * sx * sy : 0;
+    const float* p = &tile->values[3 * ((c[0] - tile->lo[0]) + sx * ((c[1] - tile->lo[1]) + sy * (c[2] - tile->lo[2])))];
+    for (int i = 0; i < 3; i++)
+    {
+        double c000 = p[i];
+        double c100 = p[ox + i];
+        double c010 = p[oy + i];
+        double c110 = p[ox + oy + i];
+        double c001 = p[oz + i];
+        double c101 = p[ox + oz + i];
+        double c011 = p[oy + oz + i];
+        double c111 = p[ox + oy + oz + i];
+
+        // along x, then y, then z
+        double a00 = c000 + f[0] * (c100 - c000);
+        double a10 = c010 + f[0] * (c110 - c010);
+        double a01 = c001 + f[0] * (c101 - c001);
+        double a11 = c011 + f[0] * (c111 - c011);
+        double b0 = a00 + f[1] * (a10 - a00);
+        double b1 = a01 + f[1] * (a11 - a01);
+        v[3 * k + i] = b0 + f[2] * (b1 - b0);
+        if (J == NULL)
+            continue;
+
+        double dx00 = c100 - c000;
+        double dx10 = c110 - c010;
+        double dx01 = c101 - c001;
+        double dx11 = c111 - c011;
+        double dx0 = dx00 + f[1] * (dx10 - dx00);
+        double dx1 = dx01 + f[1] * (dx11 - dx01);
+        double dy0 = a10 - a00;
+        double dy1 = a11 - a01;
+        J[9 * k + 3 * i + 0] = (dx0 + f[2] * (dx1 - dx0)) / spacing[0];
+        J[9 * k + 3 * i + 1] = (dy0 + f[2] * (dy1 - dy0)) / spacing[1];
+        J[9 * k + 3 * i + 2] = (b1 - b0) / spacing[2];
+    }
+}
@@ -0,0 +1,103 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#pragma once
+
+#ifndef __FLOWMAPQUERY_H__
+#define __FLOWMAPQUERY_H__
+
+#include <omp.h>
+#include <map>
+#include <vector>
+
+#include "SparseFlowMap.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Flow map and Jacobian at arbitrary points. The discrete Sibson
+// reconstruction only exists at the grid points, so the grid is cut in
+// tiles of FLOWQUERY_TILE^3 cells, a tile is reconstructed from the sparse
+// flow map (or copied from a dense one) the first time a point falls in it,
+// and the points are interpolated trilinearly in their cell. The Jacobian
+// is the derivative of the same interpolant. The last max_tiles tiles are
+// kept, tiles in use by a batch are never dropped, and batches can come
+// from several threads at once. A batch is sorted by tile and only holds
+// FLOWQUERY_GROUP tiles at a time, so a scattered batch does not grow the
+// cache past max_tiles.
+
+#define FLOWQUERY_TILE 16
+#define FLOWQUERY_GROUP 16
+
+class FlowMapQuery
+{
+public:
+	int dims[3];
+	double spacing[3];
+
+	// statistics of all the batches
+	long queries;
+	long tile_hits;
+	long tile_misses;
+
+	// tiles reconstructed from a sparse flow map
+	FlowMapQuery(SparseFlowMap* _sparse, int _max_tiles = 512);
+
+	// tiles copied from the 3 components of a dense flow map
+	FlowMapQuery(NrrdWrapper3D** _dense, int _max_tiles = 512);
+
+	~FlowMapQuery();
+
+	// n points of the grid frame (grid coordinates times spacing) in x, 3
+	// values per point in v and 9 (row major, J[i][j] = dphi_i/dx_j) in J
+	// when it is not NULL. Points outside the grid are clamped to it.
+	// Returns false if a tile could not be reconstructed.
+	bool Query(int n, const double* x, double* v, double* J);
+
+private:
+	struct Tile
+	{
+		int lo[3];
+		int size[3];
+		std::vector<float> values;   // 3 components per point, x fastest
+		long last_use;
+		int users;
+	};
+
+	SparseFlowMap* sparse;
+	NrrdWrapper3D** dense;
+	int max_tiles;
+	int ntiles[3];
+	long clock;
+	std::map<int, Tile*> tiles;
+	omp_lock_t lock;
+
+	FlowMapQuery(const FlowMapQuery&);
+	void operator=(const FlowMapQuery&);
+
+	void Init();
+	Tile* Load(int id);
+	Tile* Acquire(int id);
+	void Release(Tile* tile);
+	void Interpolate(const Tile* tile, int k, const int* c, const float* f, double* v, double* J) const;
+};
+
+#endif
@@ -0,0 +1,220 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <teem/nrrd.h>
+
+#include "FlowSampler.h"
+#include "VelocityVolume.h"
+#include "Profiler.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////
+// precomputed flow map
+////////////////////////////////////////////////////////////////////////////////
+
+bool NrrdFlowSampler::Sample(const vector<int3>& sites, vector<FlowMapSample>& samples)
+{
+	samples.resize(sites.size());
+	#pragma omp parallel for
+	for (int k = 0; k < sites.size(); k++)
+	{
+		int3 c = sites[k];
+		for (int i = 0; i < 3; i++)
+		{
+			samples[k].value[i] = fm[i]->ProbeValueAt(c.x, c.y, c.z);
+			for (int j = 0; j < 3; j++)
+				samples[k].J[i][j] = fmJ[i][j]->ProbeValueAt(c.x, c.y, c.z);
+		}
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// on-demand integration
+////////////////////////////////////////////////////////////////////////////////
+
+IntegratingFlowSampler::IntegratingFlowSampler(const AnalyticFlow* _flow, int res, double _t0, double _T, double _eps)
+	: flow(_flow), t0(_t0), T(_T), eps(_eps), maxsteps(100000), trajectories(0), steps(0), failures(0)
+{
+	double hi[3];
+	flow->domain(lo, hi);
+
+	// same lattice as the benchmark, flat axes keep a single layer
+	spc = numeric_limits<double>::max();
+	for (int i = 0; i < 3; i++)
+	{
+		if (hi[i] > lo[i])
+			spc = min(spc, (hi[i] - lo[i]) / (res - 1));
+	}
+	dims = make_int3(myround((hi[0] - lo[0]) / spc) + 1, myround((hi[1] - lo[1]) / spc) + 1, myround((hi[2] - lo[2]) / spc) + 1);
+}
+
+IntegratingFlowSampler::~IntegratingFlowSampler()
+{
+	delete flow;
+}
+
+Nrrd* IntegratingFlowSampler::CreateGrid() const
+{
+	float* data = (float*) calloc(dims.x * dims.y * dims.z, sizeof(float));
+	return createNrrd3D(data, dims, make_double3(spc, spc, spc));
+}
+
+bool IntegratingFlowSampler::Sample(const vector<int3>& sites, vector<FlowMapSample>& samples)
+{
+	ProfileScope scope("integrate");
+	samples.resize(sites.size());
+
+	// the trajectories of a chunk advance in lockstep, the cost of a chunk
+	// depends on the flow along its trajectories
+	const int chunk = 256;
+	int nchunks = (sites.size() + chunk - 1) / chunk;
+	long nsteps = 0;
+	long nfailed = 0;
+	#pragma omp parallel reduction(+:nsteps,nfailed)
+	{
+		vector<double> x0(3 * chunk), x(3 * chunk), J(9 * chunk);
+		vector<int> accepted(chunk);
+		#pragma omp for schedule(dynamic, 1)
+		for (int c = 0; c < nchunks; c++)
+		{
+			int first = c * chunk;
+			int n = min(chunk, int(sites.size()) - first);
+			for (int k = 0; k < n; k++)
+			{
+				int3 g = sites[first + k];
+				x0[3 * k + 0] = lo[0] + g.x * spc;
+				x0[3 * k + 1] = lo[1] + g.y * spc;
+				x0[3 * k + 2] = lo[2] + g.z * spc;
+			}
+			IntegrateFlowMapsDopri5(*flow, n, &x0[0], t0, T, eps, maxsteps, &x[0], &J[0], &accepted[0]);
+
+			long nchunk = 0;
+			for (int k = 0; k < n; k++)
+			{
+				FlowMapSample& sample = samples[first + k];
+				for (int i = 0; i < 3; i++)
+				{
+					sample.value[i] = x[3 * k + i] - lo[i];
+					for (int j = 0; j < 3; j++)
+						sample.J[i][j] = J[9 * k + 3 * i + j];
+				}
+				if (accepted[k] < 0)
+				{
+					nfailed++;
+					accepted[k] = maxsteps;
+				}
+				nchunk += accepted[k];
+			}
+			nsteps += nchunk;
+			ProfileCount(PROF_INTEGRATION_STEPS, nchunk);
+		}
+	}
+
+	if (flow->failed())
+	{
+		printf("Error: the flow '%s' could not be evaluated along the trajectories!\n", flow->name());
+		return false;
+	}
+
+	trajectories += sites.size();
+	steps += nsteps;
+	failures += nfailed;
+	if (nfailed > 0)
+		printf("Warning: %ld of %d trajectories did not reach the integration time!\n", nfailed, int(sites.size()));
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// parameters
+////////////////////////////////////////////////////////////////////////////////
+
+IntegratingFlowSampler* CreateIntegratingFlowSampler(map<string, string>& parameters)
+{
+	string source = parameters["FLOW_SOURCE"];
+	AnalyticFlow* flow = NULL;
+	if (source == "analytic")
+	{
+		flow = CreateAnalyticFlow(parameters["FIELD"]);
+		if (flow == NULL)
+		{
+			printf("Error: unknown flow field '%s'!\n", parameters["FIELD"].c_str());
+			return NULL;
+		}
+	}
+	else if (source == "velocity")
+	{
+		bool cubic = (parameters["INTERPOLATION"] == "cubic");
+		int nsteps = parameters["VELOCITY_STEPS"].empty() ? 1 : atoi(parameters["VELOCITY_STEPS"].c_str());
+		if (nsteps > 1)
+		{
+			// time steps are read when the trajectories reach them
+			double dt = parameters["VELOCITY_DT"].empty() ? 1.0 : atof(parameters["VELOCITY_DT"].c_str());
+			int maxresident = parameters["VELOCITY_CACHE"].empty() ? 8 : atoi(parameters["VELOCITY_CACHE"].c_str());
+			if (maxresident < 2)
+			{
+				printf("Error: VELOCITY_CACHE must be at least 2!\n");
+				return NULL;
+			}
+			VelocitySequenceFlow* sequence = new VelocitySequenceFlow(parameters["VELOCITY_FIELD"], nsteps, atof(parameters["VELOCITY_T0"].c_str()), dt, cubic, maxresident);
+			if (!sequence->valid())
+			{
+				delete sequence;
+				return NULL;
+			}
+			flow = sequence;
+		}
+		else
+		{
+			BrickedVelocityVolume* volume = ReadVelocityVolume(parameters["VELOCITY_FIELD"]);
+			if (volume == NULL)
+				return NULL;
+			flow = new BrickedFlow(volume, cubic);
+		}
+	}
+	else
+	{
+		printf("Error: unknown flow source '%s'!\n", source.c_str());
+		return NULL;
+	}
+
+	int res = parameters["RESOLUTION"].empty() ? 64 : atoi(parameters["RESOLUTION"].c_str());
+	double t0 = atof(parameters["START_TIME"].c_str());
+	double T = parameters["INTEGRATION_TIME"].empty() ? 1.0 : atof(parameters["INTEGRATION_TIME"].c_str());
+	double eps = parameters["INTEGRATION_EPS"].empty() ? 1e-6 : atof(parameters["INTEGRATION_EPS"].c_str());
+	if (res < 2)
+	{
+		printf("Error: RESOLUTION must be at least 2!\n");
+		delete flow;
+		return NULL;
+	}
+
+	IntegratingFlowSampler* sampler = new IntegratingFlowSampler(flow, res, t0, T, eps);
+	printf("On-demand flow map of '%s' on a %d x %d x %d grid for T = %lf\n", flow->name(), sampler->dims.x, sampler->dims.y, sampler->dims.z, T);
+	return sampler;
+}
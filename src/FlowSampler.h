@@ -0,0 +1,115 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#pragma once
+
+#ifndef __FLOWSAMPLER_H__
+#define __FLOWSAMPLER_H__
+
+#include <map>
+#include <string>
+
+#include "Sample_point.h"
+#include "FlowFields.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Source of the flow map samples. The reconstruction only needs the flow map
+// and its Jacobian at the grid points it selects (the initial lattice and the
+// points added by Refine), and asks for all of them at once:
+//   - NrrdFlowSampler reads them from a dense precomputed flow map
+//   - IntegratingFlowSampler integrates the trajectories of the requested
+//     points only, so the cost grows with the number of samples and not
+//     with the size of the grid
+// Flow map values are given in the frame of the grid (its first point is the
+// origin), as Grid2Space() gives the coordinates of the samples.
+
+struct FlowMapSample
+{
+	double value[3];   // flow map phi(x0)
+	double J[3][3];    // J[i][j] = dphi_i/dx0_j
+};
+
+class FlowSampler
+{
+public:
+	virtual ~FlowSampler() {}
+
+	// samples of the grid points sites, computed in parallel, false if they
+	// could not be computed
+	virtual bool Sample(const vector<int3>& sites, vector<FlowMapSample>& samples) = 0;
+};
+
+class NrrdFlowSampler : public FlowSampler
+{
+public:
+	NrrdWrapper3D** fm;
+	NrrdWrapper3D* (*fmJ)[3];
+
+	NrrdFlowSampler(NrrdWrapper3D** _fm, NrrdWrapper3D* (*_fmJ)[3]) : fm(_fm), fmJ(_fmJ) {}
+
+	bool Sample(const vector<int3>& sites, vector<FlowMapSample>& samples);
+};
+
+class IntegratingFlowSampler : public FlowSampler
+{
+public:
+	const AnalyticFlow* flow;
+	double t0;
+	double T;
+	double eps;
+	int maxsteps;
+
+	// isotropic sampling grid over the domain of the flow
+	int3 dims;
+	double lo[3];
+	double spc;
+
+	// statistics of all the calls to Sample()
+	long trajectories;
+	long steps;
+	long failures;
+
+	// res points along the shortest side of the domain, the sampler owns
+	// the flow
+	IntegratingFlowSampler(const AnalyticFlow* _flow, int res, double _t0, double _T, double _eps);
+	~IntegratingFlowSampler();
+
+	// empty nrrd with the geometry of the sampling grid
+	Nrrd* CreateGrid() const;
+
+	bool Sample(const vector<int3>& sites, vector<FlowMapSample>& samples);
+};
+
+// the on-demand sampler selected by the parameters, NULL if they are not
+// valid. The trajectories are integrated in
+//   - FLOW_SOURCE=analytic  the field FIELD (see CreateAnalyticFlow)
+//   - FLOW_SOURCE=velocity  the velocity volume VELOCITY_FIELD (3 x X x Y x Z
+//                           nrrd), or with VELOCITY_STEPS > 1 the printf
+//                           pattern of the time steps VELOCITY_T0 + i
+//                           VELOCITY_DT of which at most VELOCITY_CACHE
+//                           stay in memory, and INTERPOLATION=linear|cubic
+// from START_TIME for INTEGRATION_TIME on a grid of RESOLUTION points along
+// the shortest side of the domain, with the tolerance INTEGRATION_EPS.
+IntegratingFlowSampler* CreateIntegratingFlowSampler(map<string, string>& parameters);
+
+#endif
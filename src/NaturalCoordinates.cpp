@@ -0,0 +1,241 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#include "NaturalCoordinates.h"
+
+typedef std::vector<std::pair<Point_3, Kernel::FT> > Coordinates;
+
+bool CmpCoordinate(const std::pair<Point_3, Kernel::FT>& i, const std::pair<Point_3, Kernel::FT>& j) { return (i.second > j.second); }
+
+////////////////////////////////////////////////////////////////////////////////
+// backend
+////////////////////////////////////////////////////////////////////////////////
+
+NaturalCoordinates::NaturalCoordinates(map<string, string>& parameters)
+    : last_exact(false), inserted(0), reach(0.0), mirrored(0.0)
+{
+    backend = NATURAL_DISCRETE;
+    if (parameters["NATURAL_BACKEND"] == "auto")
+        backend = NATURAL_AUTO;
+    else if (parameters["NATURAL_BACKEND"] == "exact")
+        backend = NATURAL_EXACT;
+    exact_cost = parameters["NATURAL_EXACT_COST"].empty() ? 10000.0 : atof(parameters["NATURAL_EXACT_COST"].c_str());
+    insert_cost = parameters["NATURAL_INSERT_COST"].empty() ? 1000.0 : atof(parameters["NATURAL_INSERT_COST"].c_str());
+}
+
+NaturalCoordinates::~NaturalCoordinates()
+{
+    for (int t = 0; t < dts.size(); t++)
+        delete dts[t];
+}
+
+void NaturalCoordinates::Find(
+    void* reconsc,
+    vector<closest_site>& query_cls,
+    vector<NaturalNeighbors>& query_nc,
+    vector<Sample_point>& pts,
+    int nosurf,
+    vector<DiscSurface*>& surfaces)
+{
+    NrrdWrapper3D* recons = (NrrdWrapper3D*) reconsc;
+    bool exact = (backend == NATURAL_EXACT);
+    if (backend == NATURAL_AUTO)
+    {
+        // points of all the balls against the cost of the exact coordinates,
+        // with the sites to insert in the triangulation of every thread
+        double balls = 0.0;
+        #pragma omp parallel for reduction(+:balls)
+        for (int i = 0; i < query_cls.size(); i++)
+        {
+            double r = query_cls[i].dist / recons->min_spc;
+            balls += 4.0 / 3.0 * M_PI * r * r * r;
+        }
+        int fresh = (pts.size() < inserted) ? pts.size() : pts.size() - inserted;
+        double inserts = double(fresh) * omp_get_max_threads();
+        exact = (balls > exact_cost * query_cls.size() + insert_cost * inserts);
+    }
+    last_exact = exact && (nosurf == 0);
+    if (!last_exact)
+    {
+        FindNaturalCoordinates(reconsc, query_cls, query_nc, pts, nosurf, surfaces);
+        return;
+    }
+
+    ProfileScope scope("natural");
+    Timer timer;
+    timer.start();
+    for (int i = 0; i < query_cls.size(); i++)
+        reach = max(reach, query_cls[i].dist);
+    Update(recons, pts);
+    Exact(recons, query_cls, query_nc);
+    NormalizeNaturalCoordinates(query_cls, query_nc);
+    timer.stop();
+    cout << "\nTime for exact natural neighbors computation is " << (0.001 * timer.getElapsedTimeInMilliSec()) << " sec.\n";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// triangulation
+////////////////////////////////////////////////////////////////////////////////
+
+void NaturalCoordinates::Update(NrrdWrapper3D* recons, vector<Sample_point>& pts)
+{
+    // the sites are only appended, anything else starts over
+    int nthreads = omp_get_max_threads();
+    if ((dts.size() != nthreads) || (pts.size() < inserted))
+    {
+        for (int t = 0; t < dts.size(); t++)
+            delete dts[t];
+        dts.assign(nthreads, (Delaunay*) NULL);
+        for (int t = 0; t < nthreads; t++)
+            dts[t] = new Delaunay;
+        ids.clear();
+        inserted = 0;
+        mirrored = 0.0;
+    }
+
+    double hi[3] = {
+        (recons->width() - 1) * recons->ni->axis[0].spacing,
+        (recons->height() - 1) * recons->ni->axis[1].spacing,
+        (recons->depth() - 1) * recons->ni->axis[2].spacing};
+    vector<Point_3> added;
+    int first = (reach > mirrored) ? 0 : inserted;
+    for (int i = first; i < pts.size(); i++)
+    {
+        double c[3] = {pts[i].coordinate.x, pts[i].coordinate.y, pts[i].coordinate.z};
+
+        // the site, then its mirrors across the faces (and edges and corners)
+        // within reach, per axis: not mirrored, mirrored at 0, mirrored at hi.
+        // The sites already inserted only get the mirrors beyond the reach
+        // they were mirrored with.
+        bool old = (i < inserted);
+        for (int m = (old ? 1 : 0); m < 27; m++)
+        {
+            double p[3];
+            bool valid = true;
+            bool before = true;
+            for (int a = 0, o = m; a < 3; a++, o /= 3)
+            {
+                p[a] = c[a];
+                if ((o % 3) == 1)
+                {
+                    valid = valid && (c[a] > 0.0) && (c[a] <= reach);
+                    before = before && (c[a] <= mirrored);
+                    p[a] = -c[a];
+                }
+                else if ((o % 3) == 2)
+                {
+                    valid = valid && (c[a] < hi[a]) && (c[a] >= hi[a] - reach);
+                    before = before && (c[a] >= hi[a] - mirrored);
+                    p[a] = 2.0 * hi[a] - c[a];
+                }
+            }
+            if (!valid || (old && before))
+                continue;
+            Point_3 pt(p[0], p[1], p[2]);
+            added.push_back(pt);
+            ids[pt] = i;
+        }
+    }
+
+    // the same insertions in the triangulation of every thread
+    #pragma omp parallel for schedule(static, 1)
+    for (int t = 0; t < nthreads; t++)
+    {
+        Delaunay::Vertex_handle hint;
+        for (int k = 0; k < added.size(); k++)
+            hint = dts[t]->insert(added[k], hint);
+    }
+    printf("Delaunay triangulation of %d sites, %d vertices with the mirrors.\n", int(pts.size()), int(dts[0]->number_of_vertices()));
+    inserted = pts.size();
+    mirrored = reach;
+}
+
+void NaturalCoordinates::Exact(NrrdWrapper3D* recons, vector<closest_site>& query_cls, vector<NaturalNeighbors>& query_nc)
+{
+    int nb[3] = {
+        (recons->width() + DELAUNAY_BRICK - 1) / DELAUNAY_BRICK,
+        (recons->height() + DELAUNAY_BRICK - 1) / DELAUNAY_BRICK,
+        (recons->depth() + DELAUNAY_BRICK - 1) / DELAUNAY_BRICK};
+    int nbricks = nb[0] * nb[1] * nb[2];
+    int outside = 0;
+    #pragma omp parallel reduction(+:outside) num_threads(dts.size())
+    {
+        const Delaunay& local = *dts[omp_get_thread_num()];
+        Delaunay::Cell_handle hint;
+        Coordinates coords;
+        #pragma omp for schedule(dynamic)
+        for (int b = 0; b < nbricks; b++)
+        {
+            int bx = (b % nb[0]) * DELAUNAY_BRICK;
+            int by = ((b / nb[0]) % nb[1]) * DELAUNAY_BRICK;
+            int bz = (b / (nb[0] * nb[1])) * DELAUNAY_BRICK;
+            for (int z = bz; z < min(bz + DELAUNAY_BRICK, recons->depth()); z++)
+            {
+                for (int y = by; y < min(by + DELAUNAY_BRICK, recons->height()); y++)
+                {
+                    for (int x = bx; x < min(bx + DELAUNAY_BRICK, recons->width()); x++)
+                    {
+                        int i = recons->Coord2Addr(x, y, z);
+                        query_nc[i].clear();
+                        if (query_cls[i].dist == 0.0)
+                        {
+                            query_nc[i].insert(query_cls[i].id, 1.0);
+                            continue;
+                        }
+
+                        // from the cell of the previous point
+                        float3 q = recons->Addr2Space(i);
+                        Point_3 Q(q.x, q.y, q.z);
+                        hint = local.locate(Q, hint);
+                        coords.clear();
+                        Kernel::FT norm = 0.0;
+                        CGAL::Triple<std::back_insert_iterator<Coordinates>, Kernel::FT, bool> res =
+                            CGAL::sibson_natural_neighbor_coordinates_3(local, Q, std::back_inserter(coords), norm, hint);
+                        if (!res.third || !(norm > 0.0))
+                        {
+                            query_nc[i].insert(query_cls[i].id, 1.0);
+                            outside++;
+                            continue;
+                        }
+
+                        // the largest ones when there are too many
+                        int capacity = query_nc[i].nv.capacity();
+                        if (coords.size() > capacity)
+                            sort(coords.begin(), coords.end(), CmpCoordinate);
+                        for (int k = 0; k < coords.size(); k++)
+                        {
+                            float w = CGAL::to_double(coords[k].second);
+                            map<Point_3, int>::const_iterator it = ids.find(coords[k].first);
+                            if ((w <= 0.0) || (it == ids.end()))
+                                continue;
+                            int j = query_nc[i].find(it->second);
+                            if (j >= 0)
+                                query_nc[i].nw[j] += w;
+                            else if (query_nc[i].size() < capacity)
+                                query_nc[i].insert(it->second, w);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    if (outside > 0)
+        printf("%d grid points outside the triangulation use their closest site.\n", outside);
+}
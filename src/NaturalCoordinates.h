@@ -0,0 +1,105 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#pragma once
+
+#ifndef __NATURALCOORDINATES_H__
+#define __NATURALCOORDINATES_H__
+
+#include "DiscreteSibson.h"
+
+#include <CGAL/Delaunay_triangulation_3.h>
+#include <CGAL/natural_neighbor_coordinates_3.h>
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Natural neighbor coordinates of the grid points, discrete or exact. The
+// discrete coordinates (FindNaturalCoordinates) cost the volume of a ball
+// of radius the distance to the closest site per grid point, which grows
+// with the cube of the site spacing. The exact Sibson coordinates cost the
+// same for any spacing: the Delaunay triangulation of the sites is kept
+// and the sites added by the refinement are inserted in it, then every
+// grid point is located from the previous one (bricks of DELAUNAY_BRICK^3
+// points per task) and its coordinates computed by CGAL. The queries of a
+// triangulation are not thread safe, every thread walks its own copy, and
+// the copies are kept between the calls: the new sites are inserted in all
+// of them (in parallel), so only the first call pays for the copies.
+// The sites close to the faces of the grid are mirrored across them (the
+// mirrors count for their site), so the hull covers the grid and the cells
+// end at its faces, as the balls of the discrete coordinates do. When the
+// reach grows, the sites already inserted get the mirrors they were
+// missing. A grid point still outside the hull takes its closest site only.
+// NATURAL_BACKEND=discrete|exact|auto (discrete by default) chooses, auto
+// compares the total volume of the balls with NATURAL_EXACT_COST (in ball
+// points, 10000 by default) per grid point, plus NATURAL_INSERT_COST (1000)
+// per vertex to insert in every copy. The exact coordinates are for the
+// regular Sibson step only, with surfaces they are always discrete.
+// The results are the same query_nc as FindNaturalCoordinates fills.
+// sparse_benchmark compares the two on jittered lattice sites, exact and
+// auto are to be used once they agree there.
+
+#define DELAUNAY_BRICK 8
+
+enum NaturalBackend
+{
+	NATURAL_DISCRETE = 0,
+	NATURAL_EXACT,
+	NATURAL_AUTO
+};
+
+typedef CGAL::Delaunay_triangulation_3<Kernel> Delaunay;
+
+class NaturalCoordinates
+{
+public:
+	int backend;
+	double exact_cost;
+	double insert_cost;
+	bool last_exact;       // the backend of the last call
+
+	NaturalCoordinates(map<string, string>& parameters);
+	~NaturalCoordinates();
+
+	// same as FindNaturalCoordinates
+	void Find(
+		void* reconsc,
+		vector<closest_site>& query_cls,
+		vector<NaturalNeighbors>& query_nc,
+		vector<Sample_point>& pts,
+		int nosurf,
+		vector<DiscSurface*>& surfaces);
+
+private:
+	vector<Delaunay*> dts;   // one triangulation per thread
+	map<Point_3, int> ids;   // site of every vertex, mirrors included
+	int inserted;
+	float reach;             // largest distance to a closest site so far
+	float mirrored;          // reach of the mirrors in the triangulations
+
+	NaturalCoordinates(const NaturalCoordinates&);
+	void operator=(const NaturalCoordinates&);
+
+	void Update(NrrdWrapper3D* recons, vector<Sample_point>& pts);
+	void Exact(NrrdWrapper3D* recons, vector<closest_site>& query_cls, vector<NaturalNeighbors>& query_nc);
+};
+
+#endif
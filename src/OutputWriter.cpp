@@ -0,0 +1,301 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#include <zlib.h>
+
+#include "OutputWriter.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// writer
+////////////////////////////////////////////////////////////////////////////////
+
+OutputWriter::OutputWriter(map<string, string>& parameters)
+    : pending(false), ok(true)
+{
+    encoding = (parameters["OUTPUT_ENCODING"] == "gzip") ? OUTPUT_GZIP : OUTPUT_RAW;
+    if (!parameters["OUTPUT_ENCODING"].empty() && (parameters["OUTPUT_ENCODING"] != "gzip") && (parameters["OUTPUT_ENCODING"] != "raw"))
+        printf("Error: unknown OUTPUT_ENCODING %s, writing raw data!\n", parameters["OUTPUT_ENCODING"].c_str());
+
+    string t = parameters["OUTPUT_TYPE"];
+    type = OUTPUT_FLOAT;
+    if ((t == "ushort") || (t == "float16"))
+        type = OUTPUT_USHORT;
+    else if (t == "uchar")
+        type = OUTPUT_UCHAR;
+    else if (!t.empty() && (t != "float"))
+        printf("Error: unknown OUTPUT_TYPE %s, writing floats!\n", t.c_str());
+
+    async = (atoi(parameters["OUTPUT_ASYNC"].c_str()) != 0);
+    level = parameters["OUTPUT_GZIP_LEVEL"].empty() ? Z_DEFAULT_COMPRESSION : atoi(parameters["OUTPUT_GZIP_LEVEL"].c_str());
+    block = parameters["OUTPUT_BLOCK"].empty() ? (1 << 20) : atol(parameters["OUTPUT_BLOCK"].c_str());
+    block = max(block, size_t(4096));
+}
+
+OutputWriter::~OutputWriter()
+{
+    Wait();
+}
+
+bool OutputWriter::Wait()
+{
+    if (pending)
+    {
+        io.join();
+        pending = false;
+    }
+    bool last = ok;
+    ok = true;
+    return last;
+}
+
+bool OutputWriter::Write(const string& _filename, NrrdWrapper3D** recons, int dim)
+{
+    // the buffer belongs to the pending write
+    bool previous = Wait();
+
+    NrrdWrapper3D* grid = recons[0];
+    double vmin = 0.0;
+    double vmax = 0.0;
+    if (type == OUTPUT_FLOAT)
+        Interleave(recons, dim);
+    else
+        Quantize(recons, dim, vmin, vmax);
+
+    // same fields as nrrdSave, the component axis has unit spacing
+    const char* types[3] = {"float", "unsigned short", "unsigned char"};
+    unsigned short one = 1;
+    bool big = (*(unsigned char*) &one == 0);
+    ostringstream out;
+    out.precision(17);
+    out << "NRRD0004\n";
+    out << "# Complete NRRD file format specification at:\n";
+    out << "# http://teem.sourceforge.net/nrrd/format.html\n";
+    out << "type: " << types[type] << "\n";
+    out << "dimension: 4\n";
+    out << "sizes: " << dim << " " << grid->width() << " " << grid->height() << " " << grid->depth() << "\n";
+    out << "spacings: 1";
+    for (int i = 0; i < 3; i++)
+        out << " " << grid->ni->axis[i].spacing;
+    out << "\n";
+    if (!myiswn(grid->ni->axis[0].min) && !myiswn(grid->ni->axis[1].min) && !myiswn(grid->ni->axis[2].min))
+        out << "axis mins: nan " << grid->ni->axis[0].min << " " << grid->ni->axis[1].min << " " << grid->ni->axis[2].min << "\n";
+    if (type != OUTPUT_UCHAR)
+        out << "endian: " << (big ? "big" : "little") << "\n";
+    out << "encoding: " << ((encoding == OUTPUT_GZIP) ? "gzip" : "raw") << "\n";
+    if (type != OUTPUT_FLOAT)
+    {
+        out << "old min: " << vmin << "\n";
+        out << "old max: " << vmax << "\n";
+    }
+    out << "\n";
+    header = out.str();
+    filename = _filename;
+
+    if (async)
+    {
+        pending = true;
+        io = std::thread(&OutputWriter::Save, this);
+        return previous;
+    }
+    Save();
+    return previous && Wait();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// values
+////////////////////////////////////////////////////////////////////////////////
+
+void OutputWriter::Interleave(NrrdWrapper3D** recons, int dim)
+{
+    long size = recons[0]->Size();
+    data.resize(size_t(dim) * size * sizeof(float));
+    float* values = (float*) &data[0];
+    const float* src[3];
+    for (int cdim = 0; cdim < dim; cdim++)
+        src[cdim] = (const float*) recons[cdim]->ni->data;
+
+    #pragma omp parallel for
+    for (long k = 0; k < size; k++)
+    {
+        for (int cdim = 0; cdim < dim; cdim++)
+        {
+            float v = src[cdim][k];
+            values[dim * k + cdim] = myiswn(v) ? 0.0f : v;
+        }
+    }
+}
+
+void OutputWriter::Quantize(NrrdWrapper3D** recons, int dim, double& vmin, double& vmax)
+{
+    long size = recons[0]->Size();
+    const float* src[3];
+    for (int cdim = 0; cdim < dim; cdim++)
+        src[cdim] = (const float*) recons[cdim]->ni->data;
+
+    // range of the scrubbed values
+    int nthreads = omp_get_max_threads();
+    vector<float> tmin(nthreads, numeric_limits<float>::max());
+    vector<float> tmax(nthreads, -numeric_limits<float>::max());
+    #pragma omp parallel for
+    for (long k = 0; k < size; k++)
+    {
+        int t = omp_get_thread_num();
+        for (int cdim = 0; cdim < dim; cdim++)
+        {
+            float v = src[cdim][k];
+            if (myiswn(v))
+                v = 0.0f;
+            tmin[t] = min(tmin[t], v);
+            tmax[t] = max(tmax[t], v);
+        }
+    }
+    vmin = *min_element(tmin.begin(), tmin.end());
+    vmax = *max_element(tmax.begin(), tmax.end());
+    if (vmin > vmax)
+        vmin = vmax = 0.0;
+
+    // cells of nrrdQuantize, unquantized to their centers
+    int bytes = (type == OUTPUT_USHORT) ? 2 : 1;
+    double ncells = (type == OUTPUT_USHORT) ? 65536.0 : 256.0;
+    double scale = (vmax > vmin) ? ncells / (vmax - vmin) : 0.0;
+    data.resize(size_t(dim) * size * bytes);
+    unsigned short* us = (unsigned short*) &data[0];
+    unsigned char* uc = &data[0];
+    #pragma omp parallel for
+    for (long k = 0; k < size; k++)
+    {
+        for (int cdim = 0; cdim < dim; cdim++)
+        {
+            float v = src[cdim][k];
+            if (myiswn(v))
+                v = 0.0f;
+            double q = min(floor((v - vmin) * scale), ncells - 1.0);
+            if (bytes == 2)
+                us[dim * k + cdim] = (unsigned short) max(q, 0.0);
+            else
+                uc[dim * k + cdim] = (unsigned char) max(q, 0.0);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// file
+////////////////////////////////////////////////////////////////////////////////
+
+void OutputWriter::Save()
+{
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (file == NULL)
+    {
+        printf("Error: could not open %s!\n", filename.c_str());
+        ok = false;
+        return;
+    }
+    bool done = (fwrite(header.c_str(), 1, header.size(), file) == header.size());
+    if (done && (encoding == OUTPUT_GZIP))
+        done = WriteGzip(file);
+    else if (done && !data.empty())
+        done = (fwrite(&data[0], 1, data.size(), file) == data.size());
+    done = (fclose(file) == 0) && done;
+
+    if (!done)
+    {
+        printf("Error: could not write %s!\n", filename.c_str());
+        ok = false;
+    }
+    else
+        printf("Write '%s'\n", filename.c_str());
+}
+
+bool OutputWriter::WriteGzip(FILE* file) const
+{
+    // a gzip member with a single deflate stream: every block is compressed
+    // on its own and ends on a byte boundary (sync flush), the last one ends
+    // the stream, and the crc of the data is combined from the blocks
+    static const unsigned char gz_header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+    if (fwrite(gz_header, 1, 10, file) != 10)
+        return false;
+
+    size_t nblocks = max(size_t(1), (data.size() + block - 1) / block);
+    int nthreads = omp_get_max_threads();
+    size_t round = 4 * nthreads;
+    uLong crc = crc32(0L, Z_NULL, 0);
+    vector<vector<unsigned char> > out(round);
+    vector<uLong> crcs(round);
+    bool done = true;
+
+    // a few blocks per thread at a time, written in order
+    for (size_t first = 0; done && (first < nblocks); first += round)
+    {
+        long n = min(round, nblocks - first);
+        #pragma omp parallel for schedule(dynamic)
+        for (long b = 0; b < n; b++)
+        {
+            size_t lo = (first + b) * block;
+            size_t len = min(block, data.size() - min(lo, data.size()));
+            const unsigned char* in = data.empty() ? NULL : &data[lo];
+            bool last = (first + b == nblocks - 1);
+
+            z_stream s;
+            memset(&s, 0, sizeof(s));
+            out[b].clear();
+            if (deflateInit2(&s, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+                continue;
+            out[b].resize(deflateBound(&s, len) + 16);
+            s.next_in = (Bytef*) in;
+            s.avail_in = len;
+            s.next_out = &out[b][0];
+            s.avail_out = out[b].size();
+            int ret = deflate(&s, last ? Z_FINISH : Z_SYNC_FLUSH);
+            if ((ret == (last ? Z_STREAM_END : Z_OK)) && (s.avail_in == 0))
+                out[b].resize(s.total_out);
+            else
+                out[b].clear();
+            deflateEnd(&s);
+            crcs[b] = crc32(0L, in, len);
+        }
+
+        for (long b = 0; b < n; b++)
+        {
+            if (out[b].empty())
+            {
+                done = false;
+                break;
+            }
+            size_t len = min(block, data.size() - min((first + b) * block, data.size()));
+            crc = crc32_combine(crc, crcs[b], len);
+            done = (fwrite(&out[b][0], 1, out[b].size(), file) == out[b].size());
+            if (!done)
+                break;
+        }
+    }
+    if (!done)
+        return false;
+
+    // crc and size of the data, little endian
+    unsigned char trailer[8];
+    uLong isize = uLong(data.size() & 0xffffffffUL);
+    for (int i = 0; i < 4; i++)
+    {
+        trailer[i] = (crc >> (8 * i)) & 0xff;
+        trailer[4 + i] = (isize >> (8 * i)) & 0xff;
+    }
+    return (fwrite(trailer, 1, 8, file) == 8);
+}
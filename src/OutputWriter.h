@@ -0,0 +1,99 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#pragma once
+
+#ifndef __OUTPUTWRITER_H__
+#define __OUTPUTWRITER_H__
+
+#include <thread>
+
+#include "DiscreteSibson.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Writer of the reconstructed flow map (3 x X x Y x Z nrrd, the components
+// interleaved). The components are read from the reconstruction in one
+// parallel pass into the buffer of the file, with NaN and inf written as 0,
+// and the header is written directly, so the flow map is never copied or
+// joined with teem.
+//   - OUTPUT_ENCODING=raw|gzip (raw by default). The gzip stream is
+//     compressed in blocks of OUTPUT_BLOCK bytes (1 MB) on all the threads
+//     and stays a single gzip member that any reader takes.
+//   - OUTPUT_TYPE=float|ushort|uchar (float by default). The quantized types
+//     map the range of the values to 2^16 or 2^8 cells and store it in
+//     "old min"/"old max", so "unu unquantize" gives back floats. NRRD has
+//     no half float type, float16 selects ushort.
+//   - OUTPUT_ASYNC=1 compresses and writes in a background thread while the
+//     next step runs. A write waits for the previous one.
+
+#define OUTPUT_RAW 0
+#define OUTPUT_GZIP 1
+
+#define OUTPUT_FLOAT 0
+#define OUTPUT_USHORT 1
+#define OUTPUT_UCHAR 2
+
+class OutputWriter
+{
+public:
+	int encoding;
+	int type;
+	bool async;
+	int level;                 // zlib level, OUTPUT_GZIP_LEVEL (6)
+	size_t block;
+
+	OutputWriter(map<string, string>& parameters);
+
+	// waits for the pending write
+	~OutputWriter();
+
+	// the dim components of recons to filename. False if this write (or,
+	// when async, the previous one) failed.
+	bool Write(const string& filename, NrrdWrapper3D** recons, int dim);
+
+	// false if the pending write failed
+	bool Wait();
+
+private:
+	std::thread io;
+	bool pending;
+	bool ok;
+
+	// the file being written
+	string filename;
+	string header;
+	vector<unsigned char> data;
+
+	OutputWriter(const OutputWriter&);
+	void operator=(const OutputWriter&);
+
+	// values of the data type, interleaved and scrubbed
+	void Interleave(NrrdWrapper3D** recons, int dim);
+	void Quantize(NrrdWrapper3D** recons, int dim, double& vmin, double& vmax);
+
+	// header and data
+	void Save();
+	bool WriteGzip(FILE* file) const;
+};
+
+#endif
@@ -0,0 +1,263 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <omp.h>
+
+#ifndef WIN32
+#include <sys/resource.h>
+#endif
+
+#include "Profiler.h"
+#include "Timer.h"
+
+using namespace std;
+
+static const char* counter_names[PROF_NCOUNTERS] = {
+    "voxels",
+    "natural_neighbors",
+    "surface_fits",
+    "failed_fits",
+    "lock_contention",
+    "samples_added",
+    "integration_steps"
+};
+
+// one cache line per thread so that counting does not share lines. The
+// vector does not align its elements before C++17, so the counters are
+// placed at the first 64 byte boundary of a buffer one line larger.
+struct alignas(64) ThreadCounters
+{
+    long v[8];
+};
+
+struct ProfileRegion
+{
+    string name;
+    int depth;
+    int calls;
+    double sec;
+    long peak_rss;
+    long counters[PROF_NCOUNTERS];
+};
+
+struct OpenRegion
+{
+    string name;
+    vector<long> start;
+    Timer timer;
+};
+
+static FILE* prof_fp = NULL;
+static bool prof_csv = false;
+static int prof_iter = -1;
+static vector<char> prof_buffer;
+static ThreadCounters* prof_threads = NULL;
+static int prof_nthreads = 0;
+static vector<OpenRegion> prof_open;
+static vector<ProfileRegion> prof_regions;
+
+////////////////////////////////////////////////////////////////////////////////
+// counters
+////////////////////////////////////////////////////////////////////////////////
+
+void ProfileCount(int counter, long n)
+{
+    if (prof_fp == NULL)
+        return;
+    int thn = omp_get_thread_num();
+    if (thn < prof_nthreads)
+        prof_threads[thn].v[counter] += n;
+}
+
+void SumCounters(vector<long>& sums)
+{
+    sums.assign(PROF_NCOUNTERS, 0);
+    for (int t = 0; t < prof_nthreads; t++)
+    {
+        for (int c = 0; c < PROF_NCOUNTERS; c++)
+            sums[c] += prof_threads[t].v[c];
+    }
+}
+
+long PeakRSS()
+{
+#ifndef WIN32
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+        return ru.ru_maxrss;
+#endif
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// records
+////////////////////////////////////////////////////////////////////////////////
+
+void WriteStage()
+{
+    if (prof_regions.empty())
+        return;
+    const ProfileRegion& stage = prof_regions[0];
+    if (prof_csv)
+    {
+        for (int i = 0; i < prof_regions.size(); i++)
+        {
+            const ProfileRegion& r = prof_regions[i];
+            fprintf(prof_fp, "%d,%s,%s,%d,%d,%lf,%ld", prof_iter, stage.name.c_str(), r.name.c_str(), r.depth, r.calls, r.sec, r.peak_rss);
+            for (int c = 0; c < PROF_NCOUNTERS; c++)
+                fprintf(prof_fp, ",%ld", r.counters[c]);
+            fprintf(prof_fp, "\n");
+        }
+    }
+    else
+    {
+        fprintf(prof_fp, "{\"iter\":%d,\"stage\":\"%s\",\"seconds\":%lf,\"peak_rss_kb\":%ld,\"counters\":{", prof_iter, stage.name.c_str(), stage.sec, stage.peak_rss);
+        for (int c = 0; c < PROF_NCOUNTERS; c++)
+            fprintf(prof_fp, "%s\"%s\":%ld", (c == 0) ? "" : ",", counter_names[c], stage.counters[c]);
+        fprintf(prof_fp, "},\"regions\":[");
+        for (int i = 1; i < prof_regions.size(); i++)
+        {
+            const ProfileRegion& r = prof_regions[i];
+            fprintf(prof_fp, "%s{\"name\":\"%s\",\"depth\":%d,\"calls\":%d,\"seconds\":%lf", (i == 1) ? "" : ",", r.name.c_str(), r.depth, r.calls, r.sec);
+            for (int c = 0; c < PROF_NCOUNTERS; c++)
+            {
+                if (r.counters[c] != 0)
+                    fprintf(prof_fp, ",\"%s\":%ld", counter_names[c], r.counters[c]);
+            }
+            fprintf(prof_fp, "}");
+        }
+        fprintf(prof_fp, "]}\n");
+    }
+    fflush(prof_fp);
+    prof_regions.clear();
+}
+
+bool ProfileOpen(const string& filename)
+{
+    ProfileClose();
+    prof_fp = fopen(filename.c_str(), "w");
+    if (prof_fp == NULL)
+    {
+        printf("Error: could not open profile file %s!\n", filename.c_str());
+        return false;
+    }
+    prof_csv = (filename.size() >= 4) && (filename.compare(filename.size() - 4, 4, ".csv") == 0);
+    if (prof_csv)
+    {
+        fprintf(prof_fp, "iter,stage,region,depth,calls,seconds,peak_rss_kb");
+        for (int c = 0; c < PROF_NCOUNTERS; c++)
+            fprintf(prof_fp, ",%s", counter_names[c]);
+        fprintf(prof_fp, "\n");
+    }
+    prof_nthreads = omp_get_max_threads();
+    prof_buffer.assign((prof_nthreads + 1) * sizeof(ThreadCounters), 0);
+    prof_threads = (ThreadCounters*) ((size_t(&prof_buffer[0]) + 63) & ~size_t(63));
+    return true;
+}
+
+void ProfileClose()
+{
+    if (prof_fp == NULL)
+        return;
+    fclose(prof_fp);
+    prof_fp = NULL;
+    prof_open.clear();
+    prof_regions.clear();
+}
+
+void ProfileSetIteration(int iter)
+{
+    prof_iter = iter;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// scopes
+////////////////////////////////////////////////////////////////////////////////
+
+bool ProfileBegin(const char* name)
+{
+    if ((prof_fp == NULL) || omp_in_parallel())
+        return false;
+
+    // full name of the region
+    OpenRegion o;
+    o.name = prof_open.empty() ? string(name) : prof_open.back().name + string("/") + string(name);
+    SumCounters(o.start);
+    prof_open.push_back(o);
+    prof_open.back().timer.start();
+    return true;
+}
+
+void ProfileEnd()
+{
+    if ((prof_fp == NULL) || prof_open.empty())
+        return;
+    OpenRegion& o = prof_open.back();
+    o.timer.stop();
+
+    vector<long> sums;
+    SumCounters(sums);
+    int depth = prof_open.size() - 1;
+
+    // regions with the same name in a stage are merged
+    int k = 0;
+    while ((k < prof_regions.size()) && (prof_regions[k].name != o.name))
+        k++;
+    if (k == prof_regions.size())
+    {
+        ProfileRegion r;
+        r.name = o.name;
+        r.depth = depth;
+        r.calls = 0;
+        r.sec = 0.0;
+        memset(r.counters, 0, sizeof(r.counters));
+        prof_regions.push_back(r);
+    }
+    ProfileRegion& r = prof_regions[k];
+    r.calls++;
+    r.sec += 0.001 * o.timer.getElapsedTimeInMilliSec();
+    r.peak_rss = PeakRSS();
+    for (int c = 0; c < PROF_NCOUNTERS; c++)
+        r.counters[c] += sums[c] - o.start[c];
+    prof_open.pop_back();
+
+    // the stage is first in its record
+    if (depth == 0)
+    {
+        rotate(prof_regions.begin(), prof_regions.begin() + k, prof_regions.begin() + k + 1);
+        WriteStage();
+    }
+}
+
+ProfileScope::ProfileScope(const char* name)
+{
+    active = ProfileBegin(name);
+}
+
+ProfileScope::~ProfileScope()
+{
+    if (active)
+        ProfileEnd();
+}
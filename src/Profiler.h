@@ -0,0 +1,81 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#pragma once
+
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include <string>
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Per-stage profiling of the main loop. A ProfileScope times the code until
+// the end of its block; scopes opened inside another scope are recorded as
+// nested regions ("stage/region"). ProfileBegin()/ProfileEnd() do the same
+// for code that is not a block. When an outermost scope (a stage) closes,
+// one record with all its regions is appended to the profile file:
+//   - .csv  one row per region
+//   - other one JSON object per line
+// Scopes opened inside a parallel region are ignored. Counters can be
+// updated from any thread, every thread has its own copy.
+// Nothing is recorded until ProfileOpen() is called.
+
+enum ProfileCounter
+{
+	PROF_VOXELS = 0,          // voxels whose natural neighbors were computed
+	PROF_NATURAL_NEIGHBORS,   // natural neighbors over these voxels
+	PROF_SURFACE_FITS,        // calls to FindSurfaceFit
+	PROF_FAILED_FITS,         // fits that fell back to regular Sibson
+	PROF_LOCK_CONTENTION,     // lock acquisitions that had to wait
+	PROF_SAMPLES_ADDED,       // sites added by the refinement
+	PROF_INTEGRATION_STEPS,   // integration steps of on-demand samples
+	PROF_NCOUNTERS
+};
+
+class ProfileScope
+{
+public:
+	ProfileScope(const char* name);
+	~ProfileScope();
+
+private:
+	bool active;
+};
+
+// returns false when nothing is recorded (no file or inside a parallel region)
+bool ProfileBegin(const char* name);
+void ProfileEnd();
+
+// filename ending with .csv selects CSV, otherwise JSON lines
+bool ProfileOpen(const std::string& filename);
+void ProfileClose();
+
+// iteration written in the following records
+void ProfileSetIteration(int iter);
+
+void ProfileCount(int counter, long n = 1);
+
+// peak resident set size of the process in KB
+long PeakRSS();
+
+#endif
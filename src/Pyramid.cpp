@@ -0,0 +1,219 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#include "Pyramid.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// levels
+////////////////////////////////////////////////////////////////////////////////
+
+SibsonPyramid::SibsonPyramid(map<string, string>& parameters, NrrdWrapper3D* _grid)
+    : level(0), grid(_grid)
+{
+    enabled = (atoi(parameters["MULTIRES"].c_str()) != 0);
+    ratio = parameters["MULTIRES_RATIO"].empty() ? 4 : atoi(parameters["MULTIRES_RATIO"].c_str());
+    max_level = parameters["MULTIRES_LEVELS"].empty() ? 4 : atoi(parameters["MULTIRES_LEVELS"].c_str());
+    max_level = enabled ? max(max_level - 1, 0) : 0;
+    for (int cdim = 0; cdim < 3; cdim++)
+        lrecons[cdim] = NULL;
+
+    // start from the coarsest level, Select() only goes down
+    level = max_level;
+}
+
+SibsonPyramid::~SibsonPyramid()
+{
+    Free();
+}
+
+void SibsonPyramid::Free()
+{
+    for (int cdim = 0; cdim < 3; cdim++)
+    {
+        delete lrecons[cdim];
+        lrecons[cdim] = NULL;
+        lerrm[cdim].clear();
+    }
+    lquery_cls.clear();
+    lquery_nc.clear();
+}
+
+int SibsonPyramid::Select(long npts, bool fine)
+{
+    int l = 0;
+    if (enabled && !fine && (npts > 0))
+    {
+        // grid points between neighboring sites
+        double h = pow(double(grid->Size()) / npts, 1.0 / 3.0);
+        while ((l < max_level) && ((h / (1 << (l + 1))) >= ratio))
+            l++;
+
+        // a level needs two points along each axis
+        while ((l > 0) && ((grid->width() - 1) / (1 << l) < 1 || (grid->height() - 1) / (1 << l) < 1 || (grid->depth() - 1) / (1 << l) < 1))
+            l--;
+    }
+    l = min(l, level);
+    if ((l != level) || ((l > 0) && (lrecons[0] == NULL)))
+    {
+        level = l;
+        Free();
+        if (level > 0)
+            Build();
+    }
+    if (enabled)
+        printf("Reconstruction level %d.\n", level);
+    return level;
+}
+
+void SibsonPyramid::Build()
+{
+    int s = 1 << level;
+    ldims[0] = (grid->width() - 1) / s + 1;
+    ldims[1] = (grid->height() - 1) / s + 1;
+    ldims[2] = (grid->depth() - 1) / s + 1;
+    int size = ldims[0] * ldims[1] * ldims[2];
+    double3 spacing = make_double3(
+        s * grid->ni->axis[0].spacing,
+        s * grid->ni->axis[1].spacing,
+        s * grid->ni->axis[2].spacing);
+    for (int cdim = 0; cdim < 3; cdim++)
+    {
+        float* data = (float*) calloc(size, sizeof(float));
+        lrecons[cdim] = new NrrdWrapper3D(createNrrd3D(data, make_int3(ldims[0], ldims[1], ldims[2]), spacing));
+        lerrm[cdim].resize(size);
+    }
+    lquery_cls.resize(size);
+    lquery_nc.resize(size);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// reconstruction
+////////////////////////////////////////////////////////////////////////////////
+
+void SibsonPyramid::Upsample(int dim, NrrdWrapper3D** recons, vector<float>* errm, vector<closest_site>& query_cls)
+{
+    // a single pass over the full grid: the cell and weights of a grid point
+    // are found once for all the upsampled fields and its closest site
+    const float* src[6];
+    float* dst[6];
+    int nfields = 0;
+    for (int cdim = 0; cdim < dim; cdim++)
+    {
+        if (recons != NULL)
+        {
+            src[nfields] = (const float*) lrecons[cdim]->ni->data;
+            dst[nfields++] = (float*) recons[cdim]->ni->data;
+        }
+        src[nfields] = &lerrm[cdim][0];
+        dst[nfields++] = &errm[cdim][0];
+    }
+    int s = 1 << level;
+    int w = grid->width();
+    int h = grid->height();
+    int d = grid->depth();
+    int lw = ldims[0];
+    int lwh = ldims[0] * ldims[1];
+    query_cls.resize(grid->Size());
+    #pragma omp parallel for
+    for (int z = 0; z < d; z++)
+    {
+        // the grid points past the last level point take its value
+        int z0 = min(z / s, ldims[2] - 1);
+        int z1 = min(z0 + 1, ldims[2] - 1);
+        float fz = min(float(z - z0 * s) / s, 1.0f);
+        int zn = min((z + s / 2) / s, ldims[2] - 1);
+        for (int y = 0; y < h; y++)
+        {
+            int y0 = min(y / s, ldims[1] - 1);
+            int y1 = min(y0 + 1, ldims[1] - 1);
+            float fy = min(float(y - y0 * s) / s, 1.0f);
+            int yn = min((y + s / 2) / s, ldims[1] - 1);
+            int i00 = lw * y0 + lwh * z0;
+            int i10 = lw * y1 + lwh * z0;
+            int i01 = lw * y0 + lwh * z1;
+            int i11 = lw * y1 + lwh * z1;
+            int row = w * (y + h * z);
+            for (int x = 0; x < w; x++)
+            {
+                int x0 = min(x / s, ldims[0] - 1);
+                int x1 = min(x0 + 1, ldims[0] - 1);
+                float fx = min(float(x - x0 * s) / s, 1.0f);
+                for (int f = 0; f < nfields; f++)
+                {
+                    const float* l = src[f];
+                    float c00 = l[x0 + i00] + fx * (l[x1 + i00] - l[x0 + i00]);
+                    float c10 = l[x0 + i10] + fx * (l[x1 + i10] - l[x0 + i10]);
+                    float c01 = l[x0 + i01] + fx * (l[x1 + i01] - l[x0 + i01]);
+                    float c11 = l[x0 + i11] + fx * (l[x1 + i11] - l[x0 + i11]);
+                    float c0 = c00 + fy * (c10 - c00);
+                    float c1 = c01 + fy * (c11 - c01);
+                    dst[f][row + x] = c0 + fz * (c1 - c0);
+                }
+
+                // closest site of the nearest level point
+                int xn = min((x + s / 2) / s, ldims[0] - 1);
+                query_cls[row + x] = lquery_cls[xn + lw * yn + lwh * zn];
+            }
+        }
+    }
+}
+
+void SibsonPyramid::Sibson(
+    int dim,
+    vector<Sample_point>* pts,
+    Tree*& tree,
+    NrrdWrapper3D** recons,
+    vector<float>* errm,
+    vector<closest_site>& query_cls,
+    bool values)
+{
+    vector<bool> site_is_disc(pts[0].size());
+    vector<set<int> > site2discs;
+    vector<DiscSurface*> surfaces;
+    FindClosest(lrecons[0], lquery_cls, lquery_nc, pts[0], site_is_disc, tree, 0, surfaces, site2discs);
+    FindNaturalCoordinates(lrecons[0], lquery_cls, lquery_nc, pts[0], 0, surfaces);
+
+    // there is no reference on the level
+    for (int cdim = 0; cdim < dim; cdim++)
+    {
+        DiscreteSisbon(NULL, lrecons[cdim], lerrm[cdim], pts[cdim], tree, lquery_cls, lquery_nc);
+    }
+
+    // back to the full grid
+    ProfileScope scope("upsample");
+    Upsample(dim, values ? recons : NULL, errm, query_cls);
+
+    // the sites off the level lattice get an interpolated error, Refine only
+    // skips the grid points without error and would add them again
+    int nsites = pts[0].size();
+    #pragma omp parallel for
+    for (int i = 0; i < nsites; i++)
+    {
+        float3 c = grid->Space2Grid(pts[0][i].coordinate);
+        int x = myround(c.x);
+        int y = myround(c.y);
+        int z = myround(c.z);
+        if ((x < 0) || (y < 0) || (z < 0) || (x >= grid->width()) || (y >= grid->height()) || (z >= grid->depth()))
+            continue;
+        int addr = grid->Coord2Addr(x, y, z);
+        for (int cdim = 0; cdim < dim; cdim++)
+            errm[cdim][addr] = 0.0;
+    }
+}
@@ -0,0 +1,91 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#pragma once
+
+#ifndef __PYRAMID_H__
+#define __PYRAMID_H__
+
+#include "DiscreteSibson.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Coarse-to-fine reconstruction (MULTIRES=1). While the samples are sparse
+// the discrete Sibson reconstruction is smooth at the scale of their spacing,
+// so the regular Sibson step runs on a level of a grid pyramid: level l has
+// every 2^l-th grid point along each axis, with the same extent. The level
+// is the coarsest that keeps MULTIRES_RATIO (4 by default) grid points
+// between neighboring sites, up to MULTIRES_LEVELS (4) levels, and it only
+// gets finer as samples are added. The error map and, when it is used, the
+// reconstruction are upsampled (trilinear) to the full grid for the outputs
+// and the refinement, in one pass that also takes the closest sites from the
+// nearest level point. The modified
+// Sibson step needs the full grid to find the discontinuities and only runs
+// at level 0, as does the last iteration.
+
+class SibsonPyramid
+{
+public:
+	bool enabled;
+	int level;
+
+	SibsonPyramid(map<string, string>& parameters, NrrdWrapper3D* _grid);
+	~SibsonPyramid();
+
+	// level for npts samples, level 0 when fine is set
+	int Select(long npts, bool fine);
+
+	// the regular Sibson step on the level, recons, errm and query_cls are
+	// the full grid ones, errm is 0 at the sites. recons is only upsampled
+	// with values, when the reconstruction of the level is read (outputs,
+	// errors).
+	void Sibson(
+		int dim,
+		vector<Sample_point>* pts,
+		Tree*& tree,
+		NrrdWrapper3D** recons,
+		vector<float>* errm,
+		vector<closest_site>& query_cls,
+		bool values);
+
+private:
+	NrrdWrapper3D* grid;
+	int ratio;
+	int max_level;
+	int ldims[3];
+
+	// the level grids, built when the level changes
+	NrrdWrapper3D* lrecons[3];
+	vector<float> lerrm[3];
+	vector<closest_site> lquery_cls;
+	vector<NaturalNeighbors> lquery_nc;
+
+	SibsonPyramid(const SibsonPyramid&);
+	void operator=(const SibsonPyramid&);
+
+	void Build();
+	void Free();
+	// recons may be NULL
+	void Upsample(int dim, NrrdWrapper3D** recons, vector<float>* errm, vector<closest_site>& query_cls);
+};
+
+#endif
@@ -25,6 +25,7 @@ Sample_point::Sample_point(void)
 {
 	value = 0.0;
 	gradient[0] = gradient[1] = gradient[2] = 0.0;
+	unclamped_gradient[0] = unclamped_gradient[1] = unclamped_gradient[2] = 0.0;
 }
 
 Sample_point::~Sample_point(void)
@@ -43,7 +43,8 @@ public:
 	float3 coordinate;
 	int id;
 	double value;
-	double gradient[3];
+	double gradient[3];             // clamped to GRAD_LIMIT, for the interpolation
+	double unclamped_gradient[3];   // as sampled, for the FTLE
 
 	Sample_point(void);
 	~Sample_point(void);
@@ -0,0 +1,586 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#include "SparseFlowMap.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// write the sites and surfaces
+////////////////////////////////////////////////////////////////////////////////
+
+bool WriteSparseFlowMap(
+        const string& filename,
+        NrrdWrapper3D* grid,
+        int dim,
+        vector<Sample_point>* pts,
+        vector<closest_site>& query_cls,
+        DiscontinuitySurfaces* surfaces)
+{
+    Timer timer;
+    timer.start();
+
+    SparseFlowMapHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SPARSE_MAGIC, 8);
+    hdr.version = SPARSE_VERSION;
+    hdr.dims[0] = grid->width();
+    hdr.dims[1] = grid->height();
+    hdr.dims[2] = grid->depth();
+    hdr.dim = dim;
+    hdr.npts = pts[0].size();
+    for (int i = 0; i < 3; i++)
+    {
+        hdr.spacing[i] = grid->ni->axis[i].spacing;
+        hdr.nbuckets[i] = (hdr.dims[i] + SPARSE_BUCKET - 1) / SPARSE_BUCKET;
+        if (hdr.dims[i] > 65536)
+        {
+            printf("Error: sparse flow maps are limited to 65536 points per axis!\n");
+            return false;
+        }
+    }
+
+    // reach of the natural neighbors of both Sibson steps
+    hdr.reach = 0.0;
+    for (int i = 0; i < query_cls.size(); i++)
+    {
+        hdr.reach = max(hdr.reach, query_cls[i].dist);
+    }
+    for (int cdim = 0; cdim < dim; cdim++)
+    {
+        hdr.nosurf[cdim] = -1;
+        if (surfaces == NULL)
+            continue;
+        DiscontinuitySurfaces& ds = surfaces[cdim];
+        if (ds.site_is_disc.size() != hdr.npts)
+        {
+            printf("Error: the surfaces of component %d are not from the current samples!\n", cdim);
+            return false;
+        }
+        hdr.nosurf[cdim] = ds.points.size();
+        for (int i = 0; i < ds.points.size(); i++)
+            hdr.nsurfpts[cdim] += ds.points[i].size();
+        for (int k = 0; k < ds.site2discs.size(); k++)
+            hdr.npairs[cdim] += ds.site2discs[k].size();
+        hdr.reach = max(hdr.reach, ds.max_dist);
+    }
+
+    // sort the sites by bucket
+    int nb = hdr.nbuckets[0] * hdr.nbuckets[1] * hdr.nbuckets[2];
+    vector<int> bucket_off(nb + 1, 0);
+    vector<int> bucket(hdr.npts);
+    vector<unsigned short> grid_coords(3 * hdr.npts);
+    for (int i = 0; i < hdr.npts; i++)
+    {
+        float3 g = grid->Space2Grid(pts[0][i].coordinate);
+        int c[3] = {myround(g.x), myround(g.y), myround(g.z)};
+        for (int j = 0; j < 3; j++)
+            grid_coords[3 * i + j] = c[j];
+        bucket[i] = (c[0] / SPARSE_BUCKET) + hdr.nbuckets[0] * ((c[1] / SPARSE_BUCKET) + hdr.nbuckets[1] * (c[2] / SPARSE_BUCKET));
+        bucket_off[bucket[i] + 1]++;
+    }
+    for (int b = 0; b < nb; b++)
+    {
+        bucket_off[b + 1] += bucket_off[b];
+    }
+    vector<int> remap(hdr.npts);
+    vector<int> next(bucket_off.begin(), bucket_off.end() - 1);
+    for (int i = 0; i < hdr.npts; i++)
+    {
+        remap[i] = next[bucket[i]]++;
+    }
+
+    // site arrays in bucket order
+    vector<unsigned short> coords(3 * hdr.npts);
+    vector<float> samples(4 * hdr.npts * dim);
+    vector<unsigned char> disc(hdr.npts, 0);
+    for (int i = 0; i < hdr.npts; i++)
+    {
+        int k = remap[i];
+        for (int j = 0; j < 3; j++)
+            coords[3 * k + j] = grid_coords[3 * i + j];
+        for (int cdim = 0; cdim < dim; cdim++)
+        {
+            float* s = &samples[4 * (cdim * hdr.npts + k)];
+            s[0] = pts[cdim][i].value;
+            s[1] = pts[cdim][i].gradient[0];
+            s[2] = pts[cdim][i].gradient[1];
+            s[3] = pts[cdim][i].gradient[2];
+            if ((hdr.nosurf[cdim] >= 0) && surfaces[cdim].site_is_disc[i])
+                disc[k] |= (1 << cdim);
+        }
+    }
+
+    string tmpname = filename + string(".tmp");
+    FILE* fp = fopen(tmpname.c_str(), "wb");
+    if (fp == NULL)
+    {
+        printf("Error: could not open %s for writing!\n", tmpname.c_str());
+        return false;
+    }
+    bool ok = WriteBlock(fp, &hdr, sizeof(hdr));
+    ok = ok && WriteBlock(fp, &bucket_off[0], bucket_off.size() * sizeof(int));
+    ok = ok && WriteBlock(fp, coords.empty() ? NULL : &coords[0], coords.size() * sizeof(unsigned short));
+    for (int cdim = 0; cdim < dim; cdim++)
+        ok = ok && WriteBlock(fp, samples.empty() ? NULL : &samples[4 * cdim * hdr.npts], 4 * hdr.npts * sizeof(float));
+    ok = ok && WriteBlock(fp, disc.empty() ? NULL : &disc[0], disc.size());
+    for (int cdim = 0; cdim < dim; cdim++)
+    {
+        if (hdr.nosurf[cdim] < 0)
+            continue;
+        DiscontinuitySurfaces& ds = surfaces[cdim];
+
+        // the point sets one after the other, with the sites renumbered
+        vector<int> surf_off(hdr.nosurf[cdim] + 1, 0);
+        vector<SurfacePoint> surf_pts;
+        surf_pts.reserve(hdr.nsurfpts[cdim]);
+        for (int i = 0; i < hdr.nosurf[cdim]; i++)
+        {
+            for (int k = 0; k < ds.points[i].size(); k++)
+            {
+                surf_pts.push_back(ds.points[i][k]);
+                surf_pts.back().site = remap[surf_pts.back().site];
+            }
+            surf_off[i + 1] = surf_pts.size();
+        }
+        vector<int> pairs;
+        pairs.reserve(2 * hdr.npairs[cdim]);
+        for (int k = 0; k < ds.site2discs.size(); k++)
+        {
+            for (set<int>::iterator it = ds.site2discs[k].begin(); it != ds.site2discs[k].end(); it++)
+            {
+                pairs.push_back(remap[k]);
+                pairs.push_back(*it);
+            }
+        }
+        ok = ok && WriteBlock(fp, &surf_off[0], surf_off.size() * sizeof(int));
+        ok = ok && WriteBlock(fp, surf_pts.empty() ? NULL : &surf_pts[0], surf_pts.size() * sizeof(SurfacePoint));
+        ok = ok && WriteBlock(fp, pairs.empty() ? NULL : &pairs[0], pairs.size() * sizeof(int));
+    }
+    long bytes = ftell(fp);
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || (rename(tmpname.c_str(), filename.c_str()) != 0))
+    {
+        printf("Error: could not write sparse flow map %s!\n", filename.c_str());
+        remove(tmpname.c_str());
+        return false;
+    }
+
+    timer.stop();
+    double dense = double(grid->Size()) * dim * sizeof(float);
+    printf("Write '%s' (%d samples, %.1lf times smaller than the dense output) in %lf sec.\n", filename.c_str(), hdr.npts, dense / bytes, 0.001 * timer.getElapsedTimeInMilliSec());
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// open a sparse flow map
+////////////////////////////////////////////////////////////////////////////////
+
+// the next block of the mapping, NULL if the file is too short
+const char* NextBlock(const MappedCheckpoint& file, size_t& offset, size_t bytes)
+{
+    if (offset + bytes > file.size)
+        return NULL;
+    const char* p = file.data + offset;
+    offset += AlignedSize(bytes);
+    return p;
+}
+
+SparseFlowMap::SparseFlowMap()
+{
+    memset(&hdr, 0, sizeof(hdr));
+    bucket_off = NULL;
+    coords = NULL;
+    disc = NULL;
+    for (int i = 0; i < 3; i++)
+    {
+        samples[i] = NULL;
+        surf_off[i] = NULL;
+        surf_pts[i] = NULL;
+        pairs[i] = NULL;
+    }
+}
+
+bool SparseFlowMap::Open(const string& filename)
+{
+    // only the pages of the requested regions are read
+    if (!file.open(filename, false))
+    {
+        printf("Error: could not open sparse flow map %s!\n", filename.c_str());
+        return false;
+    }
+    if (file.size < sizeof(hdr))
+    {
+        printf("Error: %s is too short!\n", filename.c_str());
+        return false;
+    }
+    memcpy(&hdr, file.data, sizeof(hdr));
+    bool valid = (memcmp(hdr.magic, SPARSE_MAGIC, 8) == 0) && (hdr.version == SPARSE_VERSION) && (hdr.dim >= 1) && (hdr.dim <= 3) && (hdr.npts >= 0);
+    for (int i = 0; valid && (i < 3); i++)
+    {
+        valid = (hdr.dims[i] >= 1) && (hdr.dims[i] <= 65536) && (hdr.nbuckets[i] == (hdr.dims[i] + SPARSE_BUCKET - 1) / SPARSE_BUCKET);
+    }
+    valid = valid && (double(hdr.nbuckets[0]) * hdr.nbuckets[1] * hdr.nbuckets[2] < 2147483647.0);
+    for (int cdim = 0; valid && (cdim < hdr.dim); cdim++)
+    {
+        valid = (hdr.nosurf[cdim] >= -1) && ((hdr.nosurf[cdim] < 0) || ((hdr.nsurfpts[cdim] >= 0) && (hdr.npairs[cdim] >= 0)));
+    }
+    if (!valid)
+    {
+        printf("Error: %s is not a compatible sparse flow map!\n", filename.c_str());
+        return false;
+    }
+
+    size_t offset = AlignedSize(sizeof(hdr));
+    int nb = hdr.nbuckets[0] * hdr.nbuckets[1] * hdr.nbuckets[2];
+    bucket_off = (const int*) NextBlock(file, offset, (nb + 1) * sizeof(int));
+    coords = (const unsigned short*) NextBlock(file, offset, 3 * size_t(hdr.npts) * sizeof(unsigned short));
+    bool ok = (bucket_off != NULL) && (coords != NULL);
+    for (int cdim = 0; cdim < hdr.dim; cdim++)
+    {
+        samples[cdim] = (const float*) NextBlock(file, offset, 4 * size_t(hdr.npts) * sizeof(float));
+        ok = ok && (samples[cdim] != NULL);
+    }
+    disc = (const unsigned char*) NextBlock(file, offset, hdr.npts);
+    ok = ok && (disc != NULL);
+    for (int cdim = 0; cdim < hdr.dim; cdim++)
+    {
+        if (hdr.nosurf[cdim] < 0)
+            continue;
+        surf_off[cdim] = (const int*) NextBlock(file, offset, (size_t(hdr.nosurf[cdim]) + 1) * sizeof(int));
+        surf_pts[cdim] = (const SurfacePoint*) NextBlock(file, offset, size_t(hdr.nsurfpts[cdim]) * sizeof(SurfacePoint));
+        pairs[cdim] = (const int*) NextBlock(file, offset, 2 * size_t(hdr.npairs[cdim]) * sizeof(int));
+        ok = ok && (surf_off[cdim] != NULL) && (surf_pts[cdim] != NULL) && (pairs[cdim] != NULL);
+    }
+    if (!ok)
+    {
+        printf("Error: sparse flow map %s is truncated!\n", filename.c_str());
+        return false;
+    }
+
+    // the blocks are read without bounds checks, their indices must be valid
+    valid = (bucket_off[0] == 0) && (bucket_off[nb] == hdr.npts);
+    for (int i = 0; valid && (i < nb); i++)
+    {
+        valid = (bucket_off[i] <= bucket_off[i + 1]);
+    }
+    for (int k = 0; valid && (k < hdr.npts); k++)
+    {
+        const unsigned short* c = coords + 3 * k;
+        valid = (c[0] < hdr.dims[0]) && (c[1] < hdr.dims[1]) && (c[2] < hdr.dims[2]);
+    }
+    for (int cdim = 0; valid && (cdim < hdr.dim); cdim++)
+    {
+        if (hdr.nosurf[cdim] < 0)
+            continue;
+        valid = (surf_off[cdim][0] == 0) && (surf_off[cdim][hdr.nosurf[cdim]] == hdr.nsurfpts[cdim]);
+        for (int i = 0; valid && (i < hdr.nosurf[cdim]); i++)
+        {
+            valid = (surf_off[cdim][i] <= surf_off[cdim][i + 1]);
+        }
+        for (int k = 0; valid && (k < hdr.nsurfpts[cdim]); k++)
+        {
+            valid = (surf_pts[cdim][k].site >= 0) && (surf_pts[cdim][k].site < hdr.npts);
+        }
+        for (int k = 0; valid && (k < hdr.npairs[cdim]); k++)
+        {
+            valid = (pairs[cdim][2 * k] >= 0) && (pairs[cdim][2 * k] < hdr.npts) &&
+                    (pairs[cdim][2 * k + 1] >= 0) && (pairs[cdim][2 * k + 1] < hdr.nosurf[cdim]);
+        }
+    }
+    if (!valid)
+    {
+        printf("Error: sparse flow map %s has invalid site or surface indices!\n", filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+void SparseFlowMap::FindSites(const int* lo, const int* hi, vector<int>& ids) const
+{
+    int blo[3];
+    int bhi[3];
+    for (int i = 0; i < 3; i++)
+    {
+        blo[i] = max(lo[i], 0) / SPARSE_BUCKET;
+        bhi[i] = min(hi[i], hdr.dims[i] - 1) / SPARSE_BUCKET;
+    }
+
+    // the buckets of a row are consecutive
+    for (int bz = blo[2]; bz <= bhi[2]; bz++)
+    {
+        for (int by = blo[1]; by <= bhi[1]; by++)
+        {
+            int row = hdr.nbuckets[0] * (by + hdr.nbuckets[1] * bz);
+            for (int k = bucket_off[row + blo[0]]; k < bucket_off[row + bhi[0] + 1]; k++)
+            {
+                const unsigned short* c = coords + 3 * k;
+                if ((c[0] >= lo[0]) && (c[0] <= hi[0]) && (c[1] >= lo[1]) && (c[1] <= hi[1]) && (c[2] >= lo[2]) && (c[2] <= hi[2]))
+                    ids.push_back(k);
+            }
+        }
+    }
+}
+
+// position of a site in the sorted local sites, -1 if it is not there
+int LocalSite(const vector<int>& ids, int site)
+{
+    vector<int>::const_iterator it = lower_bound(ids.begin(), ids.end(), site);
+    if ((it == ids.end()) || (*it != site))
+        return -1;
+    return it - ids.begin();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// reconstruct a box
+////////////////////////////////////////////////////////////////////////////////
+
+bool SparseFlowMap::Reconstruct(const int* lo, const int* hi, vector<float>* values)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        if ((lo[i] < 0) || (hi[i] >= hdr.dims[i]) || (lo[i] > hi[i]))
+        {
+            printf("Error: box [%d %d %d]-[%d %d %d] is not inside the grid!\n", lo[0], lo[1], lo[2], hi[0], hi[1], hi[2]);
+            return false;
+        }
+    }
+
+    // a grid point only gets natural neighbors from the grid points within
+    // reach and they only see the sites within reach. The regular step is
+    // also needed within reach of the points of the modified step.
+    double min_spc = min(hdr.spacing[0], min(hdr.spacing[1], hdr.spacing[2]));
+    int reach = int(ceil(hdr.reach / min_spc)) + 1;
+    int glo[3];
+    int ghi[3];
+    int slo[3];
+    int shi[3];
+    for (int i = 0; i < 3; i++)
+    {
+        glo[i] = max(lo[i] - 2 * reach, 0);
+        ghi[i] = min(hi[i] + 2 * reach, hdr.dims[i] - 1);
+        slo[i] = lo[i] - 3 * reach;
+        shi[i] = hi[i] + 3 * reach;
+    }
+    vector<int> ids;
+    FindSites(slo, shi, ids);
+
+    // the surface fits also use the sites of the surface points
+    for (int cdim = 0; cdim < hdr.dim; cdim++)
+    {
+        for (int k = 0; k < ((hdr.nosurf[cdim] > 0) ? hdr.nsurfpts[cdim] : 0); k++)
+            ids.push_back(surf_pts[cdim][k].site);
+    }
+    sort(ids.begin(), ids.end());
+    ids.erase(unique(ids.begin(), ids.end()), ids.end());
+    if (ids.empty())
+    {
+        printf("Error: no sample sites around the box!\n");
+        return false;
+    }
+
+    // the sites in the frame of the local grid
+    int nids = ids.size();
+    vector<Sample_point> pts[3];
+    for (int cdim = 0; cdim < hdr.dim; cdim++)
+    {
+        pts[cdim].resize(nids);
+        for (int k = 0; k < nids; k++)
+        {
+            const unsigned short* c = coords + 3 * ids[k];
+            const float* s = samples[cdim] + 4 * ids[k];
+            Sample_point& qp = pts[cdim][k];
+            qp.coordinate = make_float3((c[0] - glo[0]) * hdr.spacing[0], (c[1] - glo[1]) * hdr.spacing[1], (c[2] - glo[2]) * hdr.spacing[2]);
+            qp.value = s[0];
+            qp.gradient[0] = s[1];
+            qp.gradient[1] = s[2];
+            qp.gradient[2] = s[3];
+        }
+    }
+    int3 ldims = make_int3(ghi[0] - glo[0] + 1, ghi[1] - glo[1] + 1, ghi[2] - glo[2] + 1);
+    int size = ldims.x * ldims.y * ldims.z;
+    NrrdWrapper3D* recons[3];
+    for (int cdim = 0; cdim < hdr.dim; cdim++)
+    {
+        float* data = (float*) calloc(size, sizeof(float));
+        recons[cdim] = new NrrdWrapper3D(createNrrd3D(data, ldims, make_double3(hdr.spacing[0], hdr.spacing[1], hdr.spacing[2])), false, false);
+    }
+
+    // regular Sibson
+    Tree* tree = NULL;
+    vector<closest_site> query_cls(size);
+    vector<NaturalNeighbors> query_nc(size);
+    vector<bool> site_is_disc(nids);
+    vector<set<int> > site2discs;
+    vector<DiscSurface*> surfaces;
+    FindClosest(recons[0], query_cls, query_nc, pts[0], site_is_disc, tree, 0, surfaces, site2discs);
+    FindNaturalCoordinates(recons[0], query_cls, query_nc, pts[0], 0, surfaces);
+    for (int cdim = 0; cdim < hdr.dim; cdim++)
+    {
+        vector<float> errm(size);
+        DiscreteSisbon(NULL, recons[cdim], errm, pts[cdim], tree, query_cls, query_nc);
+
+        // modified Sibson with the stored surfaces
+        int nosurf = hdr.nosurf[cdim];
+        if (nosurf <= 0)
+            continue;
+        surfaces.resize(omp_get_max_threads() * nosurf);
+        for (int i = 0; i < nosurf; i++)
+        {
+            PointSet* pPointsNormals = new PointSet(PointSet::Attribute_position
+                        | PointSet::Attribute_normal
+                        | PointSet::Attribute_radius
+                        | PointSet::Attribute_siteid);
+            for (int k = surf_off[cdim][i]; k < surf_off[cdim][i + 1]; k++)
+            {
+                const SurfacePoint& sp = surf_pts[cdim][k];
+                PointSet::PointHandle pt = pPointsNormals->append();
+                pt.position() = Vector3(sp.position[0] - glo[0] * hdr.spacing[0] / min_spc,
+                                        sp.position[1] - glo[1] * hdr.spacing[1] / min_spc,
+                                        sp.position[2] - glo[2] * hdr.spacing[2] / min_spc);
+                pt.normal() = Vector3(sp.normal[0], sp.normal[1], sp.normal[2]);
+                pt.radius() = sp.radius;
+                pt.siteid() = LocalSite(ids, sp.site);
+            }
+            FitDiscSurface(pPointsNormals, i, nosurf, surfaces);
+        }
+        vector<bool> mdisc(nids);
+        for (int k = 0; k < nids; k++)
+        {
+            mdisc[k] = ((disc[ids[k]] >> cdim) & 1) != 0;
+        }
+        vector<set<int> > msite2discs(nids);
+        for (int k = 0; k < hdr.npairs[cdim]; k++)
+        {
+            int site = LocalSite(ids, pairs[cdim][2 * k]);
+            if (site >= 0)
+                msite2discs[site].insert(pairs[cdim][2 * k + 1]);
+        }
+        vector<vector<float> > sites_pot;
+        vector<vector<float> > sites_pgr;
+        FindSitePotentials(recons[cdim], pts[cdim], nosurf, surfaces, sites_pot, sites_pgr);
+        vector<closest_site> mquery_cls(query_cls);
+        vector<NaturalNeighbors> mquery_nc(query_nc);
+        ModifiedSibsonInterpolation(recons[cdim], errm, pts[cdim], mdisc, nosurf, surfaces, msite2discs, sites_pot, sites_pgr, mquery_cls, mquery_nc);
+        FreeDiscSurfaces(surfaces, nosurf);
+    }
+    delete tree;
+
+    // copy the box out of the local grids
+    for (int cdim = 0; cdim < hdr.dim; cdim++)
+    {
+        values[cdim].resize((hi[0] - lo[0] + 1) * (hi[1] - lo[1] + 1) * (hi[2] - lo[2] + 1));
+        int k = 0;
+        for (int z = lo[2]; z <= hi[2]; z++)
+        {
+            for (int y = lo[1]; y <= hi[1]; y++)
+            {
+                for (int x = lo[0]; x <= hi[0]; x++)
+                {
+                    double v = recons[cdim]->ProbeValueAt(x - glo[0], y - glo[1], z - glo[2]);
+                    values[cdim][k++] = myiswn(v) ? 0.0 : v;
+                }
+            }
+        }
+        delete recons[cdim];
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// reconstruct at points
+////////////////////////////////////////////////////////////////////////////////
+
+bool SparseFlowMap::ReconstructAt(const vector<float3>& x, vector<float3>& values)
+{
+    values.resize(x.size());
+    if (x.empty())
+        return true;
+
+    // cell of every point, clamped to the grid, and its bucket
+    vector<int3> cells(x.size());
+    vector<float3> fracs(x.size());
+    vector<pair<int, int> > order(x.size());
+    for (int k = 0; k < x.size(); k++)
+    {
+        float g[3] = {float(x[k].x / hdr.spacing[0]), float(x[k].y / hdr.spacing[1]), float(x[k].z / hdr.spacing[2])};
+        int c[3];
+        float f[3];
+        for (int i = 0; i < 3; i++)
+        {
+            g[i] = min(max(g[i], 0.0f), float(hdr.dims[i] - 1));
+            c[i] = min(int(floor(g[i])), max(hdr.dims[i] - 2, 0));
+            f[i] = g[i] - c[i];
+        }
+        cells[k] = make_int3(c[0], c[1], c[2]);
+        fracs[k] = make_float3(f[0], f[1], f[2]);
+        int b = (c[0] / SPARSE_BUCKET) + hdr.nbuckets[0] * ((c[1] / SPARSE_BUCKET) + hdr.nbuckets[1] * (c[2] / SPARSE_BUCKET));
+        order[k] = make_pair(b, k);
+    }
+
+    // the points are reconstructed per bucket, in the box around the cells
+    // of the bucket's points only
+    sort(order.begin(), order.end());
+    int first = 0;
+    while (first < order.size())
+    {
+        int last = first;
+        while ((last < order.size()) && (order[last].first == order[first].first))
+            last++;
+
+        int lo[3] = {hdr.dims[0], hdr.dims[1], hdr.dims[2]};
+        int hi[3] = {0, 0, 0};
+        for (int j = first; j < last; j++)
+        {
+            int3 c = cells[order[j].second];
+            int ci[3] = {c.x, c.y, c.z};
+            for (int i = 0; i < 3; i++)
+            {
+                lo[i] = min(lo[i], ci[i]);
+                hi[i] = max(hi[i], min(ci[i] + 1, hdr.dims[i] - 1));
+            }
+        }
+        vector<float> box[3];
+        if (!Reconstruct(lo, hi, box))
+            return false;
+
+        // trilinear between the corners of the cells
+        int bw = hi[0] - lo[0] + 1;
+        int bh = hi[1] - lo[1] + 1;
+        for (int j = first; j < last; j++)
+        {
+            int k = order[j].second;
+            float v[3] = {0.0, 0.0, 0.0};
+            for (int corner = 0; corner < 8; corner++)
+            {
+                int dx = corner & 1;
+                int dy = (corner >> 1) & 1;
+                int dz = (corner >> 2) & 1;
+                float w = (dx ? fracs[k].x : 1.0f - fracs[k].x) * (dy ? fracs[k].y : 1.0f - fracs[k].y) * (dz ? fracs[k].z : 1.0f - fracs[k].z);
+                if (w == 0.0f)
+                    continue;
+                int idx = (cells[k].x + dx - lo[0]) + bw * ((cells[k].y + dy - lo[1]) + bh * (cells[k].z + dz - lo[2]));
+                for (int cdim = 0; cdim < hdr.dim; cdim++)
+                    v[cdim] += w * box[cdim][idx];
+            }
+            values[k] = make_float3(v[0], v[1], v[2]);
+        }
+        first = last;
+    }
+    return true;
+}
@@ -0,0 +1,115 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#pragma once
+
+#ifndef __SPARSEFLOWMAP_H__
+#define __SPARSEFLOWMAP_H__
+
+#include "DiscreteSibson.h"
+#include "Checkpoint.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Sparse flow map: the reconstruction stored as what it is computed from
+// instead of its values on the grid. The file is a fixed header followed by
+// raw arrays on 64 byte boundaries (as the checkpoints):
+//   - the offsets of the sites of every bucket of SPARSE_BUCKET^3 grid
+//     points, the sites are sorted by bucket
+//   - the grid coordinates of the sites
+//   - the value and gradient of every component at the sites
+//   - the sites left out of the closest site search of the modified Sibson
+//     step (one bit per component)
+//   - for every component of a modified Sibson step, the APSS point sets of
+//     its discontinuity surfaces and the (site, surface) pairs of site2discs
+// A box of the grid is reconstructed with the functions of DiscreteSibson
+// on a local grid around it, from the sites in reach of the box only. The
+// values match the dense output up to floating point rounding, and to the
+// choice between equidistant closest sites that the kd-tree makes in the
+// order of its own points.
+
+#define SPARSE_MAGIC "SPARSEFM"
+#define SPARSE_VERSION 1
+#define SPARSE_BUCKET 8
+
+struct SparseFlowMapHeader
+{
+	char magic[8];
+	int version;
+	int dims[3];
+	double spacing[3];
+	int dim;               // number of components
+	int npts;              // number of sites
+	int nbuckets[3];
+	float reach;           // largest distance from a grid point to its closest site
+	int nosurf[3];         // surfaces per component, -1 for regular Sibson
+	int nsurfpts[3];       // surface points per component
+	int npairs[3];         // site/surface pairs per component
+};
+
+// the sites of pts (the same for all components), with the surfaces of a
+// modified Sibson step when surfaces is not NULL. query_cls are the closest
+// sites of the last regular Sibson step.
+bool WriteSparseFlowMap(
+	const string& filename,
+	NrrdWrapper3D* grid,
+	int dim,
+	vector<Sample_point>* pts,
+	vector<closest_site>& query_cls,
+	DiscontinuitySurfaces* surfaces);
+
+class SparseFlowMap
+{
+public:
+	SparseFlowMapHeader hdr;
+
+	SparseFlowMap();
+
+	// false if the file can not be used
+	bool Open(const string& filename);
+
+	// the grid points lo..hi (inclusive), values[cdim] has the box x fastest
+	bool Reconstruct(const int* lo, const int* hi, vector<float>* values);
+
+	// points of the grid frame (grid coordinates times spacing), trilinear
+	// between the grid points. The points are grouped by bucket and only the
+	// box around the cells of a group is reconstructed.
+	bool ReconstructAt(const vector<float3>& x, vector<float3>& values);
+
+private:
+	MappedCheckpoint file;
+	const int* bucket_off;
+	const unsigned short* coords;
+	const float* samples[3];
+	const unsigned char* disc;
+	const int* surf_off[3];
+	const SurfacePoint* surf_pts[3];
+	const int* pairs[3];
+
+	SparseFlowMap(const SparseFlowMap&);
+	void operator=(const SparseFlowMap&);
+
+	// sites of the buckets overlapping lo..hi that are inside it
+	void FindSites(const int* lo, const int* hi, vector<int>& ids) const;
+};
+
+#endif
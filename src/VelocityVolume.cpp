@@ -0,0 +1,507 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <vector_types.h>
+#include <vector_functions.h>
+#include <helper_math.h>
+#include <teem/nrrd.h>
+
+#include "MyMath.h"
+#include "MyTeem.h"
+#include "VelocityVolume.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////
+// bricked volume
+////////////////////////////////////////////////////////////////////////////////
+
+// points stored along each side of a brick
+#define BRICK_POINTS (VELOCITY_BRICK + 3)
+
+// point (x, y, z) of the grid, linearly extrapolated beyond its sides so
+// that the tricubic stencils of the boundary cells stay exact for linear
+// fields
+void GridPoint(const float* data, const int* dims, int x, int y, int z, float* v)
+{
+	int g[3] = {x, y, z};
+	for (int i = 0; i < 3; i++)
+	{
+		int last = dims[i] - 1;
+		if (((g[i] < 0) || (g[i] > last)) && (last > 0))
+		{
+			// v(-d) = 2 v(0) - v(d) and v(last + d) = 2 v(last) - v(last - d)
+			int edge = (g[i] < 0) ? 0 : last;
+			int mirror[3] = {g[0], g[1], g[2]};
+			mirror[i] = min(max(2 * edge - g[i], 0), last);
+			float ve[3], vm[3];
+			g[i] = edge;
+			GridPoint(data, dims, g[0], g[1], g[2], ve);
+			GridPoint(data, dims, mirror[0], mirror[1], mirror[2], vm);
+			for (int c = 0; c < 3; c++)
+				v[c] = 2.0f * ve[c] - vm[c];
+			return;
+		}
+		g[i] = min(max(g[i], 0), last);
+	}
+	const float* src = data + 3 * (g[0] + (size_t)dims[0] * (g[1] + (size_t)dims[1] * g[2]));
+	v[0] = src[0];
+	v[1] = src[1];
+	v[2] = src[2];
+}
+
+BrickedVelocityVolume::BrickedVelocityVolume(const float* data, const int* _dims, const double* _origin, const double* _spc)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		dims[i] = _dims[i];
+		origin[i] = _origin[i];
+		spc[i] = _spc[i];
+		nbricks[i] = max(1, (dims[i] - 2) / VELOCITY_BRICK + 1);
+	}
+
+	// copy the points of every brick
+	const int P = BRICK_POINTS;
+	int nb = nbricks[0] * nbricks[1] * nbricks[2];
+	bricks.resize((size_t)nb * P * P * P * 3);
+	#pragma omp parallel for
+	for (int b = 0; b < nb; b++)
+	{
+		int bx = b % nbricks[0];
+		int by = (b / nbricks[0]) % nbricks[1];
+		int bz = b / (nbricks[0] * nbricks[1]);
+		float* dst = &bricks[(size_t)b * P * P * P * 3];
+		for (int z = 0; z < P; z++)
+		{
+			for (int y = 0; y < P; y++)
+			{
+				for (int x = 0; x < P; x++)
+				{
+					GridPoint(data, dims, bx * VELOCITY_BRICK + x - 1, by * VELOCITY_BRICK + y - 1, bz * VELOCITY_BRICK + z - 1, dst);
+					dst += 3;
+				}
+			}
+		}
+	}
+}
+
+// interpolation weights of the N points around a cell and their derivatives
+// scaled by ds
+template<int N>
+inline void CellWeights(double f, double ds, double* w, double* dw);
+
+template<>
+inline void CellWeights<2>(double f, double ds, double* w, double* dw)
+{
+	w[0] = 1.0 - f;
+	w[1] = f;
+	dw[0] = -ds;
+	dw[1] = ds;
+}
+
+// Catmull-Rom
+template<>
+inline void CellWeights<4>(double f, double ds, double* w, double* dw)
+{
+	double f2 = f * f;
+	double f3 = f2 * f;
+	w[0] = 0.5 * (-f3 + 2.0 * f2 - f);
+	w[1] = 0.5 * (3.0 * f3 - 5.0 * f2 + 2.0);
+	w[2] = 0.5 * (-3.0 * f3 + 4.0 * f2 + f);
+	w[3] = 0.5 * (f3 - f2);
+	dw[0] = 0.5 * ds * (-3.0 * f2 + 4.0 * f - 1.0);
+	dw[1] = 0.5 * ds * (9.0 * f2 - 10.0 * f);
+	dw[2] = 0.5 * ds * (-9.0 * f2 + 8.0 * f + 1.0);
+	dw[3] = 0.5 * ds * (3.0 * f2 - 2.0 * f);
+}
+
+// cell of coordinate x along one axis: brick, first point of the stencil in
+// the brick and weights. Returns 0 outside the grid and 1 inside.
+template<int N>
+inline double AxisCell(double x, double origin, double spc, int dims, int& b, int& l, double* w, double* dw)
+{
+	double g = (x - origin) / spc;
+	double in = (g >= 0.0) & (g <= dims - 1);
+	g = (in != 0.0) ? g : 0.0;
+	int c = min(int(g), max(dims - 2, 0));
+	b = c / VELOCITY_BRICK;
+	l = c - b * VELOCITY_BRICK + 1 - (N / 2 - 1);
+
+	// flat axes have no derivative
+	CellWeights<N>(g - c, (dims > 1) ? 1.0 / spc : 0.0, w, dw);
+	return in;
+}
+
+// the points are processed in groups of lanes, the lanes are the innermost
+// loop of every pass so that they map to SIMD registers (the points of a
+// stencil are gathered)
+#define SAMPLE_LANES 16
+
+template<int N>
+void SampleBricks(int n, const double* x, double* v, double* G, const float* bricks, const int* dims, const int* nbricks, const double* origin, const double* spc)
+{
+	const int P = BRICK_POINTS;
+	const int L = SAMPLE_LANES;
+	for (int k0 = 0; k0 < n; k0 += L)
+	{
+		int m = min(L, n - k0);
+		double wx[N][L], wy[N][L], wz[N][L], dwx[N][L], dwy[N][L], dwz[N][L];
+		double inside[L];
+		long base[L];
+
+		// stencil of every lane
+		#pragma omp simd
+		for (int k = 0; k < m; k++)
+		{
+			const double* xk = x + 3 * (k0 + k);
+			int b[3], l[3];
+			double w[3][N], dw[3][N];
+			double in = AxisCell<N>(xk[0], origin[0], spc[0], dims[0], b[0], l[0], w[0], dw[0]);
+			in *= AxisCell<N>(xk[1], origin[1], spc[1], dims[1], b[1], l[1], w[1], dw[1]);
+			in *= AxisCell<N>(xk[2], origin[2], spc[2], dims[2], b[2], l[2], w[2], dw[2]);
+			inside[k] = in;
+			base[k] = 3 * ((long)((b[2] * nbricks[1] + b[1]) * nbricks[0] + b[0]) * P * P * P + (l[2] * P + l[1]) * P + l[0]);
+			for (int q = 0; q < N; q++)
+			{
+				wx[q][k] = w[0][q];
+				wy[q][k] = w[1][q];
+				wz[q][k] = w[2][q];
+				dwx[q][k] = dw[0][q];
+				dwy[q][k] = dw[1][q];
+				dwz[q][k] = dw[2][q];
+			}
+		}
+
+		// velocity (0-2) and gradient (3-11, row major)
+		double acc[12][L];
+		for (int i = 0; i < 12; i++)
+		{
+			for (int k = 0; k < m; k++)
+				acc[i][k] = 0.0;
+		}
+		for (int qz = 0; qz < N; qz++)
+		{
+			for (int qy = 0; qy < N; qy++)
+			{
+				for (int qx = 0; qx < N; qx++)
+				{
+					int off = 3 * ((qz * P + qy) * P + qx);
+					#pragma omp simd
+					for (int k = 0; k < m; k++)
+					{
+						long c = base[k] + off;
+						double c0 = bricks[c], c1 = bricks[c + 1], c2 = bricks[c + 2];
+						double wyz = wy[qy][k] * wz[qz][k];
+						double wv = wx[qx][k] * wyz;
+						double g0 = dwx[qx][k] * wyz;
+						double g1 = wx[qx][k] * dwy[qy][k] * wz[qz][k];
+						double g2 = wx[qx][k] * wy[qy][k] * dwz[qz][k];
+						acc[0][k] += wv * c0;
+						acc[1][k] += wv * c1;
+						acc[2][k] += wv * c2;
+						acc[3][k] += g0 * c0;
+						acc[4][k] += g1 * c0;
+						acc[5][k] += g2 * c0;
+						acc[6][k] += g0 * c1;
+						acc[7][k] += g1 * c1;
+						acc[8][k] += g2 * c1;
+						acc[9][k] += g0 * c2;
+						acc[10][k] += g1 * c2;
+						acc[11][k] += g2 * c2;
+					}
+				}
+			}
+		}
+
+		for (int k = 0; k < m; k++)
+		{
+			for (int i = 0; i < 3; i++)
+				v[3 * (k0 + k) + i] = inside[k] * acc[i][k];
+			for (int i = 0; i < 9; i++)
+				G[9 * (k0 + k) + i] = inside[k] * acc[3 + i][k];
+		}
+	}
+}
+
+void BrickedVelocityVolume::sample(int n, const double* x, double* v, double* G, bool cubic) const
+{
+	if (cubic)
+		SampleBricks<4>(n, x, v, G, &bricks[0], dims, nbricks, origin, spc);
+	else
+		SampleBricks<2>(n, x, v, G, &bricks[0], dims, nbricks, origin, spc);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// steady flow
+////////////////////////////////////////////////////////////////////////////////
+
+void BrickedFlow::domain(double* lo, double* hi) const
+{
+	for (int i = 0; i < 3; i++)
+	{
+		lo[i] = volume->origin[i];
+		hi[i] = volume->origin[i] + (volume->dims[i] - 1) * volume->spc[i];
+	}
+}
+
+void BrickedFlow::evaluate(const double* x, double t, double* v, double G[3][3]) const
+{
+	volume->sample(1, x, v, &G[0][0], cubic);
+}
+
+void BrickedFlow::evaluateBatch(int n, const double* x, const double* t, double* v, double* G) const
+{
+	volume->sample(n, x, v, G, cubic);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// time steps
+////////////////////////////////////////////////////////////////////////////////
+
+VelocitySequenceFlow::VelocitySequenceFlow(const string& _pattern, int _nsteps, double _t0, double _dt, bool _cubic, int _maxresident)
+	: pattern(_pattern), nsteps(_nsteps), t0(_t0), dt(_dt), cubic(_cubic), maxresident(_maxresident), clock(0), resident(0), failure(false)
+{
+	omp_init_lock(&lock);
+	steps.assign(nsteps, (BrickedVelocityVolume*) NULL);
+	pins.assign(nsteps, 0);
+	lastuse.assign(nsteps, 0);
+	StepCache empty;
+	empty.a = empty.b = NULL;
+	empty.interval = -1;
+	caches.assign(omp_get_max_threads(), empty);
+
+	// the first step gives the geometry, it is never evicted
+	if (step(0) != NULL)
+		pins[0]++;
+}
+
+VelocitySequenceFlow::~VelocitySequenceFlow()
+{
+	for (int i = 0; i < steps.size(); i++)
+		delete steps[i];
+	omp_destroy_lock(&lock);
+}
+
+const BrickedVelocityVolume* VelocitySequenceFlow::step(int i) const
+{
+	if (steps[i] == NULL)
+	{
+		char filename[1024];
+		snprintf(filename, sizeof(filename), pattern.c_str(), i);
+		steps[i] = ReadVelocityVolume(filename);
+		if ((steps[i] != NULL) && (i > 0) && ((steps[i]->dims[0] != steps[0]->dims[0]) || (steps[i]->dims[1] != steps[0]->dims[1]) || (steps[i]->dims[2] != steps[0]->dims[2])))
+		{
+			printf("Error: the grid of %s is not the one of the first time step!\n", filename);
+			delete steps[i];
+			steps[i] = NULL;
+		}
+		if (steps[i] == NULL)
+		{
+			failure = true;
+			return NULL;
+		}
+		resident++;
+	}
+	return steps[i];
+}
+
+bool VelocitySequenceFlow::pin(int i, StepCache& c) const
+{
+	int j = min(i + 1, nsteps - 1);
+	c.a = failure ? NULL : step(i);
+	c.b = (c.a == NULL) ? NULL : step(j);
+	if (c.b == NULL)
+	{
+		c.interval = -1;
+		return false;
+	}
+	pins[i]++;
+	pins[j]++;
+	lastuse[i] = lastuse[j] = ++clock;
+	c.interval = i;
+	evict();
+	return true;
+}
+
+void VelocitySequenceFlow::unpin(StepCache& c) const
+{
+	if (c.interval < 0)
+		return;
+	pins[c.interval]--;
+	pins[min(c.interval + 1, nsteps - 1)]--;
+	c.interval = -1;
+}
+
+void VelocitySequenceFlow::evict() const
+{
+	while (resident > maxresident)
+	{
+		// least recently used step that no thread needs
+		int lru = -1;
+		for (int i = 0; i < nsteps; i++)
+		{
+			if ((steps[i] != NULL) && (pins[i] == 0) && ((lru < 0) || (lastuse[i] < lastuse[lru])))
+				lru = i;
+		}
+		if (lru < 0)
+			return;
+		delete steps[lru];
+		steps[lru] = NULL;
+		resident--;
+	}
+}
+
+bool VelocitySequenceFlow::interval(int i, StepCache& c) const
+{
+	int thn = omp_get_thread_num();
+	bool cached = (thn < caches.size());
+	if (cached && (caches[thn].interval == i))
+	{
+		c = caches[thn];
+		return true;
+	}
+
+	omp_set_lock(&lock);
+	if (cached)
+		unpin(caches[thn]);
+	bool ok = pin(i, c);
+	omp_unset_lock(&lock);
+
+	if (cached)
+		caches[thn] = c;
+	return ok;
+}
+
+void VelocitySequenceFlow::release(StepCache& c) const
+{
+	// threads beyond the ones counted at construction do not keep their steps
+	int thn = omp_get_thread_num();
+	if (thn < caches.size())
+		return;
+	omp_set_lock(&lock);
+	unpin(c);
+	omp_unset_lock(&lock);
+}
+
+void VelocitySequenceFlow::domain(double* lo, double* hi) const
+{
+	for (int i = 0; i < 3; i++)
+	{
+		lo[i] = steps[0]->origin[i];
+		hi[i] = steps[0]->origin[i] + (steps[0]->dims[i] - 1) * steps[0]->spc[i];
+	}
+}
+
+void VelocitySequenceFlow::evaluate(const double* x, double t, double* v, double G[3][3]) const
+{
+	evaluateBatch(1, x, &t, v, &G[0][0]);
+}
+
+void VelocitySequenceFlow::evaluateBatch(int n, const double* x, const double* t, double* v, double* G) const
+{
+	// runs of points in the same interval are sampled together
+	const int W = 16;
+	double va[3 * W], vb[3 * W], Ga[9 * W], Gb[9 * W], alpha[W];
+	int k = 0;
+	while (k < n)
+	{
+		double tmax = t0 + (nsteps - 1) * dt;
+		double tc = min(max(t[k], t0), tmax);
+		int i = min(int((tc - t0) / dt), max(nsteps - 2, 0));
+		int m = 0;
+		while ((k + m < n) && (m < W))
+		{
+			double tm = min(max(t[k + m], t0), tmax);
+			if (min(int((tm - t0) / dt), max(nsteps - 2, 0)) != i)
+				break;
+			alpha[m] = (nsteps > 1) ? (tm - (t0 + i * dt)) / dt : 0.0;
+			m++;
+		}
+
+		// the velocity is zero where a time step is missing, see failed()
+		StepCache c;
+		if (!interval(i, c))
+		{
+			fill(v + 3 * k, v + 3 * (k + m), 0.0);
+			fill(G + 9 * k, G + 9 * (k + m), 0.0);
+			k += m;
+			continue;
+		}
+		c.a->sample(m, x + 3 * k, va, Ga, cubic);
+		c.b->sample(m, x + 3 * k, vb, Gb, cubic);
+		release(c);
+		for (int l = 0; l < m; l++)
+		{
+			for (int j = 0; j < 3; j++)
+				v[3 * (k + l) + j] = (1.0 - alpha[l]) * va[3 * l + j] + alpha[l] * vb[3 * l + j];
+			for (int j = 0; j < 9; j++)
+				G[9 * (k + l) + j] = (1.0 - alpha[l]) * Ga[9 * l + j] + alpha[l] * Gb[9 * l + j];
+		}
+		k += m;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// reading
+////////////////////////////////////////////////////////////////////////////////
+
+BrickedVelocityVolume* ReadVelocityVolume(const string& filename)
+{
+	Nrrd* nin = readNrrd(filename.c_str());
+	if (nin == NULL)
+	{
+		printf("Error: could not read %s!\n", filename.c_str());
+		return NULL;
+	}
+	if ((nin->dim != 4) || (nin->axis[0].size != 3))
+	{
+		printf("Error: %s is not a 3 x X x Y x Z velocity volume!\n", filename.c_str());
+		nrrdNuke(nin);
+		return NULL;
+	}
+
+	Nrrd* nflt = nrrdNew();
+	if (nrrdConvert(nflt, nin, nrrdTypeFloat))
+	{
+		printf("Error: could not convert %s: %s\n", filename.c_str(), biffGetDone(NRRD));
+		nrrdNuke(nin);
+		nrrdNuke(nflt);
+		return NULL;
+	}
+
+	int dims[3];
+	double origin[3], spc[3];
+	for (int i = 0; i < 3; i++)
+	{
+		dims[i] = nin->axis[i + 1].size;
+		spc[i] = AIR_EXISTS(nin->axis[i + 1].spacing) ? nin->axis[i + 1].spacing : 1.0;
+		origin[i] = AIR_EXISTS(nin->axis[i + 1].min) ? nin->axis[i + 1].min : 0.0;
+	}
+	BrickedVelocityVolume* volume = new BrickedVelocityVolume((const float*) nflt->data, dims, origin, spc);
+	nrrdNuke(nin);
+	nrrdNuke(nflt);
+	return volume;
+}
@@ -0,0 +1,149 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#pragma once
+
+#ifndef __VELOCITYVOLUME_H__
+#define __VELOCITYVOLUME_H__
+
+#include <omp.h>
+#include <string>
+#include <vector>
+
+#include "FlowFields.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Gridded velocity for the on-demand integration. The 3 components are
+// interleaved and the grid is cut in bricks of VELOCITY_BRICK^3 cells. Each
+// brick also stores one point before and two points after its cells (beyond
+// the grid they are extrapolated), so the trilinear (8 points) and tricubic
+// Catmull-Rom (64 points) stencils of a cell never leave its brick. Points
+// are sampled in batches, the same instructions run for all of them. Outside
+// the grid the velocity is zero, so trajectories stop where they leave it.
+
+#define VELOCITY_BRICK 16
+
+class BrickedVelocityVolume
+{
+public:
+	int dims[3];
+	double origin[3];
+	double spc[3];
+
+	// data has 3 components per grid point, x fastest
+	BrickedVelocityVolume(const float* data, const int* _dims, const double* _origin, const double* _spc);
+
+	// velocity and its gradient at n points, x and v have 3 values per
+	// point and G 9 (row major)
+	void sample(int n, const double* x, double* v, double* G, bool cubic) const;
+
+	size_t bytes() const { return bricks.size() * sizeof(float); }
+
+private:
+	int nbricks[3];
+	std::vector<float> bricks;
+};
+
+// steady velocity volume
+class BrickedFlow : public AnalyticFlow
+{
+public:
+	BrickedVelocityVolume* volume;
+	bool cubic;
+
+	BrickedFlow(BrickedVelocityVolume* _volume, bool _cubic) : volume(_volume), cubic(_cubic) {}
+	~BrickedFlow() { delete volume; }
+
+	const char* name() const { return "velocity"; }
+	void domain(double* lo, double* hi) const;
+	void evaluate(const double* x, double t, double* v, double G[3][3]) const;
+	void evaluateBatch(int n, const double* x, const double* t, double* v, double* G) const;
+};
+
+// velocity given by a sequence of time steps t0 + i dt, read from the files
+// printf(pattern, i) when they are needed. Velocities are linear in time
+// between two steps and constant before the first and after the last. Every
+// thread pins the two steps of the interval of its last points, so the lock
+// that guards the loading is only taken when a thread moves to another
+// interval. At most maxresident steps stay in memory, the least recently used
+// unpinned step is evicted first (the pinned ones are never evicted, so the
+// bound is exceeded when the threads need more). The first step gives the
+// geometry and is always kept.
+class VelocitySequenceFlow : public AnalyticFlow
+{
+public:
+	std::string pattern;
+	int nsteps;
+	double t0;
+	double dt;
+	bool cubic;
+	int maxresident;
+
+	VelocitySequenceFlow(const std::string& _pattern, int _nsteps, double _t0, double _dt, bool _cubic, int _maxresident);
+	~VelocitySequenceFlow();
+
+	// false if the first time step could not be read
+	bool valid() const { return steps[0] != NULL; }
+
+	// true once a time step could not be read, the velocity is then zero
+	bool failed() const { return failure; }
+
+	const char* name() const { return "velocity_sequence"; }
+	void domain(double* lo, double* hi) const;
+	void evaluate(const double* x, double t, double* v, double G[3][3]) const;
+	void evaluateBatch(int n, const double* x, const double* t, double* v, double* G) const;
+
+private:
+	struct StepCache
+	{
+		const BrickedVelocityVolume* a;
+		const BrickedVelocityVolume* b;
+		int interval;
+		char pad[64 - 2 * sizeof(void*) - sizeof(int)];
+	};
+
+	mutable std::vector<BrickedVelocityVolume*> steps;
+	mutable std::vector<int> pins;      // number of threads using each step
+	mutable std::vector<long> lastuse;  // clock of the last pin of each step
+	mutable long clock;
+	mutable int resident;
+	mutable bool failure;
+	mutable std::vector<StepCache> caches;
+	mutable omp_lock_t lock;
+
+	// all under the lock
+	const BrickedVelocityVolume* step(int i) const;
+	bool pin(int i, StepCache& c) const;
+	void unpin(StepCache& c) const;
+	void evict() const;
+
+	// the pinned steps of interval i for the calling thread, false if one
+	// could not be read, release() them after sampling
+	bool interval(int i, StepCache& c) const;
+	void release(StepCache& c) const;
+};
+
+// NULL if the file is not a 3 x X x Y x Z volume
+BrickedVelocityVolume* ReadVelocityVolume(const std::string& filename);
+
+#endif
@@ -0,0 +1,625 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits>
+#include <string>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include <set>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <vector_types.h>
+#include <vector_functions.h>
+#include <cutil_inline.h>
+#include <helper_math.h>
+#include <teem/nrrd.h>
+#include <boost/algorithm/string.hpp>
+
+#include "MyMath.h"
+#include "MyTeem.h"
+#include "MyGeometry.h"
+#include "Sample_point.h"
+
+#include "DiscreteSibson.h"
+#include "SparseFlowMap.h"
+#include "FlowMapQuery.h"
+#include "AdaptiveRefinement.h"
+#include "Pyramid.h"
+#include "NaturalCoordinates.h"
+#include "FlowFields.h"
+#include "Profiler.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////
+// Benchmark of the reconstruction on analytic flow maps. Run with
+//     sparse_benchmark [params.txt] [KEY=value ...]
+// The flow map and its Jacobian are computed in memory, then the regular
+// Sibson, modified Sibson and refinement steps run for MAX_ITER iterations
+// and the time, throughput, memory and error of every stage are reported.
+// With ADAPTIVE=1 the batches and the end of the loop are left to
+// AdaptiveRefinement, MAX_ITER is then an upper bound. With MULTIRES=1
+// the regular steps run on the levels of a SibsonPyramid.
+// The final reconstruction is then saved as a sparse flow map and
+// QUERY_POINTS random points are queried from it and from the dense result.
+// The sparse reconstruction of a CHECK_BOX^3 box at the center of the grid
+// and of CHECK_POINTS of the query points (ReconstructAt) are compared with
+// the dense result. More than 0.1% of them off by CHECK_TOL times the range
+// of the component is an error (equidistant closest sites can be chosen
+// differently, which changes a few points).
+// Before all that, the exact natural coordinates are compared with the
+// discrete ones on a small grid (see CheckNaturalCoordinates), a mean
+// difference above NATURAL_CHECK_TOL is an error with NATURAL_BACKEND=exact
+// or auto.
+////////////////////////////////////////////////////////////////////////////////
+
+
+map<string, string> parameters;
+vector<Sample_point>* pts = NULL;
+NrrdWrapper3D* recons[3];
+NrrdWrapper3D* fm[3];
+NrrdWrapper3D* fmJ[3][3];
+
+struct StageResult
+{
+	int iter;
+	string stage;
+	double sec;
+	long peak_rss;
+	double mse;
+	double maxe;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// analytic input
+////////////////////////////////////////////////////////////////////////////////
+
+void SetDefault(const string& key, const string& value)
+{
+	if (parameters[key].empty())
+		parameters[key] = value;
+}
+
+void GenerateFlowMap(const AnalyticFlow& flow, int res, double T, int nsteps)
+{
+	double lo[3], hi[3];
+	flow.domain(lo, hi);
+
+	// isotropic grid with res points along the shortest side
+	double spc = numeric_limits<double>::max();
+	for (int i = 0; i < 3; i++)
+		spc = min(spc, (hi[i] - lo[i]) / (res - 1));
+	int3 d = make_int3(myround((hi[0] - lo[0]) / spc) + 1, myround((hi[1] - lo[1]) / spc) + 1, myround((hi[2] - lo[2]) / spc) + 1);
+	int size = d.x * d.y * d.z;
+	printf("Flow map of '%s' on a %d x %d x %d grid for T = %lf\n", flow.name(), d.x, d.y, d.z, T);
+
+	float* data[3];
+	float* dataJ[9];
+	for (int i = 0; i < 3; i++)
+		data[i] = (float*) malloc(size * sizeof(float));
+	for (int i = 0; i < 9; i++)
+		dataJ[i] = (float*) malloc(size * sizeof(float));
+
+	Timer timer;
+	timer.start();
+	#pragma omp parallel for schedule(dynamic, 1024)
+	for (int k = 0; k < size; k++)
+	{
+		int x = k % d.x;
+		int y = (k / d.x) % d.y;
+		int z = k / (d.x * d.y);
+		double x0[3] = {lo[0] + x * spc, lo[1] + y * spc, lo[2] + z * spc};
+		double p[3];
+		double J[3][3];
+		IntegrateFlowMap(flow, x0, 0.0, T, nsteps, p, J);
+
+		// values relative to the grid frame, gradients are the same
+		for (int i = 0; i < 3; i++)
+		{
+			data[i][k] = p[i] - lo[i];
+			for (int j = 0; j < 3; j++)
+				dataJ[3 * i + j][k] = J[i][j];
+		}
+	}
+	timer.stop();
+	printf("Integration of %d trajectories took %lf sec.\n", size, 0.001 * timer.getElapsedTimeInMilliSec());
+
+	double3 s = make_double3(spc, spc, spc);
+	for (int i = 0; i < 3; i++)
+		fm[i] = new NrrdWrapper3D(createNrrd3D(data[i], d, s));
+	for (int i = 0; i < 9; i++)
+		fmJ[i / 3][i % 3] = new NrrdWrapper3D(createNrrd3D(dataJ[i], d, s));
+}
+
+void AddSampleAt(Sample_point& qp, int cdim, int x, int y, int z, double grad_limit)
+{
+	qp.coordinate = fm[cdim]->Grid2Space(x, y, z);
+	qp.value = fm[cdim]->ProbeValueAt(x, y, z);
+	qp.gradient[0] = fmJ[cdim][0]->ProbeValueAt(x, y, z);
+	qp.gradient[1] = fmJ[cdim][1]->ProbeValueAt(x, y, z);
+	qp.gradient[2] = fmJ[cdim][2]->ProbeValueAt(x, y, z);
+	for (int k = 0; k < 3; k++)
+		qp.unclamped_gradient[k] = qp.gradient[k];
+
+	// scale gradient (very large gradient is likely error or noise), the
+	// FTLE is computed from the unclamped one
+	float3 g = make_float3(qp.gradient[0], qp.gradient[1], qp.gradient[2]);
+	if (length(g) > grad_limit)
+	{
+		g = grad_limit * normalize(g);
+		qp.gradient[0] = g.x;
+		qp.gradient[1] = g.y;
+		qp.gradient[2] = g.z;
+	}
+}
+
+// error of the reconstruction over all components
+void ReconstructionError(double& mse, double& maxe)
+{
+	int size = recons[0]->Size();
+	mse = 0.0;
+	maxe = 0.0;
+	for (int cdim = 0; cdim < 3; cdim++)
+	{
+		float* o = (float*) fm[cdim]->ni->data;
+		float* r = (float*) recons[cdim]->ni->data;
+		#pragma omp parallel for reduction(+:mse)
+		for (int i = 0; i < size; i++)
+		{
+			double e = double(o[i]) - double(r[i]);
+			mse += e * e;
+		}
+		for (int i = 0; i < size; i++)
+			maxe = max(maxe, fabs(double(o[i]) - double(r[i])));
+	}
+	mse /= 3.0 * size;
+}
+
+// exact natural coordinates (NaturalCoordinates) against the discrete ones
+// (FindNaturalCoordinates) for sites on a jittered lattice of a small grid,
+// false if the mean L1 distance of the coordinates of a grid point is
+// larger than tol
+bool CheckNaturalCoordinates(double tol)
+{
+	int n = 33;
+	int step = 8;
+	float* data = (float*) calloc(n * n * n, sizeof(float));
+	NrrdWrapper3D* grid = new NrrdWrapper3D(createNrrd3D(data, make_int3(n, n, n), make_double3(1.0 / (n - 1), 1.0 / (n - 1), 1.0 / (n - 1))));
+	int size = grid->Size();
+
+	// the jitter breaks the cospherical sites of the lattice
+	vector<Sample_point> sites;
+	for (int z = 0; z < n; z += step)
+	{
+		for (int y = 0; y < n; y += step)
+		{
+			for (int x = 0; x < n; x += step)
+			{
+				Sample_point qp;
+				qp.coordinate = grid->Grid2Space(min(x + (x * 7 + y * 13 + z * 29) % (step / 2), n - 1), min(y + (x * 11 + y * 5 + z * 17) % (step / 2), n - 1), min(z + (x * 3 + y * 19 + z * 23) % (step / 2), n - 1));
+				sites.push_back(qp);
+			}
+		}
+	}
+
+	Tree* tree = NULL;
+	vector<closest_site> query_cls(size);
+	vector<NaturalNeighbors> discrete(size);
+	vector<NaturalNeighbors> exact(size);
+	vector<bool> site_is_disc(sites.size());
+	vector<set<int> > site2discs;
+	vector<DiscSurface*> surfaces;
+	FindClosest(grid, query_cls, discrete, sites, site_is_disc, tree, 0, surfaces, site2discs);
+	FindNaturalCoordinates(grid, query_cls, discrete, sites, 0, surfaces);
+	map<string, string> params;
+	params["NATURAL_BACKEND"] = "exact";
+	NaturalCoordinates naturals(params);
+	naturals.Find(grid, query_cls, exact, sites, 0, surfaces);
+
+	double sum = 0.0;
+	double maxd = 0.0;
+	for (int i = 0; i < size; i++)
+	{
+		double d = 0.0;
+		for (int k = 0; k < discrete[i].size(); k++)
+		{
+			int j = exact[i].find(discrete[i].nv[k]);
+			d += fabs(discrete[i].nw[k] - ((j >= 0) ? exact[i].nw[j] : 0.0));
+		}
+		for (int k = 0; k < exact[i].size(); k++)
+		{
+			if (discrete[i].find(exact[i].nv[k]) < 0)
+				d += fabs(exact[i].nw[k]);
+		}
+		sum += d;
+		maxd = max(maxd, d);
+	}
+	delete tree;
+	delete grid;
+	printf("Natural coordinates of %d sites on a %d^3 grid: exact against discrete, mean L1 difference %e, largest %e.\n", int(sites.size()), n, sum / size, maxd);
+	return (sum / size <= tol);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Main entry point
+////////////////////////////////////////////////////////////////////////////////
+
+int main( int argc, char *argv[] )
+{
+	printf("Start the sparse flow map benchmark.\n");
+
+	// optional parameter file followed by KEY=value overrides
+	for (int a = 1; a < argc; a++)
+	{
+		string arg(argv[a]);
+		vector<string> results;
+		boost::split(results, arg, boost::is_any_of("="));
+		if (results.size() == 2)
+		{
+			parameters[results[0]] = results[1];
+			continue;
+		}
+
+		string line;
+		ifstream myfile (arg.c_str());
+		if (!myfile.is_open())
+		{
+			cout << "Unable to open parameters file!\n";
+			return 0;
+		}
+		while ( myfile.good() )
+		{
+			getline(myfile,line);
+			boost::split(results, line, boost::is_any_of("="));
+			if ((results.size() == 2) && parameters[results[0]].empty())
+				parameters[results[0]] = results[1];
+		}
+		myfile.close();
+	}
+	SetDefault("FIELD", "abc");
+	SetDefault("RESOLUTION", "64");
+	SetDefault("INTEGRATION_TIME", "2.0");
+	SetDefault("RK4_STEPS", "100");
+	SetDefault("START_FACTOR", "8");
+	SetDefault("MAX_ITER", "3");
+	SetDefault("LAMBDA", "1.0");
+	SetDefault("GRAD_LIMIT", "1000000");
+	SetDefault("MODIFIED_SIBSON", "1");
+	SetDefault("UPPER_THRES", "0.01");
+	SetDefault("LOWER_THRES_0", "0.05");
+	SetDefault("LOWER_THRES_1", "0.05");
+	SetDefault("LOWER_THRES_2", "0.05");
+	SetDefault("OUTPUT_EDGES", "bench_edges");
+	SetDefault("OUTPUT_REFINE", "bench_refine");
+	SetDefault("OUTPUT_SPARSE", "bench.sfm");
+	SetDefault("QUERY_POINTS", "1000000");
+	SetDefault("CHECK_BOX", "16");
+	SetDefault("CHECK_POINTS", "1000");
+	SetDefault("CHECK_TOL", "1e-4");
+	SetDefault("NATURAL_CHECK_TOL", "0.1");
+
+	// the exact natural coordinates are only used once they agree with the
+	// discrete ones
+	if (!CheckNaturalCoordinates(atof(parameters["NATURAL_CHECK_TOL"].c_str())))
+	{
+		if (!parameters["NATURAL_BACKEND"].empty() && (parameters["NATURAL_BACKEND"] != "discrete"))
+		{
+			printf("Error: the exact natural coordinates do not match the discrete ones, use NATURAL_BACKEND=discrete!\n");
+			return -1;
+		}
+		printf("Warning: the exact natural coordinates do not match the discrete ones!\n");
+	}
+
+	// analytic flow map
+	AnalyticFlow* flow = CreateAnalyticFlow(parameters["FIELD"]);
+	if (flow == NULL)
+	{
+		printf("Unknown FIELD '%s', use abc, double_gyre or linear.\n", parameters["FIELD"].c_str());
+		return 0;
+	}
+	GenerateFlowMap(*flow, atoi(parameters["RESOLUTION"].c_str()), atof(parameters["INTEGRATION_TIME"].c_str()), atoi(parameters["RK4_STEPS"].c_str()));
+	delete flow;
+
+	int dim = 3;
+	int size = fm[0]->Size();
+	for (int cdim = 0; cdim < dim; cdim++)
+	{
+		recons[cdim] = new NrrdWrapper3D(teem_copy(fm[cdim]->ni));
+		memset(recons[cdim]->ni->data, 0, recons[cdim]->Size() * sizeof(float));
+	}
+
+	// 1% of the voxels per refinement unless given
+	char str[32];
+	sprintf(str, "%d", max(1, size / 100));
+	SetDefault("NEWSAMPLES", str);
+	if (!parameters["PROFILE_OUTPUT"].empty())
+		ProfileOpen(parameters["PROFILE_OUTPUT"]);
+
+	// initial samples
+	int factor = atoi(parameters["START_FACTOR"].c_str());
+	double grad_limit = atof(parameters["GRAD_LIMIT"].c_str());
+	pts = new vector<Sample_point>[dim];
+	for (int cdim = 0; cdim < dim; cdim++)
+	{
+		for (int x = 0; x < fm[cdim]->width(); x+=factor)
+		{
+			for (int y = 0; y < fm[cdim]->height(); y+=factor)
+			{
+				for (int z = 0; z < fm[cdim]->depth(); z+=factor)
+				{
+					Sample_point qp;
+					AddSampleAt(qp, cdim, x, y, z, grad_limit);
+					pts[cdim].push_back(qp);
+				}
+			}
+		}
+	}
+	printf("Number of samples is %d\n", int(pts[0].size()));
+
+	// data structures
+	Tree* tree = NULL;
+	vector<closest_site> query_cls(size);
+	vector<NaturalNeighbors> query_nc(size);
+	vector<set<int> > site2discs;
+	int nosurf = 0;
+	vector<DiscSurface*> surfaces;
+	DiscontinuitySurfaces disc_surfaces[3];
+	bool last_modified = false;
+	vector<float> errm[3];
+	for (int i = 0; i < dim; i++)
+		errm[i].resize(size);
+	vector<float> errmt(size);
+
+	// same sequence as the application without the output
+	bool modified = (atoi(parameters["MODIFIED_SIBSON"].c_str()) != 0);
+	int miter = atoi(parameters["MAX_ITER"].c_str());
+	AdaptiveRefinement control(parameters, size);
+	bool last = false;
+	SibsonPyramid pyramid(parameters, recons[0]);
+	NaturalCoordinates naturals(parameters);
+	vector<StageResult> results;
+	for (int iter = 0; iter < miter; iter++)
+	{
+		ProfileSetIteration(iter);
+		for (int option = 1; option <= 3; option++)
+		{
+			if ((option == 2) && (!modified || (iter == 0) || !control.ModifiedNeeded(last) || (pyramid.level > 0)))
+				continue;
+
+			StageResult res;
+			res.iter = iter;
+			Timer timer;
+			timer.start();
+			if (option == 1)
+			{
+				ProfileScope scope("sibson");
+				res.stage = "sibson";
+				int level = pyramid.Select(pts[0].size(), iter == miter - 1);
+				if (level > 0)
+				{
+					char name[32];
+					sprintf(name, "sibson_level%d", level);
+					res.stage = name;
+					pyramid.Sibson(dim, pts, tree, recons, errm, query_cls, true);
+				}
+				else
+				{
+					vector<bool> site_is_disc(pts[0].size());
+					FindClosest(recons[0], query_cls, query_nc, pts[0], site_is_disc, tree, nosurf, surfaces, site2discs);
+					naturals.Find(recons[0], query_cls, query_nc, pts[0], nosurf, surfaces);
+					if (naturals.last_exact)
+						res.stage = "sibson_exact";
+					for (int cdim = 0; cdim < dim; cdim++)
+						DiscreteSisbon(fm[cdim], recons[cdim], errm[cdim], pts[cdim], tree, query_cls, query_nc);
+				}
+				last_modified = false;
+				if (control.enabled)
+				{
+					control.Observe(errm, dim, pts[0].size());
+					last = ((level == 0) && control.Done()) || (iter == miter - 1);
+				}
+			}
+			else if (option == 2)
+			{
+				ProfileScope scope("modified_sibson");
+				res.stage = "modified_sibson";
+				for (int cdim = 0; cdim < dim; cdim++)
+					DiscreteSisbonWithSurfaces(iter, cdim, fm[cdim], recons[cdim], errm[cdim], pts[cdim], query_cls, query_nc, &disc_surfaces[cdim]);
+				last_modified = true;
+				control.ModifiedDone();
+			}
+			else
+			{
+				// the last iteration is not refined
+				if ((iter == miter - 1) || last)
+					break;
+
+				ProfileScope scope("refine");
+				res.stage = "refine";
+				for (int i = 0; i < size; i++)
+					errmt[i] = errm[0][i] + errm[1][i] + errm[2][i];
+
+				vector<int> nids;
+				Refine(iter, fm[0], nids, errmt, pts[0], tree, query_cls, control.NextBatch(pts[0].size()));
+				control.Refined(nids, query_cls, disc_surfaces, dim);
+				ProfileCount(PROF_SAMPLES_ADDED, nids.size());
+
+				std::vector<Point_3> points;
+				std::vector<int> indices;
+				for (int cdim = 0; cdim < dim; cdim++)
+				{
+					for (int i = 0; i < nids.size(); i++)
+					{
+						int3 c = fm[cdim]->Addr2Coord(nids[i]);
+						Sample_point qp;
+						AddSampleAt(qp, cdim, c.x, c.y, c.z, grad_limit);
+						pts[cdim].push_back(qp);
+						if (cdim == 0)
+						{
+							points.push_back(Point_3(qp.coordinate.x, qp.coordinate.y, qp.coordinate.z));
+							indices.push_back(pts[cdim].size() - 1);
+						}
+					}
+				}
+				tree->insert(
+					boost::make_zip_iterator(boost::make_tuple( points.begin(),indices.begin() )),
+					boost::make_zip_iterator(boost::make_tuple( points.end(),indices.end() ) )
+				);
+			}
+			timer.stop();
+			res.sec = 0.001 * timer.getElapsedTimeInMilliSec();
+			res.peak_rss = PeakRSS();
+			ReconstructionError(res.mse, res.maxe);
+			results.push_back(res);
+		}
+		if (last)
+			break;
+	}
+	ProfileClose();
+
+	// report
+	printf("\n%-5s %-16s %10s %14s %12s %12s %12s\n", "iter", "stage", "sec", "voxels/s", "peak MB", "rmse", "max error");
+	double total = 0.0;
+	for (int i = 0; i < results.size(); i++)
+	{
+		StageResult& r = results[i];
+		total += r.sec;
+		printf("%-5d %-16s %10.3lf %14.0lf %12.1lf %12.4e %12.4e\n", r.iter, r.stage.c_str(), r.sec, size / max(r.sec, 1e-9), r.peak_rss / 1024.0, sqrt(r.mse), r.maxe);
+	}
+	printf("Total %.3lf sec for %d voxels and %d samples (%2.2lf%%) on %d threads.\n", total, size, int(pts[0].size()), (100.0 * pts[0].size()) / size, omp_get_max_threads());
+
+	// point queries on the final reconstruction
+	string sfm = parameters["OUTPUT_SPARSE"];
+	SparseFlowMap sparse;
+	if (!WriteSparseFlowMap(sfm, recons[0], dim, pts, query_cls, last_modified ? disc_surfaces : NULL) || !sparse.Open(sfm))
+		return 0;
+	int nq = atoi(parameters["QUERY_POINTS"].c_str());
+	vector<double> qx(3 * nq);
+	for (int k = 0; k < nq; k++)
+	{
+		for (int i = 0; i < 3; i++)
+			qx[3 * k + i] = drand48() * (sparse.hdr.dims[i] - 1) * sparse.hdr.spacing[i];
+	}
+	vector<double> qv[2];
+	vector<double> qJ(9 * nq);
+	FlowMapQuery* queries[2] = {new FlowMapQuery(recons), new FlowMapQuery(&sparse)};
+	const char* names[2] = {"dense", "sparse"};
+	printf("\n%-8s %-6s %10s %14s %8s\n", "source", "cache", "sec", "queries/s", "tiles");
+	for (int s = 0; s < 2; s++)
+	{
+		qv[s].resize(3 * nq);
+		for (int pass = 0; pass < 2; pass++)
+		{
+			long misses = queries[s]->tile_misses;
+			Timer timer;
+			timer.start();
+			queries[s]->Query(nq, &qx[0], &qv[s][0], &qJ[0]);
+			timer.stop();
+			double sec = 0.001 * timer.getElapsedTimeInMilliSec();
+			printf("%-8s %-6s %10.3lf %14.0lf %8ld\n", names[s], pass ? "warm" : "cold", sec, nq / max(sec, 1e-9), queries[s]->tile_misses - misses);
+		}
+	}
+	double maxd = 0.0;
+	for (int k = 0; k < 3 * nq; k++)
+		maxd = max(maxd, fabs(qv[0][k] - qv[1][k]));
+	printf("Largest difference between the sparse and dense queries is %e\n", maxd);
+	delete queries[0];
+	delete queries[1];
+
+	// value range of every component, for the tolerance
+	double tol[3];
+	for (int cdim = 0; cdim < dim; cdim++)
+	{
+		float* data = (float*) recons[cdim]->ni->data;
+		tol[cdim] = atof(parameters["CHECK_TOL"].c_str()) * (*max_element(data, data + size) - *min_element(data, data + size));
+	}
+
+	// sparse reconstruction of a box against the dense result
+	int cb = atoi(parameters["CHECK_BOX"].c_str());
+	int lo[3];
+	int hi[3];
+	for (int i = 0; i < 3; i++)
+	{
+		lo[i] = max(sparse.hdr.dims[i] / 2 - cb / 2, 0);
+		hi[i] = min(lo[i] + cb - 1, sparse.hdr.dims[i] - 1);
+	}
+	vector<float> box[3];
+	if (!sparse.Reconstruct(lo, hi, box))
+		return -1;
+	double boxd = 0.0;
+	int nbox = 0;
+	int boxoff = 0;
+	for (int cdim = 0; cdim < dim; cdim++)
+	{
+		int k = 0;
+		for (int z = lo[2]; z <= hi[2]; z++)
+		{
+			for (int y = lo[1]; y <= hi[1]; y++)
+			{
+				for (int x = lo[0]; x <= hi[0]; x++)
+				{
+					double d = fabs(box[cdim][k++] - recons[cdim]->ProbeValueAt(x, y, z));
+					boxd = max(boxd, d);
+					boxoff += (d > tol[cdim]);
+					nbox++;
+				}
+			}
+		}
+	}
+	printf("Sparse reconstruction of the box [%d %d %d]-[%d %d %d]: largest difference to the dense result %e, %d of %d values off.\n", lo[0], lo[1], lo[2], hi[0], hi[1], hi[2], boxd, boxoff, nbox);
+
+	// point reconstruction against the dense queries
+	int np = min(nq, atoi(parameters["CHECK_POINTS"].c_str()));
+	vector<float3> px(np);
+	vector<float3> pv;
+	for (int k = 0; k < np; k++)
+		px[k] = make_float3(qx[3 * k], qx[3 * k + 1], qx[3 * k + 2]);
+	Timer ptimer;
+	ptimer.start();
+	if (!sparse.ReconstructAt(px, pv))
+		return -1;
+	ptimer.stop();
+	double pointd = 0.0;
+	int pointoff = 0;
+	for (int k = 0; k < np; k++)
+	{
+		float v[3] = {pv[k].x, pv[k].y, pv[k].z};
+		for (int cdim = 0; cdim < dim; cdim++)
+		{
+			double d = fabs(v[cdim] - qv[0][3 * k + cdim]);
+			pointd = max(pointd, d);
+			pointoff += (d > tol[cdim]);
+		}
+	}
+	printf("ReconstructAt of %d points in %.3lf sec: largest difference to the dense queries %e, %d of %d values off.\n", np, 0.001 * ptimer.getElapsedTimeInMilliSec(), pointd, pointoff, dim * np);
+
+	if ((boxoff > 0.001 * nbox) || (pointoff > 0.001 * dim * np))
+	{
+		printf("Error: the sparse reconstruction does not match the dense result!\n");
+		return -1;
+	}
+	return 0;
+}
@@ -36,9 +36,6 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <vector_functions.h>
 #include <cutil_inline.h>
 #include <helper_math.h>
-#include <math/fixed_vector.hpp>
-#include <math/bezier_spline.hpp>
-#include <math/dopri5.hpp>
 #include <gsl/gsl_poly.h>
 #include <gsl/gsl_linalg.h>
 #include <gsl/gsl_errno.h>
@@ -59,6 +56,15 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "Sample_point.h"
 
 #include "DiscreteSibson.h"
+#include "Checkpoint.h"
+#include "SparseFlowMap.h"
+#include "FTLE.h"
+#include "AdaptiveRefinement.h"
+#include "Pyramid.h"
+#include "NaturalCoordinates.h"
+#include "Profiler.h"
+#include "FlowSampler.h"
+#include "OutputWriter.h"
 
 using namespace std;
 
@@ -73,6 +79,9 @@ vector<Sample_point>* pts = NULL;
 NrrdWrapper3D* recons[3];
 NrrdWrapper3D* fm[3];
 NrrdWrapper3D* fmJ[3][3];
+NrrdWrapper3D* reference[3];
+FlowSampler* sampler = NULL;
+OutputWriter* writer = NULL;
 int selected_field = 0;
 double min_spc;
 
@@ -82,53 +91,9 @@ double min_spc;
 
 void WriteOutput(int oid, int option)
 {
+	ProfileScope scope("output");
 	min_spc = fm[0]->min_spc;
 	int dim = 3;
-	int dimJ = 9;
-
-	// add samples and create the triangulation
-	NrrdWrapper3D* output[3];
-	for (int cdim = 0; cdim < dim; cdim++)
-	{
-		output[cdim] = new NrrdWrapper3D(teem_copy(fm[cdim]->ni));
-
-		double mse = 0.0;
-		double psnr = 0.0;
-		for (int x = 0; x < fm[cdim]->width(); x+=1)
-		{
-			for (int y = 0; y < fm[cdim]->height(); y+=1)
-			{
-				for (int z = 0; z < fm[cdim]->depth(); z+=1)
-				{
-					int k = fm[cdim]->Coord2Addr(x, y, z);
-
-
-					// data fields
-					double init_value = fm[cdim]->ProbeValueAt(x, y, z);
-					double value = recons[cdim]->ProbeValueAt(x, y, z);
-
-					// value to save
-					double quan = 0.0;
-					quan = value;
-
-					if (myiswn(quan))
-						quan = 0.0;
-
-					output[cdim]->Set(x, y, z, quan);
-				}
-			}
-		}
-	}
-
-	// join the different fields into a single nrrd
-	Nrrd** tmp = new Nrrd*[dim];
-	for (int cdim = 0; cdim < dim; cdim++)
-	{
-		tmp[cdim] = output[cdim]->ni;
-	}
-	Nrrd* nout = nrrdNew();
-	nrrdJoin(nout, tmp, dim, 0, 1);
-	nout->axis[0].spacing = 1.0;
 
 	// ready to save the file
 	char str[12];
@@ -136,27 +101,27 @@ void WriteOutput(int oid, int option)
 	char str2[12];
 	sprintf(str2, "%d", option);
 	string filename(parameters["OUTPUT_SIGNAL"] + string("_") + string(str) + string(str2) + string(".nrrd"));
-	if (nrrdSave(filename.c_str(), nout, NULL)) {
-		cerr << "readNrrd: " << biffGetDone(NRRD) << std::endl;
+
+	// interleaved straight from the reconstruction, written in the background
+	// with OUTPUT_ASYNC
+	if (!writer->Write(filename, recons, dim)) {
+		cerr << "WriteOutput: could not write the flow map" << std::endl;
 		exit(-1);
 	}
-	for (int cdim = 0; cdim < dim; cdim++)
-	{
-		delete output[cdim];
-	}
-	delete[] tmp;
-	nrrdNuke(nout);
 }
 
-void AddSampleAt(Sample_point& qp, int cdim, int x, int y, int z, double grad_limit)
+void AddSampleAt(Sample_point& qp, int cdim, int x, int y, int z, const FlowMapSample& s, double grad_limit)
 {
 	qp.coordinate = fm[cdim]->Grid2Space(x, y, z);
-	qp.value = fm[cdim]->ProbeValueAt(x, y, z);
-	qp.gradient[0] = fmJ[cdim][0]->ProbeValueAt(x, y, z);
-	qp.gradient[1] = fmJ[cdim][1]->ProbeValueAt(x, y, z);
-	qp.gradient[2] = fmJ[cdim][2]->ProbeValueAt(x, y, z);// / 3.0; // only tdelta divide by 3
-
-	// scale gradient (very large gradient is likely error or noise)
+	qp.value = s.value[cdim];
+	qp.gradient[0] = s.J[cdim][0];
+	qp.gradient[1] = s.J[cdim][1];
+	qp.gradient[2] = s.J[cdim][2];// / 3.0; // only tdelta divide by 3
+	for (int k = 0; k < 3; k++)
+		qp.unclamped_gradient[k] = qp.gradient[k];
+
+	// scale gradient (very large gradient is likely error or noise), the
+	// FTLE is computed from the unclamped one
 	float3 g = make_float3(qp.gradient[0], qp.gradient[1], qp.gradient[2]);
 	if (length(g) > grad_limit)
 	{
@@ -217,107 +182,187 @@ int main( int argc, char *argv[] )
 		return 0;
 	}
 
-	// read nrrd scalar and setup the gage object
-	Nrrd* flowmap = readNrrd(parameters["INPUT_SIGNAL"].c_str());
-	Nrrd* flowmapJ = readNrrd(parameters["INPUT_SIGNAL_JACOBIAN"].c_str());
-
-	// Seven
-	//size_t minr[2] = {785, 819};
-	//size_t maxr[2] = {minr[0] + 200, minr[1] + 200};
-
-	// LINEARSYS
-	//size_t minr[2] = {0, 0};
-	//size_t maxr[2] = {minr[0] + 255, minr[1] + 255};
-
-
 	int dim = 3;
 	int dimJ = 9;
 	int factor = atoi(parameters["START_FACTOR"].c_str());
 	pts = new vector<Sample_point>[dim];
-	Nrrd* ref;
-	for (int i = 0; i < dim; i++)
+	if (!parameters["FLOW_SOURCE"].empty() && (parameters["FLOW_SOURCE"] != "nrrd"))
 	{
-		// for the flow map
-		Nrrd* flowmap_c = teem_slice(flowmap, 0, i);
-
-		//ref = flowmap_c;
-		//flowmap_c = teem_crop(flowmap_c, minr, maxr);
-		//nrrdNuke(ref);
-
-		fm[i] = new NrrdWrapper3D(flowmap_c);
+		// integrate the trajectories of the samples only, the grid is empty
+		IntegratingFlowSampler* isampler = CreateIntegratingFlowSampler(parameters);
+		if (isampler == NULL)
+			return 0;
+		for (int i = 0; i < dim; i++)
+		{
+			fm[i] = new NrrdWrapper3D(isampler->CreateGrid());
+			reference[i] = NULL;
+		}
+		sampler = isampler;
 	}
-	for (int i = 0; i < dimJ; i++)
+	else
 	{
-		// for the flow map
-		Nrrd* flowmap_c = teem_slice(flowmapJ, 0, i);
+		// read nrrd scalar and setup the gage object
+		Nrrd* flowmap = readNrrd(parameters["INPUT_SIGNAL"].c_str());
+		Nrrd* flowmapJ = readNrrd(parameters["INPUT_SIGNAL_JACOBIAN"].c_str());
 
-		//ref = flowmap_c;
-		//flowmap_c = teem_crop(flowmap_c, minr, maxr);
-		//nrrdNuke(ref);
+		// Seven
+		//size_t minr[2] = {785, 819};
+		//size_t maxr[2] = {minr[0] + 200, minr[1] + 200};
 
-		fmJ[i/dim][i%dim] = new NrrdWrapper3D(flowmap_c);
-	}
+		// LINEARSYS
+		//size_t minr[2] = {0, 0};
+		//size_t maxr[2] = {minr[0] + 255, minr[1] + 255};
 
-	nrrdNuke(flowmap);
-	nrrdNuke(flowmapJ);
-	printf("Loading data complete.\n");
 
-	////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-	////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-	////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-	// copy from flow map
-	for (int cdim = 0; cdim < dim; cdim++)
-	{
-		recons[cdim] = new NrrdWrapper3D(teem_copy(fm[cdim]->ni));
-		memset(recons[cdim]->ni->data, 0, recons[cdim]->Size() * sizeof(float));
-	}
+		Nrrd* ref;
+		for (int i = 0; i < dim; i++)
+		{
+			// for the flow map
+			Nrrd* flowmap_c = teem_slice(flowmap, 0, i);
 
-	// sample points
-	printf("Adding initial samples.\n");
-	double grad_limit = atof(parameters["GRAD_LIMIT"].c_str());
-	for (int cdim = 0; cdim < dim; cdim++)
-	{
-		for (int x = 0; x < fm[cdim]->width(); x+=factor)
+			//ref = flowmap_c;
+			//flowmap_c = teem_crop(flowmap_c, minr, maxr);
+			//nrrdNuke(ref);
+
+			fm[i] = new NrrdWrapper3D(flowmap_c);
+			reference[i] = fm[i];
+		}
+		for (int i = 0; i < dimJ; i++)
 		{
-			for (int y = 0; y < fm[cdim]->height(); y+=factor)
-			{
-				for (int z = 0; z < fm[cdim]->depth(); z+=factor)
-				{
-					// add the point
-					Sample_point qp;
-					AddSampleAt(qp, cdim, x, y, z, grad_limit);
+			// for the flow map
+			Nrrd* flowmap_c = teem_slice(flowmapJ, 0, i);
 
-					// add the point
-					pts[cdim].push_back(qp);
-				}
-			}
+			//ref = flowmap_c;
+			//flowmap_c = teem_crop(flowmap_c, minr, maxr);
+			//nrrdNuke(ref);
+
+			fmJ[i/dim][i%dim] = new NrrdWrapper3D(flowmap_c);
 		}
+
+		nrrdNuke(flowmap);
+		nrrdNuke(flowmapJ);
+		sampler = new NrrdFlowSampler(fm, fmJ);
 	}
+	printf("Loading data complete.\n");
 
-	printf("Number of samples is %d\n", pts[0].size());
+	// per-stage timing and counters
+	if (!parameters["PROFILE_OUTPUT"].empty())
+		ProfileOpen(parameters["PROFILE_OUTPUT"]);
+
+	// encoding and type of the flow map outputs
+	writer = new OutputWriter(parameters);
 
 	////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 	////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 	////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// copy from flow map
+	for (int cdim = 0; cdim < dim; cdim++)
+	{
+		recons[cdim] = new NrrdWrapper3D(teem_copy(fm[cdim]->ni));
+		memset(recons[cdim]->ni->data, 0, recons[cdim]->Size() * sizeof(float));
+	}
 
 	// data structures
 	int size = recons[0]->Size();
 	Tree* tree = NULL;
+	vector<int> tree_order;
 	vector<closest_site> query_cls(size);
 	vector<NaturalNeighbors> query_nc(size);
 	vector<set<int> > site2discs;
 	int nosurf = 0;
-	vector<NormalConstrainedSphericalMlsSurface*> surfaces;
+	vector<DiscSurface*> surfaces;
+	DiscontinuitySurfaces disc_surfaces[3];
 	vector<float> errm[3];
 	for (int i = 0; i < dim; i++)
 		errm[i].resize(size);
 	vector<float> errmt(size);
 
+	// FTLE of the reconstruction, computed by the interpolation sweeps
+	FTLEField* ftle = NULL;
+	if (!parameters["OUTPUT_FTLE"].empty())
+	{
+		double T = parameters["INTEGRATION_TIME"].empty() ? 1.0 : atof(parameters["INTEGRATION_TIME"].c_str());
+		if (!parameters["FTLE_TIME"].empty())
+			T = atof(parameters["FTLE_TIME"].c_str());
+		ftle = new FTLEField(size, dim, T);
+	}
+	bool ftle_only = (ftle != NULL) && (atoi(parameters["FTLE_ONLY"].c_str()) != 0);
+
 	// loop on user commands
 	int seq[5] = {1, 4, 3, 4, 2};
 	int seq_idx = 0;
 	int miter = atoi(parameters["MAX_ITER"].c_str());
 	int iter = -1;
+
+	// error driven batches and termination
+	AdaptiveRefinement control(parameters, size);
+	if (control.enabled && parameters["MAX_ITER"].empty())
+		miter = numeric_limits<int>::max();
+	bool last = false;
+	bool skip_modified = false;
+
+	// coarse grid levels while the samples are sparse
+	SibsonPyramid pyramid(parameters, recons[0]);
+
+	// discrete or exact natural neighbor coordinates
+	NaturalCoordinates naturals(parameters);
+
+	double grad_limit = atof(parameters["GRAD_LIMIT"].c_str());
+	if (!parameters["RESUME_FROM"].empty())
+	{
+		// continue a previous run from its checkpoint
+		if (!ReadCheckpoint(parameters["RESUME_FROM"], iter, seq_idx, dim, pts, tree_order, errm, errmt))
+			return 0;
+		if (control.enabled || pyramid.enabled)
+			printf("Warning: the adaptive and multiresolution state is not in the checkpoint, the resumed run may differ!\n");
+
+		// rebuild the kd-tree with the same insert order
+		std::vector<Point_3> points;
+		for (int i = 0; i < tree_order.size(); i++)
+		{
+			float3 c = pts[0][tree_order[i]].coordinate;
+			points.push_back(Point_3(c.x, c.y, c.z));
+		}
+		if (!tree_order.empty())
+		{
+			tree = new Tree(
+				boost::make_zip_iterator(boost::make_tuple( points.begin(),tree_order.begin() )),
+				boost::make_zip_iterator(boost::make_tuple( points.end(),tree_order.end() ))
+			);
+		}
+	}
+	else
+	{
+		// sample points
+		ProfileScope scope("initial_samples");
+		printf("Adding initial samples.\n");
+		vector<int3> sites;
+		for (int x = 0; x < fm[0]->width(); x+=factor)
+		{
+			for (int y = 0; y < fm[0]->height(); y+=factor)
+			{
+				for (int z = 0; z < fm[0]->depth(); z+=factor)
+					sites.push_back(make_int3(x, y, z));
+			}
+		}
+		vector<FlowMapSample> samples;
+		if (!sampler->Sample(sites, samples))
+			exit(-1);
+		for (int cdim = 0; cdim < dim; cdim++)
+		{
+			for (int i = 0; i < sites.size(); i++)
+			{
+				// add the point
+				Sample_point qp;
+				AddSampleAt(qp, cdim, sites[i].x, sites[i].y, sites[i].z, samples[i], grad_limit);
+
+				// add the point
+				pts[cdim].push_back(qp);
+			}
+		}
+	}
+
+	printf("Number of samples is %d\n", pts[0].size());
 	while(true)
 	{
 		printf("\n======================================\n");
@@ -339,22 +384,46 @@ int main( int argc, char *argv[] )
 		option = seq[seq_idx];
 		seq_idx = (seq_idx + 1) % 5;
 		printf("selected is %d for iteration %d\n", option, iter);
+		ProfileSetIteration(iter);
 
 
 		if (option == 1)
 		{
+			ProfileScope scope("sibson");
 			Timer timer;
 			timer.start();
 
 			// compute the natural neighbors
 			vector<bool> site_is_disc(pts[0].size());
-			FindClosest(recons[0], query_cls, query_nc, pts[0], site_is_disc, tree, nosurf, surfaces, site2discs);
-			FindNaturalCoordinates(recons[0], query_cls, query_nc, pts[0], nosurf, surfaces);
+			if (tree == NULL)
+			{
+				// FindClosest builds the tree from all the sites
+				tree_order.resize(pts[0].size());
+				for (int i = 0; i < tree_order.size(); i++)
+					tree_order[i] = i;
+			}
+			int level = pyramid.Select(pts[0].size(), iter == miter - 1);
+			if (level > 0)
+			{
+				// upsampled to the full grid
+				pyramid.Sibson(dim, pts, tree, recons, errm, query_cls, !ftle_only);
+			}
+			else
+			{
+				FindClosest(recons[0], query_cls, query_nc, pts[0], site_is_disc, tree, nosurf, surfaces, site2discs);
+				naturals.Find(recons[0], query_cls, query_nc, pts[0], nosurf, surfaces);
 
-			// now run regular sibson
-			for (int cdim = 0; cdim < dim; cdim++)
+				// now run regular sibson
+				for (int cdim = 0; cdim < dim; cdim++)
+				{
+					DiscreteSisbon(reference[cdim], recons[cdim], errm[cdim], pts[cdim], tree, query_cls, query_nc, ftle, cdim);
+				}
+			}
+			if (control.enabled)
 			{
-				DiscreteSisbon(fm[cdim], recons[cdim], errm[cdim], pts[cdim], tree, query_cls, query_nc);
+				// the loop only ends at the full resolution
+				control.Observe(errm, dim, pts[0].size());
+				last = ((level == 0) && control.Done()) || (iter == miter - 1);
 			}
 
 			timer.stop();
@@ -362,6 +431,11 @@ int main( int argc, char *argv[] )
 		}
 		else if (option == 2)
 		{
+			// the outputs of the last iteration are written
+			if (last)
+				break;
+
+			ProfileScope scope("refine");
 			Timer timer;
 			timer.start();
 
@@ -381,23 +455,36 @@ int main( int argc, char *argv[] )
 
 			// do the refinement
 			vector<int> nids;
-			Refine(iter, fm[0], nids, errmt, pts[0], tree, query_cls);
+			{
+				ProfileScope scope("select");
+				Refine(iter, fm[0], nids, errmt, pts[0], tree, query_cls, control.NextBatch(pts[0].size()));
+			}
+			control.Refined(nids, query_cls, disc_surfaces, dim);
+			ProfileCount(PROF_SAMPLES_ADDED, nids.size());
+
+			// samples at the new sites
+			vector<int3> sites(nids.size());
+			for (int i = 0; i < nids.size(); i++)
+				sites[i] = fm[0]->Addr2Coord(nids[i]);
+			vector<FlowMapSample> samples;
+			if (!sampler->Sample(sites, samples))
+				exit(-1);
 
 			// insert the points
+			bool profiled = ProfileBegin("insert");
 			std::vector<Point_3> points;
 			std::vector<int> indices;
 			for (int cdim = 0; cdim < dim; cdim++)
 			{
 				for (int i = 0; i < nids.size(); i++)
 				{
-					int3 c = fm[cdim]->Addr2Coord(nids[i]);
-					int x = c.x;
-					int y = c.y;
-					int z = c.z;
+					int x = sites[i].x;
+					int y = sites[i].y;
+					int z = sites[i].z;
 
 					// add the point
 					Sample_point qp;
-					AddSampleAt(qp, cdim, x, y, z, grad_limit);
+					AddSampleAt(qp, cdim, x, y, z, samples[i], grad_limit);
 
 					// add the point
 					pts[cdim].push_back(qp);
@@ -415,24 +502,76 @@ int main( int argc, char *argv[] )
 				boost::make_zip_iterator(boost::make_tuple( points.begin(),indices.begin() )),
 				boost::make_zip_iterator(boost::make_tuple( points.end(),indices.end() ) )
 			);
+			tree_order.insert(tree_order.end(), indices.begin(), indices.end());
+			if (profiled)
+				ProfileEnd();
 			printf("Total number of samples is %d, a percentage of %2.2lf%%\n", pts[0].size(), (100.0 * pts[0].size()) / recons[0]->Size());
 
 			timer.stop();
 			cout << "\nTime for refinement step is " << (0.001 * timer.getElapsedTimeInMilliSec()) << " sec.\n";
+
+			// the iteration is complete, save its state
+			if (!parameters["OUTPUT_CHECKPOINT"].empty())
+			{
+				char str[12];
+				sprintf(str, "%d", iter);
+				string filename(parameters["OUTPUT_CHECKPOINT"] + string("_") + string(str) + string(".ckpt"));
+				WriteCheckpoint(filename, iter, seq_idx, dim, pts, tree_order, errm, errmt);
+			}
 		}
 		else if (option == 3)
 		{
 			if (iter == 0)
 				continue;
+			skip_modified = !control.ModifiedNeeded(last) || (pyramid.level > 0);
+			if (skip_modified)
+			{
+				if (pyramid.level > 0)
+					printf("Coarse level, skipping the modified Sibson step.\n");
+				else
+					printf("No sample added at a discontinuity, skipping the modified Sibson step.\n");
+				continue;
+			}
 
+			ProfileScope scope("modified_sibson");
 			for (int cdim = 0; cdim < dim; cdim++)
 			{
-				DiscreteSisbonWithSurfaces(iter, cdim, fm[cdim], recons[cdim], errm[cdim], pts[cdim], query_cls, query_nc);
+				DiscreteSisbonWithSurfaces(iter, cdim, reference[cdim], recons[cdim], errm[cdim], pts[cdim], query_cls, query_nc, &disc_surfaces[cdim], ftle);
 			}
+			control.ModifiedDone();
 		}
 		else if (option == 4)
 		{
-			WriteOutput(iter, seq[seq_idx - 2]);
+			// same as the output of the regular step
+			if ((seq[seq_idx - 2] == 3) && skip_modified)
+				continue;
+
+			if (!ftle_only)
+				WriteOutput(iter, seq[seq_idx - 2]);
+
+			// FTLE of the same reconstruction, computed at the full resolution only
+			if ((ftle != NULL) && (pyramid.level == 0))
+			{
+				char str[12];
+				sprintf(str, "%d%d", iter, seq[seq_idx - 2]);
+				string filename(parameters["OUTPUT_FTLE"] + string("_") + string(str) + string(".nrrd"));
+				int dims[3] = {recons[0]->width(), recons[0]->height(), recons[0]->depth()};
+				double spacing[3];
+				for (int i = 0; i < 3; i++)
+					spacing[i] = recons[0]->ni->axis[i].spacing;
+				WriteFTLE(filename, *ftle, dims, spacing);
+			}
+
+			// the samples and surfaces the output is computed from, the closest
+			// sites of a coarse level are not exact on the full grid
+			if (!parameters["OUTPUT_SPARSE"].empty() && (pyramid.level == 0))
+			{
+				char str[12];
+				sprintf(str, "%d%d", iter, seq[seq_idx - 2]);
+				string filename(parameters["OUTPUT_SPARSE"] + string("_") + string(str) + string(".sfm"));
+				bool modified = (seq[seq_idx - 2] == 3) && (iter > 0);
+				WriteSparseFlowMap(filename, recons[0], dim, pts, query_cls, modified ? disc_surfaces : NULL);
+			}
 		}
 		else if (option == 0)
 			break;
@@ -446,5 +585,18 @@ int main( int argc, char *argv[] )
 
 
 
+	// cost of the on-demand samples
+	IntegratingFlowSampler* isampler = dynamic_cast<IntegratingFlowSampler*>(sampler);
+	if (isampler != NULL)
+		printf("Integrated %ld trajectories with %ld steps, %ld did not reach the integration time.\n", isampler->trajectories, isampler->steps, isampler->failures);
+	delete sampler;
+	delete ftle;
+
+	// the last output may still be written
+	if (!writer->Wait())
+		exit(-1);
+	delete writer;
+
+	ProfileClose();
 	return 0;
 }
@@ -0,0 +1,380 @@
+/*************************************************************************
+sparse: Efficient Computation of the Flow Map from Sparse Samples
+
+Author: Samer S. Barakat
+
+Copyright (c) 2010-2013, Purdue University
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************/
+#include <mpi.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits>
+#include <string>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include <set>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <vector_types.h>
+#include <vector_functions.h>
+#include <cutil_inline.h>
+#include <helper_math.h>
+#include <teem/nrrd.h>
+#include <boost/algorithm/string.hpp>
+
+#include "MyMath.h"
+#include "MyTeem.h"
+#include "MyGeometry.h"
+#include "Sample_point.h"
+
+#include "DiscreteSibson.h"
+#include "DistributedSibson.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////
+// Distributed version of the reconstruction. Run with
+//     mpirun -np N sparse_flow_map_mpi params.txt
+// Each rank reconstructs one slab of z planes. The modified Sibson step
+// needs the edges of the whole volume and is not part of this mode.
+////////////////////////////////////////////////////////////////////////////////
+
+
+map<string, string> parameters;
+vector<Sample_point>* pts = NULL;
+NrrdWrapper3D* recons[3];
+NrrdWrapper3D* fm[3];
+NrrdWrapper3D* fmJ[3][3];
+SlabDecomposition slab;
+
+////////////////////////////////////////////////////////////////////////////////
+// Main entry point
+////////////////////////////////////////////////////////////////////////////////
+
+void WriteOutput(int oid, int option)
+{
+	int dim = 3;
+
+	// interleave the owned planes of the three components
+	int ob = slab.ownedBegin();
+	int n = slab.ownedEnd() - ob;
+	float* out = (float*) malloc(size_t(n) * dim * sizeof(float));
+	#pragma omp parallel for
+	for (int i = 0; i < n; i++)
+	{
+		for (int cdim = 0; cdim < dim; cdim++)
+		{
+			float quan = ((float*) recons[cdim]->ni->data)[ob + i];
+			if (myiswn(quan))
+				quan = 0.0;
+			out[size_t(i) * dim + cdim] = quan;
+		}
+	}
+
+	// ready to save the file
+	char str[12];
+	sprintf(str, "%d", oid);
+	char str2[12];
+	sprintf(str2, "%d", option);
+	string filename(parameters["OUTPUT_SIGNAL"] + string("_") + string(str) + string(str2) + string(".nrrd"));
+	WriteSlabNrrd(filename, slab, out, dim);
+	free(out);
+}
+
+void AddSampleAt(Sample_point& qp, int cdim, int x, int y, int z, double grad_limit)
+{
+	// local slab frame
+	qp.coordinate = fm[cdim]->Grid2Space(x, y, z);
+	qp.value = fm[cdim]->ProbeValueAt(x, y, z);
+	qp.gradient[0] = fmJ[cdim][0]->ProbeValueAt(x, y, z);
+	qp.gradient[1] = fmJ[cdim][1]->ProbeValueAt(x, y, z);
+	qp.gradient[2] = fmJ[cdim][2]->ProbeValueAt(x, y, z);
+	for (int k = 0; k < 3; k++)
+		qp.unclamped_gradient[k] = qp.gradient[k];
+
+	// scale gradient (very large gradient is likely error or noise), the
+	// FTLE is computed from the unclamped one
+	float3 g = make_float3(qp.gradient[0], qp.gradient[1], qp.gradient[2]);
+	if (length(g) > grad_limit)
+	{
+		g = grad_limit * normalize(g);
+		qp.gradient[0] = g.x;
+		qp.gradient[1] = g.y;
+		qp.gradient[2] = g.z;
+	}
+}
+
+// send the sites created on this rank to all others and append them
+void ShareSamples(vector<Sample_point>& local_new, int cdim, std::vector<Point_3>* points, std::vector<int>* indices)
+{
+	vector<Sample_point> all_new;
+	SamplesToGlobal(slab, local_new);
+	ExchangeSamples(slab, local_new, all_new);
+	SamplesToLocal(slab, all_new);
+	for (int i = 0; i < all_new.size(); i++)
+	{
+		pts[cdim].push_back(all_new[i]);
+		if (points != NULL)
+		{
+			points->push_back(Point_3(all_new[i].coordinate.x, all_new[i].coordinate.y, all_new[i].coordinate.z));
+			indices->push_back(pts[cdim].size() - 1);
+		}
+	}
+}
+
+int main( int argc, char *argv[] )
+{
+	MPI_Init(&argc, &argv);
+	int rank;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	if (rank == 0)
+		printf("Start the distributed adaptive sampling application.\n");
+
+	if (argc < 2)
+	{
+		if (rank == 0)
+			printf("Usage: %s params.txt\n", argv[0]);
+		MPI_Finalize();
+		return 0;
+	}
+	string pfile(argv[1]);
+
+	// reading the parameters from a file
+	string line;
+	ifstream myfile (pfile.c_str());
+	if (myfile.is_open())
+	{
+		while ( myfile.good() )
+		{
+			getline(myfile,line);
+			if (rank == 0)
+				cout << line << endl;
+			vector<string> results;
+			boost::split(results, line, boost::is_any_of("="));
+			if (results.size() < 2)
+				continue;
+			parameters[results[0]] = results[1];
+		}
+		myfile.close();
+	}
+	else
+	{
+		cout << "Unable to open parameters file!\n";
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+
+	int dim = 3;
+	int dimJ = 9;
+	int factor = atoi(parameters["START_FACTOR"].c_str());
+
+	// the halo must cover the largest closest-site distance which is
+	// reached at the initial sampling
+	int halo = int(ceil(sqrt(3.0) * factor)) + 1;
+	if (parameters.find("HALO") != parameters.end())
+		halo = atoi(parameters["HALO"].c_str());
+
+	// decompose the grid
+	int ncomp;
+	int3 gdims;
+	double spc[3];
+	ReadNrrdDims(parameters["INPUT_SIGNAL"].c_str(), MPI_COMM_WORLD, ncomp, gdims, spc);
+	SetupSlabDecomposition(slab, MPI_COMM_WORLD, gdims, spc, halo);
+
+	// every rank gets a different random stream
+	srand48(time(NULL) + 7919 * slab.rank);
+
+	// read the slab of the flow map and its jacobian
+	int ncompJ;
+	Nrrd* flowmap = ReadSlabNrrd(parameters["INPUT_SIGNAL"].c_str(), slab, ncomp);
+	Nrrd* flowmapJ = ReadSlabNrrd(parameters["INPUT_SIGNAL_JACOBIAN"].c_str(), slab, ncompJ);
+
+	pts = new vector<Sample_point>[dim];
+	for (int i = 0; i < dim; i++)
+	{
+		fm[i] = new NrrdWrapper3D(teem_slice(flowmap, 0, i));
+	}
+	for (int i = 0; i < dimJ; i++)
+	{
+		fmJ[i/dim][i%dim] = new NrrdWrapper3D(teem_slice(flowmapJ, 0, i));
+	}
+	nrrdNuke(flowmap);
+	nrrdNuke(flowmapJ);
+	if (slab.rank == 0)
+		printf("Loading data complete.\n");
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// copy from flow map
+	for (int cdim = 0; cdim < dim; cdim++)
+	{
+		recons[cdim] = new NrrdWrapper3D(teem_copy(fm[cdim]->ni));
+		memset(recons[cdim]->ni->data, 0, recons[cdim]->Size() * sizeof(float));
+	}
+
+	// sample points of the global lattice that fall in the owned planes
+	if (slab.rank == 0)
+		printf("Adding initial samples.\n");
+	double grad_limit = atof(parameters["GRAD_LIMIT"].c_str());
+	for (int cdim = 0; cdim < dim; cdim++)
+	{
+		vector<Sample_point> local_new;
+		for (int x = 0; x < fm[cdim]->width(); x+=factor)
+		{
+			for (int y = 0; y < fm[cdim]->height(); y+=factor)
+			{
+				for (int z = slab.z0; z < slab.z1; z++)
+				{
+					if (z % factor != 0)
+						continue;
+
+					// add the point
+					Sample_point qp;
+					AddSampleAt(qp, cdim, x, y, z - slab.h0, grad_limit);
+					local_new.push_back(qp);
+				}
+			}
+		}
+		ShareSamples(local_new, cdim, NULL, NULL);
+	}
+
+	if (slab.rank == 0)
+		printf("Number of samples is %d\n", pts[0].size());
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// data structures
+	int size = recons[0]->Size();
+	Tree* tree = NULL;
+	vector<closest_site> query_cls(size);
+	vector<NaturalNeighbors> query_nc(size);
+	vector<set<int> > site2discs;
+	int nosurf = 0;
+	vector<DiscSurface*> surfaces;
+	vector<float> errm[3];
+	for (int i = 0; i < dim; i++)
+		errm[i].resize(size);
+	vector<float> errmt(size);
+
+	// the modified Sibson's step is not available in this mode
+	int seq[3] = {1, 4, 2};
+	int seq_idx = 0;
+	int miter = atoi(parameters["MAX_ITER"].c_str());
+	int iter = -1;
+	while(true)
+	{
+		if (seq_idx == 0)
+			iter++;
+		if (iter >= miter)
+			break;
+		int option = seq[seq_idx];
+		seq_idx = (seq_idx + 1) % 3;
+		if (slab.rank == 0)
+			printf("\n======================================\nselected is %d for iteration %d\n", option, iter);
+
+		if (option == 1)
+		{
+			Timer timer;
+			timer.start();
+
+			// compute the natural neighbors of the slab and its halo
+			vector<bool> site_is_disc(pts[0].size());
+			FindClosest(recons[0], query_cls, query_nc, pts[0], site_is_disc, tree, nosurf, surfaces, site2discs);
+			double maxd = GlobalMaxClosestDistance(slab, recons[0]->min_spc, query_cls);
+			if (maxd > slab.halo)
+			{
+				// the balls of the slab boundaries would miss sites of the neighbor slabs
+				if (slab.rank == 0)
+					printf("Error: closest site distance %lf is larger than the halo %d, set HALO to at least %d!\n", maxd, slab.halo, int(ceil(maxd)) + 1);
+				MPI_Abort(slab.comm, -1);
+			}
+			FindNaturalCoordinates(recons[0], query_cls, query_nc, pts[0], nosurf, surfaces);
+
+			// now run regular sibson
+			for (int cdim = 0; cdim < dim; cdim++)
+			{
+				DiscreteSisbon(fm[cdim], recons[cdim], errm[cdim], pts[cdim], tree, query_cls, query_nc);
+				double mse = GlobalMSE(slab, fm[cdim], recons[cdim]);
+				if (slab.rank == 0)
+					printf("Global MSE error is %e\n", mse);
+			}
+
+			MPI_Barrier(slab.comm);
+			timer.stop();
+			if (slab.rank == 0)
+				cout << "\nTime for regular Sibson's step is " << (0.001 * timer.getElapsedTimeInMilliSec()) << " sec.\n";
+		}
+		else if (option == 2)
+		{
+			Timer timer;
+			timer.start();
+
+			// sum of the errors
+			for (int i = 0; i < errmt.size(); i++)
+			{
+				double sume = 0.0;
+				for (int cdim = 0; cdim < dim; cdim++)
+				{
+					sume += double(errm[cdim][i]);
+				}
+				errmt[i] = sume;
+			}
+
+			// do the refinement of the owned planes
+			vector<int> nids;
+			DistributedRefine(iter, slab, fm[0], nids, errmt, pts[0], query_cls);
+
+			// create the points and share them
+			std::vector<Point_3> points;
+			std::vector<int> indices;
+			for (int cdim = 0; cdim < dim; cdim++)
+			{
+				vector<Sample_point> local_new;
+				for (int i = 0; i < nids.size(); i++)
+				{
+					int3 c = fm[cdim]->Addr2Coord(nids[i]);
+					Sample_point qp;
+					AddSampleAt(qp, cdim, c.x, c.y, c.z, grad_limit);
+					local_new.push_back(qp);
+				}
+				ShareSamples(local_new, cdim, (cdim == 0) ? &points : NULL, &indices);
+			}
+			tree->insert(
+				boost::make_zip_iterator(boost::make_tuple( points.begin(),indices.begin() )),
+				boost::make_zip_iterator(boost::make_tuple( points.end(),indices.end() ) )
+			);
+			if (slab.rank == 0)
+				printf("Total number of samples is %d, a percentage of %2.2lf%%\n", pts[0].size(), (100.0 * pts[0].size()) / (double(gdims.x) * gdims.y * gdims.z));
+
+			timer.stop();
+			if (slab.rank == 0)
+				cout << "\nTime for refinement step is " << (0.001 * timer.getElapsedTimeInMilliSec()) << " sec.\n";
+		}
+		else if (option == 4)
+		{
+			WriteOutput(iter, 1);
+		}
+	}
+
+	MPI_Finalize();
+	return 0;
+}